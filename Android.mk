@@ -29,7 +29,9 @@ LOCAL_SRC_FILES := \
 	kdf2_test.cpp \
 	kdf_test.cpp \
 	key_blob_test.cpp \
-	keymaster_enforcement_test.cpp
+	keymaster_enforcement_test.cpp \
+	sha256_multibuffer.cpp \
+	sha256_multibuffer_test.cpp
 
 LOCAL_C_INCLUDES := \
 	$(LOCAL_PATH)/include
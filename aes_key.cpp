@@ -30,6 +30,12 @@ namespace keymaster {
 AesEncryptionOperationFactory encrypt_factory;
 AesDecryptionOperationFactory decrypt_factory;
 
+AesKeyFactory::AesKeyFactory(const KeymasterContext* context)
+    : SymmetricKeyFactory(context),
+      cipher_cache_(new (std::nothrow) AesCipherContextCache(kAesCipherContextCacheSize)) {}
+
+AesKeyFactory::~AesKeyFactory() {}
+
 OperationFactory* AesKeyFactory::GetOperationFactory(keymaster_purpose_t purpose) const {
     switch (purpose) {
     case KM_PURPOSE_ENCRYPT:
@@ -62,7 +68,8 @@ keymaster_error_t AesKeyFactory::LoadKey(const KeymasterKeyBlob& key_material,
     }
 
     keymaster_error_t error = KM_ERROR_OK;
-    key->reset(new (std::nothrow) AesKey(key_material, hw_enforced, sw_enforced, &error));
+    key->reset(new (std::nothrow)
+                   AesKey(key_material, hw_enforced, sw_enforced, &error, cipher_cache_.get()));
     if (!key->get())
         error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
     return error;
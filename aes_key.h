@@ -26,9 +26,15 @@ namespace keymaster {
 const size_t kMinGcmTagLength = 12 * 8;
 const size_t kMaxGcmTagLength = 16 * 8;
 
+// Number of keyed cipher contexts retained by each AesKeyFactory.
+const size_t kAesCipherContextCacheSize = 16;
+
+class AesCipherContextCache;
+
 class AesKeyFactory : public SymmetricKeyFactory {
   public:
-    explicit AesKeyFactory(const KeymasterContext* context) : SymmetricKeyFactory(context) {}
+    explicit AesKeyFactory(const KeymasterContext* context);
+    ~AesKeyFactory();
 
     keymaster_algorithm_t registry_key() const { return KM_ALGORITHM_AES; }
 
@@ -40,19 +46,38 @@ class AesKeyFactory : public SymmetricKeyFactory {
 
     OperationFactory* GetOperationFactory(keymaster_purpose_t purpose) const override;
 
+    /**
+     * Returns the cache of keyed cipher contexts shared by this factory's keys, or null if it
+     * couldn't be allocated.
+     */
+    AesCipherContextCache* cipher_cache() const { return cipher_cache_.get(); }
+
   private:
     bool key_size_supported(size_t key_size_bits) const override {
         return key_size_bits == 128 || key_size_bits == 192 || key_size_bits == 256;
     }
     keymaster_error_t validate_algorithm_specific_new_key_params(
         const AuthorizationSet& key_description) const override;
+
+    UniquePtr<AesCipherContextCache> cipher_cache_;
 };
 
 class AesKey : public SymmetricKey {
   public:
     AesKey(const KeymasterKeyBlob& key_material, const AuthorizationSet& hw_enforced,
-           const AuthorizationSet& sw_enforced, keymaster_error_t* error)
-        : SymmetricKey(key_material, hw_enforced, sw_enforced, error) {}
+           const AuthorizationSet& sw_enforced, keymaster_error_t* error,
+           AesCipherContextCache* cipher_cache = nullptr)
+        : SymmetricKey(key_material, hw_enforced, sw_enforced, error),
+          cipher_cache_(cipher_cache) {}
+
+    /**
+     * Returns the cache of keyed cipher contexts shared by keys from the same factory, or null if
+     * operations must key their contexts from scratch.  The cache outlives the key.
+     */
+    AesCipherContextCache* cipher_cache() const { return cipher_cache_; }
+
+  private:
+    AesCipherContextCache* cipher_cache_;
 };
 
 }  // namespace keymaster
@@ -75,11 +75,80 @@ static keymaster_error_t GetAndValidateGcmTagLength(const AuthorizationSet& begi
     return KM_ERROR_OK;
 }
 
+static keymaster_error_t GetAesCipher(keymaster_block_mode_t block_mode, size_t key_size,
+                                      const EVP_CIPHER** cipher) {
+    switch (block_mode) {
+    case KM_MODE_ECB:
+        switch (key_size) {
+        case 16:
+            *cipher = EVP_aes_128_ecb();
+            break;
+        case 24:
+            *cipher = EVP_aes_192_ecb();
+            break;
+        case 32:
+            *cipher = EVP_aes_256_ecb();
+            break;
+        default:
+            return KM_ERROR_UNSUPPORTED_KEY_SIZE;
+        }
+        break;
+    case KM_MODE_CBC:
+        switch (key_size) {
+        case 16:
+            *cipher = EVP_aes_128_cbc();
+            break;
+        case 24:
+            *cipher = EVP_aes_192_cbc();
+            break;
+        case 32:
+            *cipher = EVP_aes_256_cbc();
+            break;
+        default:
+            return KM_ERROR_UNSUPPORTED_KEY_SIZE;
+        }
+        break;
+    case KM_MODE_CTR:
+        switch (key_size) {
+        case 16:
+            *cipher = EVP_aes_128_ctr();
+            break;
+        case 24:
+            *cipher = EVP_aes_192_ctr();
+            break;
+        case 32:
+            *cipher = EVP_aes_256_ctr();
+            break;
+        default:
+            return KM_ERROR_UNSUPPORTED_KEY_SIZE;
+        }
+        break;
+    case KM_MODE_GCM:
+        switch (key_size) {
+        case 16:
+            *cipher = EVP_aes_128_gcm();
+            break;
+        case 24:
+            *cipher = EVP_aes_192_gcm();
+            break;
+        case 32:
+            *cipher = EVP_aes_256_gcm();
+            break;
+        default:
+            return KM_ERROR_UNSUPPORTED_KEY_SIZE;
+        }
+        break;
+    default:
+        return KM_ERROR_UNSUPPORTED_BLOCK_MODE;
+    }
+    return KM_ERROR_OK;
+}
+
 Operation* AesOperationFactory::CreateOperation(const Key& key,
                                                 const AuthorizationSet& begin_params,
                                                 keymaster_error_t* error) {
     *error = KM_ERROR_OK;
-    const SymmetricKey* symmetric_key = static_cast<const SymmetricKey*>(&key);
+    const AesKey* symmetric_key = static_cast<const AesKey*>(&key);
 
     switch (symmetric_key->key_data_size()) {
     case 16:
@@ -131,12 +200,13 @@ Operation* AesOperationFactory::CreateOperation(const Key& key,
     case KM_PURPOSE_ENCRYPT:
         op = new (std::nothrow)
             AesEvpEncryptOperation(block_mode, padding, caller_nonce, tag_length,
-                                   symmetric_key->key_data(), symmetric_key->key_data_size());
+                                   symmetric_key->key_data(), symmetric_key->key_data_size(),
+                                   symmetric_key->cipher_cache());
         break;
     case KM_PURPOSE_DECRYPT:
         op = new (std::nothrow)
             AesEvpDecryptOperation(block_mode, padding, tag_length, symmetric_key->key_data(),
-                                   symmetric_key->key_data_size());
+                                   symmetric_key->key_data_size(), symmetric_key->cipher_cache());
         break;
     default:
         *error = KM_ERROR_UNSUPPORTED_PURPOSE;
@@ -164,12 +234,61 @@ AesOperationFactory::SupportedPaddingModes(size_t* padding_mode_count) const {
     return supported_padding_modes;
 }
 
+void AesCipherContextCache::Entry::Release() {
+    // EVP_CIPHER_CTX_cleanup cleanses the expanded key schedule before freeing it.
+    EVP_CIPHER_CTX_cleanup(&ctx);
+    EVP_CIPHER_CTX_init(&ctx);
+    memset_s(key, 0, sizeof(key));
+    key_size = 0;
+}
+
+keymaster_error_t AesCipherContextCache::InitializeContext(const uint8_t* key, size_t key_size,
+                                                           keymaster_block_mode_t block_mode,
+                                                           int encrypt, EVP_CIPHER_CTX* ctx) {
+    const EVP_CIPHER* cipher;
+    keymaster_error_t error = GetAesCipher(block_mode, key_size, &cipher);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    Entry* entry = entries_.Find([&](const Entry& candidate) {
+        return candidate.block_mode == block_mode && candidate.encrypt == encrypt &&
+               candidate.key_size == key_size && memcmp_s(candidate.key, key, key_size) == 0;
+    });
+    if (entry) {
+        entries_.RecordHit();
+    } else {
+        entries_.RecordMiss();
+        entry = entries_.Evict();
+        if (!entry) {
+            // No room to cache anything; key the context directly.
+            if (!EVP_CipherInit_ex(ctx, cipher, NULL /* engine */, key, NULL /* iv */, encrypt))
+                return TranslateLastOpenSslError();
+            return KM_ERROR_OK;
+        }
+
+        if (!EVP_CipherInit_ex(&entry->ctx, cipher, NULL /* engine */, key, NULL /* iv */,
+                               encrypt)) {
+            entry->Release();
+            return TranslateLastOpenSslError();
+        }
+        memcpy(entry->key, key, key_size);
+        entry->key_size = key_size;
+        entry->block_mode = block_mode;
+        entry->encrypt = encrypt;
+    }
+
+    if (!EVP_CIPHER_CTX_copy(ctx, &entry->ctx))
+        return TranslateLastOpenSslError();
+    return KM_ERROR_OK;
+}
+
 AesEvpOperation::AesEvpOperation(keymaster_purpose_t purpose, keymaster_block_mode_t block_mode,
                                  keymaster_padding_t padding, bool caller_iv, size_t tag_length,
-                                 const uint8_t* key, size_t key_size)
+                                 const uint8_t* key, size_t key_size,
+                                 AesCipherContextCache* cipher_cache)
     : Operation(purpose), block_mode_(block_mode), caller_iv_(caller_iv), tag_length_(tag_length),
-      data_started_(false), key_size_(key_size), padding_(padding) {
-    memcpy(key_, key, key_size_);
+      data_started_(false), key_size_(key_size), padding_(padding), key_(key, key_size),
+      cipher_cache_(cipher_cache) {
     EVP_CIPHER_CTX_init(&ctx_);
 }
 
@@ -254,74 +373,27 @@ bool AesEvpOperation::need_iv() const {
 }
 
 keymaster_error_t AesEvpOperation::InitializeCipher() {
-    const EVP_CIPHER* cipher;
-    switch (block_mode_) {
-    case KM_MODE_ECB:
-        switch (key_size_) {
-        case 16:
-            cipher = EVP_aes_128_ecb();
-            break;
-        case 24:
-            cipher = EVP_aes_192_ecb();
-            break;
-        case 32:
-            cipher = EVP_aes_256_ecb();
-            break;
-        default:
-            return KM_ERROR_UNSUPPORTED_KEY_SIZE;
-        }
-        break;
-    case KM_MODE_CBC:
-        switch (key_size_) {
-        case 16:
-            cipher = EVP_aes_128_cbc();
-            break;
-        case 24:
-            cipher = EVP_aes_192_cbc();
-            break;
-        case 32:
-            cipher = EVP_aes_256_cbc();
-            break;
-        default:
-            return KM_ERROR_UNSUPPORTED_KEY_SIZE;
-        }
-        break;
-    case KM_MODE_CTR:
-        switch (key_size_) {
-        case 16:
-            cipher = EVP_aes_128_ctr();
-            break;
-        case 24:
-            cipher = EVP_aes_192_ctr();
-            break;
-        case 32:
-            cipher = EVP_aes_256_ctr();
-            break;
-        default:
-            return KM_ERROR_UNSUPPORTED_KEY_SIZE;
-        }
-        break;
-    case KM_MODE_GCM:
-        switch (key_size_) {
-        case 16:
-            cipher = EVP_aes_128_gcm();
-            break;
-        case 24:
-            cipher = EVP_aes_192_gcm();
-            break;
-        case 32:
-            cipher = EVP_aes_256_gcm();
-            break;
-        default:
-            return KM_ERROR_UNSUPPORTED_KEY_SIZE;
-        }
-        break;
-    default:
-        return KM_ERROR_UNSUPPORTED_BLOCK_MODE;
-    }
+    if (!key_.key_material)
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
 
-    if (!EVP_CipherInit_ex(&ctx_, cipher, NULL /* engine */, key_, iv_.get(), evp_encrypt_mode()))
-        return TranslateLastOpenSslError();
+    if (cipher_cache_) {
+        keymaster_error_t error = cipher_cache_->InitializeContext(
+            key_.key_material, key_size_, block_mode_, evp_encrypt_mode(), &ctx_);
+        if (error != KM_ERROR_OK)
+            return error;
+        // The template is already keyed; only the IV needs to be supplied.
+        if (iv_.get() && !EVP_CipherInit_ex(&ctx_, NULL /* cipher */, NULL /* engine */,
+                                            NULL /* key */, iv_.get(), evp_encrypt_mode()))
+            return TranslateLastOpenSslError();
+    } else {
+        const EVP_CIPHER* cipher;
+        keymaster_error_t error = GetAesCipher(block_mode_, key_size_, &cipher);
+        if (error != KM_ERROR_OK)
+            return error;
+        if (!EVP_CipherInit_ex(&ctx_, cipher, NULL /* engine */, key_.key_material, iv_.get(),
+                               evp_encrypt_mode()))
+            return TranslateLastOpenSslError();
+    }
 
     switch (padding_) {
     case KM_PAD_NONE:
@@ -19,6 +19,7 @@
 
 #include <openssl/evp.h>
 
+#include "lru_cache.h"
 #include "ocb_utils.h"
 #include "operation.h"
 
@@ -56,11 +57,57 @@ class AesDecryptionOperationFactory : public AesOperationFactory {
 
 static const size_t MAX_EVP_KEY_SIZE = 32;
 
+/**
+ * AesCipherContextCache holds keyed EVP_CIPHER_CTX templates for recently-used AES keys, indexed by
+ * (key, block mode, direction).  Copying a template into a new operation's context avoids redoing
+ * the AES key expansion (and for GCM, the GHASH key setup) on every Begin.  Entries are wiped on
+ * eviction and when the cache is destroyed.
+ */
+class AesCipherContextCache {
+  public:
+    explicit AesCipherContextCache(size_t capacity) : entries_(capacity) {}
+
+    /**
+     * Initialize \p ctx with the cipher and key schedule for the specified key, block mode and
+     * direction, building and caching a template if none exists.  \p ctx must have been
+     * initialized with EVP_CIPHER_CTX_init.  The IV is not set; the caller must provide it.
+     */
+    keymaster_error_t InitializeContext(const uint8_t* key, size_t key_size,
+                                        keymaster_block_mode_t block_mode, int encrypt,
+                                        EVP_CIPHER_CTX* ctx);
+
+    /**
+     * Wipe and discard all cached templates.
+     */
+    void Clear() { entries_.Clear(); }
+
+    size_t capacity() const { return entries_.capacity(); }
+    size_t size() const { return entries_.size(); }
+    size_t hits() const { return entries_.hits(); }
+    size_t misses() const { return entries_.misses(); }
+
+  private:
+    struct Entry {
+        Entry() : key_size(0) { EVP_CIPHER_CTX_init(&ctx); }
+        bool in_use() const { return key_size != 0; }
+        void Release();
+
+        keymaster_block_mode_t block_mode;
+        int encrypt;
+        size_t key_size;
+        uint8_t key[MAX_EVP_KEY_SIZE];
+        uint64_t last_used;
+        EVP_CIPHER_CTX ctx;
+    };
+
+    LruCache<Entry> entries_;
+};
+
 class AesEvpOperation : public Operation {
   public:
     AesEvpOperation(keymaster_purpose_t purpose, keymaster_block_mode_t block_mode,
                     keymaster_padding_t padding, bool caller_iv, size_t tag_length,
-                    const uint8_t* key, size_t key_size);
+                    const uint8_t* key, size_t key_size, AesCipherContextCache* cipher_cache);
     ~AesEvpOperation();
 
     keymaster_error_t Begin(const AuthorizationSet& input_params,
@@ -102,15 +149,17 @@ class AesEvpOperation : public Operation {
     bool data_started_;
     const size_t key_size_;
     const keymaster_padding_t padding_;
-    uint8_t key_[MAX_EVP_KEY_SIZE];
+    KeymasterKeyBlob key_;
+    AesCipherContextCache* cipher_cache_;
 };
 
 class AesEvpEncryptOperation : public AesEvpOperation {
   public:
     AesEvpEncryptOperation(keymaster_block_mode_t block_mode, keymaster_padding_t padding,
-                           bool caller_iv, size_t tag_length, const uint8_t* key, size_t key_size)
+                           bool caller_iv, size_t tag_length, const uint8_t* key, size_t key_size,
+                           AesCipherContextCache* cipher_cache = nullptr)
         : AesEvpOperation(KM_PURPOSE_ENCRYPT, block_mode, padding, caller_iv, tag_length, key,
-                          key_size) {}
+                          key_size, cipher_cache) {}
 
     keymaster_error_t Begin(const AuthorizationSet& input_params,
                             AuthorizationSet* output_params) override;
@@ -127,9 +176,11 @@ class AesEvpEncryptOperation : public AesEvpOperation {
 class AesEvpDecryptOperation : public AesEvpOperation {
   public:
     AesEvpDecryptOperation(keymaster_block_mode_t block_mode, keymaster_padding_t padding,
-                           size_t tag_length, const uint8_t* key, size_t key_size)
+                           size_t tag_length, const uint8_t* key, size_t key_size,
+                           AesCipherContextCache* cipher_cache = nullptr)
         : AesEvpOperation(KM_PURPOSE_DECRYPT, block_mode, padding,
-                          false /* caller_iv -- don't care */, tag_length, key, key_size) {}
+                          false /* caller_iv -- don't care */, tag_length, key, key_size,
+                          cipher_cache) {}
 
     keymaster_error_t Begin(const AuthorizationSet& input_params,
                             AuthorizationSet* output_params) override;
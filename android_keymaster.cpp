@@ -26,9 +26,13 @@
 
 #include <keymaster/UniquePtr.h>
 
+#include <keymaster/allocation_stats.h>
 #include <keymaster/android_keymaster_utils.h>
 #include <keymaster/key_factory.h>
 #include <keymaster/keymaster_context.h>
+#include <keymaster/latency_stats.h>
+#include <keymaster/request_arena.h>
+#include <keymaster/trace.h>
 
 #include "ae.h"
 #include "key.h"
@@ -44,6 +48,9 @@ const uint8_t MAJOR_VER = 1;
 const uint8_t MINOR_VER = 1;
 const uint8_t SUBMINOR_VER = 0;
 
+// Room for the parsed authorizations of typical keys.  Larger sets spill into heap blocks.
+const size_t kOperationArenaSize = 1024;
+
 keymaster_error_t CheckVersionInfo(const AuthorizationSet& tee_enforced,
                                    const AuthorizationSet& sw_enforced,
                                    const KeymasterContext& context) {
@@ -65,8 +72,78 @@ keymaster_error_t CheckVersionInfo(const AuthorizationSet& tee_enforced,
 
 }  // anonymous namespace
 
+/**
+ * RequestTimer times one request, and the phases of it marked by PhaseTimers, and records them in
+ * LatencyStats when the request ends, under the labels set by then.  It does nothing if there are
+ * no stats or the context has no clock.  The request is also traced as a span named for its entry
+ * point.
+ */
+class RequestTimer {
+  public:
+    RequestTimer(const KeymasterContext& context, LatencyStats* stats,
+                 LatencyStats::EntryPoint entry_point)
+        : span_(LatencyStats::entry_point_name(entry_point)), context_(context), stats_(stats),
+          entry_point_(entry_point), start_(stats ? context.GetMonotonicTimeNs() : 0),
+          phases_seen_(0) {}
+
+    ~RequestTimer() {
+        if (!enabled())
+            return;
+        stats_->Record(entry_point_, LatencyStats::TOTAL_PHASE, labels_, now() - start_);
+        for (size_t phase = LatencyStats::TOTAL_PHASE + 1; phase < LatencyStats::kPhaseCount;
+             ++phase) {
+            if (phases_seen_ & (1 << phase))
+                stats_->Record(entry_point_, static_cast<LatencyStats::Phase>(phase), labels_,
+                               phase_ns_[phase]);
+        }
+    }
+
+    bool enabled() const { return start_ != 0; }
+    uint64_t now() const { return context_.GetMonotonicTimeNs(); }
+    LatencyLabels* labels() { return &labels_; }
+
+    void AddPhase(LatencyStats::Phase phase, uint64_t duration_ns) {
+        if (!(phases_seen_ & (1 << phase)))
+            phase_ns_[phase] = 0;
+        phase_ns_[phase] += duration_ns;
+        phases_seen_ |= 1 << phase;
+    }
+
+  private:
+    TraceSpan span_;
+    const KeymasterContext& context_;
+    LatencyStats* stats_;
+    const LatencyStats::EntryPoint entry_point_;
+    const uint64_t start_;
+    LatencyLabels labels_;
+    uint32_t phases_seen_;
+    uint64_t phase_ns_[LatencyStats::kPhaseCount];
+};
+
+/**
+ * PhaseTimer adds the time until it goes out of scope to one phase of a request, and traces it as
+ * a span named \p span_name.  \p request may be null.
+ */
+class PhaseTimer {
+  public:
+    PhaseTimer(RequestTimer* request, LatencyStats::Phase phase, const char* span_name)
+        : span_(span_name), request_(request && request->enabled() ? request : nullptr),
+          phase_(phase), start_(request_ ? request_->now() : 0) {}
+    ~PhaseTimer() {
+        if (request_)
+            request_->AddPhase(phase_, request_->now() - start_);
+    }
+
+  private:
+    TraceSpan span_;
+    RequestTimer* const request_;
+    const LatencyStats::Phase phase_;
+    const uint64_t start_;
+};
+
 AndroidKeymaster::AndroidKeymaster(KeymasterContext* context, size_t operation_table_size)
-    : context_(context), operation_table_(new(std::nothrow) OperationTable(operation_table_size)) {}
+    : context_(context), operation_table_(new(std::nothrow) OperationTable(operation_table_size)),
+      latency_stats_(new (std::nothrow) LatencyStats) {}
 
 AndroidKeymaster::~AndroidKeymaster() {}
 
@@ -179,12 +256,16 @@ void AndroidKeymaster::SupportedExportFormats(const SupportedExportFormatsReques
 
 void AndroidKeymaster::AddRngEntropy(const AddEntropyRequest& request,
                                      AddEntropyResponse* response) {
+    AllocationScope allocation_scope("AddRngEntropy");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::ADD_RNG_ENTROPY);
     response->error = context_->AddRngEntropy(request.random_data.peek_read(),
                                               request.random_data.available_read());
 }
 
 void AndroidKeymaster::GenerateKey(const GenerateKeyRequest& request,
                                    GenerateKeyResponse* response) {
+    AllocationScope allocation_scope("GenerateKey");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::GENERATE_KEY);
     if (response == NULL)
         return;
 
@@ -195,25 +276,35 @@ void AndroidKeymaster::GenerateKey(const GenerateKeyRequest& request,
         !(factory = context_->GetKeyFactory(algorithm)))
         response->error = KM_ERROR_UNSUPPORTED_ALGORITHM;
     else {
+        timer.labels()->algorithm = algorithm;
         KeymasterKeyBlob key_blob;
         response->enforced.Clear();
         response->unenforced.Clear();
+        PhaseTimer crypto_timer(&timer, LatencyStats::CRYPTO_PHASE, "KeyFactory::GenerateKey");
         response->error = factory->GenerateKey(request.key_description, &key_blob,
                                                &response->enforced, &response->unenforced);
-        if (response->error == KM_ERROR_OK)
+        if (response->error == KM_ERROR_OK) {
             response->key_blob = key_blob.release();
+            if (!response->key_blob.key_material)
+                response->error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        }
     }
 }
 
 void AndroidKeymaster::GetKeyCharacteristics(const GetKeyCharacteristicsRequest& request,
                                              GetKeyCharacteristicsResponse* response) {
+    AllocationScope allocation_scope("GetKeyCharacteristics");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::GET_KEY_CHARACTERISTICS);
     if (response == NULL)
         return;
 
     KeymasterKeyBlob key_material;
-    response->error =
-        context_->ParseKeyBlob(KeymasterKeyBlob(request.key_blob), request.additional_params,
-                               &key_material, &response->enforced, &response->unenforced);
+    {
+        PhaseTimer key_blob_timer(&timer, LatencyStats::KEY_BLOB_PHASE, "ParseKeyBlob");
+        response->error =
+            context_->ParseKeyBlob(KeymasterKeyBlob(request.key_blob), request.additional_params,
+                                   &key_material, &response->enforced, &response->unenforced);
+    }
     if (response->error != KM_ERROR_OK)
         return;
 
@@ -236,67 +327,57 @@ static KeyFactory* GetKeyFactory(const KeymasterContext& context,
 
 void AndroidKeymaster::BeginOperation(const BeginOperationRequest& request,
                                       BeginOperationResponse* response) {
+    AllocationScope allocation_scope("BeginOperation");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::BEGIN_OPERATION);
     if (response == NULL)
         return;
     response->op_handle = 0;
 
-    AuthorizationSet hw_enforced;
-    AuthorizationSet sw_enforced;
-    const KeyFactory* key_factory;
+    timer.labels()->purpose = request.purpose;
+    keymaster_block_mode_t block_mode;
+    if (request.additional_params.GetTagValue(TAG_BLOCK_MODE, &block_mode))
+        timer.labels()->block_mode = block_mode;
+
     UniquePtr<Key> key;
-    response->error = LoadKey(request.key_blob, request.additional_params, &hw_enforced,
-                              &sw_enforced, &key_factory, &key);
+    UniquePtr<Operation> operation;
+    response->error = PrepareOperation(request.key_blob, request.purpose,
+                                       request.additional_params, &key, &operation, &timer);
     if (response->error != KM_ERROR_OK)
         return;
 
-    response->error = KM_ERROR_UNKNOWN_ERROR;
-    keymaster_algorithm_t key_algorithm;
-    if (!key->authorizations().GetTagValue(TAG_ALGORITHM, &key_algorithm))
-        return;
-
-    response->error = KM_ERROR_UNSUPPORTED_PURPOSE;
-    OperationFactory* factory = key_factory->GetOperationFactory(request.purpose);
-    if (!factory)
-        return;
-
-    UniquePtr<Operation> operation(
-        factory->CreateOperation(*key, request.additional_params, &response->error));
-    if (operation.get() == NULL)
-        return;
-
-    if (context_->enforcement_policy()) {
-        km_id_t key_id;
-        response->error = KM_ERROR_UNKNOWN_ERROR;
-        if (!context_->enforcement_policy()->CreateKeyId(request.key_blob, &key_id))
-            return;
-        operation->set_key_id(key_id);
-        response->error = context_->enforcement_policy()->AuthorizeOperation(
-            request.purpose, key_id, key->authorizations(), request.additional_params,
-            0 /* op_handle */, true /* is_begin_operation */);
-        if (response->error != KM_ERROR_OK)
-            return;
-    }
-
     response->output_params.Clear();
-    response->error = operation->Begin(request.additional_params, &response->output_params);
+    {
+        PhaseTimer crypto_timer(&timer, LatencyStats::CRYPTO_PHASE, "Operation::Begin");
+        response->error = operation->Begin(request.additional_params, &response->output_params);
+    }
     if (response->error != KM_ERROR_OK)
         return;
 
+    PhaseTimer table_timer(&timer, LatencyStats::TABLE_PHASE, "OperationTable::Add");
     operation->SetAuthorizations(key->authorizations());
+    operation->set_latency_labels(*timer.labels());
     response->error = operation_table_->Add(operation.release(), &response->op_handle);
 }
 
 void AndroidKeymaster::UpdateOperation(const UpdateOperationRequest& request,
                                        UpdateOperationResponse* response) {
+    AllocationScope allocation_scope("UpdateOperation");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::UPDATE_OPERATION);
     if (response == NULL)
         return;
 
     response->error = KM_ERROR_INVALID_OPERATION_HANDLE;
-    Operation* operation = operation_table_->Find(request.op_handle);
+    Operation* operation;
+    {
+        PhaseTimer table_timer(&timer, LatencyStats::TABLE_PHASE, "OperationTable::Find");
+        operation = operation_table_->Find(request.op_handle);
+    }
     if (operation == NULL)
         return;
+    *timer.labels() = operation->latency_labels();
 
     if (context_->enforcement_policy()) {
+        PhaseTimer enforcement_timer(&timer, LatencyStats::ENFORCEMENT_PHASE, "AuthorizeOperation");
         response->error = context_->enforcement_policy()->AuthorizeOperation(
             operation->purpose(), operation->key_id(), operation->authorizations(),
             request.additional_params, request.op_handle, false /* is_begin_operation */);
@@ -306,26 +387,38 @@ void AndroidKeymaster::UpdateOperation(const UpdateOperationRequest& request,
         }
     }
 
-    response->error =
-        operation->Update(request.additional_params, request.input, &response->output_params,
-                          &response->output, &response->input_consumed);
+    {
+        PhaseTimer crypto_timer(&timer, LatencyStats::CRYPTO_PHASE, "Operation::Update");
+        response->error =
+            operation->Update(request.additional_params, request.input, &response->output_params,
+                              &response->output, &response->input_consumed);
+    }
     if (response->error != KM_ERROR_OK) {
         // Any error invalidates the operation.
+        PhaseTimer table_timer(&timer, LatencyStats::TABLE_PHASE, "OperationTable::Delete");
         operation_table_->Delete(request.op_handle);
     }
 }
 
 void AndroidKeymaster::FinishOperation(const FinishOperationRequest& request,
                                        FinishOperationResponse* response) {
+    AllocationScope allocation_scope("FinishOperation");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::FINISH_OPERATION);
     if (response == NULL)
         return;
 
     response->error = KM_ERROR_INVALID_OPERATION_HANDLE;
-    Operation* operation = operation_table_->Find(request.op_handle);
+    Operation* operation;
+    {
+        PhaseTimer table_timer(&timer, LatencyStats::TABLE_PHASE, "OperationTable::Find");
+        operation = operation_table_->Find(request.op_handle);
+    }
     if (operation == NULL)
         return;
+    *timer.labels() = operation->latency_labels();
 
     if (context_->enforcement_policy()) {
+        PhaseTimer enforcement_timer(&timer, LatencyStats::ENFORCEMENT_PHASE, "AuthorizeOperation");
         response->error = context_->enforcement_policy()->AuthorizeOperation(
             operation->purpose(), operation->key_id(), operation->authorizations(),
             request.additional_params, request.op_handle, false /* is_begin_operation */);
@@ -335,51 +428,74 @@ void AndroidKeymaster::FinishOperation(const FinishOperationRequest& request,
         }
     }
 
-    response->error = operation->Finish(request.additional_params, request.input, request.signature,
-                                        &response->output_params, &response->output);
+    {
+        PhaseTimer crypto_timer(&timer, LatencyStats::CRYPTO_PHASE, "Operation::Finish");
+        response->error =
+            operation->Finish(request.additional_params, request.input, request.signature,
+                              &response->output_params, &response->output);
+    }
+    PhaseTimer table_timer(&timer, LatencyStats::TABLE_PHASE, "OperationTable::Delete");
     operation_table_->Delete(request.op_handle);
 }
 
 void AndroidKeymaster::AbortOperation(const AbortOperationRequest& request,
                                       AbortOperationResponse* response) {
+    AllocationScope allocation_scope("AbortOperation");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::ABORT_OPERATION);
     if (!response)
         return;
 
-    Operation* operation = operation_table_->Find(request.op_handle);
+    Operation* operation;
+    {
+        PhaseTimer table_timer(&timer, LatencyStats::TABLE_PHASE, "OperationTable::Find");
+        operation = operation_table_->Find(request.op_handle);
+    }
     if (!operation) {
         response->error = KM_ERROR_INVALID_OPERATION_HANDLE;
         return;
     }
+    *timer.labels() = operation->latency_labels();
 
-    response->error = operation->Abort();
+    {
+        PhaseTimer crypto_timer(&timer, LatencyStats::CRYPTO_PHASE, "Operation::Abort");
+        response->error = operation->Abort();
+    }
+    PhaseTimer table_timer(&timer, LatencyStats::TABLE_PHASE, "OperationTable::Delete");
     operation_table_->Delete(request.op_handle);
 }
 
 void AndroidKeymaster::ExportKey(const ExportKeyRequest& request, ExportKeyResponse* response) {
+    AllocationScope allocation_scope("ExportKey");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::EXPORT_KEY);
     if (response == NULL)
         return;
 
-    AuthorizationSet hw_enforced;
-    AuthorizationSet sw_enforced;
-    KeymasterKeyBlob key_material;
-    response->error =
-        context_->ParseKeyBlob(KeymasterKeyBlob(request.key_blob), request.additional_params,
-                               &key_material, &hw_enforced, &sw_enforced);
-    if (response->error != KM_ERROR_OK)
-        return;
+    UniquePtr<Key> key;
+    {
+        PhaseTimer key_blob_timer(&timer, LatencyStats::KEY_BLOB_PHASE, "LoadKey");
+        AuthorizationSet hw_enforced;
+        AuthorizationSet sw_enforced;
+        KeymasterKeyBlob key_material;
+        response->error =
+            context_->ParseKeyBlob(KeymasterKeyBlob(request.key_blob), request.additional_params,
+                                   &key_material, &hw_enforced, &sw_enforced);
+        if (response->error != KM_ERROR_OK)
+            return;
 
-    keymaster_algorithm_t algorithm;
-    KeyFactory* key_factory =
-        GetKeyFactory(*context_, hw_enforced, sw_enforced, &algorithm, &response->error);
-    if (!key_factory)
-        return;
+        keymaster_algorithm_t algorithm;
+        KeyFactory* key_factory =
+            GetKeyFactory(*context_, hw_enforced, sw_enforced, &algorithm, &response->error);
+        if (!key_factory)
+            return;
+        timer.labels()->algorithm = algorithm;
 
-    UniquePtr<Key> key;
-    response->error = key_factory->LoadKey(key_material, request.additional_params, hw_enforced,
-                                           sw_enforced, &key);
-    if (response->error != KM_ERROR_OK)
-        return;
+        response->error = key_factory->LoadKey(key_material, request.additional_params,
+                                               hw_enforced, sw_enforced, &key);
+        if (response->error != KM_ERROR_OK)
+            return;
+    }
 
+    PhaseTimer crypto_timer(&timer, LatencyStats::CRYPTO_PHASE, "ExportKeyMaterial");
     UniquePtr<uint8_t[]> out_key;
     size_t size;
     response->error = key->formatted_key_material(request.key_format, &out_key, &size);
@@ -390,41 +506,44 @@ void AndroidKeymaster::ExportKey(const ExportKeyRequest& request, ExportKeyRespo
 }
 
 void AndroidKeymaster::AttestKey(const AttestKeyRequest& request, AttestKeyResponse* response) {
+    AllocationScope allocation_scope("AttestKey");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::ATTEST_KEY);
     if (!response)
         return;
 
     AuthorizationSet tee_enforced;
     AuthorizationSet sw_enforced;
-    const KeyFactory* key_factory;
     UniquePtr<Key> key;
-    response->error = LoadKey(request.key_blob, request.attest_params, &tee_enforced, &sw_enforced,
-                              &key_factory, &key);
+    response->error = PrepareAttestation(request.key_blob, request.attest_params, &key,
+                                         &tee_enforced, &sw_enforced, &timer);
     if (response->error != KM_ERROR_OK)
         return;
 
-    keymaster_blob_t attestation_application_id;
-    if (request.attest_params.GetTagValue(TAG_ATTESTATION_APPLICATION_ID,
-                                          &attestation_application_id)) {
-        sw_enforced.push_back(TAG_ATTESTATION_APPLICATION_ID, attestation_application_id);
-    }
-
+    PhaseTimer crypto_timer(&timer, LatencyStats::CRYPTO_PHASE, "GenerateAttestation");
     response->error = key->GenerateAttestation(*context_, request.attest_params, tee_enforced,
                                                sw_enforced, &response->certificate_chain);
 }
 
 void AndroidKeymaster::UpgradeKey(const UpgradeKeyRequest& request, UpgradeKeyResponse* response) {
+    AllocationScope allocation_scope("UpgradeKey");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::UPGRADE_KEY);
     if (!response)
         return;
 
     KeymasterKeyBlob upgraded_key;
-    response->error = context_->UpgradeKeyBlob(KeymasterKeyBlob(request.key_blob),
-                                               request.upgrade_params, &upgraded_key);
+    {
+        PhaseTimer key_blob_timer(&timer, LatencyStats::KEY_BLOB_PHASE, "UpgradeKeyBlob");
+        response->error = context_->UpgradeKeyBlob(KeymasterKeyBlob(request.key_blob),
+                                                   request.upgrade_params, &upgraded_key);
+    }
     if (response->error != KM_ERROR_OK)
         return;
     response->upgraded_key = upgraded_key.release();
 }
 
 void AndroidKeymaster::ImportKey(const ImportKeyRequest& request, ImportKeyResponse* response) {
+    AllocationScope allocation_scope("ImportKey");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::IMPORT_KEY);
     if (response == NULL)
         return;
 
@@ -435,46 +554,165 @@ void AndroidKeymaster::ImportKey(const ImportKeyRequest& request, ImportKeyRespo
         !(factory = context_->GetKeyFactory(algorithm)))
         response->error = KM_ERROR_UNSUPPORTED_ALGORITHM;
     else {
+        timer.labels()->algorithm = algorithm;
         keymaster_key_blob_t key_material = {request.key_data, request.key_data_length};
         KeymasterKeyBlob key_blob;
+        PhaseTimer crypto_timer(&timer, LatencyStats::CRYPTO_PHASE, "KeyFactory::ImportKey");
         response->error = factory->ImportKey(request.key_description, request.key_format,
                                              KeymasterKeyBlob(key_material), &key_blob,
                                              &response->enforced, &response->unenforced);
-        if (response->error == KM_ERROR_OK)
+        if (response->error == KM_ERROR_OK) {
             response->key_blob = key_blob.release();
+            if (!response->key_blob.key_material)
+                response->error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        }
     }
 }
 
 void AndroidKeymaster::DeleteKey(const DeleteKeyRequest& request, DeleteKeyResponse* response) {
+    AllocationScope allocation_scope("DeleteKey");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::DELETE_KEY);
     if (!response)
         return;
     response->error = context_->DeleteKey(KeymasterKeyBlob(request.key_blob));
 }
 
 void AndroidKeymaster::DeleteAllKeys(const DeleteAllKeysRequest&, DeleteAllKeysResponse* response) {
+    AllocationScope allocation_scope("DeleteAllKeys");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::DELETE_ALL_KEYS);
     if (!response)
         return;
     response->error = context_->DeleteAllKeys();
 }
 
 void AndroidKeymaster::Configure(const ConfigureRequest& request, ConfigureResponse* response) {
+    AllocationScope allocation_scope("Configure");
+    RequestTimer timer(*context_, latency_stats_.get(), LatencyStats::CONFIGURE);
     if (!response)
         return;
     response->error = context_->SetSystemVersion(request.os_version, request.os_patchlevel);
 }
 
+void AndroidKeymaster::GetLatencyStats(const GetLatencyStatsRequest& request,
+                                       GetLatencyStatsResponse* response) {
+    if (!response)
+        return;
+    if (!latency_stats_.get()) {
+        response->error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        return;
+    }
+    response->error = latency_stats_->Summarize(response);
+    if (response->error == KM_ERROR_OK && request.reset)
+        latency_stats_->Reset();
+}
+
 bool AndroidKeymaster::has_operation(keymaster_operation_handle_t op_handle) const {
     return operation_table_->Find(op_handle) != nullptr;
 }
 
+keymaster_error_t AndroidKeymaster::PrepareOperation(const keymaster_key_blob_t& key_blob,
+                                                     keymaster_purpose_t purpose,
+                                                     const AuthorizationSet& begin_params,
+                                                     UniquePtr<Key>* key,
+                                                     UniquePtr<Operation>* operation) {
+    return PrepareOperation(key_blob, purpose, begin_params, key, operation, nullptr /* timer */);
+}
+
+keymaster_error_t AndroidKeymaster::PrepareOperation(const keymaster_key_blob_t& key_blob,
+                                                     keymaster_purpose_t purpose,
+                                                     const AuthorizationSet& begin_params,
+                                                     UniquePtr<Key>* key,
+                                                     UniquePtr<Operation>* operation,
+                                                     RequestTimer* timer) {
+    // The key's authorizations are copied into the key, so the parsed sets are only temporaries.
+    // Keep them in an arena, on the stack unless the key carries unusually many tags.
+    uint8_t arena_buffer[kOperationArenaSize];
+    RequestArena arena(arena_buffer, sizeof(arena_buffer));
+    AuthorizationSet hw_enforced(&arena);
+    AuthorizationSet sw_enforced(&arena);
+    const KeyFactory* key_factory;
+    keymaster_error_t error =
+        LoadKey(key_blob, begin_params, &hw_enforced, &sw_enforced, &key_factory, key, timer);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    keymaster_algorithm_t key_algorithm;
+    if (!(*key)->authorizations().GetTagValue(TAG_ALGORITHM, &key_algorithm))
+        return KM_ERROR_UNKNOWN_ERROR;
+
+    OperationFactory* factory = key_factory->GetOperationFactory(purpose);
+    if (!factory)
+        return KM_ERROR_UNSUPPORTED_PURPOSE;
+
+    {
+        PhaseTimer crypto_timer(timer, LatencyStats::CRYPTO_PHASE, "CreateOperation");
+        operation->reset(factory->CreateOperation(**key, begin_params, &error));
+    }
+    if (operation->get() == NULL)
+        return error;
+
+    if (context_->enforcement_policy()) {
+        PhaseTimer enforcement_timer(timer, LatencyStats::ENFORCEMENT_PHASE, "AuthorizeOperation");
+        km_id_t key_id;
+        if (!context_->enforcement_policy()->CreateKeyId(key_blob, &key_id))
+            return KM_ERROR_UNKNOWN_ERROR;
+        (*operation)->set_key_id(key_id);
+        error = context_->enforcement_policy()->AuthorizeOperation(
+            purpose, key_id, (*key)->authorizations(), begin_params, 0 /* op_handle */,
+            true /* is_begin_operation */);
+        if (error != KM_ERROR_OK)
+            return error;
+    }
+
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t AndroidKeymaster::PrepareAttestation(const keymaster_key_blob_t& key_blob,
+                                                       const AuthorizationSet& attest_params,
+                                                       UniquePtr<Key>* key,
+                                                       AuthorizationSet* tee_enforced,
+                                                       AuthorizationSet* sw_enforced) {
+    return PrepareAttestation(key_blob, attest_params, key, tee_enforced, sw_enforced,
+                              nullptr /* timer */);
+}
+
+keymaster_error_t AndroidKeymaster::PrepareAttestation(const keymaster_key_blob_t& key_blob,
+                                                       const AuthorizationSet& attest_params,
+                                                       UniquePtr<Key>* key,
+                                                       AuthorizationSet* tee_enforced,
+                                                       AuthorizationSet* sw_enforced,
+                                                       RequestTimer* timer) {
+    const KeyFactory* key_factory;
+    keymaster_error_t error =
+        LoadKey(key_blob, attest_params, tee_enforced, sw_enforced, &key_factory, key, timer);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    keymaster_blob_t attestation_application_id;
+    if (attest_params.GetTagValue(TAG_ATTESTATION_APPLICATION_ID, &attestation_application_id)) {
+        sw_enforced->push_back(TAG_ATTESTATION_APPLICATION_ID, attestation_application_id);
+    }
+    return KM_ERROR_OK;
+}
+
 keymaster_error_t AndroidKeymaster::LoadKey(const keymaster_key_blob_t& key_blob,
                                             const AuthorizationSet& additional_params,
                                             AuthorizationSet* hw_enforced,
                                             AuthorizationSet* sw_enforced,
-                                            const KeyFactory** factory, UniquePtr<Key>* key) {
+                                            const KeyFactory** factory, UniquePtr<Key>* key,
+                                            RequestTimer* timer) {
+    PhaseTimer key_blob_timer(timer, LatencyStats::KEY_BLOB_PHASE, "LoadKey");
+
+    // ParseKeyBlob only reads the blob, so lend it the caller's bytes rather than a copy.
+    BorrowedKeymasterKeyBlob borrowed_blob(key_blob);
+
     KeymasterKeyBlob key_material;
-    keymaster_error_t error = context_->ParseKeyBlob(KeymasterKeyBlob(key_blob), additional_params,
-                                                     &key_material, hw_enforced, sw_enforced);
+    keymaster_error_t error;
+    {
+        TraceSpan span("ParseKeyBlob");
+        error = context_->ParseKeyBlob(borrowed_blob, additional_params, &key_material,
+                                       hw_enforced, sw_enforced);
+    }
     if (error != KM_ERROR_OK)
         return error;
 
@@ -486,6 +724,8 @@ keymaster_error_t AndroidKeymaster::LoadKey(const keymaster_key_blob_t& key_blob
     *factory = GetKeyFactory(*context_, *hw_enforced, *sw_enforced, &algorithm, &error);
     if (error != KM_ERROR_OK)
         return error;
+    if (timer)
+        timer->labels()->algorithm = algorithm;
 
     return (*factory)->LoadKey(key_material, additional_params, *hw_enforced, *sw_enforced, key);
 }
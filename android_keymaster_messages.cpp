@@ -561,4 +561,70 @@ bool UpgradeKeyResponse::NonErrorDeserialize(const uint8_t** buf_ptr, const uint
     return deserialize_key_blob(&upgraded_key, buf_ptr, end);
 }
 
+const size_t kMaxLatencySummaryCount = 1024;
+const size_t kLatencySummarySize = 5 * sizeof(uint32_t) + 7 * sizeof(uint64_t);
+
+bool GetLatencyStatsResponse::AllocateSummaries(size_t count) {
+    if (count > kMaxLatencySummaryCount)
+        return false;
+
+    delete[] summaries;
+    summary_count = 0;
+    summaries = new (std::nothrow) LatencySummary[count];
+    if (!summaries)
+        return false;
+    memset(summaries, 0, sizeof(summaries[0]) * count);
+    summary_count = count;
+    return true;
+}
+
+size_t GetLatencyStatsResponse::NonErrorSerializedSize() const {
+    return sizeof(uint32_t) /* summary_count */ + summary_count * kLatencySummarySize +
+           sizeof(uint64_t) /* dropped */;
+}
+
+uint8_t* GetLatencyStatsResponse::NonErrorSerialize(uint8_t* buf, const uint8_t* end) const {
+    buf = append_uint32_to_buf(buf, end, summary_count);
+    for (size_t i = 0; i < summary_count; ++i) {
+        const LatencySummary& summary = summaries[i];
+        buf = append_uint32_to_buf(buf, end, summary.entry_point);
+        buf = append_uint32_to_buf(buf, end, summary.phase);
+        buf = append_uint32_to_buf(buf, end, summary.algorithm);
+        buf = append_uint32_to_buf(buf, end, summary.purpose);
+        buf = append_uint32_to_buf(buf, end, summary.block_mode);
+        buf = append_uint64_to_buf(buf, end, summary.count);
+        buf = append_uint64_to_buf(buf, end, summary.total_ns);
+        buf = append_uint64_to_buf(buf, end, summary.max_ns);
+        buf = append_uint64_to_buf(buf, end, summary.p50_ns);
+        buf = append_uint64_to_buf(buf, end, summary.p90_ns);
+        buf = append_uint64_to_buf(buf, end, summary.p99_ns);
+        buf = append_uint64_to_buf(buf, end, summary.p999_ns);
+    }
+    return append_uint64_to_buf(buf, end, dropped);
+}
+
+bool GetLatencyStatsResponse::NonErrorDeserialize(const uint8_t** buf_ptr, const uint8_t* end) {
+    size_t count;
+    if (!copy_uint32_from_buf(buf_ptr, end, &count) || !AllocateSummaries(count))
+        return false;
+
+    for (size_t i = 0; i < summary_count; ++i) {
+        LatencySummary* summary = &summaries[i];
+        if (!copy_uint32_from_buf(buf_ptr, end, &summary->entry_point) ||
+            !copy_uint32_from_buf(buf_ptr, end, &summary->phase) ||
+            !copy_uint32_from_buf(buf_ptr, end, &summary->algorithm) ||
+            !copy_uint32_from_buf(buf_ptr, end, &summary->purpose) ||
+            !copy_uint32_from_buf(buf_ptr, end, &summary->block_mode) ||
+            !copy_uint64_from_buf(buf_ptr, end, &summary->count) ||
+            !copy_uint64_from_buf(buf_ptr, end, &summary->total_ns) ||
+            !copy_uint64_from_buf(buf_ptr, end, &summary->max_ns) ||
+            !copy_uint64_from_buf(buf_ptr, end, &summary->p50_ns) ||
+            !copy_uint64_from_buf(buf_ptr, end, &summary->p90_ns) ||
+            !copy_uint64_from_buf(buf_ptr, end, &summary->p99_ns) ||
+            !copy_uint64_from_buf(buf_ptr, end, &summary->p999_ns))
+            return false;
+    }
+    return copy_uint64_from_buf(buf_ptr, end, &dropped);
+}
+
 }  // namespace keymaster
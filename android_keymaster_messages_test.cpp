@@ -625,6 +625,59 @@ TEST(RoundTrip, UpgradeKeyResponse) {
     }
 }
 
+TEST(RoundTrip, GetLatencyStatsRequest) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        GetLatencyStatsRequest req(ver);
+        req.reset = true;
+
+        UniquePtr<GetLatencyStatsRequest> deserialized(round_trip(ver, req, 4));
+        EXPECT_TRUE(deserialized->reset);
+    }
+}
+
+TEST(RoundTrip, GetLatencyStatsResponse) {
+    for (int ver = 0; ver <= MAX_MESSAGE_VERSION; ++ver) {
+        GetLatencyStatsResponse rsp(ver);
+        rsp.error = KM_ERROR_OK;
+        EXPECT_TRUE(rsp.AllocateSummaries(2));
+        for (size_t i = 0; i < 2; ++i) {
+            LatencySummary& summary = rsp.summaries[i];
+            summary.entry_point = 9;
+            summary.phase = i;
+            summary.algorithm = KM_ALGORITHM_HMAC;
+            summary.purpose = KM_PURPOSE_SIGN;
+            summary.block_mode = kNoLatencyLabel;
+            summary.count = 10 + i;
+            summary.total_ns = 0x100000000ULL + i;
+            summary.max_ns = 5000;
+            summary.p50_ns = 1000;
+            summary.p90_ns = 2000;
+            summary.p99_ns = 3000;
+            summary.p999_ns = 4000;
+        }
+        rsp.dropped = 7;
+
+        UniquePtr<GetLatencyStatsResponse> deserialized(round_trip(ver, rsp, 168));
+        EXPECT_EQ(2U, deserialized->summary_count);
+        EXPECT_EQ(7U, deserialized->dropped);
+        for (size_t i = 0; i < 2; ++i) {
+            const LatencySummary& summary = deserialized->summaries[i];
+            EXPECT_EQ(9U, summary.entry_point);
+            EXPECT_EQ(i, summary.phase);
+            EXPECT_EQ(static_cast<uint32_t>(KM_ALGORITHM_HMAC), summary.algorithm);
+            EXPECT_EQ(static_cast<uint32_t>(KM_PURPOSE_SIGN), summary.purpose);
+            EXPECT_EQ(kNoLatencyLabel, summary.block_mode);
+            EXPECT_EQ(10 + i, summary.count);
+            EXPECT_EQ(0x100000000ULL + i, summary.total_ns);
+            EXPECT_EQ(5000U, summary.max_ns);
+            EXPECT_EQ(1000U, summary.p50_ns);
+            EXPECT_EQ(2000U, summary.p90_ns);
+            EXPECT_EQ(3000U, summary.p99_ns);
+            EXPECT_EQ(4000U, summary.p999_ns);
+        }
+    }
+}
+
 uint8_t msgbuf[] = {
     220, 88,  183, 255, 71,  1,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,   0,
     0,   173, 0,   0,   0,   228, 174, 98,  187, 191, 135, 253, 200, 51,  230, 114, 247, 151, 109,
@@ -721,6 +774,8 @@ GARBAGE_TEST(AttestKeyRequest);
 GARBAGE_TEST(AttestKeyResponse);
 GARBAGE_TEST(UpgradeKeyRequest);
 GARBAGE_TEST(UpgradeKeyResponse);
+GARBAGE_TEST(GetLatencyStatsRequest);
+GARBAGE_TEST(GetLatencyStatsResponse);
 
 // The macro doesn't work on this one.
 TEST(GarbageTest, SupportedResponse) {
@@ -14,24 +14,45 @@
  * limitations under the License.
  */
 
+#include <chrono>
 #include <fstream>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <openssl/evp.h>
 #include <openssl/x509.h>
+#include <openssl/x509v3.h>
 
 #include <hardware/keymaster0.h>
+#include <keymaster/allocation_stats.h>
+#include <keymaster/android_keymaster.h>
+#include <keymaster/async_logger.h>
+#include <keymaster/batch_attester.h>
 #include <keymaster/key_factory.h>
+#include <keymaster/key_pregeneration_pool.h>
+#include <keymaster/latency_stats.h>
+#include <keymaster/rsa_batch_verifier.h>
+#include <keymaster/rsa_key_pool.h>
 #include <keymaster/soft_keymaster_context.h>
 #include <keymaster/soft_keymaster_device.h>
 #include <keymaster/softkeymaster.h>
+#include <keymaster/trace_event_recorder.h>
 
+#include "aes_key.h"
+#include "aes_operation.h"
 #include "android_keymaster_test_utils.h"
+#include "attestation_cert_template.h"
 #include "attestation_record.h"
+#include "evp_key_cache.h"
 #include "hmac_key.h"
+#include "hmac_operation.h"
 #include "keymaster0_engine.h"
+#include "lru_cache.h"
 #include "openssl_utils.h"
+#include "rsa_operation.h"
+#include "secure_memory_pool.h"
 
 using std::ifstream;
 using std::istreambuf_iterator;
@@ -782,6 +803,60 @@ TEST_P(SigningOperationsTest, EcdsaNoPaddingHugeData) {
         EXPECT_EQ(2, GetParam()->keymaster0_calls());
 }
 
+TEST_P(SigningOperationsTest, RsaUndigestedFinishOnlyMatchesUpdate) {
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder()
+                                           .RsaSigningKey(512, 3)
+                                           .Digest(KM_DIGEST_NONE)
+                                           .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN)));
+    string message = "12345678901234567890123456789012";
+    AuthorizationSet begin_params(client_params());
+    begin_params.push_back(TAG_DIGEST, KM_DIGEST_NONE);
+    begin_params.push_back(TAG_PADDING, KM_PAD_RSA_PKCS1_1_5_SIGN);
+
+    // The whole message in Finish is signed without being buffered.
+    EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_SIGN, begin_params));
+    string direct_signature;
+    EXPECT_EQ(KM_ERROR_OK, FinishOperation(message, "" /* signature */, &direct_signature));
+
+    // A message split across Update and Finish is buffered.
+    EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_SIGN, begin_params));
+    string output;
+    size_t input_consumed;
+    EXPECT_EQ(KM_ERROR_OK, UpdateOperation(message.substr(0, 10), &output, &input_consumed));
+    string buffered_signature;
+    EXPECT_EQ(KM_ERROR_OK,
+              FinishOperation(message.substr(10), "" /* signature */, &buffered_signature));
+
+    // PKCS#1 v1.5 signatures are deterministic, so the two must match.
+    EXPECT_EQ(direct_signature, buffered_signature);
+}
+
+TEST_P(SigningOperationsTest, EcdsaUndigestedFinishOnlyAndUpdate) {
+    ASSERT_EQ(KM_ERROR_OK,
+              GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_NONE)));
+    // Longer than the key, so both paths must truncate it the same way.
+    string message(40, 'a');
+    AuthorizationSet begin_params(client_params());
+    begin_params.push_back(TAG_DIGEST, KM_DIGEST_NONE);
+
+    EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_SIGN, begin_params));
+    string signature;
+    EXPECT_EQ(KM_ERROR_OK, FinishOperation(message, "" /* signature */, &signature));
+
+    EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_VERIFY, begin_params));
+    string output;
+    size_t input_consumed;
+    EXPECT_EQ(KM_ERROR_OK, UpdateOperation(message.substr(0, 10), &output, &input_consumed));
+    EXPECT_EQ(KM_ERROR_OK, FinishOperation(message.substr(10), signature, &output));
+
+    EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_SIGN, begin_params));
+    EXPECT_EQ(KM_ERROR_OK, UpdateOperation(message.substr(0, 10), &output, &input_consumed));
+    EXPECT_EQ(KM_ERROR_OK, FinishOperation(message.substr(10), "" /* signature */, &signature));
+
+    EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_VERIFY, begin_params));
+    EXPECT_EQ(KM_ERROR_OK, FinishOperation(message, signature, &output));
+}
+
 TEST_P(SigningOperationsTest, EcdsaAllSizesAndHashes) {
     vector<int> key_sizes = {224, 256, 384, 521};
     vector<keymaster_digest_t> digests = {
@@ -1308,6 +1383,33 @@ TEST_P(VerificationOperationsTest, RsaPkcs1Sha256CorruptInput) {
         EXPECT_EQ(4, GetParam()->keymaster0_calls());
 }
 
+TEST_P(VerificationOperationsTest, RsaRepeatedMixedPadding) {
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder()
+                                           .RsaSigningKey(768, 3)
+                                           .Digest(KM_DIGEST_SHA_2_256)
+                                           .Padding(KM_PAD_RSA_PSS)
+                                           .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN)));
+    string message(1024, 'a');
+    keymaster_padding_t paddings[] = {KM_PAD_RSA_PSS, KM_PAD_RSA_PKCS1_1_5_SIGN};
+
+    // Repeat, so that later operations start from contexts configured by earlier ones.
+    for (int i = 0; i < 3; ++i) {
+        for (keymaster_padding_t padding : paddings) {
+            string signature;
+            SignMessage(message, &signature, KM_DIGEST_SHA_2_256, padding);
+            VerifyMessage(message, signature, KM_DIGEST_SHA_2_256, padding);
+
+            ++signature[signature.size() / 2];
+            AuthorizationSet begin_params(client_params());
+            begin_params.push_back(TAG_DIGEST, KM_DIGEST_SHA_2_256);
+            begin_params.push_back(TAG_PADDING, padding);
+            EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_VERIFY, begin_params));
+            string result;
+            EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED, FinishOperation(message, signature, &result));
+        }
+    }
+}
+
 TEST_P(VerificationOperationsTest, RsaAllDigestAndPadCombinations) {
     vector<keymaster_digest_t> digests = {
         KM_DIGEST_NONE,      KM_DIGEST_MD5,       KM_DIGEST_SHA1,      KM_DIGEST_SHA_2_224,
@@ -1512,6 +1614,31 @@ TEST_P(VerificationOperationsTest, EcdsaAllDigestsAndKeySizes) {
                   GetParam()->keymaster0_calls());
 }
 
+TEST_P(VerificationOperationsTest, EcdsaRepeatedOperationsEachCurve) {
+    size_t key_sizes[] = {256, 384, 521};
+    string message = "12345678901234567890123456789012";
+
+    for (auto key_size : key_sizes) {
+        ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder()
+                                               .EcdsaSigningKey(key_size)
+                                               .Digest(KM_DIGEST_SHA_2_256)));
+
+        // Repeat, so that later operations use the key as loaded and kept by earlier ones.
+        for (int i = 0; i < 3; ++i) {
+            string signature;
+            SignMessage(message, &signature, KM_DIGEST_SHA_2_256);
+            VerifyMessage(message, signature, KM_DIGEST_SHA_2_256);
+
+            ++signature[signature.size() / 2];
+            AuthorizationSet begin_params(client_params());
+            begin_params.push_back(TAG_DIGEST, KM_DIGEST_SHA_2_256);
+            EXPECT_EQ(KM_ERROR_OK, BeginOperation(KM_PURPOSE_VERIFY, begin_params));
+            string result;
+            EXPECT_EQ(KM_ERROR_VERIFICATION_FAILED, FinishOperation(message, signature, &result));
+        }
+    }
+}
+
 TEST_P(VerificationOperationsTest, HmacSha1Success) {
     GenerateKey(AuthorizationSetBuilder()
                     .HmacKey(128)
@@ -2097,6 +2224,29 @@ TEST_P(EncryptionOperationsTest, RsaOaepDecryptWithWrongDigest) {
         EXPECT_EQ(4, GetParam()->keymaster0_calls());
 }
 
+TEST_P(EncryptionOperationsTest, RsaOaepRepeatedMixedDigests) {
+    if (GetParam()->minimal_digest_set())
+        // We don't have two supported digests.
+        return;
+
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder()
+                                           .RsaEncryptionKey(768, 3)
+                                           .Padding(KM_PAD_RSA_OAEP)
+                                           .Digest(KM_DIGEST_SHA_2_256)
+                                           .Digest(KM_DIGEST_SHA_2_384)));
+    string message = "Hello World!";
+    keymaster_digest_t digests[] = {KM_DIGEST_SHA_2_256, KM_DIGEST_SHA_2_384};
+
+    // Repeat, so that later operations start from contexts configured by earlier ones.
+    for (int i = 0; i < 3; ++i) {
+        for (keymaster_digest_t digest : digests) {
+            string ciphertext = EncryptMessage(string(message), digest, KM_PAD_RSA_OAEP);
+            EXPECT_EQ(768U / 8, ciphertext.size());
+            EXPECT_EQ(message, DecryptMessage(ciphertext, digest, KM_PAD_RSA_OAEP));
+        }
+    }
+}
+
 TEST_P(EncryptionOperationsTest, RsaOaepTooLarge) {
     ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder()
                                            .RsaEncryptionKey(512, 3)
@@ -2577,6 +2727,70 @@ TEST_P(EncryptionOperationsTest, AesCbcRoundTripSuccess) {
     EXPECT_EQ(0, GetParam()->keymaster0_calls());
 }
 
+TEST_P(EncryptionOperationsTest, AesMultipleModesSameKey) {
+    ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder()
+                                           .AesEncryptionKey(128)
+                                           .Authorization(TAG_BLOCK_MODE, KM_MODE_ECB)
+                                           .Authorization(TAG_BLOCK_MODE, KM_MODE_CBC)
+                                           .Authorization(TAG_BLOCK_MODE, KM_MODE_CTR)
+                                           .Padding(KM_PAD_NONE)));
+    // Two-block message.
+    string message = "12345678901234567890123456789012";
+
+    // AES keys in the wrapped keymaster1 configurations are handled by the fake hardware, whose
+    // context isn't visible here.
+    AesCipherContextCache* cache = nullptr;
+    if (!GetParam()->is_keymaster1_hw()) {
+        KeyFactory* factory = GetParam()->keymaster_context()->GetKeyFactory(KM_ALGORITHM_AES);
+        ASSERT_TRUE(factory != nullptr);
+        cache = static_cast<AesKeyFactory*>(factory)->cipher_cache();
+        ASSERT_TRUE(cache != nullptr);
+    }
+    size_t hits = cache ? cache->hits() : 0;
+    size_t misses = cache ? cache->misses() : 0;
+    auto expect_cache_use = [&](bool first_use) {
+        if (!cache)
+            return;
+        if (first_use)
+            ++misses;
+        else
+            ++hits;
+        EXPECT_EQ(hits, cache->hits());
+        EXPECT_EQ(misses, cache->misses());
+    };
+
+    // Repeated operations with one key are keyed from cached cipher contexts.  Each mode and
+    // direction misses once, on first use, and hits thereafter.  Each must still use its own mode,
+    // direction and IV.
+    for (int i = 0; i < 3; ++i) {
+        bool first = (i == 0);
+        string ciphertext = EncryptMessage(message, KM_MODE_ECB, KM_PAD_NONE);
+        expect_cache_use(first);
+        EXPECT_EQ(message, DecryptMessage(ciphertext, KM_MODE_ECB, KM_PAD_NONE));
+        expect_cache_use(first);
+
+        string iv1;
+        string ciphertext1 = EncryptMessage(message, KM_MODE_CBC, KM_PAD_NONE, &iv1);
+        expect_cache_use(first);
+        string iv2;
+        string ciphertext2 = EncryptMessage(message, KM_MODE_CBC, KM_PAD_NONE, &iv2);
+        expect_cache_use(false);
+        EXPECT_NE(ciphertext1, ciphertext2);
+        EXPECT_EQ(message, DecryptMessage(ciphertext2, KM_MODE_CBC, KM_PAD_NONE, iv2));
+        expect_cache_use(first);
+        EXPECT_EQ(message, DecryptMessage(ciphertext1, KM_MODE_CBC, KM_PAD_NONE, iv1));
+        expect_cache_use(false);
+
+        string iv3;
+        ciphertext = EncryptMessage(message, KM_MODE_CTR, KM_PAD_NONE, &iv3);
+        expect_cache_use(first);
+        EXPECT_EQ(message, DecryptMessage(ciphertext, KM_MODE_CTR, KM_PAD_NONE, iv3));
+        expect_cache_use(first);
+    }
+
+    EXPECT_EQ(0, GetParam()->keymaster0_calls());
+}
+
 TEST_P(EncryptionOperationsTest, AesCallerNonce) {
     ASSERT_EQ(KM_ERROR_OK, GenerateKey(AuthorizationSetBuilder()
                                            .AesEncryptionKey(128)
@@ -3721,6 +3935,956 @@ TEST_P(KeyUpgradeTest, EcVersionUpgrade) {
         EXPECT_EQ(7, GetParam()->keymaster0_calls());
 }
 
+struct TestLruEntry {
+    TestLruEntry() : value(0) {}
+    bool in_use() const { return value != 0; }
+    void Release() { value = 0; }
+
+    int value;
+    uint64_t last_used;
+};
+
+TEST(LruCacheTest, EvictsLeastRecentlyUsed) {
+    LruCache<TestLruEntry> cache(3);
+    EXPECT_EQ(3U, cache.capacity());
+    for (int value = 1; value <= 3; ++value)
+        cache.Evict()->value = value;
+    EXPECT_EQ(3U, cache.size());
+
+    // Using 1 leaves 2 as the least recently used.
+    auto find = [&](int value) {
+        return cache.Find([=](const TestLruEntry& entry) { return entry.value == value; });
+    };
+    ASSERT_TRUE(find(1) != nullptr);
+    TestLruEntry* entry = cache.Evict();
+    ASSERT_TRUE(entry != nullptr);
+    EXPECT_FALSE(entry->in_use());
+    entry->value = 4;
+    EXPECT_EQ(nullptr, find(2));
+    EXPECT_TRUE(find(1) != nullptr);
+    EXPECT_TRUE(find(3) != nullptr);
+    EXPECT_TRUE(find(4) != nullptr);
+
+    // Released entries are reused before anything is evicted.
+    find(3)->Release();
+    EXPECT_EQ(2U, cache.size());
+    cache.Evict()->value = 5;
+    EXPECT_TRUE(find(1) != nullptr);
+    EXPECT_TRUE(find(4) != nullptr);
+
+    cache.Clear();
+    EXPECT_EQ(0U, cache.size());
+    EXPECT_EQ(nullptr, find(1));
+
+    LruCache<TestLruEntry> empty(0);
+    EXPECT_EQ(nullptr, empty.Evict());
+}
+
+TEST(HmacContextCacheTest, MatchesOneShotHmac) {
+    // Three keys through a two-entry cache, so that entries are evicted and rebuilt.
+    const string keys[] = {string(16, 'a'), string(32, 'b'), string(200, 'c')};
+    const EVP_MD* mds[] = {EVP_sha256(), EVP_sha512()};
+    const string message = "Hello World!";
+
+    HmacContextCache cache(2);
+    for (int round = 0; round < 3; ++round) {
+        for (const string& key : keys) {
+            for (const EVP_MD* md : mds) {
+                const uint8_t* key_data = reinterpret_cast<const uint8_t*>(key.data());
+                HMAC_CTX ctx;
+                HMAC_CTX_init(&ctx);
+                ASSERT_EQ(KM_ERROR_OK, cache.InitializeContext(key_data, key.size(), md, &ctx));
+                uint8_t mac[EVP_MAX_MD_SIZE];
+                unsigned int mac_len;
+                ASSERT_TRUE(HMAC_Update(&ctx, reinterpret_cast<const uint8_t*>(message.data()),
+                                        message.size()));
+                ASSERT_TRUE(HMAC_Final(&ctx, mac, &mac_len));
+                HMAC_CTX_cleanup(&ctx);
+
+                uint8_t expected[EVP_MAX_MD_SIZE];
+                unsigned int expected_len;
+                ASSERT_TRUE(HMAC(md, key_data, key.size(),
+                                 reinterpret_cast<const uint8_t*>(message.data()), message.size(),
+                                 expected, &expected_len));
+                EXPECT_EQ(string(reinterpret_cast<char*>(expected), expected_len),
+                          string(reinterpret_cast<char*>(mac), mac_len));
+            }
+        }
+    }
+    EXPECT_EQ(2U, cache.size());
+    EXPECT_EQ(18U, cache.hits() + cache.misses());
+
+    cache.Clear();
+    EXPECT_EQ(0U, cache.size());
+}
+
+static void GenerateRsaKeyMaterial(KeymasterKeyBlob* key_material) {
+    BIGNUM_Ptr exponent(BN_new());
+    RSA_Ptr rsa(RSA_new());
+    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+    ASSERT_TRUE(BN_set_word(exponent.get(), 65537));
+    ASSERT_TRUE(RSA_generate_key_ex(rsa.get(), 512, exponent.get(), nullptr /* callback */));
+    ASSERT_EQ(1, EVP_PKEY_set1_RSA(pkey.get(), rsa.get()));
+    ASSERT_EQ(KM_ERROR_OK, EvpKeyToKeyMaterial(pkey.get(), key_material));
+}
+
+TEST(EvpKeyCacheTest, SharesAndEvictsKeys) {
+    KeymasterKeyBlob key1, key2, key3;
+    GenerateRsaKeyMaterial(&key1);
+    GenerateRsaKeyMaterial(&key2);
+    GenerateRsaKeyMaterial(&key3);
+
+    EvpKeyCache cache(2);
+    keymaster_error_t error;
+    EVP_PKEY_Ptr first(cache.Get(EVP_PKEY_RSA, key1, &error));
+    ASSERT_EQ(KM_ERROR_OK, error);
+    EVP_PKEY_Ptr second(cache.Get(EVP_PKEY_RSA, key1, &error));
+    ASSERT_EQ(KM_ERROR_OK, error);
+    EXPECT_EQ(first.get(), second.get());
+    EXPECT_EQ(1U, cache.misses());
+    EXPECT_EQ(1U, cache.hits());
+
+    // Loading two more keys evicts key1, the least recently used.
+    EVP_PKEY_Ptr other(cache.Get(EVP_PKEY_RSA, key2, &error));
+    other.reset(cache.Get(EVP_PKEY_RSA, key3, &error));
+    ASSERT_EQ(KM_ERROR_OK, error);
+    EXPECT_EQ(2U, cache.size());
+
+    // key1 is parsed again, but the references handed out earlier remain usable.
+    EVP_PKEY_Ptr third(cache.Get(EVP_PKEY_RSA, key1, &error));
+    ASSERT_EQ(KM_ERROR_OK, error);
+    EXPECT_NE(first.get(), third.get());
+    EXPECT_EQ(4U, cache.misses());
+    EXPECT_EQ(EVP_PKEY_size(first.get()), EVP_PKEY_size(third.get()));
+
+    cache.Clear();
+    EXPECT_EQ(0U, cache.size());
+    EXPECT_EQ(512 / 8, EVP_PKEY_size(second.get()));
+}
+
+TEST(EvpKeyCacheTest, BadKeyMaterial) {
+    KeymasterKeyBlob garbage(reinterpret_cast<const uint8_t*>("garbage"), 7);
+    EvpKeyCache cache(2);
+    keymaster_error_t error;
+    EXPECT_EQ(nullptr, cache.Get(EVP_PKEY_RSA, garbage, &error));
+    EXPECT_NE(KM_ERROR_OK, error);
+    EXPECT_EQ(0U, cache.size());
+}
+
+static void StoreSigningContext(RsaContextCache* contexts, EVP_PKEY* pkey) {
+    EVP_MD_CTX digest_ctx;
+    EVP_MD_CTX_init(&digest_ctx);
+    EXPECT_EQ(1, EVP_DigestSignInit(&digest_ctx, nullptr /* pctx */, EVP_sha256(),
+                                    nullptr /* engine */, pkey));
+    contexts->StoreDigestContext(pkey, KM_PURPOSE_SIGN, KM_PAD_RSA_PKCS1_1_5_SIGN,
+                                 KM_DIGEST_SHA_2_256, &digest_ctx);
+    EVP_MD_CTX_cleanup(&digest_ctx);
+}
+
+TEST(EvpKeyCacheTest, EvictionDropsContextTemplates) {
+    KeymasterKeyBlob key1, key2;
+    GenerateRsaKeyMaterial(&key1);
+    GenerateRsaKeyMaterial(&key2);
+
+    RsaContextCache contexts(4);
+    EvpKeyCache cache(1, &contexts);
+    keymaster_error_t error;
+    EVP_PKEY_Ptr pkey(cache.Get(EVP_PKEY_RSA, key1, &error));
+    ASSERT_EQ(KM_ERROR_OK, error);
+    StoreSigningContext(&contexts, pkey.get());
+    EXPECT_EQ(1U, contexts.size());
+
+    // Loading key2 evicts key1, and with it key1's template.
+    pkey.reset(cache.Get(EVP_PKEY_RSA, key2, &error));
+    ASSERT_EQ(KM_ERROR_OK, error);
+    EXPECT_EQ(0U, contexts.size());
+
+    StoreSigningContext(&contexts, pkey.get());
+    EXPECT_EQ(1U, contexts.size());
+    cache.Clear();
+    EXPECT_EQ(0U, contexts.size());
+}
+
+// Generates ints, or fails for stocks configured to fail.
+struct TestKeyGenerator {
+    typedef int Key;
+    struct Params {
+        bool fail;
+    };
+    static bool Matches(const Params& a, const Params& b) { return a.fail == b.fail; }
+    static int* Generate(const Params& params) { return params.fail ? nullptr : new int(0); }
+    static void Free(int* key) { delete key; }
+};
+
+class TestKeyPregenerationPool : public KeyPregenerationPool<TestKeyGenerator> {
+  public:
+    using KeyPregenerationPool::AddStock;
+    using KeyPregenerationPool::Take;
+};
+
+TEST(KeyPregenerationPoolTest, FailingStockBacksOffAlone) {
+    TestKeyPregenerationPool pool;
+    ASSERT_TRUE(pool.AddStock({true /* fail */}, 1));
+    ASSERT_TRUE(pool.AddStock({false /* fail */}, 3));
+    ASSERT_TRUE(pool.Start(1));
+
+    // A single thread still fills the good stock while the other keeps failing.
+    for (int i = 0; i < 1000 && pool.GetStats()[1].available < 3; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_EQ(3U, pool.GetStats()[1].available);
+
+    // The failing stock is retried after a growing delay, not continuously.
+    std::this_thread::sleep_for(std::chrono::milliseconds(200));
+    uint64_t failures = pool.GetStats()[0].failures;
+    EXPECT_LE(1U, failures);
+    EXPECT_GE(10U, failures);
+
+    std::unique_ptr<int> key(pool.Take({false /* fail */}));
+    EXPECT_TRUE(key.get() != nullptr);
+    EXPECT_EQ(nullptr, pool.Take({true /* fail */}));
+}
+
+TEST(RsaKeyPregenerationPoolTest, FillsAndServesStock) {
+    RsaKeyPregenerationPool pool;
+    EXPECT_FALSE(pool.AddStock(500, 3, 2));
+    EXPECT_FALSE(pool.AddStock(512, 4, 2));
+    ASSERT_TRUE(pool.AddStock(512, 3, 2));
+    EXPECT_FALSE(pool.AddStock(512, 3, 2));
+    ASSERT_TRUE(pool.Start(2));
+    EXPECT_FALSE(pool.AddStock(768, 3, 1));
+
+    // Give the background threads plenty of time to fill the stock.
+    for (int i = 0; i < 1000 && pool.GetStats()[0].available < 2; ++i)
+        std::this_thread::sleep_for(std::chrono::milliseconds(10));
+    ASSERT_EQ(2U, pool.GetStats()[0].available);
+
+    RSA_Ptr key(pool.TakeKey(512, 3));
+    ASSERT_TRUE(key.get() != nullptr);
+    EXPECT_EQ(512 / 8, RSA_size(key.get()));
+    EXPECT_EQ(nullptr, pool.TakeKey(768, 3));
+
+    RsaKeyPregenerationPool::Stats stats = pool.GetStats()[0];
+    EXPECT_EQ(1U, stats.hits);
+    EXPECT_EQ(0U, stats.misses);
+
+    pool.Stop();
+    EXPECT_EQ(0U, pool.GetStats()[0].available);
+
+    // Once stopped, every take misses and leaves generation to the caller.
+    EXPECT_EQ(nullptr, pool.TakeKey(512, 3));
+    EXPECT_EQ(1U, pool.GetStats()[0].misses);
+}
+
+TEST(RsaKeyPregenerationPoolTest, GenerateKeyTakesFromPool) {
+    RsaKeyPregenerationPool* pool = new RsaKeyPregenerationPool;
+    ASSERT_TRUE(pool->AddStock(512, 3, 1));
+    ASSERT_TRUE(pool->Start(1));
+    SoftKeymasterContext* context = new SoftKeymasterContext;
+    context->SetRsaKeyPool(pool);
+    AndroidKeymaster keymaster(context, 16 /* operation_table_size */);
+
+    GenerateKeyRequest request;
+    request.key_description.Reinitialize(AuthorizationSetBuilder()
+                                             .RsaSigningKey(512, 3)
+                                             .Digest(KM_DIGEST_NONE)
+                                             .Padding(KM_PAD_NONE)
+                                             .Authorization(TAG_NO_AUTH_REQUIRED)
+                                             .build());
+    GenerateKeyResponse response;
+    keymaster.GenerateKey(request, &response);
+    EXPECT_EQ(KM_ERROR_OK, response.error);
+
+    RsaKeyPregenerationPool::Stats stats = pool->GetStats()[0];
+    EXPECT_EQ(1U, stats.hits + stats.misses);
+}
+
+TEST(RsaKeyPregenerationPoolTest, GenerateKeyGeneratesInlineOnMiss) {
+    // Never started, so the stock stays empty.
+    RsaKeyPregenerationPool* pool = new RsaKeyPregenerationPool;
+    ASSERT_TRUE(pool->AddStock(512, 3, 1));
+    SoftKeymasterContext* context = new SoftKeymasterContext;
+    context->SetRsaKeyPool(pool);
+    AndroidKeymaster keymaster(context, 16 /* operation_table_size */);
+
+    GenerateKeyRequest request;
+    request.key_description.Reinitialize(AuthorizationSetBuilder()
+                                             .RsaSigningKey(512, 3)
+                                             .Digest(KM_DIGEST_NONE)
+                                             .Padding(KM_PAD_NONE)
+                                             .Authorization(TAG_NO_AUTH_REQUIRED)
+                                             .build());
+    GenerateKeyResponse response;
+    keymaster.GenerateKey(request, &response);
+    EXPECT_EQ(KM_ERROR_OK, response.error);
+
+    RsaKeyPregenerationPool::Stats stats = pool->GetStats()[0];
+    EXPECT_EQ(0U, stats.hits);
+    EXPECT_EQ(1U, stats.misses);
+}
+
+static string SignWithKeymaster(AndroidKeymaster* keymaster, const keymaster_key_blob_t& key_blob,
+                                const AuthorizationSet& params, const string& message) {
+    BeginOperationRequest begin_request;
+    begin_request.purpose = KM_PURPOSE_SIGN;
+    begin_request.SetKeyMaterial(key_blob);
+    begin_request.additional_params.Reinitialize(params);
+    BeginOperationResponse begin_response;
+    keymaster->BeginOperation(begin_request, &begin_response);
+    EXPECT_EQ(KM_ERROR_OK, begin_response.error);
+
+    FinishOperationRequest finish_request;
+    finish_request.op_handle = begin_response.op_handle;
+    finish_request.input.Reinitialize(message.data(), message.size());
+    FinishOperationResponse finish_response;
+    keymaster->FinishOperation(finish_request, &finish_response);
+    EXPECT_EQ(KM_ERROR_OK, finish_response.error);
+    return string(reinterpret_cast<const char*>(finish_response.output.peek_read()),
+                  finish_response.output.available_read());
+}
+
+TEST(RsaBatchVerifierTest, PerItemResults) {
+    AndroidKeymaster keymaster(new SoftKeymasterContext, 16 /* operation_table_size */);
+    GenerateKeyRequest generate_request;
+    generate_request.key_description.Reinitialize(AuthorizationSetBuilder()
+                                                      .RsaSigningKey(768, 3)
+                                                      .Digest(KM_DIGEST_SHA_2_256)
+                                                      .Padding(KM_PAD_RSA_PSS)
+                                                      .Authorization(TAG_NO_AUTH_REQUIRED)
+                                                      .build());
+    GenerateKeyResponse generate_response;
+    keymaster.GenerateKey(generate_request, &generate_response);
+    ASSERT_EQ(KM_ERROR_OK, generate_response.error);
+    const keymaster_key_blob_t& key_blob = generate_response.key_blob;
+
+    AuthorizationSet params =
+        AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256).Padding(KM_PAD_RSA_PSS).build();
+    const size_t kItemCount = 50;
+    vector<string> messages, signatures;
+    for (size_t i = 0; i < kItemCount; ++i) {
+        messages.push_back(string(i + 1, 'a' + i % 26));
+        signatures.push_back(SignWithKeymaster(&keymaster, key_blob, params, messages[i]));
+        // Corrupt every third signature.
+        if (i % 3 == 0)
+            ++signatures[i][signatures[i].size() / 2];
+    }
+
+    vector<RsaBatchVerifier::Item> items(kItemCount);
+    for (size_t i = 0; i < kItemCount; ++i) {
+        items[i].message = {reinterpret_cast<const uint8_t*>(messages[i].data()),
+                            messages[i].size()};
+        items[i].signature = {reinterpret_cast<const uint8_t*>(signatures[i].data()),
+                              signatures[i].size()};
+    }
+
+    RsaBatchVerifier verifier(4);
+    vector<keymaster_error_t> results;
+    ASSERT_EQ(KM_ERROR_OK, verifier.Verify(&keymaster, key_blob, params, items, &results));
+    ASSERT_EQ(kItemCount, results.size());
+    for (size_t i = 0; i < kItemCount; ++i)
+        EXPECT_EQ(i % 3 == 0 ? KM_ERROR_VERIFICATION_FAILED : KM_ERROR_OK, results[i]) << i;
+
+    // Parameters the key doesn't authorize fail the whole batch.
+    AuthorizationSet bad_params = AuthorizationSetBuilder()
+                                      .Digest(KM_DIGEST_SHA_2_256)
+                                      .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN)
+                                      .build();
+    EXPECT_EQ(KM_ERROR_INCOMPATIBLE_PADDING_MODE,
+              verifier.Verify(&keymaster, key_blob, bad_params, items, &results));
+}
+
+TEST(RsaBatchVerifierTest, RejectsUseLimitedKeys) {
+    AndroidKeymaster keymaster(new SoftKeymasterContext, 16 /* operation_table_size */);
+    AuthorizationSet params =
+        AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256).Padding(KM_PAD_RSA_PSS).build();
+    const keymaster_key_param_t limits[] = {
+        Authorization(TAG_MAX_USES_PER_BOOT, 100), Authorization(TAG_MIN_SECONDS_BETWEEN_OPS, 1),
+    };
+    for (const keymaster_key_param_t& limit : limits) {
+        GenerateKeyRequest generate_request;
+        generate_request.key_description.Reinitialize(AuthorizationSetBuilder()
+                                                          .RsaSigningKey(768, 3)
+                                                          .Digest(KM_DIGEST_SHA_2_256)
+                                                          .Padding(KM_PAD_RSA_PSS)
+                                                          .Authorization(TAG_NO_AUTH_REQUIRED)
+                                                          .build());
+        generate_request.key_description.push_back(limit);
+        GenerateKeyResponse generate_response;
+        keymaster.GenerateKey(generate_request, &generate_response);
+        ASSERT_EQ(KM_ERROR_OK, generate_response.error);
+
+        string message = "message";
+        string signature =
+            SignWithKeymaster(&keymaster, generate_response.key_blob, params, message);
+        vector<RsaBatchVerifier::Item> items(
+            2, {{reinterpret_cast<const uint8_t*>(message.data()), message.size()},
+                {reinterpret_cast<const uint8_t*>(signature.data()), signature.size()}});
+
+        RsaBatchVerifier verifier(2);
+        vector<keymaster_error_t> results;
+        EXPECT_EQ(KM_ERROR_INVALID_ARGUMENT,
+                  verifier.Verify(&keymaster, generate_response.key_blob, params, items, &results))
+            << limit.tag;
+        EXPECT_TRUE(results.empty());
+    }
+}
+
+TEST(BatchAttesterTest, MatchesAttestKey) {
+    AndroidKeymaster keymaster(new SoftKeymasterContext, 16 /* operation_table_size */);
+    const AuthorizationSet key_descriptions[] = {
+        AuthorizationSetBuilder().RsaSigningKey(256, 3).Digest(KM_DIGEST_NONE).build(),
+        AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256).build(),
+        AuthorizationSetBuilder().RsaSigningKey(256, 3).Digest(KM_DIGEST_NONE).build(),
+        AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256).build(),
+        AuthorizationSetBuilder()
+            .AesEncryptionKey(128)
+            .Authorization(TAG_BLOCK_MODE, KM_MODE_ECB)
+            .Padding(KM_PAD_NONE)
+            .build(),
+    };
+    const size_t kKeyCount = sizeof(key_descriptions) / sizeof(key_descriptions[0]);
+    GenerateKeyResponse generate_responses[kKeyCount];
+    vector<keymaster_key_blob_t> key_blobs;
+    for (size_t i = 0; i < kKeyCount; ++i) {
+        GenerateKeyRequest generate_request;
+        generate_request.key_description.Reinitialize(key_descriptions[i]);
+        generate_request.key_description.push_back(TAG_NO_AUTH_REQUIRED);
+        keymaster.GenerateKey(generate_request, &generate_responses[i]);
+        ASSERT_EQ(KM_ERROR_OK, generate_responses[i].error);
+        key_blobs.push_back(generate_responses[i].key_blob);
+    }
+    const uint8_t bad_key_material[] = {1, 2, 3, 4};
+    key_blobs.push_back({bad_key_material, sizeof(bad_key_material)});
+
+    AuthorizationSet attest_params =
+        AuthorizationSetBuilder()
+            .Authorization(TAG_ATTESTATION_CHALLENGE, "challenge", 9)
+            .Authorization(TAG_ATTESTATION_APPLICATION_ID, "attest_app_id", 13)
+            .build();
+
+    BatchAttester attester(4);
+    AttestationBatch batch;
+    ASSERT_EQ(KM_ERROR_OK, attester.Attest(&keymaster, key_blobs, attest_params, &batch));
+    ASSERT_EQ(key_blobs.size(), batch.size());
+
+    // The signing keys get the same chains AttestKey produces, with identical attestation records.
+    for (size_t i = 0; i < 4; ++i) {
+        ASSERT_EQ(KM_ERROR_OK, batch.error(i)) << i;
+        const keymaster_cert_chain_t& chain = batch.chain(i);
+        ASSERT_EQ(3U, chain.entry_count);
+        EXPECT_TRUE(verify_chain(chain));
+
+        AttestKeyRequest request;
+        request.SetKeyMaterial(key_blobs[i]);
+        request.attest_params.Reinitialize(attest_params);
+        AttestKeyResponse response;
+        keymaster.AttestKey(request, &response);
+        ASSERT_EQ(KM_ERROR_OK, response.error);
+        ASSERT_EQ(chain.entry_count, response.certificate_chain.entry_count);
+        for (size_t j = 1; j < chain.entry_count; ++j) {
+            const keymaster_blob_t& expected = response.certificate_chain.entries[j];
+            ASSERT_EQ(expected.data_length, chain.entries[j].data_length);
+            EXPECT_EQ(0, memcmp(expected.data, chain.entries[j].data, expected.data_length));
+        }
+
+        X509_Ptr batch_cert(parse_cert_blob(chain.entries[0]));
+        X509_Ptr single_cert(parse_cert_blob(response.certificate_chain.entries[0]));
+        ASSERT_TRUE(batch_cert.get() && single_cert.get());
+        ASN1_OCTET_STRING* batch_record = get_attestation_record(batch_cert.get());
+        ASN1_OCTET_STRING* single_record = get_attestation_record(single_cert.get());
+        ASSERT_TRUE(batch_record && single_record);
+        EXPECT_EQ(0, ASN1_OCTET_STRING_cmp(batch_record, single_record));
+    }
+
+    // Keys of the same algorithm share one copy of the signing key's chain.
+    EXPECT_EQ(batch.chain(0).entries[1].data, batch.chain(2).entries[1].data);
+    EXPECT_EQ(batch.chain(1).entries[1].data, batch.chain(3).entries[1].data);
+    EXPECT_NE(batch.chain(0).entries[1].data, batch.chain(1).entries[1].data);
+
+    // Keys that can't be attested fail alone.
+    EXPECT_EQ(KM_ERROR_INCOMPATIBLE_ALGORITHM, batch.error(4));
+    EXPECT_NE(KM_ERROR_OK, batch.error(5));
+    EXPECT_EQ(0U, batch.chain(5).entry_count);
+}
+
+TEST(SecureMemoryPoolTest, SizeClassesAndWipe) {
+    SecureMemoryPool pool;
+    uint8_t* small = pool.Allocate(1);
+    uint8_t* aes_key = pool.Allocate(32);
+    uint8_t* rsa_key = pool.Allocate(1200);
+    ASSERT_TRUE(small && aes_key && rsa_key);
+    EXPECT_EQ(nullptr, pool.Allocate(SecureMemoryPool::kMaxSlotSize + 1));
+
+    SecureMemoryPool::Stats stats;
+    pool.GetStats(&stats);
+    EXPECT_EQ(3U, stats.chunks);
+    EXPECT_EQ(3U, stats.slots_in_use);
+
+    EXPECT_TRUE(pool.Owns(rsa_key));
+    uint8_t heap[32];
+    EXPECT_FALSE(pool.Owns(heap));
+    EXPECT_FALSE(pool.Free(heap));
+
+    // Freed slots are wiped, apart from the free list link, and handed out again.
+    memset(aes_key, 0xAA, 32);
+    EXPECT_TRUE(pool.Free(aes_key));
+    for (size_t i = sizeof(uint8_t*); i < 32; ++i)
+        EXPECT_EQ(0, aes_key[i]);
+    EXPECT_EQ(aes_key, pool.Allocate(20));
+
+    pool.GetStats(&stats);
+    EXPECT_EQ(3U, stats.slots_in_use);
+}
+
+// Installs a key material allocator for the life of a test, then puts back the previous one.
+class ScopedKeyMaterialAllocator {
+  public:
+    explicit ScopedKeyMaterialAllocator(KeyMaterialAllocator* allocator)
+        : previous_(SetKeyMaterialAllocator(allocator)) {}
+    ~ScopedKeyMaterialAllocator() { SetKeyMaterialAllocator(previous_); }
+
+  private:
+    KeyMaterialAllocator* previous_;
+};
+
+TEST(SecureMemoryPoolTest, KeyBlobsUseInstalledPool) {
+    ScopedKeyMaterialAllocator allocator(SecureMemoryPool::Get());
+    const uint8_t key[] = "0123456789abcdef0123456789abcdef";
+    KeymasterKeyBlob blob(key, 32);
+    ASSERT_TRUE(blob.key_material != nullptr);
+    EXPECT_TRUE(SecureMemoryPool::Get()->Owns(blob.key_material));
+
+    // Released key material leaves the pool, so the caller can delete[] it.
+    keymaster_key_blob_t released = blob.release();
+    ASSERT_EQ(32U, released.key_material_size);
+    EXPECT_FALSE(SecureMemoryPool::Get()->Owns(released.key_material));
+    EXPECT_EQ(0, memcmp(key, released.key_material, 32));
+    delete[] released.key_material;
+
+    // Heap storage allocated before the pool was installed is still released correctly.
+    KeymasterKeyBlob adopted;
+    adopted.key_material = dup_buffer(key, 32);
+    adopted.key_material_size = 32;
+    adopted.Clear();
+}
+
+TEST(SecureMemoryPoolTest, BeginOperationLeavesPooledKeyBlobAlone) {
+    ScopedKeyMaterialAllocator allocator(SecureMemoryPool::Get());
+    AndroidKeymaster keymaster(new SoftKeymasterContext, 16 /* operation_table_size */);
+    GenerateKeyRequest generate_request;
+    generate_request.key_description.Reinitialize(AuthorizationSetBuilder()
+                                                      .HmacKey(128)
+                                                      .Digest(KM_DIGEST_SHA_2_256)
+                                                      .Authorization(TAG_MIN_MAC_LENGTH, 256)
+                                                      .Authorization(TAG_NO_AUTH_REQUIRED)
+                                                      .build());
+    GenerateKeyResponse generate_response;
+    keymaster.GenerateKey(generate_request, &generate_response);
+    ASSERT_EQ(KM_ERROR_OK, generate_response.error);
+
+    // A caller holding its key blob in the pool, as the batch front-ends may.
+    KeymasterKeyBlob pooled_blob(generate_response.key_blob);
+    ASSERT_TRUE(SecureMemoryPool::Get()->Owns(pooled_blob.key_material));
+    string original(reinterpret_cast<const char*>(pooled_blob.key_material),
+                    pooled_blob.key_material_size);
+
+    for (size_t i = 0; i < 2; ++i) {
+        BeginOperationRequest request;
+        request.purpose = KM_PURPOSE_SIGN;
+        request.key_blob = pooled_blob;
+        request.additional_params.Reinitialize(AuthorizationSetBuilder()
+                                                   .Digest(KM_DIGEST_SHA_2_256)
+                                                   .Authorization(TAG_MAC_LENGTH, 256)
+                                                   .build());
+        BeginOperationResponse response;
+        keymaster.BeginOperation(request, &response);
+        request.key_blob = {nullptr, 0};  // Still owned by pooled_blob.
+        ASSERT_EQ(KM_ERROR_OK, response.error) << i;
+
+        AbortOperationRequest abort_request;
+        abort_request.op_handle = response.op_handle;
+        AbortOperationResponse abort_response;
+        keymaster.AbortOperation(abort_request, &abort_response);
+        EXPECT_EQ(KM_ERROR_OK, abort_response.error);
+    }
+
+    // The caller's slot was neither wiped nor freed.
+    EXPECT_TRUE(SecureMemoryPool::Get()->Owns(pooled_blob.key_material));
+    EXPECT_EQ(original, string(reinterpret_cast<const char*>(pooled_blob.key_material),
+                               pooled_blob.key_material_size));
+}
+
+class CapturingLogger : public Logger {
+  public:
+    int log_msg(LogLevel level, const char* fmt, va_list args) const override {
+        char message[1024];
+        int length = vsnprintf(message, sizeof(message), fmt, args);
+        std::lock_guard<std::mutex> lock(mutex_);
+        levels_.push_back(level);
+        messages_.push_back(message);
+        return length;
+    }
+
+    std::vector<std::string> messages() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return messages_;
+    }
+    std::vector<LogLevel> levels() const {
+        std::lock_guard<std::mutex> lock(mutex_);
+        return levels_;
+    }
+
+  private:
+    mutable std::mutex mutex_;
+    mutable std::vector<std::string> messages_;
+    mutable std::vector<LogLevel> levels_;
+};
+
+TEST(AsyncLoggerTest, FormatsOnWriterThread) {
+    CapturingLogger sink;
+    AsyncLogger logger(&sink);
+    char buffer[] = "buffer";
+    const char* null_string = nullptr;
+    Logger::Warning("%d %-5s|%05.2f %c %hhu %zu %llx %p %s %%", -42, "ab", 3.14159, 'z', 300,
+                    static_cast<size_t>(17), 0xfeedfaceULL, &sink, null_string);
+    buffer[0] = 'B';  // Strings are copied when logged.
+    Logger::Error("%s %*d", buffer, 4, 7);  // '*' is formatted on the calling thread.
+    Logger::Info("no arguments");
+    logger.Flush();
+
+    char expected[128];
+    snprintf(expected, sizeof(expected), "-42 ab   |03.14 z 44 17 feedface %p (null) %%", &sink);
+    std::vector<std::string> messages = sink.messages();
+    ASSERT_EQ(3U, messages.size());
+    EXPECT_EQ(expected, messages[0]);
+    EXPECT_EQ("Buffer    7", messages[1]);
+    EXPECT_EQ("no arguments", messages[2]);
+    std::vector<Logger::LogLevel> levels = sink.levels();
+    EXPECT_EQ(Logger::WARNING_LVL, levels[0]);
+    EXPECT_EQ(Logger::ERROR_LVL, levels[1]);
+    EXPECT_EQ(0U, logger.dropped());
+}
+
+TEST(AsyncLoggerTest, KeepsPerThreadOrderAndCountsDrops) {
+    const int kThreads = 4;
+    const int kMessagesPerThread = 2000;
+    CapturingLogger sink;
+    uint64_t dropped;
+    {
+        AsyncLogger logger(&sink, 8 /* records_per_thread */);
+        std::vector<std::thread> threads;
+        for (int t = 0; t < kThreads; ++t)
+            threads.emplace_back([t] {
+                for (int i = 0; i < kMessagesPerThread; ++i)
+                    Logger::Info("%d %d", t, i);
+            });
+        for (auto& thread : threads)
+            thread.join();
+        dropped = logger.dropped();
+    }
+
+    // Every message was either written or dropped, and each thread's were written in order.
+    int written = 0;
+    int last[kThreads] = {-1, -1, -1, -1};
+    for (const std::string& message : sink.messages()) {
+        int t, i;
+        if (sscanf(message.c_str(), "%d %d", &t, &i) != 2) {
+            EXPECT_NE(std::string::npos, message.find("dropped"));
+            continue;
+        }
+        ASSERT_TRUE(t >= 0 && t < kThreads);
+        EXPECT_LT(last[t], i);
+        last[t] = i;
+        ++written;
+    }
+    EXPECT_EQ(static_cast<uint64_t>(kThreads * kMessagesPerThread), written + dropped);
+}
+
+TEST(LoggerTest, SuppressedLevelsSkipArgumentEvaluation) {
+    CapturingLogger sink;
+    AsyncLogger logger(&sink);
+    int evaluations = 0;
+    Logger::set_min_level(Logger::WARNING_LVL);
+    LOG_I("%d", ++evaluations);
+    LOG_W("%d", ++evaluations);
+    Logger::set_min_level(Logger::DEBUG_LVL);
+    logger.Flush();
+
+    EXPECT_EQ(1, evaluations);
+    std::vector<std::string> messages = sink.messages();
+    ASSERT_EQ(1U, messages.size());
+    EXPECT_NE(std::string::npos, messages[0].find(": 1"));
+}
+
+#ifdef KEYMASTER_ALLOCATION_STATS
+static const char* last_scope_name;
+static AllocationStats last_scope_stats;
+
+static void RecordAllocationScope(const char* scope_name, const AllocationStats& stats) {
+    last_scope_name = scope_name;
+    last_scope_stats = stats;
+}
+
+TEST(AllocationStatsTest, CountsScopesAndRequests) {
+    AllocationScope scope("test");
+    UniquePtr<uint8_t[]> buffer(new(std::nothrow) uint8_t[100]);
+    buffer.reset();
+    AllocationStats stats;
+    scope.GetStats(&stats);
+    EXPECT_EQ(1U, stats.allocations);
+    EXPECT_EQ(1U, stats.frees);
+    EXPECT_EQ(100U, stats.bytes_allocated);
+    EXPECT_EQ(1U, stats.size_histogram[6]);  // 64 to 127 bytes.
+
+    AndroidKeymaster keymaster(new SoftKeymasterContext, 16 /* operation_table_size */);
+    GenerateKeyRequest request;
+    request.key_description.Reinitialize(
+        AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(KM_DIGEST_SHA_2_256).build());
+    GenerateKeyResponse response;
+    SetAllocationReporter(RecordAllocationScope);
+    keymaster.GenerateKey(request, &response);
+    SetAllocationReporter(nullptr);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+
+    EXPECT_STREQ("GenerateKey", last_scope_name);
+    EXPECT_LT(0U, last_scope_stats.allocations);
+    uint64_t histogram_total = 0;
+    for (size_t i = 0; i < kAllocationSizeBuckets; ++i)
+        histogram_total += last_scope_stats.size_histogram[i];
+    EXPECT_EQ(last_scope_stats.allocations, histogram_total);
+}
+#endif  // KEYMASTER_ALLOCATION_STATS
+
+TEST(LatencyHistogramTest, PercentilesWithinBucketWidth) {
+    LatencyHistogram histogram;
+    EXPECT_EQ(0U, histogram.Percentile(500));
+
+    // 1000 durations of 1..1000 microseconds.
+    for (uint64_t i = 1; i <= 1000; ++i)
+        histogram.Record(i * 1000);
+    EXPECT_EQ(1000U, histogram.count());
+    EXPECT_EQ(1000000U, histogram.max_ns());
+    EXPECT_EQ(500500000U, histogram.total_ns());
+
+    for (uint32_t per_mille : {10, 500, 900, 990, 999}) {
+        uint64_t exact = per_mille * 1000;
+        uint64_t reported = histogram.Percentile(per_mille);
+        EXPECT_LE(exact, reported) << per_mille;
+        EXPECT_GE(exact + exact / LatencyHistogram::kSubBuckets, reported) << per_mille;
+    }
+    EXPECT_EQ(1000000U, histogram.Percentile(1000));
+
+    histogram.Reset();
+    EXPECT_EQ(0U, histogram.count());
+    EXPECT_EQ(0U, histogram.Percentile(990));
+}
+
+TEST(LatencyStatsTest, RecordsPhasesOfOperations) {
+    AndroidKeymaster keymaster(new SoftKeymasterContext, 16 /* operation_table_size */);
+    GenerateKeyRequest generate_request;
+    generate_request.key_description.Reinitialize(AuthorizationSetBuilder()
+                                                      .HmacKey(128)
+                                                      .Digest(KM_DIGEST_SHA_2_256)
+                                                      .Authorization(TAG_MIN_MAC_LENGTH, 256)
+                                                      .Authorization(TAG_NO_AUTH_REQUIRED)
+                                                      .build());
+    GenerateKeyResponse generate_response;
+    keymaster.GenerateKey(generate_request, &generate_response);
+    ASSERT_EQ(KM_ERROR_OK, generate_response.error);
+
+    AuthorizationSet params = AuthorizationSetBuilder()
+                                  .Digest(KM_DIGEST_SHA_2_256)
+                                  .Authorization(TAG_MAC_LENGTH, 256)
+                                  .build();
+    for (size_t i = 0; i < 3; ++i)
+        SignWithKeymaster(&keymaster, generate_response.key_blob, params, "message");
+
+    GetLatencyStatsRequest request;
+    request.reset = true;
+    GetLatencyStatsResponse response;
+    keymaster.GetLatencyStats(request, &response);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+
+    bool begin_phases[LatencyStats::kPhaseCount] = {};
+    for (size_t i = 0; i < response.summary_count; ++i) {
+        const LatencySummary& summary = response.summaries[i];
+        if (summary.entry_point == LatencyStats::GENERATE_KEY) {
+            EXPECT_EQ(1U, summary.count);
+            EXPECT_EQ(static_cast<uint32_t>(KM_ALGORITHM_HMAC), summary.algorithm);
+            EXPECT_EQ(kNoLatencyLabel, summary.purpose);
+        }
+        if (summary.entry_point != LatencyStats::BEGIN_OPERATION)
+            continue;
+        EXPECT_EQ(3U, summary.count);
+        EXPECT_EQ(static_cast<uint32_t>(KM_ALGORITHM_HMAC), summary.algorithm);
+        EXPECT_EQ(static_cast<uint32_t>(KM_PURPOSE_SIGN), summary.purpose);
+        EXPECT_EQ(kNoLatencyLabel, summary.block_mode);
+        EXPECT_LE(summary.p50_ns, summary.p99_ns);
+        EXPECT_LE(summary.p99_ns, summary.max_ns);
+        begin_phases[summary.phase] = true;
+    }
+    // SoftKeymasterContext has no enforcement policy, so BeginOperation has no enforcement phase.
+    EXPECT_TRUE(begin_phases[LatencyStats::TOTAL_PHASE]);
+    EXPECT_TRUE(begin_phases[LatencyStats::KEY_BLOB_PHASE]);
+    EXPECT_FALSE(begin_phases[LatencyStats::ENFORCEMENT_PHASE]);
+    EXPECT_TRUE(begin_phases[LatencyStats::CRYPTO_PHASE]);
+    EXPECT_TRUE(begin_phases[LatencyStats::TABLE_PHASE]);
+
+    char table[4096];
+    size_t length = FormatLatencyStats(response, table, sizeof(table));
+    ASSERT_LT(length, sizeof(table));
+    EXPECT_NE(nullptr, strstr(table, "BeginOperation"));
+    EXPECT_NE(nullptr, strstr(table, "HMAC"));
+
+    // The request reset the statistics.
+    keymaster.GetLatencyStats(GetLatencyStatsRequest(), &response);
+    ASSERT_EQ(KM_ERROR_OK, response.error);
+    EXPECT_EQ(0U, response.summary_count);
+}
+
+static bool Contains(const std::string& json, const char* text) {
+    return json.find(text) != std::string::npos;
+}
+
+TEST(TraceEventRecorderTest, ExportsSpansOfEachThread) {
+    EXPECT_EQ(nullptr, Tracer::instance());
+    {
+        TraceEventRecorder recorder(2 /* spans_per_thread */);
+        EXPECT_EQ(&recorder, Tracer::instance());
+        {
+            TraceSpan outer("outer");
+            TraceSpan inner("inner");
+        }
+        std::thread([] { TraceSpan span("other \"thread\""); }).join();
+
+        // This thread's buffer is full.
+        { TraceSpan span("dropped"); }
+        EXPECT_EQ(1U, recorder.dropped());
+
+        std::string json = recorder.ExportJson();
+        EXPECT_TRUE(Contains(json, "\"traceEvents\":["));
+        EXPECT_TRUE(Contains(json, "\"ph\":\"X\",\"cat\":\"keymaster\",\"name\":\"outer\""));
+        EXPECT_TRUE(Contains(json, "\"name\":\"inner\""));
+        EXPECT_TRUE(Contains(json, "\"name\":\"other \\\"thread\\\"\""));
+        EXPECT_FALSE(Contains(json, "\"name\":\"dropped\""));
+
+        // One thread name record per thread.
+        size_t threads = 0;
+        for (size_t pos = json.find("thread_name"); pos != std::string::npos;
+             pos = json.find("thread_name", pos + 1))
+            ++threads;
+        EXPECT_EQ(2U, threads);
+    }
+    EXPECT_EQ(nullptr, Tracer::instance());
+
+    // With no tracer installed, spans record nothing.
+    TraceSpan span("untraced");
+}
+
+TEST(TraceEventRecorderTest, TracesPhasesOfRequests) {
+    AndroidKeymaster keymaster(new SoftKeymasterContext, 16 /* operation_table_size */);
+    GenerateKeyRequest generate_request;
+    generate_request.key_description.Reinitialize(AuthorizationSetBuilder()
+                                                      .HmacKey(128)
+                                                      .Digest(KM_DIGEST_SHA_2_256)
+                                                      .Authorization(TAG_MIN_MAC_LENGTH, 256)
+                                                      .Authorization(TAG_NO_AUTH_REQUIRED)
+                                                      .build());
+    GenerateKeyResponse generate_response;
+    keymaster.GenerateKey(generate_request, &generate_response);
+    ASSERT_EQ(KM_ERROR_OK, generate_response.error);
+
+    TraceEventRecorder recorder;
+    AuthorizationSet params = AuthorizationSetBuilder()
+                                  .Digest(KM_DIGEST_SHA_2_256)
+                                  .Authorization(TAG_MAC_LENGTH, 256)
+                                  .build();
+    SignWithKeymaster(&keymaster, generate_response.key_blob, params, "message");
+
+    std::string json = recorder.ExportJson();
+    for (const char* name : {"BeginOperation", "LoadKey", "ParseKeyBlob", "CreateOperation",
+                             "Operation::Begin", "OperationTable::Add", "FinishOperation",
+                             "Operation::Finish", "OperationTable::Delete"}) {
+        std::string field = std::string("\"name\":\"") + name + "\"";
+        EXPECT_TRUE(Contains(json, field.c_str())) << name;
+    }
+    EXPECT_FALSE(Contains(json, "\"name\":\"GenerateKey\""));
+    EXPECT_EQ(0U, recorder.dropped());
+}
+
+TEST(SoftKeymasterContextTest, SharesAttestationKeysAndChains) {
+    SoftKeymasterContext context;
+    for (keymaster_algorithm_t algorithm : {KM_ALGORITHM_RSA, KM_ALGORITHM_EC}) {
+        keymaster_error_t error = KM_ERROR_UNKNOWN_ERROR;
+        EVP_PKEY_Ptr key1(context.AttestationKey(algorithm, &error));
+        ASSERT_TRUE(key1.get() != nullptr);
+        EVP_PKEY_Ptr key2(context.AttestationKey(algorithm, &error));
+        EXPECT_EQ(key1.get(), key2.get());
+        key1.reset();
+        key2.reset();
+        key1.reset(context.AttestationKey(algorithm, &error));
+        EXPECT_TRUE(key1.get() != nullptr);
+
+        const keymaster_cert_chain_t* shared_chain = context.SharedAttestationChain(algorithm);
+        ASSERT_TRUE(shared_chain != nullptr);
+        EXPECT_EQ(shared_chain, context.SharedAttestationChain(algorithm));
+        UniquePtr<keymaster_cert_chain_t, CertificateChainDelete> chain(
+            context.AttestationChain(algorithm, &error));
+        ASSERT_EQ(KM_ERROR_OK, error);
+        ASSERT_EQ(shared_chain->entry_count, chain->entry_count);
+        for (size_t i = 0; i < chain->entry_count; ++i) {
+            EXPECT_NE(shared_chain->entries[i].data, chain->entries[i].data);
+            ASSERT_EQ(shared_chain->entries[i].data_length, chain->entries[i].data_length);
+            EXPECT_EQ(0, memcmp(shared_chain->entries[i].data, chain->entries[i].data,
+                                chain->entries[i].data_length));
+        }
+    }
+
+    keymaster_error_t error = KM_ERROR_OK;
+    EXPECT_TRUE(context.AttestationKey(KM_ALGORITHM_AES, &error) == nullptr);
+    EXPECT_EQ(KM_ERROR_UNSUPPORTED_ALGORITHM, error);
+    error = KM_ERROR_OK;
+    EXPECT_TRUE(context.AttestationChain(KM_ALGORITHM_AES, &error) == nullptr);
+    EXPECT_EQ(KM_ERROR_UNSUPPORTED_ALGORITHM, error);
+    EXPECT_TRUE(context.SharedAttestationChain(KM_ALGORITHM_AES) == nullptr);
+}
+
+DEFINE_OPENSSL_OBJECT_POINTER(AUTHORITY_KEYID)
+
+TEST(SoftKeymasterContextTest, AttestationCertTemplates) {
+    SoftKeymasterContext context;
+    for (keymaster_algorithm_t algorithm : {KM_ALGORITHM_RSA, KM_ALGORITHM_EC}) {
+        const AttestationCertTemplate* cert_template =
+            context.AttestationCertificateTemplate(algorithm);
+        ASSERT_TRUE(cert_template != nullptr);
+        EXPECT_EQ(cert_template, context.AttestationCertificateTemplate(algorithm));
+
+        const keymaster_blob_t& signing_blob =
+            context.SharedAttestationChain(algorithm)->entries[0];
+        const uint8_t* p = signing_blob.data;
+        X509_Ptr signing_cert(d2i_X509(nullptr, &p, signing_blob.data_length));
+        ASSERT_TRUE(signing_cert.get() != nullptr);
+
+        keymaster_error_t error = KM_ERROR_UNKNOWN_ERROR;
+        X509_Ptr certificate(cert_template->NewCertificate(&error));
+        ASSERT_EQ(KM_ERROR_OK, error);
+        ASSERT_EQ(KM_ERROR_OK, cert_template->AddAuthorityKeyId(certificate.get()));
+
+        EXPECT_EQ(2, X509_get_version(certificate.get()));
+        EXPECT_EQ(0, X509_NAME_cmp(X509_get_subject_name(signing_cert.get()),
+                                   X509_get_issuer_name(certificate.get())));
+
+        AUTHORITY_KEYID_Ptr authority_key_id(reinterpret_cast<AUTHORITY_KEYID*>(
+            X509_get_ext_d2i(certificate.get(), NID_authority_key_identifier, nullptr, nullptr)));
+        ASN1_OCTET_STRING_Ptr subject_key_id(reinterpret_cast<ASN1_OCTET_STRING*>(
+            X509_get_ext_d2i(signing_cert.get(), NID_subject_key_identifier, nullptr, nullptr)));
+        ASSERT_TRUE(authority_key_id.get() != nullptr && authority_key_id->keyid != nullptr);
+        ASSERT_TRUE(subject_key_id.get() != nullptr);
+        EXPECT_EQ(0, ASN1_OCTET_STRING_cmp(authority_key_id->keyid, subject_key_id.get()));
+    }
+
+    EXPECT_TRUE(context.AttestationCertificateTemplate(KM_ALGORITHM_AES) == nullptr);
+}
+
 TEST(SoftKeymasterWrapperTest, CheckKeymaster2Device) {
     // Make a good fake device, and wrap it.
     SoftKeymasterDevice* good_fake(new SoftKeymasterDevice(new TestKeymasterContext));
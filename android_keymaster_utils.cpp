@@ -33,6 +33,76 @@ uint8_t* dup_buffer(const void* buf, size_t size) {
     return retval;
 }
 
+// Set once at startup by SetKeyMaterialAllocator, and read by every key material allocation.  Each
+// allocation records which allocator it came from, so freeing never consults this.
+static KeyMaterialAllocator* key_material_allocator = nullptr;
+
+KeyMaterialAllocator* SetKeyMaterialAllocator(KeyMaterialAllocator* allocator) {
+    KeyMaterialAllocator* previous = key_material_allocator;
+    key_material_allocator = allocator;
+    return previous;
+}
+
+uint8_t* AllocateKeyMaterial(size_t size, KeyMaterialAllocator** allocator) {
+    *allocator = key_material_allocator;
+    if (*allocator) {
+        uint8_t* material = (*allocator)->Allocate(size);
+        if (material)
+            return material;
+    }
+    *allocator = nullptr;
+    return new (std::nothrow) uint8_t[size];
+}
+
+uint8_t* DuplicateKeyMaterial(const void* data, size_t size, KeyMaterialAllocator** allocator) {
+    *allocator = nullptr;
+    if (size >= kMaxDupBufferSize)
+        return nullptr;
+    uint8_t* material = AllocateKeyMaterial(size, allocator);
+    if (material)
+        memcpy(material, data, size);
+    return material;
+}
+
+void FreeKeyMaterial(const uint8_t* material, size_t size, KeyMaterialAllocator* allocator) {
+    if (!material)
+        return;
+    uint8_t* writable_material = const_cast<uint8_t*>(material);
+    if (allocator && allocator->Free(writable_material))
+        return;
+    memset_s(writable_material, 0, size);
+    delete[] writable_material;
+}
+
+uint8_t* ReleaseKeyMaterial(const uint8_t* material, size_t size,
+                            KeyMaterialAllocator* allocator) {
+    if (!material || !allocator)
+        return const_cast<uint8_t*>(material);
+
+    uint8_t* released = dup_buffer(material, size);
+    FreeKeyMaterial(material, size, allocator);
+    return released;
+}
+
+namespace {
+
+// The "allocator" of borrowed key material, which leaves freeing to the material's owner.
+class BorrowedKeyMaterial : public KeyMaterialAllocator {
+  public:
+    uint8_t* Allocate(size_t /* size */) override { return nullptr; }
+    bool Free(uint8_t* /* material */) override { return true; }
+};
+
+BorrowedKeyMaterial borrowed_key_material;
+
+}  // anonymous namespace
+
+BorrowedKeymasterKeyBlob::BorrowedKeymasterKeyBlob(const keymaster_key_blob_t& blob) {
+    key_material = blob.key_material;
+    key_material_size = blob.key_material_size;
+    allocator_ = &borrowed_key_material;
+}
+
 int memcmp_s(const void* p1, const void* p2, size_t length) {
     const uint8_t* s1 = static_cast<const uint8_t*>(p1);
     const uint8_t* s2 = static_cast<const uint8_t*>(p2);
@@ -23,6 +23,7 @@
 #include <openssl/x509.h>
 #include <openssl/x509v3.h>
 
+#include "attestation_cert_template.h"
 #include "attestation_record.h"
 #include "openssl_err.h"
 #include "openssl_utils.h"
@@ -142,26 +143,17 @@ keymaster_error_t AsymmetricKey::formatted_key_material(keymaster_key_format_t f
     return KM_ERROR_OK;
 }
 
-static keymaster_error_t build_attestation_extension(const AuthorizationSet& attest_params,
-                                                     const AuthorizationSet& tee_enforced,
-                                                     const AuthorizationSet& sw_enforced,
-                                                     const KeymasterContext& context,
+static keymaster_error_t build_attestation_extension(const uint8_t* attestation_record,
+                                                     size_t record_length,
                                                      X509_EXTENSION_Ptr* extension) {
     ASN1_OBJECT_Ptr oid(
         OBJ_txt2obj(kAttestionRecordOid, 1 /* accept numerical dotted string form only */));
     if (!oid.get())
         return TranslateLastOpenSslError();
 
-    UniquePtr<uint8_t[]> attest_bytes;
-    size_t attest_bytes_len;
-    keymaster_error_t error = build_attestation_record(attest_params, sw_enforced, tee_enforced,
-                                                       context, &attest_bytes, &attest_bytes_len);
-    if (error != KM_ERROR_OK)
-        return error;
-
     ASN1_OCTET_STRING_Ptr attest_str(ASN1_OCTET_STRING_new());
     if (!attest_str.get() ||
-        !ASN1_OCTET_STRING_set(attest_str.get(), attest_bytes.get(), attest_bytes_len))
+        !ASN1_OCTET_STRING_set(attest_str.get(), attestation_record, record_length))
         return TranslateLastOpenSslError();
 
     extension->reset(
@@ -180,14 +172,10 @@ static bool add_public_key(EVP_PKEY* key, X509* certificate, keymaster_error_t*
     return true;
 }
 
-static bool add_attestation_extension(const AuthorizationSet& attest_params,
-                                      const AuthorizationSet& tee_enforced,
-                                      const AuthorizationSet& sw_enforced,
-                                      const KeymasterContext& context, X509* certificate,
-                                      keymaster_error_t* error) {
+static bool add_attestation_extension(const uint8_t* attestation_record, size_t record_length,
+                                      X509* certificate, keymaster_error_t* error) {
     X509_EXTENSION_Ptr attest_extension;
-    *error = build_attestation_extension(attest_params, tee_enforced, sw_enforced, context,
-                                         &attest_extension);
+    *error = build_attestation_extension(attestation_record, record_length, &attest_extension);
     if (*error != KM_ERROR_OK)
         return false;
 
@@ -241,6 +229,26 @@ static bool copy_attestation_chain(const KeymasterContext& context,
                                    keymaster_algorithm_t sign_algorithm,
                                    keymaster_cert_chain_t* chain, keymaster_error_t* error) {
 
+    // Copy straight from the context's own chain if it has one, so the certificates are copied
+    // only into the chain returned to the caller.
+    const keymaster_cert_chain_t* shared_chain = context.SharedAttestationChain(sign_algorithm);
+    if (shared_chain) {
+        if (!allocate_cert_chain(shared_chain->entry_count + 1, chain, error))
+            return false;
+        memset(chain->entries, 0, sizeof(chain->entries[0]) * chain->entry_count);
+
+        for (size_t i = 0; i < shared_chain->entry_count; ++i) {
+            const keymaster_blob_t& entry = shared_chain->entries[i];
+            chain->entries[i + 1].data = dup_buffer(entry.data, entry.data_length);
+            if (!chain->entries[i + 1].data) {
+                *error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+                return false;
+            }
+            chain->entries[i + 1].data_length = entry.data_length;
+        }
+        return true;
+    }
+
     UniquePtr<keymaster_cert_chain_t, CertificateChainDelete> attest_key_chain(
         context.AttestationChain(sign_algorithm, error));
     if (!attest_key_chain.get())
@@ -260,6 +268,30 @@ static bool copy_attestation_chain(const KeymasterContext& context,
     return true;
 }
 
+AttestationSigner::AttestationSigner() : cert_template_(nullptr) {}
+
+AttestationSigner::~AttestationSigner() {}
+
+keymaster_error_t AttestationSigner::Init(const KeymasterContext& context,
+                                          keymaster_algorithm_t sign_algorithm,
+                                          const keymaster_blob_t& signing_cert) {
+    keymaster_error_t error;
+    sign_key_.reset(context.AttestationKey(sign_algorithm, &error));
+    if (!sign_key_.get())
+        return error;
+
+    // Use the context's template for the signing key if it keeps one; otherwise build one from the
+    // signing key's certificate.
+    cert_template_ = context.AttestationCertificateTemplate(sign_algorithm);
+    if (!cert_template_) {
+        local_template_.reset(AttestationCertTemplate::Create(signing_cert, &error));
+        if (!local_template_.get())
+            return error;
+        cert_template_ = local_template_.get();
+    }
+    return KM_ERROR_OK;
+}
+
 keymaster_error_t AsymmetricKey::GenerateAttestation(const KeymasterContext& context,
                                                      const AuthorizationSet& attest_params,
                                                      const AuthorizationSet& tee_enforced,
@@ -274,30 +306,47 @@ keymaster_error_t AsymmetricKey::GenerateAttestation(const KeymasterContext& con
     if ((sign_algorithm != KM_ALGORITHM_RSA && sign_algorithm != KM_ALGORITHM_EC))
         return KM_ERROR_INCOMPATIBLE_ALGORITHM;
 
-    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
-    if (!InternalToEvp(pkey.get()))
-        return TranslateLastOpenSslError();
+    keymaster_error_t error;
+    if (!copy_attestation_chain(context, sign_algorithm, cert_chain, &error))
+        return error;
 
-    X509_Ptr certificate(X509_new());
-    if (!certificate.get())
-        return TranslateLastOpenSslError();
+    if (cert_chain->entry_count < 2) {
+        // cert_chain must have at least two entries, one for the cert we're trying to create and
+        // one for the cert for the key that signs the new cert.
+        return KM_ERROR_UNKNOWN_ERROR;
+    }
 
-    if (!X509_set_version(certificate.get(), 2 /* version 3, but zero-based */))
-        return TranslateLastOpenSslError();
+    AttestationSigner signer;
+    error = signer.Init(context, sign_algorithm, cert_chain->entries[1]);
+    if (error != KM_ERROR_OK)
+        return error;
 
-    ASN1_INTEGER_Ptr serialNumber(ASN1_INTEGER_new());
-    if (!serialNumber.get() || !ASN1_INTEGER_set(serialNumber.get(), 1) ||
-        !X509_set_serialNumber(certificate.get(), serialNumber.get() /* Don't release; copied */))
-        return TranslateLastOpenSslError();
+    UniquePtr<uint8_t[]> attest_bytes;
+    size_t attest_bytes_len;
+    error = build_attestation_record(attest_params, sw_enforced, tee_enforced, context,
+                                     &attest_bytes, &attest_bytes_len);
+    if (error != KM_ERROR_OK)
+        return error;
 
-    X509_NAME_Ptr subjectName(X509_NAME_new());
-    if (!subjectName.get() ||
-        !X509_NAME_add_entry_by_txt(subjectName.get(), "CN", MBSTRING_ASC,
-                                    reinterpret_cast<const uint8_t*>("Android Keystore Key"),
-                                    -1 /* len */, -1 /* loc */, 0 /* set */) ||
-        !X509_set_subject_name(certificate.get(), subjectName.get() /* Don't release; copied */))
+    return SignAttestation(signer, attest_bytes.get(), attest_bytes_len, tee_enforced, sw_enforced,
+                           &cert_chain->entries[0]);
+}
+
+keymaster_error_t AsymmetricKey::SignAttestation(const AttestationSigner& signer,
+                                                 const uint8_t* attestation_record,
+                                                 size_t record_length,
+                                                 const AuthorizationSet& tee_enforced,
+                                                 const AuthorizationSet& sw_enforced,
+                                                 keymaster_blob_t* certificate_blob) const {
+    EVP_PKEY_Ptr pkey(EVP_PKEY_new());
+    if (!InternalToEvp(pkey.get()))
         return TranslateLastOpenSslError();
 
+    keymaster_error_t error;
+    X509_Ptr certificate(signer.cert_template()->NewCertificate(&error));
+    if (!certificate.get())
+        return error;
+
     ASN1_TIME_Ptr notBefore(ASN1_TIME_new());
     uint64_t activeDateTime = 0;
     authorizations().GetTagValue(TAG_ACTIVE_DATETIME, &activeDateTime);
@@ -316,64 +365,23 @@ keymaster_error_t AsymmetricKey::GenerateAttestation(const KeymasterContext& con
         !X509_set_notAfter(certificate.get(), notAfter.get() /* Don't release; copied */))
         return TranslateLastOpenSslError();
 
-    keymaster_error_t error = add_key_usage_extension(tee_enforced, sw_enforced, certificate.get());
+    error = add_key_usage_extension(tee_enforced, sw_enforced, certificate.get());
     if (error != KM_ERROR_OK) {
         return error;
     }
 
-    EVP_PKEY_Ptr sign_key(context.AttestationKey(sign_algorithm, &error));
-
-    if (!sign_key.get() ||  //
-        !add_public_key(pkey.get(), certificate.get(), &error) ||
-        !add_attestation_extension(attest_params, tee_enforced, sw_enforced, context,
-                                   certificate.get(), &error))
+    if (!add_public_key(pkey.get(), certificate.get(), &error) ||
+        !add_attestation_extension(attestation_record, record_length, certificate.get(), &error))
         return error;
 
-    if (!copy_attestation_chain(context, sign_algorithm, cert_chain, &error))
+    error = signer.cert_template()->AddAuthorityKeyId(certificate.get());
+    if (error != KM_ERROR_OK)
         return error;
 
-    // Copy subject key identifier from cert_chain->entries[1] as authority key_id.
-    if (cert_chain->entry_count < 2) {
-        // cert_chain must have at least two entries, one for the cert we're trying to create and
-        // one for the cert for the key that signs the new cert.
-        return KM_ERROR_UNKNOWN_ERROR;
-    }
-
-    const uint8_t* p = cert_chain->entries[1].data;
-    X509_Ptr signing_cert(d2i_X509(nullptr, &p, cert_chain->entries[1].data_length));
-    if (!signing_cert.get()) {
-        return TranslateLastOpenSslError();
-    }
-
-    // Set issuer to subject of batch certificate.
-    X509_NAME* issuerSubject = X509_get_subject_name(signing_cert.get());
-    if (!issuerSubject) {
-        return KM_ERROR_UNKNOWN_ERROR;
-    }
-    if (!X509_set_issuer_name(certificate.get(), issuerSubject)) {
-        return TranslateLastOpenSslError();
-    }
-
-    UniquePtr<X509V3_CTX> x509v3_ctx(new(std::nothrow) X509V3_CTX);
-    if (!x509v3_ctx.get())
-        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-    *x509v3_ctx = {};
-    X509V3_set_ctx(x509v3_ctx.get(), signing_cert.get(), certificate.get(), nullptr /* req */,
-                   nullptr /* crl */, 0 /* flags */);
-
-    X509_EXTENSION_Ptr auth_key_id(X509V3_EXT_nconf_nid(nullptr /* conf */, x509v3_ctx.get(),
-                                                        NID_authority_key_identifier,
-                                                        const_cast<char*>("keyid:always")));
-    if (!auth_key_id.get() ||
-        !X509_add_ext(certificate.get(), auth_key_id.get() /* Don't release; copied */,
-                      -1 /* insert at end */)) {
-        return TranslateLastOpenSslError();
-    }
-
-    if (!X509_sign(certificate.get(), sign_key.get(), EVP_sha256()))
+    if (!X509_sign(certificate.get(), signer.sign_key(), EVP_sha256()))
         return TranslateLastOpenSslError();
 
-    return get_certificate_blob(certificate.get(), &cert_chain->entries[0]);
+    return get_certificate_blob(certificate.get(), certificate_blob);
 }
 
 }  // namespace keymaster
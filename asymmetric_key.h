@@ -20,9 +20,40 @@
 #include <openssl/evp.h>
 
 #include "key.h"
+#include "openssl_utils.h"
 
 namespace keymaster {
 
+class AttestationCertTemplate;
+
+/**
+ * The attestation signing key of one algorithm together with the certificate template for it.
+ * GenerateAttestation loads these for every certificate; callers attesting many keys load them
+ * once and pass the signer to SignAttestation instead.  A signer is immutable once initialized and
+ * may be used from several threads at once.
+ */
+class AttestationSigner {
+  public:
+    AttestationSigner();
+    ~AttestationSigner();
+
+    /**
+     * Load the signing key for \p sign_algorithm from \p context, and use the context's
+     * certificate template if it keeps one, or build one from \p signing_cert, the DER-encoded
+     * certificate of the signing key.
+     */
+    keymaster_error_t Init(const KeymasterContext& context, keymaster_algorithm_t sign_algorithm,
+                           const keymaster_blob_t& signing_cert);
+
+    EVP_PKEY* sign_key() const { return sign_key_.get(); }
+    const AttestationCertTemplate* cert_template() const { return cert_template_; }
+
+  private:
+    EVP_PKEY_Ptr sign_key_;
+    const AttestationCertTemplate* cert_template_;
+    UniquePtr<AttestationCertTemplate> local_template_;
+};
+
 class AsymmetricKey : public Key {
   public:
     AsymmetricKey(const AuthorizationSet& hw_enforced, const AuthorizationSet& sw_enforced,
@@ -39,6 +70,12 @@ class AsymmetricKey : public Key {
                                           const AuthorizationSet& sw_enforced,
                                           keymaster_cert_chain_t* certificate_chain) const override;
 
+    keymaster_error_t SignAttestation(const AttestationSigner& signer,
+                                      const uint8_t* attestation_record, size_t record_length,
+                                      const AuthorizationSet& tee_enforced,
+                                      const AuthorizationSet& sw_enforced,
+                                      keymaster_blob_t* certificate) const override;
+
     virtual bool InternalToEvp(EVP_PKEY* pkey) const = 0;
     virtual bool EvpToInternal(const EVP_PKEY* pkey) = 0;
 };
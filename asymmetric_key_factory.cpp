@@ -18,12 +18,24 @@
 
 #include <keymaster/android_keymaster_utils.h>
 
+#include <keymaster/new>
+
 #include "asymmetric_key.h"
+#include "evp_key_cache.h"
 #include "openssl_err.h"
 #include "openssl_utils.h"
 
 namespace keymaster {
 
+AsymmetricKeyFactory::AsymmetricKeyFactory(const KeymasterContext* context)
+    : KeyFactory(context) {}
+
+AsymmetricKeyFactory::~AsymmetricKeyFactory() {}
+
+void AsymmetricKeyFactory::set_key_cache_size(size_t capacity, EvpKeyCacheListener* listener) {
+    key_cache_.reset(capacity ? new (std::nothrow) EvpKeyCache(capacity, listener) : nullptr);
+}
+
 static const keymaster_key_format_t supported_import_formats[] = {KM_KEY_FORMAT_PKCS8};
 const keymaster_key_format_t*
 AsymmetricKeyFactory::SupportedImportFormats(size_t* format_count) const {
@@ -48,11 +60,18 @@ keymaster_error_t AsymmetricKeyFactory::LoadKey(const KeymasterKeyBlob& key_mate
     if (error != KM_ERROR_OK)
         return error;
 
-    const uint8_t* tmp = key_material.key_material;
-    EVP_PKEY* pkey =
-        d2i_PrivateKey(evp_key_type(), NULL /* pkey */, &tmp, key_material.key_material_size);
-    if (!pkey)
-        return TranslateLastOpenSslError();
+    EVP_PKEY* pkey;
+    if (key_cache_.get()) {
+        pkey = key_cache_->Get(evp_key_type(), key_material, &error);
+        if (!pkey)
+            return error;
+    } else {
+        const uint8_t* tmp = key_material.key_material;
+        pkey =
+            d2i_PrivateKey(evp_key_type(), NULL /* pkey */, &tmp, key_material.key_material_size);
+        if (!pkey)
+            return TranslateLastOpenSslError();
+    }
     UniquePtr<EVP_PKEY, EVP_PKEY_Delete> pkey_deleter(pkey);
 
     if (!asymmetric_key->EvpToInternal(pkey))
@@ -0,0 +1,569 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/async_logger.h>
+
+#include <assert.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/types.h>
+
+#include <algorithm>
+#include <chrono>
+
+#include <keymaster/new>
+
+namespace keymaster {
+
+namespace {
+
+const size_t kMaxArgs = 8;
+const size_t kTextSize = 160;
+const size_t kMaxSpecLength = 24;
+const size_t kMaxMessageLength = 1024;
+const auto kWriteInterval = std::chrono::milliseconds(10);
+
+// Stands in for the offset of a string argument that was null, or didn't fit in the record.
+const uint64_t kNullString = UINT64_MAX;
+const uint64_t kTruncatedString = UINT64_MAX - 1;
+
+/**
+ * A message as recorded by the logging thread.  If fmt is null, text holds the formatted message;
+ * otherwise args holds the argument values, and text the string arguments args points into.
+ */
+struct Record {
+    Logger::LogLevel level;
+    const char* fmt;
+    uint64_t args[kMaxArgs];
+    char text[kTextSize];
+};
+
+enum ArgKind { SIGNED_ARG, UNSIGNED_ARG, CHAR_ARG, DOUBLE_ARG, POINTER_ARG, STRING_ARG };
+
+enum ArgLength {
+    DEFAULT_LENGTH,
+    CHAR_LENGTH,
+    SHORT_LENGTH,
+    LONG_LENGTH,
+    LONG_LONG_LENGTH,
+    SIZE_LENGTH,
+    INTMAX_LENGTH,
+    PTRDIFF_LENGTH,
+};
+
+struct Conversion {
+    const char* start;         // The '%'.
+    const char* length_start;  // The length modifier, or the conversion character if there's none.
+    const char* end;           // One past the conversion character.
+    ArgKind kind;
+    ArgLength length;
+};
+
+enum ParseResult { PARSE_END, PARSE_CONVERSION, PARSE_UNSUPPORTED };
+
+static const char* skip_digits(const char* p) {
+    while (isdigit(static_cast<unsigned char>(*p)))
+        ++p;
+    return p;
+}
+
+static const char* parse_length(const char* p, ArgLength* length) {
+    switch (*p) {
+    case 'h':
+        if (p[1] == 'h') {
+            *length = CHAR_LENGTH;
+            return p + 2;
+        }
+        *length = SHORT_LENGTH;
+        return p + 1;
+    case 'l':
+        if (p[1] == 'l') {
+            *length = LONG_LONG_LENGTH;
+            return p + 2;
+        }
+        *length = LONG_LENGTH;
+        return p + 1;
+    case 'z':
+        *length = SIZE_LENGTH;
+        return p + 1;
+    case 'j':
+        *length = INTMAX_LENGTH;
+        return p + 1;
+    case 't':
+        *length = PTRDIFF_LENGTH;
+        return p + 1;
+    default:
+        *length = DEFAULT_LENGTH;
+        return p;
+    }
+}
+
+/**
+ * Find the next conversion in the format at *pos that consumes an argument, and advance *pos past
+ * it.  "%%" is skipped.  Conversions whose arguments can't be recorded (and '*' widths and
+ * precisions, which take arguments of their own) are reported as unsupported.
+ */
+static ParseResult next_conversion(const char** pos, Conversion* conversion) {
+    const char* p = *pos;
+    while ((p = strchr(p, '%')) && p[1] == '%')
+        p += 2;
+    if (!p)
+        return PARSE_END;
+
+    conversion->start = p++;
+    while (*p && strchr("-+ #0'", *p))
+        ++p;
+    if (*p == '*')
+        return PARSE_UNSUPPORTED;
+    p = skip_digits(p);
+    if (*p == '.') {
+        if (*++p == '*')
+            return PARSE_UNSUPPORTED;
+        p = skip_digits(p);
+    }
+
+    conversion->length_start = p;
+    p = parse_length(p, &conversion->length);
+    switch (*p) {
+    case 'd':
+    case 'i':
+        conversion->kind = SIGNED_ARG;
+        break;
+    case 'u':
+    case 'o':
+    case 'x':
+    case 'X':
+        conversion->kind = UNSIGNED_ARG;
+        break;
+    case 'c':
+        conversion->kind = CHAR_ARG;
+        break;
+    case 'f':
+    case 'F':
+    case 'e':
+    case 'E':
+    case 'g':
+    case 'G':
+    case 'a':
+    case 'A':
+        conversion->kind = DOUBLE_ARG;
+        break;
+    case 'p':
+        conversion->kind = POINTER_ARG;
+        break;
+    case 's':
+        conversion->kind = STRING_ARG;
+        break;
+    default:
+        // Includes 'n' and 'L', and the end of the format.
+        return PARSE_UNSUPPORTED;
+    }
+    // Wide characters and strings aren't recorded, and "%lf" means the same as "%f".
+    if (conversion->length != DEFAULT_LENGTH && conversion->kind != SIGNED_ARG &&
+        conversion->kind != UNSIGNED_ARG &&
+        !(conversion->kind == DOUBLE_ARG && conversion->length == LONG_LENGTH))
+        return PARSE_UNSUPPORTED;
+
+    conversion->end = ++p;
+    if (static_cast<size_t>(conversion->end - conversion->start) > kMaxSpecLength)
+        return PARSE_UNSUPPORTED;
+    *pos = p;
+    return PARSE_CONVERSION;
+}
+
+static int64_t read_signed(ArgLength length, va_list* args) {
+    switch (length) {
+    case DEFAULT_LENGTH:
+        return va_arg(*args, int);
+    case CHAR_LENGTH:
+        return static_cast<signed char>(va_arg(*args, int));
+    case SHORT_LENGTH:
+        return static_cast<short>(va_arg(*args, int));
+    case LONG_LENGTH:
+        return va_arg(*args, long);
+    case LONG_LONG_LENGTH:
+        return va_arg(*args, long long);
+    case SIZE_LENGTH:
+        return va_arg(*args, ssize_t);
+    case INTMAX_LENGTH:
+        return va_arg(*args, intmax_t);
+    case PTRDIFF_LENGTH:
+        return va_arg(*args, ptrdiff_t);
+    }
+    return 0;
+}
+
+static uint64_t read_unsigned(ArgLength length, va_list* args) {
+    switch (length) {
+    case DEFAULT_LENGTH:
+        return va_arg(*args, unsigned);
+    case CHAR_LENGTH:
+        return static_cast<unsigned char>(va_arg(*args, unsigned));
+    case SHORT_LENGTH:
+        return static_cast<unsigned short>(va_arg(*args, unsigned));
+    case LONG_LENGTH:
+        return va_arg(*args, unsigned long);
+    case LONG_LONG_LENGTH:
+        return va_arg(*args, unsigned long long);
+    case SIZE_LENGTH:
+        return va_arg(*args, size_t);
+    case INTMAX_LENGTH:
+        return va_arg(*args, uintmax_t);
+    case PTRDIFF_LENGTH:
+        return static_cast<uint64_t>(va_arg(*args, ptrdiff_t));
+    }
+    return 0;
+}
+
+/**
+ * Record the arguments \p fmt consumes from \p args.  Returns false if the format can't be
+ * recorded, in which case the caller formats the message instead.
+ */
+static bool capture(const char* fmt, va_list* args, Record* record) {
+    record->fmt = fmt;
+    size_t arg_count = 0;
+    size_t text_used = 0;
+
+    Conversion conversion;
+    ParseResult result;
+    while ((result = next_conversion(&fmt, &conversion)) == PARSE_CONVERSION) {
+        if (arg_count == kMaxArgs)
+            return false;
+        uint64_t* arg = &record->args[arg_count++];
+        switch (conversion.kind) {
+        case SIGNED_ARG:
+            *arg = static_cast<uint64_t>(read_signed(conversion.length, args));
+            break;
+        case UNSIGNED_ARG:
+            *arg = read_unsigned(conversion.length, args);
+            break;
+        case CHAR_ARG:
+            *arg = static_cast<uint64_t>(va_arg(*args, int));
+            break;
+        case DOUBLE_ARG: {
+            double value = va_arg(*args, double);
+            static_assert(sizeof(value) == sizeof(*arg), "double doesn't fit in an argument slot");
+            memcpy(arg, &value, sizeof(value));
+            break;
+        }
+        case POINTER_ARG:
+            *arg = reinterpret_cast<uintptr_t>(va_arg(*args, void*));
+            break;
+        case STRING_ARG: {
+            const char* value = va_arg(*args, const char*);
+            if (!value) {
+                *arg = kNullString;
+            } else if (text_used == kTextSize) {
+                *arg = kTruncatedString;
+            } else {
+                // Strings that don't fit are truncated.
+                size_t length = strnlen(value, kTextSize - text_used - 1);
+                memcpy(record->text + text_used, value, length);
+                record->text[text_used + length] = '\0';
+                *arg = text_used;
+                text_used += length + 1;
+            }
+            break;
+        }
+        }
+    }
+    return result == PARSE_END;
+}
+
+// Appends [begin, end) of a format to the message, replacing "%%" with '%'.
+static void append_literal(const char* begin, const char* end, char** out, size_t* left) {
+    for (const char* p = begin; p < end && *left > 1; ++p) {
+        if (*p == '%' && p + 1 < end && p[1] == '%')
+            ++p;
+        *(*out)++ = *p;
+        --*left;
+    }
+    **out = '\0';
+}
+
+static const char* string_arg(const Record& record, uint64_t arg) {
+    if (arg == kNullString)
+        return "(null)";
+    if (arg == kTruncatedString)
+        return "...";
+    return record.text + arg;
+}
+
+/**
+ * Format \p record into \p message, a buffer of \p size bytes.  Integer conversions are widened
+ * to long long, which is how their values were recorded.
+ */
+static void format(const Record& record, char* message, size_t size) {
+    if (!record.fmt) {
+        snprintf(message, size, "%s", record.text);
+        return;
+    }
+
+    char* out = message;
+    size_t left = size;
+    const char* pos = record.fmt;
+    size_t arg_index = 0;
+    Conversion conversion;
+    for (;;) {
+        const char* literal = pos;
+        if (next_conversion(&pos, &conversion) != PARSE_CONVERSION) {
+            append_literal(literal, literal + strlen(literal), &out, &left);
+            return;
+        }
+        append_literal(literal, conversion.start, &out, &left);
+
+        char spec[kMaxSpecLength + 3];
+        size_t prefix_length = conversion.length_start - conversion.start;
+        memcpy(spec, conversion.start, prefix_length);
+        char* spec_end = spec + prefix_length;
+        if (conversion.kind == SIGNED_ARG || conversion.kind == UNSIGNED_ARG) {
+            *spec_end++ = 'l';
+            *spec_end++ = 'l';
+        }
+        *spec_end++ = conversion.end[-1];
+        *spec_end = '\0';
+
+        uint64_t arg = record.args[arg_index++];
+        int written = 0;
+        switch (conversion.kind) {
+        case SIGNED_ARG:
+            written = snprintf(out, left, spec, static_cast<long long>(arg));
+            break;
+        case UNSIGNED_ARG:
+            written = snprintf(out, left, spec, static_cast<unsigned long long>(arg));
+            break;
+        case CHAR_ARG:
+            written = snprintf(out, left, spec, static_cast<int>(arg));
+            break;
+        case DOUBLE_ARG: {
+            double value;
+            memcpy(&value, &arg, sizeof(value));
+            written = snprintf(out, left, spec, value);
+            break;
+        }
+        case POINTER_ARG:
+            written = snprintf(out, left, spec, reinterpret_cast<void*>(arg));
+            break;
+        case STRING_ARG:
+            written = snprintf(out, left, spec, string_arg(record, arg));
+            break;
+        }
+        if (written < 0)
+            return;
+        size_t advance = static_cast<size_t>(written) < left ? written : left - 1;
+        out += advance;
+        left -= advance;
+    }
+}
+
+static int sink_log(const Logger* sink, Logger::LogLevel level, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = sink->log_msg(level, fmt, args);
+    va_end(args);
+    return result;
+}
+
+std::atomic<uint64_t> next_logger_id(1);
+
+}  // anonymous namespace
+
+/**
+ * A single-producer, single-consumer ring of records.  The logging thread that owns the ring
+ * pushes; Drain, serialized by drain_mutex_, pops.
+ */
+class AsyncLogger::Ring {
+  public:
+    explicit Ring(size_t capacity)
+        : records_(new (std::nothrow) Record[capacity]), capacity_(capacity), head_(0), tail_(0),
+          abandoned_(false) {}
+    ~Ring() { delete[] records_; }
+
+    bool Init() const { return records_ != nullptr; }
+
+    // Returns the slot for the next record, or nullptr if the ring is full.
+    Record* BeginPush() {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail - head_.load(std::memory_order_acquire) == capacity_)
+            return nullptr;
+        return &records_[tail % capacity_];
+    }
+
+    // Publishes the record returned by BeginPush, and returns the number of records now queued.
+    size_t EndPush() {
+        size_t tail = tail_.load(std::memory_order_relaxed) + 1;
+        tail_.store(tail, std::memory_order_release);
+        return tail - head_.load(std::memory_order_relaxed);
+    }
+
+    template <typename Consumer> void PopAll(Consumer consume) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        size_t tail = tail_.load(std::memory_order_acquire);
+        for (; head != tail; ++head) {
+            consume(records_[head % capacity_]);
+            head_.store(head + 1, std::memory_order_release);
+        }
+    }
+
+    bool empty() const {
+        return head_.load(std::memory_order_relaxed) == tail_.load(std::memory_order_acquire);
+    }
+
+    // Called when the owning thread will push no more.
+    void Abandon() { abandoned_.store(true, std::memory_order_release); }
+    bool abandoned() const { return abandoned_.load(std::memory_order_acquire); }
+
+  private:
+    Record* const records_;
+    const size_t capacity_;
+    std::atomic<size_t> head_;
+    std::atomic<size_t> tail_;
+    std::atomic<bool> abandoned_;
+};
+
+AsyncLogger::AsyncLogger(Logger* sink, size_t records_per_thread)
+    : sink_(sink), previous_(instance()), records_per_thread_(records_per_thread),
+      id_(next_logger_id++), dropped_(0), installed_(true), callers_(0), dropped_reported_(0),
+      stopping_(false), writer_(&AsyncLogger::RunWriter, this) {
+    set_instance(this);
+}
+
+AsyncLogger::~AsyncLogger() {
+    set_instance(previous_);
+    installed_ = false;
+    // A call that read the instance pointer before it was swapped may still be recording.
+    while (callers_.load() != 0)
+        std::this_thread::yield();
+    {
+        std::lock_guard<std::mutex> lock(writer_mutex_);
+        stopping_ = true;
+    }
+    work_available_.notify_one();
+    writer_.join();
+    Drain();
+}
+
+int AsyncLogger::log_msg(LogLevel level, const char* fmt, va_list args) const {
+    struct Caller {
+        explicit Caller(std::atomic<uint32_t>* callers) : callers_(callers) { ++*callers_; }
+        ~Caller() { --*callers_; }
+        std::atomic<uint32_t>* callers_;
+    } caller(&callers_);
+    bool installed = installed_.load();
+    assert(installed);  // Removed while another thread was logging; see the class comment.
+    if (!installed)
+        return 0;
+
+    Ring* ring = ThreadRing();
+    Record* record = ring ? ring->BeginPush() : nullptr;
+    if (!record) {
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+        return 0;
+    }
+
+    record->level = level;
+    va_list capture_args;
+    va_copy(capture_args, args);
+    bool captured = capture(fmt, &capture_args, record);
+    va_end(capture_args);
+    if (!captured) {
+        record->fmt = nullptr;
+        vsnprintf(record->text, sizeof(record->text), fmt, args);
+    }
+
+    if (ring->EndPush() > records_per_thread_ / 2)
+        work_available_.notify_one();
+    return 0;
+}
+
+void AsyncLogger::Flush() {
+    Drain();
+}
+
+AsyncLogger::Ring* AsyncLogger::ThreadRing() const {
+    // Each thread keeps a ring for the AsyncLogger it last logged through.  The ring is abandoned
+    // when the thread exits or logs through another AsyncLogger, and freed once it's drained.
+    struct ThreadState {
+        ~ThreadState() {
+            if (ring)
+                ring->Abandon();
+        }
+        uint64_t logger_id = 0;
+        std::shared_ptr<Ring> ring;
+    };
+    static thread_local ThreadState state;
+
+    if (state.logger_id != id_) {
+        std::shared_ptr<Ring> ring(new (std::nothrow) Ring(records_per_thread_));
+        if (!ring || !ring->Init())
+            return nullptr;
+        {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            rings_.push_back(ring);
+        }
+        if (state.ring)
+            state.ring->Abandon();
+        state.logger_id = id_;
+        state.ring = std::move(ring);
+    }
+    return state.ring.get();
+}
+
+void AsyncLogger::RunWriter() {
+    std::unique_lock<std::mutex> lock(writer_mutex_);
+    while (!stopping_) {
+        work_available_.wait_for(lock, kWriteInterval);
+        lock.unlock();
+        Drain();
+        lock.lock();
+    }
+}
+
+void AsyncLogger::Drain() {
+    std::lock_guard<std::mutex> drain_lock(drain_mutex_);
+
+    std::vector<std::shared_ptr<Ring>> rings;
+    {
+        std::lock_guard<std::mutex> lock(rings_mutex_);
+        rings = rings_;
+    }
+
+    char message[kMaxMessageLength];
+    for (auto& ring : rings) {
+        // Check for abandonment first; once abandoned, an empty ring stays empty.
+        bool abandoned = ring->abandoned();
+        ring->PopAll([&](const Record& record) {
+            format(record, message, sizeof(message));
+            sink_log(sink_, record.level, "%s", message);
+        });
+        if (abandoned) {
+            std::lock_guard<std::mutex> lock(rings_mutex_);
+            rings_.erase(std::find(rings_.begin(), rings_.end(), ring));
+        }
+    }
+
+    uint64_t dropped = dropped_.load(std::memory_order_relaxed);
+    if (dropped != dropped_reported_) {
+        sink_log(sink_, WARNING_LVL, "AsyncLogger dropped %llu messages",
+                 static_cast<unsigned long long>(dropped - dropped_reported_));
+        dropped_reported_ = dropped;
+    }
+}
+
+}  // namespace keymaster
@@ -0,0 +1,132 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "attestation_cert_template.h"
+
+#include <keymaster/new>
+
+#include <openssl/x509v3.h>
+
+#include "openssl_err.h"
+#include "openssl_utils.h"
+
+namespace keymaster {
+
+AttestationCertTemplate::AttestationCertTemplate()
+    : serial_number_(nullptr), subject_(nullptr), issuer_(nullptr), authority_key_id_(nullptr) {}
+
+AttestationCertTemplate::~AttestationCertTemplate() {
+    ASN1_INTEGER_free(serial_number_);
+    X509_NAME_free(subject_);
+    X509_NAME_free(issuer_);
+    X509_EXTENSION_free(authority_key_id_);
+}
+
+/* static */
+AttestationCertTemplate* AttestationCertTemplate::Create(const keymaster_blob_t& signing_cert,
+                                                         keymaster_error_t* error) {
+    UniquePtr<AttestationCertTemplate> cert_template(new(std::nothrow) AttestationCertTemplate);
+    if (!cert_template.get()) {
+        *error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        return nullptr;
+    }
+
+    cert_template->serial_number_ = ASN1_INTEGER_new();
+    if (!cert_template->serial_number_ || !ASN1_INTEGER_set(cert_template->serial_number_, 1)) {
+        *error = TranslateLastOpenSslError();
+        return nullptr;
+    }
+
+    cert_template->subject_ = X509_NAME_new();
+    if (!cert_template->subject_ ||
+        !X509_NAME_add_entry_by_txt(cert_template->subject_, "CN", MBSTRING_ASC,
+                                    reinterpret_cast<const uint8_t*>("Android Keystore Key"),
+                                    -1 /* len */, -1 /* loc */, 0 /* set */)) {
+        *error = TranslateLastOpenSslError();
+        return nullptr;
+    }
+
+    // A freshly built name is encoded, and the encoding cached, the first time it is copied.
+    // Encode it here so that NewCertificate only ever reads it, even from several threads.
+    if (i2d_X509_NAME(cert_template->subject_, nullptr) < 0) {
+        *error = TranslateLastOpenSslError();
+        return nullptr;
+    }
+
+    const uint8_t* p = signing_cert.data;
+    X509_Ptr issuer_cert(d2i_X509(nullptr, &p, signing_cert.data_length));
+    if (!issuer_cert.get()) {
+        *error = TranslateLastOpenSslError();
+        return nullptr;
+    }
+
+    // Certificates are issued by the subject of the signing key's certificate.
+    X509_NAME* issuer = X509_get_subject_name(issuer_cert.get());
+    if (!issuer) {
+        *error = KM_ERROR_UNKNOWN_ERROR;
+        return nullptr;
+    }
+    cert_template->issuer_ = X509_NAME_dup(issuer);
+    if (!cert_template->issuer_) {
+        *error = TranslateLastOpenSslError();
+        return nullptr;
+    }
+
+    // The authority key identifier is the signing certificate's subject key identifier.
+    UniquePtr<X509V3_CTX> x509v3_ctx(new(std::nothrow) X509V3_CTX);
+    if (!x509v3_ctx.get()) {
+        *error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        return nullptr;
+    }
+    *x509v3_ctx = {};
+    X509V3_set_ctx(x509v3_ctx.get(), issuer_cert.get(), nullptr /* subject */, nullptr /* req */,
+                   nullptr /* crl */, 0 /* flags */);
+
+    cert_template->authority_key_id_ =
+        X509V3_EXT_nconf_nid(nullptr /* conf */, x509v3_ctx.get(), NID_authority_key_identifier,
+                             const_cast<char*>("keyid:always"));
+    if (!cert_template->authority_key_id_) {
+        *error = TranslateLastOpenSslError();
+        return nullptr;
+    }
+
+    *error = KM_ERROR_OK;
+    return cert_template.release();
+}
+
+X509* AttestationCertTemplate::NewCertificate(keymaster_error_t* error) const {
+    X509_Ptr certificate(X509_new());
+    if (!certificate.get() ||
+        !X509_set_version(certificate.get(), 2 /* version 3, but zero-based */) ||
+        !X509_set_serialNumber(certificate.get(), serial_number_ /* Don't release; copied */) ||
+        !X509_set_subject_name(certificate.get(), subject_ /* Don't release; copied */) ||
+        !X509_set_issuer_name(certificate.get(), issuer_ /* Don't release; copied */)) {
+        *error = TranslateLastOpenSslError();
+        return nullptr;
+    }
+
+    *error = KM_ERROR_OK;
+    return certificate.release();
+}
+
+keymaster_error_t AttestationCertTemplate::AddAuthorityKeyId(X509* certificate) const {
+    if (!X509_add_ext(certificate, authority_key_id_ /* Don't release; copied */,
+                      -1 /* insert at end */))
+        return TranslateLastOpenSslError();
+    return KM_ERROR_OK;
+}
+
+}  // namespace keymaster
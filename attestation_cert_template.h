@@ -0,0 +1,71 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_ATTESTATION_CERT_TEMPLATE_H_
+#define SYSTEM_KEYMASTER_ATTESTATION_CERT_TEMPLATE_H_
+
+#include <openssl/x509.h>
+
+#include <hardware/keymaster_defs.h>
+
+namespace keymaster {
+
+/**
+ * The parts of an attestation certificate that depend only on the attestation signing key: the
+ * version, serial number and subject, the issuer taken from the signing key's certificate and the
+ * authority key identifier extension derived from it.  Working these out means parsing the signing
+ * certificate and evaluating an X509V3 extension, so contexts that keep their attestation chain in
+ * memory build one template per signing key and share it between attestations.
+ *
+ * A template is immutable once created and may be used from several threads at once.  That holds
+ * because Create encodes every name up front; see subject_.
+ */
+class AttestationCertTemplate {
+  public:
+    /**
+     * Create a template for certificates signed with the key certified by \p signing_cert, a
+     * DER-encoded X.509 certificate.  Returns null on failure, with the reason in \p error.
+     */
+    static AttestationCertTemplate* Create(const keymaster_blob_t& signing_cert,
+                                           keymaster_error_t* error);
+    ~AttestationCertTemplate();
+
+    /**
+     * Return a new certificate with the fixed fields filled in.  The caller adds the validity, the
+     * subject public key and the key usage and attestation extensions, then calls
+     * AddAuthorityKeyId and signs.  Returns null on failure, with the reason in \p error.
+     */
+    X509* NewCertificate(keymaster_error_t* error) const;
+
+    /**
+     * Append the authority key identifier extension to \p certificate.
+     */
+    keymaster_error_t AddAuthorityKeyId(X509* certificate) const;
+
+  private:
+    AttestationCertTemplate();
+
+    ASN1_INTEGER* serial_number_;
+    // Built by Create, which also encodes it.  Copying a name that hasn't been encoded yet caches
+    // its encoding in the source, so without that NewCertificate would write to shared state.
+    X509_NAME* subject_;
+    X509_NAME* issuer_;  // Parsed from the signing certificate, so already encoded.
+    X509_EXTENSION* authority_key_id_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_ATTESTATION_CERT_TEMPLATE_H_
@@ -17,6 +17,7 @@
 #include "attestation_record.h"
 
 #include <assert.h>
+#include <string.h>
 
 #include <openssl/asn1t.h>
 
@@ -472,31 +473,31 @@ static keymaster_error_t build_auth_list(const AuthorizationSet& auth_list, KM_A
     return KM_ERROR_OK;
 }
 
-// Construct an ASN1.1 DER-encoded attestation record containing the values from sw_enforced and
-// tee_enforced.
-keymaster_error_t build_attestation_record(const AuthorizationSet& attestation_params,
-                                           AuthorizationSet sw_enforced,
-                                           AuthorizationSet tee_enforced,
-                                           const KeymasterContext& context,
-                                           UniquePtr<uint8_t[]>* asn1_key_desc,
-                                           size_t* asn1_key_desc_len) {
-    assert(asn1_key_desc && asn1_key_desc_len);
-
-    UniquePtr<KM_KEY_DESCRIPTION, KM_KEY_DESCRIPTION_Delete> key_desc(KM_KEY_DESCRIPTION_new());
-    if (!key_desc.get())
-        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-
+// The KeyDescription fields that are not authorization lists, gathered once for either encoder.
+struct KeyDescriptionValues {
+    uint32_t keymaster_version;
     keymaster_security_level_t keymaster_security_level;
-    uint32_t keymaster_version = UINT32_MAX;
-    if (tee_enforced.empty()) {
+    keymaster_blob_t attestation_challenge;
+    Buffer unique_id;
+};
+
+// Compute the values that go into the attestation record besides the authorization lists.  The
+// attestation application ID and any device IDs are added to sw_enforced or tee_enforced.
+static keymaster_error_t prepare_attestation_record(const AuthorizationSet& attestation_params,
+                                                    AuthorizationSet* sw_enforced,
+                                                    AuthorizationSet* tee_enforced,
+                                                    const KeymasterContext& context,
+                                                    KeyDescriptionValues* values) {
+    values->keymaster_version = UINT32_MAX;
+    if (tee_enforced->empty()) {
         // Software key.
-        keymaster_security_level = KM_SECURITY_LEVEL_SOFTWARE;
-        keymaster_version = kCurrentKeymasterVersion;
+        values->keymaster_security_level = KM_SECURITY_LEVEL_SOFTWARE;
+        values->keymaster_version = kCurrentKeymasterVersion;
     } else {
-        keymaster_security_level = KM_SECURITY_LEVEL_TRUSTED_ENVIRONMENT;
+        values->keymaster_security_level = KM_SECURITY_LEVEL_TRUSTED_ENVIRONMENT;
         switch (context.GetSecurityLevel()) {
         case KM_SECURITY_LEVEL_TRUSTED_ENVIRONMENT:
-            keymaster_version = kCurrentKeymasterVersion;
+            values->keymaster_version = kCurrentKeymasterVersion;
             break;
 
         case KM_SECURITY_LEVEL_SOFTWARE:
@@ -505,34 +506,26 @@ keymaster_error_t build_attestation_record(const AuthorizationSet& attestation_p
             // without a purpose, which would fool this test into reporting it's a KM0 key.  That
             // corner case doesn't matter much, because purpose-less keys are not usable anyway.
             // Also, KM1 TEEs should disappear rapidly.
-            keymaster_version = tee_enforced.Contains(TAG_PURPOSE) ? 1 : 0;
+            values->keymaster_version = tee_enforced->Contains(TAG_PURPOSE) ? 1 : 0;
             break;
         }
 
-        if (keymaster_version == UINT32_MAX)
+        if (values->keymaster_version == UINT32_MAX)
             return KM_ERROR_UNKNOWN_ERROR;
     }
 
-    if (!ASN1_INTEGER_set(key_desc->attestation_version, kCurrentAttestationVersion) ||
-        !ASN1_ENUMERATED_set(key_desc->attestation_security_level, context.GetSecurityLevel()) ||
-        !ASN1_INTEGER_set(key_desc->keymaster_version, keymaster_version) ||
-        !ASN1_ENUMERATED_set(key_desc->keymaster_security_level, keymaster_security_level))
-        return TranslateLastOpenSslError();
-
-    keymaster_blob_t attestation_challenge = {nullptr, 0};
-    if (!attestation_params.GetTagValue(TAG_ATTESTATION_CHALLENGE, &attestation_challenge))
+    values->attestation_challenge = {nullptr, 0};
+    if (!attestation_params.GetTagValue(TAG_ATTESTATION_CHALLENGE, &values->attestation_challenge))
         return KM_ERROR_ATTESTATION_CHALLENGE_MISSING;
-    if (!ASN1_OCTET_STRING_set(key_desc->attestation_challenge, attestation_challenge.data,
-                               attestation_challenge.data_length))
-        return TranslateLastOpenSslError();
 
     keymaster_blob_t attestation_app_id;
     if (!attestation_params.GetTagValue(TAG_ATTESTATION_APPLICATION_ID, &attestation_app_id))
         return KM_ERROR_ATTESTATION_APPLICATION_ID_MISSING;
-    sw_enforced.push_back(TAG_ATTESTATION_APPLICATION_ID, attestation_app_id);
+    sw_enforced->push_back(TAG_ATTESTATION_APPLICATION_ID, attestation_app_id);
 
-    keymaster_error_t error = context.VerifyAndCopyDeviceIds(attestation_params,
-            keymaster_security_level == KM_SECURITY_LEVEL_SOFTWARE ? &sw_enforced : &tee_enforced);
+    AuthorizationSet* device_ids_list =
+        values->keymaster_security_level == KM_SECURITY_LEVEL_SOFTWARE ? sw_enforced : tee_enforced;
+    keymaster_error_t error = context.VerifyAndCopyDeviceIds(attestation_params, device_ids_list);
     if (error == KM_ERROR_UNIMPLEMENTED) {
         // The KeymasterContext implementation does not support device ID attestation. Bail out if
         // device ID attestation is being attempted.
@@ -545,42 +538,74 @@ keymaster_error_t build_attestation_record(const AuthorizationSet& attestation_p
         return error;
     }
 
-    error = build_auth_list(sw_enforced, key_desc->software_enforced);
-    if (error != KM_ERROR_OK)
-        return error;
-
-    error = build_auth_list(tee_enforced, key_desc->tee_enforced);
-    if (error != KM_ERROR_OK)
-        return error;
-
     // Only check tee_enforced for TAG_INCLUDE_UNIQUE_ID.  If we don't have hardware we can't
     // generate unique IDs.
-    if (tee_enforced.GetTagValue(TAG_INCLUDE_UNIQUE_ID)) {
+    if (tee_enforced->GetTagValue(TAG_INCLUDE_UNIQUE_ID)) {
         uint64_t creation_datetime;
         // Only check sw_enforced for TAG_CREATION_DATETIME, since it shouldn't be in tee_enforced,
         // since this implementation has no secure wall clock.
-        if (!sw_enforced.GetTagValue(TAG_CREATION_DATETIME, &creation_datetime)) {
+        if (!sw_enforced->GetTagValue(TAG_CREATION_DATETIME, &creation_datetime)) {
             LOG_E("Unique ID cannot be created without creation datetime", 0);
             return KM_ERROR_INVALID_KEY_BLOB;
         }
 
         keymaster_blob_t application_id = {nullptr, 0};
-        sw_enforced.GetTagValue(TAG_APPLICATION_ID, &application_id);
+        sw_enforced->GetTagValue(TAG_APPLICATION_ID, &application_id);
 
-        Buffer unique_id;
         error = context.GenerateUniqueId(
             creation_datetime, application_id,
-            attestation_params.GetTagValue(TAG_RESET_SINCE_ID_ROTATION), &unique_id);
+            attestation_params.GetTagValue(TAG_RESET_SINCE_ID_ROTATION), &values->unique_id);
         if (error != KM_ERROR_OK)
             return error;
-
-        key_desc->unique_id = ASN1_OCTET_STRING_new();
-        if (!key_desc->unique_id ||
-            !ASN1_OCTET_STRING_set(key_desc->unique_id, unique_id.peek_read(),
-                                   unique_id.available_read()))
-            return TranslateLastOpenSslError();
     }
 
+    return KM_ERROR_OK;
+}
+
+// Construct an ASN1.1 DER-encoded attestation record containing the values from sw_enforced and
+// tee_enforced, using the ASN.1 templates above.
+keymaster_error_t build_attestation_record_asn1(const AuthorizationSet& attestation_params,
+                                                AuthorizationSet sw_enforced,
+                                                AuthorizationSet tee_enforced,
+                                                const KeymasterContext& context,
+                                                UniquePtr<uint8_t[]>* asn1_key_desc,
+                                                size_t* asn1_key_desc_len) {
+    assert(asn1_key_desc && asn1_key_desc_len);
+
+    KeyDescriptionValues values;
+    keymaster_error_t error = prepare_attestation_record(attestation_params, &sw_enforced,
+                                                         &tee_enforced, context, &values);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    UniquePtr<KM_KEY_DESCRIPTION, KM_KEY_DESCRIPTION_Delete> key_desc(KM_KEY_DESCRIPTION_new());
+    if (!key_desc.get())
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+
+    if (!ASN1_INTEGER_set(key_desc->attestation_version, kCurrentAttestationVersion) ||
+        !ASN1_ENUMERATED_set(key_desc->attestation_security_level, context.GetSecurityLevel()) ||
+        !ASN1_INTEGER_set(key_desc->keymaster_version, values.keymaster_version) ||
+        !ASN1_ENUMERATED_set(key_desc->keymaster_security_level, values.keymaster_security_level))
+        return TranslateLastOpenSslError();
+
+    if (!ASN1_OCTET_STRING_set(key_desc->attestation_challenge,
+                               values.attestation_challenge.data,
+                               values.attestation_challenge.data_length))
+        return TranslateLastOpenSslError();
+
+    if (values.unique_id.available_read() &&
+        !ASN1_OCTET_STRING_set(key_desc->unique_id, values.unique_id.peek_read(),
+                               values.unique_id.available_read()))
+        return TranslateLastOpenSslError();
+
+    error = build_auth_list(sw_enforced, key_desc->software_enforced);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    error = build_auth_list(tee_enforced, key_desc->tee_enforced);
+    if (error != KM_ERROR_OK)
+        return error;
+
     int len = i2d_KM_KEY_DESCRIPTION(key_desc.get(), nullptr);
     if (len < 0)
         return TranslateLastOpenSslError();
@@ -596,6 +621,427 @@ keymaster_error_t build_attestation_record(const AuthorizationSet& attestation_p
     return KM_ERROR_OK;
 }
 
+/*
+ * Direct DER encoding of the KeyDescription.
+ *
+ * The template encoder builds a tree of ASN.1 objects, allocating for every field, then walks the
+ * tree twice to size and write it.  The encoder below computes every length arithmetically from
+ * the AuthorizationSets and writes the record in one pass into a buffer of exactly the right size.
+ * Its output is byte-for-byte what i2d_KM_KEY_DESCRIPTION produces for the same values.
+ */
+
+const uint8_t kAsn1Boolean = 0x01;
+const uint8_t kAsn1Integer = 0x02;
+const uint8_t kAsn1OctetString = 0x04;
+const uint8_t kAsn1Null = 0x05;
+const uint8_t kAsn1Enumerated = 0x0a;
+const uint8_t kAsn1Sequence = 0x30;
+const uint8_t kAsn1Set = 0x31;
+const uint8_t kAsn1Constructed = 0x20;
+const uint8_t kAsn1ContextSpecificConstructed = 0xa0;
+const uint8_t kAsn1HighTagNumber = 0x1f;
+
+// Identifier, length and nine content octets: the longest INTEGER a 64-bit value encodes to.
+const size_t kMaxIntegerEncodingSize = 11;
+
+// The fields of KM_AUTH_LIST, in template order.  Each is explicitly tagged with its masked tag.
+static const keymaster_tag_t kAuthListTags[] = {
+    KM_TAG_PURPOSE,
+    KM_TAG_ALGORITHM,
+    KM_TAG_KEY_SIZE,
+    KM_TAG_DIGEST,
+    KM_TAG_PADDING,
+    KM_TAG_KDF,
+    KM_TAG_EC_CURVE,
+    KM_TAG_RSA_PUBLIC_EXPONENT,
+    KM_TAG_ACTIVE_DATETIME,
+    KM_TAG_ORIGINATION_EXPIRE_DATETIME,
+    KM_TAG_USAGE_EXPIRE_DATETIME,
+    KM_TAG_NO_AUTH_REQUIRED,
+    KM_TAG_USER_AUTH_TYPE,
+    KM_TAG_AUTH_TIMEOUT,
+    KM_TAG_ALLOW_WHILE_ON_BODY,
+    KM_TAG_ALL_APPLICATIONS,
+    KM_TAG_APPLICATION_ID,
+    KM_TAG_CREATION_DATETIME,
+    KM_TAG_ORIGIN,
+    KM_TAG_ROLLBACK_RESISTANT,
+    KM_TAG_ROOT_OF_TRUST,
+    KM_TAG_OS_VERSION,
+    KM_TAG_OS_PATCHLEVEL,
+    KM_TAG_ATTESTATION_APPLICATION_ID,
+    KM_TAG_ATTESTATION_ID_BRAND,
+    KM_TAG_ATTESTATION_ID_DEVICE,
+    KM_TAG_ATTESTATION_ID_PRODUCT,
+    KM_TAG_ATTESTATION_ID_SERIAL,
+    KM_TAG_ATTESTATION_ID_IMEI,
+    KM_TAG_ATTESTATION_ID_MEID,
+    KM_TAG_ATTESTATION_ID_MANUFACTURER,
+    KM_TAG_ATTESTATION_ID_MODEL,
+};
+const size_t kAuthListFieldCount = sizeof(kAuthListTags) / sizeof(kAuthListTags[0]);
+
+static size_t der_length_size(size_t length) {
+    size_t size = 1;
+    if (length >= 0x80)
+        for (; length; length >>= 8)
+            ++size;
+    return size;
+}
+
+// Size of a DER element with a single-octet identifier and content_length octets of content.
+static size_t der_element_size(size_t content_length) {
+    return 1 + der_length_size(content_length) + content_length;
+}
+
+// Size of the identifier octets of an explicit context-specific tag for tag.
+static size_t explicit_tag_size(keymaster_tag_t tag) {
+    uint32_t number = keymaster_tag_mask_type(tag);
+    if (number < kAsn1HighTagNumber)
+        return 1;
+    size_t size = 1;
+    for (; number; number >>= 7)
+        ++size;
+    return size;
+}
+
+// Write the minimal DER encoding of an INTEGER or ENUMERATED to out and return its size.  value is
+// taken as unsigned, unless negative is set, in which case it holds the two's complement bits of a
+// negative number.
+static size_t encode_integer(uint8_t identifier, uint64_t value, bool negative, uint8_t* out) {
+    uint8_t content[9];
+    content[0] = negative ? 0xff : 0x00;
+    for (size_t i = 1; i < sizeof(content); ++i)
+        content[i] = static_cast<uint8_t>(value >> (8 * (sizeof(content) - 1 - i)));
+
+    // Drop leading octets that only repeat the sign bit.
+    size_t start = 0;
+    while (start < sizeof(content) - 1 &&
+           ((content[start] == 0x00 && !(content[start + 1] & 0x80)) ||
+            (content[start] == 0xff && (content[start + 1] & 0x80))))
+        ++start;
+
+    size_t length = sizeof(content) - start;
+    out[0] = identifier;
+    out[1] = static_cast<uint8_t>(length);
+    memcpy(out + 2, content + start, length);
+    return 2 + length;
+}
+
+// ASN1_INTEGER_set and ASN1_ENUMERATED_set take a long, so values headed for them go through one
+// here too.
+static size_t encode_long(uint8_t identifier, long value, uint8_t* out) {
+    return encode_integer(identifier, static_cast<uint64_t>(static_cast<int64_t>(value)), value < 0,
+                          out);
+}
+
+// Encode the value of an integer-typed param the way build_auth_list converts it.
+static size_t encode_integer_param(const keymaster_key_param_t& param, uint8_t* out) {
+    switch (keymaster_tag_get_type(param.tag)) {
+    case KM_ULONG:
+    case KM_ULONG_REP:
+        return encode_integer(kAsn1Integer, param.long_integer, false /* negative */, out);
+    case KM_DATE:
+        return encode_integer(kAsn1Integer, param.date_time, false /* negative */, out);
+    default:
+        return encode_long(kAsn1Integer, get_uint32_value(param), out);
+    }
+}
+
+// DER orders the elements of a SET OF by comparing their encodings as octet strings.
+static int compare_encodings(const uint8_t* a, size_t a_size, const uint8_t* b, size_t b_size) {
+    int cmp = memcmp(a, b, a_size < b_size ? a_size : b_size);
+    if (cmp != 0)
+        return cmp;
+    return static_cast<int>(a_size) - static_cast<int>(b_size);
+}
+
+// Writes DER into a buffer sized in advance.
+class DerWriter {
+  public:
+    DerWriter(uint8_t* buf, size_t size) : pos_(buf), end_(buf + size) {}
+
+    void WriteByte(uint8_t value) {
+        assert(pos_ < end_);
+        *pos_++ = value;
+    }
+
+    void Write(const uint8_t* data, size_t length) {
+        assert(length <= static_cast<size_t>(end_ - pos_));
+        if (length)
+            memcpy(pos_, data, length);
+        pos_ += length;
+    }
+
+    void WriteLength(size_t length) {
+        if (length < 0x80) {
+            WriteByte(static_cast<uint8_t>(length));
+            return;
+        }
+        size_t octets = der_length_size(length) - 1;
+        WriteByte(static_cast<uint8_t>(0x80 | octets));
+        for (size_t i = octets; i > 0; --i)
+            WriteByte(static_cast<uint8_t>(length >> (8 * (i - 1))));
+    }
+
+    void WriteHeader(uint8_t identifier, size_t length) {
+        WriteByte(identifier);
+        WriteLength(length);
+    }
+
+    void WriteExplicitTag(keymaster_tag_t tag, size_t length) {
+        uint32_t number = keymaster_tag_mask_type(tag);
+        if (number < kAsn1HighTagNumber) {
+            WriteByte(static_cast<uint8_t>(kAsn1ContextSpecificConstructed | number));
+        } else {
+            WriteByte(kAsn1ContextSpecificConstructed | kAsn1HighTagNumber);
+            for (size_t i = explicit_tag_size(tag) - 1; i > 0; --i) {
+                uint8_t septet = (number >> (7 * (i - 1))) & 0x7f;
+                WriteByte(i > 1 ? septet | 0x80 : septet);
+            }
+        }
+        WriteLength(length);
+    }
+
+    bool finished() const { return pos_ == end_; }
+
+  private:
+    uint8_t* pos_;
+    uint8_t* end_;
+};
+
+// Encodes one AuthorizationSet as a KM_AUTH_LIST.  Init() picks out each field's value and sizes
+// the encoding; Write() then emits exactly encoded_size() octets.
+class AuthListEncoder {
+  public:
+    explicit AuthListEncoder(const AuthorizationSet& auth_list)
+        : auth_list_(auth_list), content_size_(0) {}
+
+    keymaster_error_t Init();
+    size_t encoded_size() const { return der_element_size(content_size_); }
+    void Write(DerWriter* writer) const;
+
+  private:
+    static size_t FieldIndex(keymaster_tag_t tag);
+    void WriteSet(size_t field, DerWriter* writer) const;
+
+    const AuthorizationSet& auth_list_;
+    // For non-repeatable fields, the entry that supplies the value.  build_auth_list lets later
+    // entries overwrite earlier ones, so this is the last entry with the tag.
+    const keymaster_key_param_t* values_[kAuthListFieldCount];
+    // For repeatable fields, the total size of the encoded SET OF elements.
+    size_t set_content_sizes_[kAuthListFieldCount];
+    // Size of the content of each field's explicit tag, or zero if the field is absent.
+    size_t field_sizes_[kAuthListFieldCount];
+    keymaster_key_param_t inferred_ec_curve_;
+    size_t content_size_;
+};
+
+size_t AuthListEncoder::FieldIndex(keymaster_tag_t tag) {
+    for (size_t i = 0; i < kAuthListFieldCount; ++i)
+        if (kAuthListTags[i] == tag)
+            return i;
+    return kAuthListFieldCount;
+}
+
+keymaster_error_t AuthListEncoder::Init() {
+    for (size_t i = 0; i < kAuthListFieldCount; ++i) {
+        values_[i] = nullptr;
+        set_content_sizes_[i] = 0;
+        field_sizes_[i] = 0;
+    }
+
+    uint8_t encoding[kMaxIntegerEncodingSize];
+    for (const auto& entry : auth_list_) {
+        // build_auth_list never fills in the root of trust.
+        size_t field = FieldIndex(entry.tag);
+        if (field == kAuthListFieldCount || entry.tag == KM_TAG_ROOT_OF_TRUST)
+            continue;
+        if (keymaster_tag_repeatable(entry.tag))
+            set_content_sizes_[field] += encode_integer_param(entry, encoding);
+        else
+            values_[field] = &entry;
+    }
+
+    keymaster_ec_curve_t ec_curve;
+    uint32_t key_size;
+    if (auth_list_.Contains(TAG_ALGORITHM, KM_ALGORITHM_EC) &&  //
+        !auth_list_.Contains(TAG_EC_CURVE) &&                   //
+        auth_list_.GetTagValue(TAG_KEY_SIZE, &key_size)) {
+        // This must be a keymaster1 key. It's an EC key with no curve.  Insert the curve.
+        keymaster_error_t error = EcKeySizeToCurve(key_size, &ec_curve);
+        if (error != KM_ERROR_OK)
+            return error;
+        inferred_ec_curve_ = keymaster_param_enum(KM_TAG_EC_CURVE, ec_curve);
+        values_[FieldIndex(KM_TAG_EC_CURVE)] = &inferred_ec_curve_;
+    }
+
+    for (size_t i = 0; i < kAuthListFieldCount; ++i) {
+        keymaster_tag_t tag = kAuthListTags[i];
+        if (keymaster_tag_repeatable(tag)) {
+            if (set_content_sizes_[i])
+                field_sizes_[i] = der_element_size(set_content_sizes_[i]);
+        } else if (values_[i]) {
+            switch (keymaster_tag_get_type(tag)) {
+            case KM_BOOL:
+                field_sizes_[i] = der_element_size(0);
+                break;
+            case KM_BYTES:
+                field_sizes_[i] = der_element_size(values_[i]->blob.data_length);
+                break;
+            default:
+                field_sizes_[i] = encode_integer_param(*values_[i], encoding);
+                break;
+            }
+        }
+        if (field_sizes_[i])
+            content_size_ +=
+                explicit_tag_size(tag) + der_length_size(field_sizes_[i]) + field_sizes_[i];
+    }
+
+    return KM_ERROR_OK;
+}
+
+void AuthListEncoder::Write(DerWriter* writer) const {
+    writer->WriteHeader(kAsn1Sequence, content_size_);
+    for (size_t i = 0; i < kAuthListFieldCount; ++i) {
+        if (!field_sizes_[i])
+            continue;
+
+        keymaster_tag_t tag = kAuthListTags[i];
+        writer->WriteExplicitTag(tag, field_sizes_[i]);
+        if (keymaster_tag_repeatable(tag)) {
+            WriteSet(i, writer);
+            continue;
+        }
+
+        const keymaster_key_param_t& value = *values_[i];
+        switch (keymaster_tag_get_type(tag)) {
+        case KM_BOOL:
+            writer->WriteHeader(kAsn1Null, 0);
+            break;
+        case KM_BYTES:
+            writer->WriteHeader(kAsn1OctetString, value.blob.data_length);
+            writer->Write(value.blob.data, value.blob.data_length);
+            break;
+        default: {
+            uint8_t encoding[kMaxIntegerEncodingSize];
+            writer->Write(encoding, encode_integer_param(value, encoding));
+            break;
+        }
+        }
+    }
+}
+
+void AuthListEncoder::WriteSet(size_t field, DerWriter* writer) const {
+    keymaster_tag_t tag = kAuthListTags[field];
+    writer->WriteHeader(kAsn1Set, set_content_sizes_[field]);
+
+    // Sets hold a handful of values, so rather than sorting a copy, repeatedly select the smallest
+    // encoding greater than the last one written.  Duplicates are written together.
+    uint8_t last[kMaxIntegerEncodingSize];
+    size_t last_size = 0;
+    for (size_t written = 0; written < set_content_sizes_[field];) {
+        uint8_t next[kMaxIntegerEncodingSize];
+        size_t next_size = 0;
+        size_t count = 0;
+        for (const auto& entry : auth_list_) {
+            if (entry.tag != tag)
+                continue;
+            uint8_t encoding[kMaxIntegerEncodingSize];
+            size_t size = encode_integer_param(entry, encoding);
+            if (last_size && compare_encodings(encoding, size, last, last_size) <= 0)
+                continue;
+            int cmp = next_size ? compare_encodings(encoding, size, next, next_size) : -1;
+            if (cmp < 0) {
+                memcpy(next, encoding, size);
+                next_size = size;
+                count = 1;
+            } else if (cmp == 0) {
+                ++count;
+            }
+        }
+
+        assert(count);
+        if (!count)
+            break;
+        for (; count > 0; --count) {
+            writer->Write(next, next_size);
+            written += next_size;
+        }
+        memcpy(last, next, next_size);
+        last_size = next_size;
+    }
+}
+
+// Construct an ASN1.1 DER-encoded attestation record containing the values from sw_enforced and
+// tee_enforced.
+keymaster_error_t build_attestation_record(const AuthorizationSet& attestation_params,
+                                           AuthorizationSet sw_enforced,
+                                           AuthorizationSet tee_enforced,
+                                           const KeymasterContext& context,
+                                           UniquePtr<uint8_t[]>* asn1_key_desc,
+                                           size_t* asn1_key_desc_len) {
+    assert(asn1_key_desc && asn1_key_desc_len);
+
+    KeyDescriptionValues values;
+    keymaster_error_t error = prepare_attestation_record(attestation_params, &sw_enforced,
+                                                         &tee_enforced, context, &values);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    AuthListEncoder software_enforced(sw_enforced);
+    error = software_enforced.Init();
+    if (error != KM_ERROR_OK)
+        return error;
+
+    AuthListEncoder hardware_enforced(tee_enforced);
+    error = hardware_enforced.Init();
+    if (error != KM_ERROR_OK)
+        return error;
+
+    uint8_t attestation_version[kMaxIntegerEncodingSize];
+    uint8_t attestation_security_level[kMaxIntegerEncodingSize];
+    uint8_t keymaster_version[kMaxIntegerEncodingSize];
+    uint8_t keymaster_security_level[kMaxIntegerEncodingSize];
+    size_t attestation_version_size =
+        encode_long(kAsn1Integer, kCurrentAttestationVersion, attestation_version);
+    size_t attestation_security_level_size =
+        encode_long(kAsn1Enumerated, context.GetSecurityLevel(), attestation_security_level);
+    size_t keymaster_version_size =
+        encode_long(kAsn1Integer, values.keymaster_version, keymaster_version);
+    size_t keymaster_security_level_size =
+        encode_long(kAsn1Enumerated, values.keymaster_security_level, keymaster_security_level);
+
+    const keymaster_blob_t& challenge = values.attestation_challenge;
+    size_t content_size = attestation_version_size + attestation_security_level_size +
+                          keymaster_version_size + keymaster_security_level_size +
+                          der_element_size(challenge.data_length) +
+                          der_element_size(values.unique_id.available_read()) +
+                          software_enforced.encoded_size() + hardware_enforced.encoded_size();
+
+    *asn1_key_desc_len = der_element_size(content_size);
+    asn1_key_desc->reset(new(std::nothrow) uint8_t[*asn1_key_desc_len]);
+    if (!asn1_key_desc->get())
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+
+    DerWriter writer(asn1_key_desc->get(), *asn1_key_desc_len);
+    writer.WriteHeader(kAsn1Sequence, content_size);
+    writer.Write(attestation_version, attestation_version_size);
+    writer.Write(attestation_security_level, attestation_security_level_size);
+    writer.Write(keymaster_version, keymaster_version_size);
+    writer.Write(keymaster_security_level, keymaster_security_level_size);
+    writer.WriteHeader(kAsn1OctetString, challenge.data_length);
+    writer.Write(challenge.data, challenge.data_length);
+    writer.WriteHeader(kAsn1OctetString, values.unique_id.available_read());
+    writer.Write(values.unique_id.peek_read(), values.unique_id.available_read());
+    software_enforced.Write(&writer);
+    hardware_enforced.Write(&writer);
+    assert(writer.finished());
+
+    return KM_ERROR_OK;
+}
+
 // Copy all enumerated values with the specified tag from stack to auth_list.
 static bool get_repeated_enums(const stack_st_ASN1_INTEGER* stack, keymaster_tag_t tag,
                                AuthorizationSet* auth_list) {
@@ -820,4 +1266,322 @@ keymaster_error_t parse_attestation_record(const uint8_t* asn1_key_desc, size_t
     return extract_auth_list(record->tee_enforced, tee_enforced);
 }
 
+/*
+ * In-place parsing of the KeyDescription.
+ *
+ * parse_attestation_record decodes into a tree of ASN.1 objects and then copies every value into
+ * AuthorizationSets.  The reader below walks the DER directly.  It accepts what the templates
+ * accept, except for encodings that DER forbids: constructed strings, indefinite or over-long
+ * lengths and low tag numbers written in the multi-octet form.  It decodes integers the way
+ * ASN1_INTEGER_get and BN_get_word do, so both parsers agree on every value.
+ */
+
+// Reads DER elements from a buffer.
+class DerReader {
+  public:
+    DerReader() : pos_(nullptr), end_(nullptr) {}
+    DerReader(const uint8_t* data, size_t length) : pos_(data), end_(data + length) {}
+    explicit DerReader(const keymaster_blob_t& blob)
+        : pos_(blob.data), end_(blob.data + blob.data_length) {}
+
+    bool empty() const { return pos_ == end_; }
+    const uint8_t* position() const { return pos_; }
+
+    // Read the next element.  *identifier receives its first identifier octet and *tag_number its
+    // tag number, which may be in high tag number form.
+    bool ReadElement(uint8_t* identifier, uint32_t* tag_number, keymaster_blob_t* content) {
+        if (pos_ == end_)
+            return false;
+        *identifier = *pos_++;
+        *tag_number = *identifier & kAsn1HighTagNumber;
+        if (*tag_number == kAsn1HighTagNumber) {
+            *tag_number = 0;
+            uint8_t octet;
+            do {
+                // Masked tags fit easily in four septets.
+                if (pos_ == end_ || *tag_number >> 21)
+                    return false;
+                octet = *pos_++;
+                *tag_number = (*tag_number << 7) | (octet & 0x7f);
+            } while (octet & 0x80);
+            // Tag numbers below 31 must use the single octet form.
+            if (*tag_number < kAsn1HighTagNumber)
+                return false;
+        }
+
+        if (pos_ == end_)
+            return false;
+        size_t length = *pos_++;
+        if (length & 0x80) {
+            size_t octets = length & 0x7f;
+            if (octets == 0 || octets > sizeof(size_t) || octets > static_cast<size_t>(end_ - pos_))
+                return false;
+            // The long form must be minimal.
+            if (*pos_ == 0)
+                return false;
+            length = 0;
+            for (; octets > 0; --octets)
+                length = (length << 8) | *pos_++;
+            if (length < 0x80)
+                return false;
+        }
+        if (length > static_cast<size_t>(end_ - pos_))
+            return false;
+
+        content->data = pos_;
+        content->data_length = length;
+        pos_ += length;
+        return true;
+    }
+
+    // Read the next element, which must have the single-octet identifier expected.
+    bool ReadElement(uint8_t expected, keymaster_blob_t* content) {
+        uint8_t identifier;
+        uint32_t tag_number;
+        return ReadElement(&identifier, &tag_number, content) && identifier == expected &&
+               (expected & kAsn1HighTagNumber) != kAsn1HighTagNumber;
+    }
+
+  private:
+    const uint8_t* pos_;
+    const uint8_t* end_;
+};
+
+// Split the content octets of a DER INTEGER into sign and magnitude, the form OpenSSL keeps
+// integers in.  Returns false if the magnitude does not fit in 64 bits.
+static bool integer_magnitude(const keymaster_blob_t& content, bool* negative,
+                              uint64_t* magnitude) {
+    *negative = content.data[0] & 0x80;
+    *magnitude = 0;
+    unsigned carry = 1;
+    for (size_t i = 0; i < content.data_length; ++i) {
+        unsigned octet = content.data[content.data_length - 1 - i];
+        if (*negative) {
+            // Two's complement negation, from the least significant octet up.
+            octet = (~octet & 0xff) + carry;
+            carry = octet >> 8;
+            octet &= 0xff;
+        }
+        if (i < sizeof(*magnitude))
+            *magnitude |= static_cast<uint64_t>(octet) << (8 * i);
+        else if (octet)
+            return false;
+    }
+    return true;
+}
+
+// Read an INTEGER or ENUMERATED with the given identifier and return its value as
+// ASN1_INTEGER_get and ASN1_ENUMERATED_get would.
+static bool read_long(DerReader* reader, uint8_t identifier, long* value) {
+    keymaster_blob_t content;
+    if (!reader->ReadElement(identifier, &content) || content.data_length == 0)
+        return false;
+    // Reject the padding that DER forbids, as the OpenSSL decoder does.
+    if (content.data_length > 1 &&
+        ((content.data[0] == 0x00 && !(content.data[1] & 0x80)) ||
+         (content.data[0] == 0xff && (content.data[1] & 0x80))))
+        return false;
+
+    bool negative;
+    uint64_t magnitude;
+    if (!integer_magnitude(content, &negative, &magnitude) ||
+        (sizeof(long) < sizeof(magnitude) && magnitude >> (8 * sizeof(long)))) {
+        *value = -1;
+        return true;
+    }
+    *value = static_cast<long>(negative ? 0 - magnitude : magnitude);
+    return true;
+}
+
+// Read an INTEGER and return its value as get_ulong in parse_attestation_record would, which
+// drops the sign and saturates values wider than 64 bits.
+static bool read_ulong(DerReader* reader, uint64_t* value) {
+    keymaster_blob_t content;
+    if (!reader->ReadElement(kAsn1Integer, &content) || content.data_length == 0)
+        return false;
+    if (content.data_length > 1 &&
+        ((content.data[0] == 0x00 && !(content.data[1] & 0x80)) ||
+         (content.data[0] == 0xff && (content.data[1] & 0x80))))
+        return false;
+
+    bool negative;
+    if (!integer_magnitude(content, &negative, value))
+        *value = UINT64_MAX;
+    return true;
+}
+
+// Check that content holds a well-formed RootOfTrust.
+static bool check_root_of_trust(const keymaster_blob_t& content) {
+    DerReader reader(content);
+    keymaster_blob_t root_of_trust;
+    if (!reader.ReadElement(kAsn1Sequence, &root_of_trust) || !reader.empty())
+        return false;
+
+    DerReader fields(root_of_trust);
+    keymaster_blob_t verified_boot_key;
+    keymaster_blob_t device_locked;
+    long verified_boot_state;
+    return fields.ReadElement(kAsn1OctetString, &verified_boot_key) &&
+           fields.ReadElement(kAsn1Boolean, &device_locked) && device_locked.data_length == 1 &&
+           read_long(&fields, kAsn1Enumerated, &verified_boot_state) && fields.empty();
+}
+
+AuthListReader::AuthListReader(const keymaster_blob_t& auth_list)
+    : pos_(auth_list.data), end_(auth_list.data + auth_list.data_length), set_pos_(nullptr),
+      set_end_(nullptr), set_tag_(KM_TAG_INVALID), next_field_(0), error_(KM_ERROR_OK) {}
+
+bool AuthListReader::Fail() {
+    error_ = KM_ERROR_INVALID_ARGUMENT;
+    pos_ = end_;
+    set_pos_ = set_end_;
+    return false;
+}
+
+bool AuthListReader::Next(keymaster_key_param_t* param) {
+    for (;;) {
+        if (set_pos_ != set_end_) {
+            DerReader set(set_pos_, set_end_ - set_pos_);
+            long value;
+            if (!read_long(&set, kAsn1Integer, &value))
+                return Fail();
+            set_pos_ = set.position();
+            *param = keymaster_param_enum(set_tag_, value);
+            return true;
+        }
+
+        if (pos_ == end_)
+            return false;
+
+        DerReader fields(pos_, end_ - pos_);
+        uint8_t identifier;
+        uint32_t tag_number;
+        keymaster_blob_t explicit_content;
+        if (!fields.ReadElement(&identifier, &tag_number, &explicit_content) ||
+            (identifier & ~kAsn1HighTagNumber) != kAsn1ContextSpecificConstructed)
+            return Fail();
+        pos_ = fields.position();
+
+        // Fields appear at most once each, in template order.
+        size_t field = next_field_;
+        while (field < kAuthListFieldCount &&
+               keymaster_tag_mask_type(kAuthListTags[field]) != tag_number)
+            ++field;
+        if (field == kAuthListFieldCount)
+            return Fail();
+        next_field_ = field + 1;
+
+        keymaster_tag_t tag = kAuthListTags[field];
+        DerReader value(explicit_content);
+        keymaster_blob_t content;
+        switch (keymaster_tag_get_type(tag)) {
+        case KM_ENUM_REP:
+            // The template decoder does not check that a SET OF is constructed, so neither do we.
+            if (!value.ReadElement(&identifier, &tag_number, &content) ||
+                (identifier | kAsn1Constructed) != kAsn1Set || !value.empty())
+                return Fail();
+            set_pos_ = content.data;
+            set_end_ = content.data + content.data_length;
+            set_tag_ = tag;
+            continue;
+
+        case KM_ENUM:
+        case KM_UINT: {
+            long integer;
+            if (!read_long(&value, kAsn1Integer, &integer) || !value.empty())
+                return Fail();
+            *param = keymaster_param_int(tag, integer);
+            return true;
+        }
+
+        case KM_ULONG:
+        case KM_DATE: {
+            uint64_t ulong;
+            if (!read_ulong(&value, &ulong) || !value.empty())
+                return Fail();
+            *param = keymaster_tag_get_type(tag) == KM_DATE ? keymaster_param_date(tag, ulong)
+                                                             : keymaster_param_long(tag, ulong);
+            return true;
+        }
+
+        case KM_BOOL:
+            if (!value.ReadElement(kAsn1Null, &content) || content.data_length != 0 ||
+                !value.empty())
+                return Fail();
+            *param = keymaster_param_bool(tag);
+            return true;
+
+        case KM_BYTES:
+            if (tag == KM_TAG_ROOT_OF_TRUST) {
+                // Checked, but not mapped to an entry, as in extract_auth_list.
+                if (!check_root_of_trust(explicit_content))
+                    return Fail();
+                continue;
+            }
+            if (!value.ReadElement(kAsn1OctetString, &content) || !value.empty())
+                return Fail();
+            *param = keymaster_param_blob(tag, content.data, content.data_length);
+            return true;
+
+        default:
+            assert(false);
+            return Fail();
+        }
+    }
+}
+
+keymaster_error_t copy_auth_list(const keymaster_blob_t& auth_list, AuthorizationSet* auth_set) {
+    AuthListReader reader(auth_list);
+    keymaster_key_param_t param;
+    while (reader.Next(&param))
+        if (!auth_set->push_back(param))
+            return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    return reader.error();
+}
+
+// Check that auth_list is a well-formed AuthorizationList.
+static keymaster_error_t check_auth_list(const keymaster_blob_t& auth_list) {
+    AuthListReader reader(auth_list);
+    keymaster_key_param_t param;
+    while (reader.Next(&param))
+        continue;
+    return reader.error();
+}
+
+keymaster_error_t parse_attestation_record(const uint8_t* asn1_key_desc, size_t asn1_key_desc_len,
+                                           AttestationRecordView* record) {
+    // Like d2i, ignore anything after the KeyDescription.
+    DerReader reader(asn1_key_desc, asn1_key_desc_len);
+    keymaster_blob_t key_desc;
+    if (!reader.ReadElement(kAsn1Sequence, &key_desc))
+        return KM_ERROR_INVALID_ARGUMENT;
+
+    DerReader fields(key_desc);
+    long attestation_version;
+    long attestation_security_level;
+    long keymaster_version;
+    long keymaster_security_level;
+    if (!read_long(&fields, kAsn1Integer, &attestation_version) ||
+        !read_long(&fields, kAsn1Enumerated, &attestation_security_level) ||
+        !read_long(&fields, kAsn1Integer, &keymaster_version) ||
+        !read_long(&fields, kAsn1Enumerated, &keymaster_security_level) ||
+        !fields.ReadElement(kAsn1OctetString, &record->attestation_challenge) ||
+        !fields.ReadElement(kAsn1OctetString, &record->unique_id) ||
+        !fields.ReadElement(kAsn1Sequence, &record->software_enforced) ||
+        !fields.ReadElement(kAsn1Sequence, &record->tee_enforced) || !fields.empty())
+        return KM_ERROR_INVALID_ARGUMENT;
+
+    record->attestation_version = attestation_version;
+    record->attestation_security_level =
+        static_cast<keymaster_security_level_t>(attestation_security_level);
+    record->keymaster_version = keymaster_version;
+    record->keymaster_security_level =
+        static_cast<keymaster_security_level_t>(keymaster_security_level);
+
+    // Validate both lists now, so that reading them later cannot fail.
+    keymaster_error_t error = check_auth_list(record->software_enforced);
+    if (error != KM_ERROR_OK)
+        return error;
+    return check_auth_list(record->tee_enforced);
+}
+
 }  // namespace keymaster
@@ -48,6 +48,17 @@ keymaster_error_t build_attestation_record(const AuthorizationSet& attestation_p
                                            UniquePtr<uint8_t[]>* asn1_key_desc,
                                            size_t* asn1_key_desc_len);
 
+/**
+ * Builds the same record as build_attestation_record, but through the OpenSSL ASN.1 templates
+ * rather than the direct DER writer.  Kept as the reference encoding for tests and benchmarks.
+ */
+keymaster_error_t build_attestation_record_asn1(const AuthorizationSet& attestation_params,
+                                                AuthorizationSet software_enforced,
+                                                AuthorizationSet tee_enforced,
+                                                const KeymasterContext& context,
+                                                UniquePtr<uint8_t[]>* asn1_key_desc,
+                                                size_t* asn1_key_desc_len);
+
 keymaster_error_t parse_attestation_record(const uint8_t* asn1_key_desc, size_t asn1_key_desc_len,
                                            uint32_t* attestation_version,  //
                                            keymaster_security_level_t* attestation_security_level,
@@ -57,6 +68,68 @@ keymaster_error_t parse_attestation_record(const uint8_t* asn1_key_desc, size_t
                                            AuthorizationSet* software_enforced,
                                            AuthorizationSet* tee_enforced,
                                            keymaster_blob_t* unique_id);
+
+/**
+ * A parsed attestation record that borrows from the DER it was parsed from.  The blobs point into
+ * that buffer and are valid only as long as it is.
+ */
+struct AttestationRecordView {
+    uint32_t attestation_version;
+    keymaster_security_level_t attestation_security_level;
+    uint32_t keymaster_version;
+    keymaster_security_level_t keymaster_security_level;
+    keymaster_blob_t attestation_challenge;
+    keymaster_blob_t unique_id;
+    // Contents of the AuthorizationList sequences.  Read them with AuthListReader or
+    // copy_auth_list.
+    keymaster_blob_t software_enforced;
+    keymaster_blob_t tee_enforced;
+};
+
+/**
+ * Parse the DER-encoded attestation record in place, without allocating.  Accepts the records the
+ * parse_attestation_record above accepts, apart from BER forms that DER forbids, such as
+ * constructed strings and indefinite or over-long lengths.  Both authorization lists are checked
+ * here, so reading them afterwards cannot fail.
+ */
+keymaster_error_t parse_attestation_record(const uint8_t* asn1_key_desc, size_t asn1_key_desc_len,
+                                           AttestationRecordView* record);
+
+/**
+ * Iterates over the entries of an authorization list from an AttestationRecordView, in the order
+ * parse_attestation_record adds them to an AuthorizationSet.  KM_BYTES entries point into the
+ * parsed buffer.  Unlike parse_attestation_record, the reader also returns KM_TAG_KDF,
+ * KM_TAG_ALLOW_WHILE_ON_BODY and KM_TAG_ATTESTATION_APPLICATION_ID entries.
+ */
+class AuthListReader {
+  public:
+    explicit AuthListReader(const keymaster_blob_t& auth_list);
+
+    /**
+     * Fetch the next entry into \p param.  Returns false at the end of the list, or if the list
+     * is malformed, in which case error() reports it.
+     */
+    bool Next(keymaster_key_param_t* param);
+    keymaster_error_t error() const { return error_; }
+
+  private:
+    bool Fail();
+
+    const uint8_t* pos_;
+    const uint8_t* end_;
+    // Remaining elements of the SET OF INTEGER being read, if any.
+    const uint8_t* set_pos_;
+    const uint8_t* set_end_;
+    keymaster_tag_t set_tag_;
+    size_t next_field_;
+    keymaster_error_t error_;
+};
+
+/**
+ * Append the entries of \p auth_list, from an AttestationRecordView, to \p auth_set.
+ */
+keymaster_error_t copy_auth_list(const keymaster_blob_t& auth_list, AuthorizationSet* auth_set);
+
 }  // namespace keymaster
 
 #endif  // SYSTEM_KEYMASTER_ATTESTATION_RECORD_H_
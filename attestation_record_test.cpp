@@ -146,5 +146,278 @@ TEST(AttestTest, Simple) {
     EXPECT_EQ(sw_set, parsed_sw_set);
 }
 
+static void ExpectSameEncoding(const AuthorizationSet& attest_params,
+                               const AuthorizationSet& sw_set, const AuthorizationSet& hw_set) {
+    UniquePtr<uint8_t[]> direct;
+    size_t direct_len;
+    ASSERT_EQ(KM_ERROR_OK, build_attestation_record(attest_params, sw_set, hw_set, TestContext(),
+                                                    &direct, &direct_len));
+    UniquePtr<uint8_t[]> reference;
+    size_t reference_len;
+    ASSERT_EQ(KM_ERROR_OK,
+              build_attestation_record_asn1(attest_params, sw_set, hw_set, TestContext(),
+                                            &reference, &reference_len));
+    ASSERT_EQ(reference_len, direct_len);
+    EXPECT_EQ(0, memcmp(reference.get(), direct.get(), direct_len));
+}
+
+TEST(AttestTest, DirectEncodingMatchesTemplates) {
+    uint8_t long_value[300];
+    for (size_t i = 0; i < sizeof(long_value); ++i)
+        long_value[i] = static_cast<uint8_t>(i);
+
+    AuthorizationSet attest_params(
+        AuthorizationSetBuilder()
+            .Authorization(TAG_ATTESTATION_CHALLENGE, long_value, 200)
+            .Authorization(TAG_ATTESTATION_APPLICATION_ID, long_value, sizeof(long_value)));
+
+    // Empty lists.
+    ExpectSameEncoding(attest_params, AuthorizationSet(), AuthorizationSet());
+
+    // Unsorted and duplicated SET OF members, 64-bit values with the high bit set, zeros, booleans,
+    // repeated non-repeatable tags and unique ID generation.
+    AuthorizationSet hw_set(AuthorizationSetBuilder()
+                                .RsaSigningKey(2048, 0x8000000000000001ULL)
+                                .Authorization(TAG_PURPOSE, KM_PURPOSE_VERIFY)
+                                .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                                .Digest(KM_DIGEST_SHA_2_512)
+                                .Digest(KM_DIGEST_NONE)
+                                .Digest(KM_DIGEST_SHA_2_256)
+                                .Digest(KM_DIGEST_SHA_2_256)
+                                .Padding(KM_PAD_RSA_PSS)
+                                .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN)
+                                .Authorization(TAG_KEY_SIZE, 4096)
+                                .Authorization(TAG_USER_AUTH_TYPE, HW_AUTH_FINGERPRINT)
+                                .Authorization(TAG_AUTH_TIMEOUT, 0xFFFFFFFF)
+                                .Authorization(TAG_NO_AUTH_REQUIRED)
+                                .Authorization(TAG_ROLLBACK_RESISTANT)
+                                .Authorization(TAG_ORIGIN, KM_ORIGIN_GENERATED)
+                                .Authorization(TAG_OS_VERSION, 0)
+                                .Authorization(TAG_OS_PATCHLEVEL, 201712)
+                                .Authorization(TAG_INCLUDE_UNIQUE_ID)
+                                .Authorization(TAG_ATTESTATION_ID_BRAND, "brand", 5)
+                                .Authorization(TAG_ATTESTATION_ID_MODEL, long_value, 130));
+    AuthorizationSet sw_set(AuthorizationSetBuilder()
+                                .Authorization(TAG_ACTIVE_DATETIME, 0)
+                                .Authorization(TAG_ORIGINATION_EXPIRE_DATETIME, 0x7F)
+                                .Authorization(TAG_USAGE_EXPIRE_DATETIME, UINT64_MAX)
+                                .Authorization(TAG_CREATION_DATETIME, 1500000000000ULL)
+                                .Authorization(TAG_ALL_APPLICATIONS)
+                                .Authorization(TAG_ALLOW_WHILE_ON_BODY)
+                                .Authorization(TAG_APPLICATION_ID, "", 0)
+                                .Authorization(TAG_APPLICATION_ID, "app", 3)
+                                .Authorization(TAG_BLOCK_MODE, KM_MODE_ECB)
+                                .Authorization(TAG_APPLICATION_DATA, "ignored", 7));
+    ExpectSameEncoding(attest_params, sw_set, hw_set);
+    ExpectSameEncoding(attest_params, hw_set, sw_set);
+
+    // A keymaster1 EC key, which has no curve, and a set of KDFs.
+    AuthorizationSet km1_set(AuthorizationSetBuilder()
+                                 .EcdsaSigningKey(384)
+                                 .Digest(KM_DIGEST_SHA_2_384)
+                                 .Authorization(TAG_KDF, KM_KDF_RFC5869_SHA256)
+                                 .Authorization(TAG_KDF, KM_KDF_NONE));
+    ExpectSameEncoding(attest_params, AuthorizationSet(), km1_set);
+}
+
+TEST(AttestTest, DirectEncodingParses) {
+    AuthorizationSet hw_set(AuthorizationSetBuilder()
+                                .EcdsaSigningKey(256)
+                                .Authorization(TAG_EC_CURVE, KM_EC_CURVE_P_256)
+                                .Digest(KM_DIGEST_SHA_2_512)
+                                .Digest(KM_DIGEST_SHA_2_256)
+                                .Authorization(TAG_USAGE_EXPIRE_DATETIME, UINT64_MAX)
+                                .Authorization(TAG_OS_VERSION, 60000)
+                                .Authorization(TAG_APPLICATION_ID, "bar", 3));
+    AuthorizationSet sw_set(AuthorizationSetBuilder()
+                                .Authorization(TAG_ACTIVE_DATETIME, 10)
+                                .Authorization(TAG_ALL_APPLICATIONS));
+    AuthorizationSet attest_params(
+        AuthorizationSetBuilder()
+            .Authorization(TAG_ATTESTATION_CHALLENGE, "hello", 5)
+            .Authorization(TAG_ATTESTATION_APPLICATION_ID, "hello again", 11));
+
+    UniquePtr<uint8_t[]> asn1;
+    size_t asn1_len;
+    ASSERT_EQ(KM_ERROR_OK, build_attestation_record(attest_params, sw_set, hw_set, TestContext(),
+                                                    &asn1, &asn1_len));
+
+    AuthorizationSet parsed_hw_set;
+    AuthorizationSet parsed_sw_set;
+    uint32_t attestation_version;
+    uint32_t keymaster_version;
+    keymaster_security_level_t attestation_security_level;
+    keymaster_security_level_t keymaster_security_level;
+    keymaster_blob_t attestation_challenge = {};
+    keymaster_blob_t unique_id = {};
+    ASSERT_EQ(KM_ERROR_OK,
+              parse_attestation_record(asn1.get(), asn1_len, &attestation_version,
+                                       &attestation_security_level, &keymaster_version,
+                                       &keymaster_security_level, &attestation_challenge,
+                                       &parsed_sw_set, &parsed_hw_set, &unique_id));
+    EXPECT_EQ(2U, attestation_version);
+    EXPECT_EQ(KM_SECURITY_LEVEL_SOFTWARE, attestation_security_level);
+    EXPECT_EQ(1U, keymaster_version);
+    EXPECT_EQ(KM_SECURITY_LEVEL_TRUSTED_ENVIRONMENT, keymaster_security_level);
+    EXPECT_EQ(5U, attestation_challenge.data_length);
+    EXPECT_EQ(0, memcmp("hello", attestation_challenge.data, 5));
+    EXPECT_EQ(0U, unique_id.data_length);
+
+    delete[] attestation_challenge.data;
+    delete[] unique_id.data;
+
+    hw_set.Sort();
+    sw_set.Sort();
+    parsed_hw_set.Sort();
+    parsed_sw_set.Sort();
+    EXPECT_EQ(hw_set, parsed_hw_set);
+    EXPECT_EQ(sw_set, parsed_sw_set);
+}
+
+// Parse asn1 with both parsers and check that they agree.
+static void ExpectSameParse(const uint8_t* asn1, size_t asn1_len) {
+    AuthorizationSet sw_set;
+    AuthorizationSet hw_set;
+    uint32_t attestation_version;
+    uint32_t keymaster_version;
+    keymaster_security_level_t attestation_security_level;
+    keymaster_security_level_t keymaster_security_level;
+    keymaster_blob_t attestation_challenge = {};
+    keymaster_blob_t unique_id = {};
+    keymaster_error_t error = parse_attestation_record(
+        asn1, asn1_len, &attestation_version, &attestation_security_level, &keymaster_version,
+        &keymaster_security_level, &attestation_challenge, &sw_set, &hw_set, &unique_id);
+    UniquePtr<const uint8_t[]> challenge_deleter(attestation_challenge.data);
+    UniquePtr<const uint8_t[]> unique_id_deleter(unique_id.data);
+
+    AttestationRecordView record;
+    if (error != KM_ERROR_OK) {
+        EXPECT_NE(KM_ERROR_OK, parse_attestation_record(asn1, asn1_len, &record));
+        return;
+    }
+    ASSERT_EQ(KM_ERROR_OK, parse_attestation_record(asn1, asn1_len, &record));
+
+    EXPECT_EQ(attestation_version, record.attestation_version);
+    EXPECT_EQ(attestation_security_level, record.attestation_security_level);
+    EXPECT_EQ(keymaster_version, record.keymaster_version);
+    EXPECT_EQ(keymaster_security_level, record.keymaster_security_level);
+    ASSERT_EQ(attestation_challenge.data_length, record.attestation_challenge.data_length);
+    EXPECT_EQ(0, memcmp(attestation_challenge.data, record.attestation_challenge.data,
+                        attestation_challenge.data_length));
+    ASSERT_EQ(unique_id.data_length, record.unique_id.data_length);
+    EXPECT_EQ(0, memcmp(unique_id.data, record.unique_id.data, unique_id.data_length));
+
+    AuthorizationSet view_sw_set;
+    AuthorizationSet view_hw_set;
+    ASSERT_EQ(KM_ERROR_OK, copy_auth_list(record.software_enforced, &view_sw_set));
+    ASSERT_EQ(KM_ERROR_OK, copy_auth_list(record.tee_enforced, &view_hw_set));
+
+    // The copying parser drops these.
+    for (AuthorizationSet* set : {&view_sw_set, &view_hw_set}) {
+        for (keymaster_tag_t tag :
+             {KM_TAG_KDF, KM_TAG_ALLOW_WHILE_ON_BODY, KM_TAG_ATTESTATION_APPLICATION_ID}) {
+            int pos;
+            while ((pos = set->find(tag)) != -1)
+                set->erase(pos);
+        }
+    }
+
+    sw_set.Sort();
+    hw_set.Sort();
+    view_sw_set.Sort();
+    view_hw_set.Sort();
+    EXPECT_EQ(sw_set, view_sw_set);
+    EXPECT_EQ(hw_set, view_hw_set);
+}
+
+TEST(AttestTest, InPlaceParseMatchesCopyingParse) {
+    uint8_t long_value[300];
+    for (size_t i = 0; i < sizeof(long_value); ++i)
+        long_value[i] = static_cast<uint8_t>(i);
+
+    AuthorizationSet attest_params(
+        AuthorizationSetBuilder()
+            .Authorization(TAG_ATTESTATION_CHALLENGE, long_value, 200)
+            .Authorization(TAG_ATTESTATION_APPLICATION_ID, long_value, sizeof(long_value)));
+    AuthorizationSet hw_set(AuthorizationSetBuilder()
+                                .RsaSigningKey(2048, 0x8000000000000001ULL)
+                                .Digest(KM_DIGEST_SHA_2_512)
+                                .Digest(KM_DIGEST_NONE)
+                                .Padding(KM_PAD_RSA_PSS)
+                                .Authorization(TAG_USER_AUTH_TYPE, HW_AUTH_FINGERPRINT)
+                                .Authorization(TAG_AUTH_TIMEOUT, 0xFFFFFFFF)
+                                .Authorization(TAG_NO_AUTH_REQUIRED)
+                                .Authorization(TAG_ROLLBACK_RESISTANT)
+                                .Authorization(TAG_ORIGIN, KM_ORIGIN_GENERATED)
+                                .Authorization(TAG_OS_VERSION, 0)
+                                .Authorization(TAG_OS_PATCHLEVEL, 201712)
+                                .Authorization(TAG_INCLUDE_UNIQUE_ID)
+                                .Authorization(TAG_KDF, KM_KDF_RFC5869_SHA256));
+    AuthorizationSet sw_set(AuthorizationSetBuilder()
+                                .Authorization(TAG_ACTIVE_DATETIME, 0)
+                                .Authorization(TAG_USAGE_EXPIRE_DATETIME, UINT64_MAX)
+                                .Authorization(TAG_CREATION_DATETIME, 1500000000000ULL)
+                                .Authorization(TAG_ALL_APPLICATIONS)
+                                .Authorization(TAG_APPLICATION_ID, "app", 3));
+
+    UniquePtr<uint8_t[]> asn1;
+    size_t asn1_len;
+    ASSERT_EQ(KM_ERROR_OK, build_attestation_record(attest_params, sw_set, hw_set, TestContext(),
+                                                    &asn1, &asn1_len));
+
+    // Every prefix, including the whole record, and every single-byte corruption.
+    for (size_t len = 0; len <= asn1_len; ++len)
+        ExpectSameParse(asn1.get(), len);
+    for (size_t i = 0; i < asn1_len; ++i) {
+        for (uint8_t flip : {0x01, 0x80, 0xFF}) {
+            asn1[i] ^= flip;
+            ExpectSameParse(asn1.get(), asn1_len);
+            asn1[i] ^= flip;
+        }
+    }
+}
+
+TEST(AttestTest, InPlaceParseBorrows) {
+    AuthorizationSet hw_set(AuthorizationSetBuilder()
+                                .EcdsaSigningKey(256)
+                                .Authorization(TAG_APPLICATION_ID, "bar", 3)
+                                .Authorization(TAG_INCLUDE_UNIQUE_ID));
+    AuthorizationSet attest_params(
+        AuthorizationSetBuilder()
+            .Authorization(TAG_ATTESTATION_CHALLENGE, "hello", 5)
+            .Authorization(TAG_ATTESTATION_APPLICATION_ID, "hello again", 11));
+
+    AuthorizationSet sw_set(AuthorizationSetBuilder().Authorization(TAG_CREATION_DATETIME, 10));
+
+    UniquePtr<uint8_t[]> asn1;
+    size_t asn1_len;
+    ASSERT_EQ(KM_ERROR_OK, build_attestation_record(attest_params, sw_set, hw_set, TestContext(),
+                                                    &asn1, &asn1_len));
+
+    AttestationRecordView record;
+    ASSERT_EQ(KM_ERROR_OK, parse_attestation_record(asn1.get(), asn1_len, &record));
+    const uint8_t* begin = asn1.get();
+    const uint8_t* end = asn1.get() + asn1_len;
+    EXPECT_TRUE(record.attestation_challenge.data > begin &&
+                record.attestation_challenge.data + 5 <= end);
+    EXPECT_EQ(0, memcmp("hello", record.attestation_challenge.data, 5));
+    EXPECT_TRUE(record.unique_id.data > begin && record.unique_id.data + 3 <= end);
+    EXPECT_EQ(0, memcmp("foo", record.unique_id.data, 3));
+
+    // The attestation application ID is added to the software-enforced list.
+    AuthListReader reader(record.software_enforced);
+    keymaster_key_param_t param;
+    ASSERT_TRUE(reader.Next(&param));
+    EXPECT_EQ(KM_TAG_CREATION_DATETIME, param.tag);
+    EXPECT_EQ(10U, param.date_time);
+    ASSERT_TRUE(reader.Next(&param));
+    EXPECT_EQ(KM_TAG_ATTESTATION_APPLICATION_ID, param.tag);
+    ASSERT_EQ(11U, param.blob.data_length);
+    EXPECT_TRUE(param.blob.data > begin && param.blob.data + 11 <= end);
+    EXPECT_EQ(0, memcmp("hello again", param.blob.data, 11));
+    EXPECT_FALSE(reader.Next(&param));
+    EXPECT_EQ(KM_ERROR_OK, reader.error());
+}
+
 }  // namespace test
 }  // namespace keymaster
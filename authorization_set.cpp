@@ -25,6 +25,7 @@
 
 #include <keymaster/android_keymaster_utils.h>
 #include <keymaster/logger.h>
+#include <keymaster/request_arena.h>
 
 namespace keymaster {
 
@@ -34,7 +35,21 @@ static inline bool is_blob_tag(keymaster_tag_t tag) {
 
 const size_t STARTING_ELEMS_CAPACITY = 8;
 
-AuthorizationSet::AuthorizationSet(AuthorizationSetBuilder& builder) {
+template <typename T> static T* allocate_array(RequestArena* arena, size_t count) {
+    if (!arena)
+        return new (std::nothrow) T[count];
+    if (count > SIZE_MAX / sizeof(T))
+        return NULL;
+    return reinterpret_cast<T*>(arena->Allocate(count * sizeof(T)));
+}
+
+// Arena storage is wiped and released with the arena, not piecemeal.
+template <typename T> static void free_array(RequestArena* arena, T* array) {
+    if (!arena)
+        delete[] array;
+}
+
+AuthorizationSet::AuthorizationSet(AuthorizationSetBuilder& builder) : arena_(nullptr) {
     elems_ = builder.set.elems_;
     builder.set.elems_ = NULL;
 
@@ -66,13 +81,13 @@ bool AuthorizationSet::reserve_elems(size_t count) {
         return false;
 
     if (count > elems_capacity_) {
-        keymaster_key_param_t* new_elems = new (std::nothrow) keymaster_key_param_t[count];
+        keymaster_key_param_t* new_elems = allocate_array<keymaster_key_param_t>(arena_, count);
         if (new_elems == NULL) {
             set_invalid(ALLOCATION_FAILURE);
             return false;
         }
         memcpy(new_elems, elems_, sizeof(*elems_) * elems_size_);
-        delete[] elems_;
+        free_array(arena_, elems_);
         elems_ = new_elems;
         elems_capacity_ = count;
     }
@@ -84,7 +99,7 @@ bool AuthorizationSet::reserve_indirect(size_t length) {
         return false;
 
     if (length > indirect_data_capacity_) {
-        uint8_t* new_data = new (std::nothrow) uint8_t[length];
+        uint8_t* new_data = allocate_array<uint8_t>(arena_, length);
         if (new_data == NULL) {
             set_invalid(ALLOCATION_FAILURE);
             return false;
@@ -96,7 +111,7 @@ bool AuthorizationSet::reserve_indirect(size_t length) {
             if (is_blob_tag(elems_[i].tag))
                 elems_[i].blob.data = new_data + (elems_[i].blob.data - indirect_data_);
         }
-        delete[] indirect_data_;
+        free_array(arena_, indirect_data_);
         indirect_data_ = new_data;
         indirect_data_capacity_ = length;
     }
@@ -104,6 +119,17 @@ bool AuthorizationSet::reserve_indirect(size_t length) {
 }
 
 void AuthorizationSet::MoveFrom(AuthorizationSet& set) {
+    if (set.arena_) {
+        // The source's storage dies with its arena, which this set may outlive, so copy it.
+        Error error = set.error_;
+        Reinitialize(set.elems_, set.elems_size_);
+        if (error != OK)
+            error_ = error;
+        set.FreeData();
+        return;
+    }
+
+    arena_ = nullptr;
     elems_ = set.elems_;
     elems_size_ = set.elems_size_;
     elems_capacity_ = set.elems_capacity_;
@@ -436,13 +462,22 @@ uint8_t* AuthorizationSet::Serialize(uint8_t* buf, const uint8_t* end) const {
 }
 
 bool AuthorizationSet::DeserializeIndirectData(const uint8_t** buf_ptr, const uint8_t* end) {
-    UniquePtr<uint8_t[]> indirect_buf;
-    if (!copy_size_and_data_from_buf(buf_ptr, end, &indirect_data_size_, &indirect_buf)) {
+    // Check the length against the input before reserving, so a corrupt length can't cause a huge
+    // allocation.
+    uint32_t length;
+    if (!copy_uint32_from_buf(buf_ptr, end, &length) ||
+        static_cast<size_t>(end - *buf_ptr) < length) {
         LOG_E("Malformed data found in AuthorizationSet deserialization", 0);
         set_invalid(MALFORMED_DATA);
         return false;
     }
-    indirect_data_ = indirect_buf.release();
+
+    if (!reserve_indirect(length))
+        return false;
+    if (length > 0)
+        memcpy(indirect_data_, *buf_ptr, length);
+    *buf_ptr += length;
+    indirect_data_size_ = length;
     return true;
 }
 
@@ -506,8 +541,8 @@ void AuthorizationSet::Clear() {
 void AuthorizationSet::FreeData() {
     Clear();
 
-    delete[] elems_;
-    delete[] indirect_data_;
+    free_array(arena_, elems_);
+    free_array(arena_, indirect_data_);
 
     elems_ = NULL;
     indirect_data_ = NULL;
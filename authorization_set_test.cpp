@@ -14,10 +14,13 @@
  * limitations under the License.
  */
 
+#include <utility>
+
 #include <gtest/gtest.h>
 
 #include <keymaster/authorization_set.h>
 #include <keymaster/android_keymaster_utils.h>
+#include <keymaster/request_arena.h>
 
 #include "android_keymaster_test_utils.h"
 
@@ -416,6 +419,93 @@ TEST(Growable, PushBackSets) {
     EXPECT_EQ(12U, combined.indirect_size());
 }
 
+TEST(Arena, AllocatesAlignedThenSpills) {
+    uint8_t buffer[64];
+    RequestArena arena(buffer, sizeof(buffer));
+
+    uint8_t* first = reinterpret_cast<uint8_t*>(arena.Allocate(3));
+    uint8_t* second = reinterpret_cast<uint8_t*>(arena.Allocate(8));
+    ASSERT_TRUE(first != NULL);
+    ASSERT_TRUE(second != NULL);
+    EXPECT_TRUE(first >= buffer && first < buffer + sizeof(buffer));
+    EXPECT_TRUE(second >= buffer && second < buffer + sizeof(buffer));
+    EXPECT_EQ(0U, reinterpret_cast<uintptr_t>(second) % 8);
+    EXPECT_EQ(0U, arena.heap_blocks());
+
+    // Too big for what is left of the buffer, and for a standard block.
+    uint8_t* large = reinterpret_cast<uint8_t*>(arena.Allocate(RequestArena::kBlockSize * 2));
+    ASSERT_TRUE(large != NULL);
+    EXPECT_TRUE(large < buffer || large >= buffer + sizeof(buffer));
+    EXPECT_EQ(1U, arena.heap_blocks());
+    EXPECT_EQ(11U + RequestArena::kBlockSize * 2, arena.bytes_allocated());
+}
+
+TEST(Arena, WipesUsedPartOfBuffer) {
+    uint8_t buffer[64];
+    memset(buffer, 0xaa, sizeof(buffer));
+    {
+        RequestArena arena(buffer, sizeof(buffer));
+        memset(arena.Allocate(10), 1, 10);
+    }
+    for (size_t i = 0; i < sizeof(buffer); ++i)
+        EXPECT_EQ(i < 10 ? 0 : 0xaa, buffer[i]) << i;
+
+    // Once the arena has spilled, the buffer is wiped up to where it was abandoned.
+    memset(buffer, 0xaa, sizeof(buffer));
+    {
+        RequestArena arena(buffer, sizeof(buffer));
+        memset(arena.Allocate(40), 1, 40);
+        memset(arena.Allocate(100), 1, 100);
+        EXPECT_EQ(1U, arena.heap_blocks());
+    }
+    for (size_t i = 0; i < sizeof(buffer); ++i)
+        EXPECT_EQ(i < 40 ? 0 : 0xaa, buffer[i]) << i;
+}
+
+TEST(Arena, BackedSetRoundTrip) {
+    AuthorizationSet set(AuthorizationSetBuilder()
+                             .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                             .Authorization(TAG_ALGORITHM, KM_ALGORITHM_RSA)
+                             .Authorization(TAG_APPLICATION_ID, "my_app", 6)
+                             .Authorization(TAG_KEY_SIZE, 256));
+    size_t size = set.SerializedSize();
+    UniquePtr<uint8_t[]> serialized(new uint8_t[size]);
+    set.Serialize(serialized.get(), serialized.get() + size);
+
+    uint8_t buffer[512];
+    RequestArena arena(buffer, sizeof(buffer));
+    AuthorizationSet deserialized(&arena);
+    const uint8_t* p = serialized.get();
+    EXPECT_TRUE(deserialized.Deserialize(&p, p + size));
+    EXPECT_EQ(set, deserialized);
+
+    // Growing the set keeps it in the arena.
+    EXPECT_TRUE(deserialized.push_back(TAG_APPLICATION_DATA, "some data", 9));
+    EXPECT_TRUE(deserialized.push_back(TAG_USER_ID, 7));
+    EXPECT_EQ(6U, deserialized.size());
+    EXPECT_EQ(15U, deserialized.indirect_size());
+    EXPECT_EQ(0U, arena.heap_blocks());
+}
+
+TEST(Arena, CopiesOutliveArena) {
+    AuthorizationSet expected(AuthorizationSetBuilder()
+                                  .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
+                                  .Authorization(TAG_APPLICATION_ID, "my_app", 6));
+    UniquePtr<AuthorizationSet> copied;
+    UniquePtr<AuthorizationSet> moved;
+    {
+        RequestArena arena;
+        AuthorizationSet set(&arena);
+        EXPECT_TRUE(set.push_back(expected));
+        copied.reset(new AuthorizationSet(set));
+        moved.reset(new AuthorizationSet(std::move(set)));
+        EXPECT_EQ(0U, set.size());
+        EXPECT_EQ(1U, arena.heap_blocks());
+    }
+    EXPECT_EQ(expected, *copied);
+    EXPECT_EQ(expected, *moved);
+}
+
 TEST(GetValue, GetInt) {
     AuthorizationSet set(AuthorizationSetBuilder()
                              .Authorization(TAG_PURPOSE, KM_PURPOSE_SIGN)
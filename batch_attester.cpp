@@ -0,0 +1,172 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/batch_attester.h>
+
+#include <keymaster/android_keymaster.h>
+
+#include "asymmetric_key.h"
+#include "attestation_record.h"
+#include "worker_pool.h"
+
+namespace keymaster {
+
+namespace {
+
+// The signing key and chain tail for one attestation algorithm, loaded when the batch first meets
+// a key of that algorithm.
+struct SigningState {
+    SigningState() : loaded(false), error(KM_ERROR_OK), tail(nullptr) {}
+
+    bool loaded;
+    keymaster_error_t error;
+    const keymaster_cert_chain_t* tail;
+    AttestationSigner signer;
+};
+
+// A key whose attestation record has been built, waiting for its certificate to be signed.
+struct PendingKey {
+    PendingKey() : signing(nullptr), record_length(0) {}
+
+    UniquePtr<Key> key;
+    AuthorizationSet tee_enforced;
+    AuthorizationSet sw_enforced;
+    const SigningState* signing;
+    UniquePtr<uint8_t[]> record;
+    size_t record_length;
+};
+
+keymaster_error_t LoadSigningState(const KeymasterContext& context,
+                                   keymaster_algorithm_t algorithm,
+                                   std::vector<std::unique_ptr<keymaster_cert_chain_t,
+                                                               CertificateChainDelete>>* tails,
+                                   SigningState* state) {
+    keymaster_error_t error;
+    std::unique_ptr<keymaster_cert_chain_t, CertificateChainDelete> tail(
+        context.AttestationChain(algorithm, &error));
+    if (!tail)
+        return error;
+
+    // The chain must at least hold the certificate of the key that signs the new certificates.
+    if (tail->entry_count < 1)
+        return KM_ERROR_UNKNOWN_ERROR;
+
+    error = state->signer.Init(context, algorithm, tail->entries[0]);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    state->tail = tail.get();
+    tails->push_back(std::move(tail));
+    return KM_ERROR_OK;
+}
+
+}  // anonymous namespace
+
+AttestationBatch::Item::Item() : error(KM_ERROR_UNKNOWN_ERROR), chain{nullptr, 0} {}
+
+AttestationBatch::AttestationBatch() {}
+
+AttestationBatch::~AttestationBatch() {}
+
+void AttestationBatch::Clear() {
+    items_.clear();
+    tails_.clear();
+}
+
+BatchAttester::BatchAttester(size_t thread_count)
+    : pool_(new (std::nothrow) WorkerPool(thread_count)) {}
+
+BatchAttester::~BatchAttester() {}
+
+size_t BatchAttester::thread_count() const {
+    return pool_ ? pool_->thread_count() : 0;
+}
+
+keymaster_error_t BatchAttester::Attest(AndroidKeymaster* keymaster,
+                                        const std::vector<keymaster_key_blob_t>& key_blobs,
+                                        const AuthorizationSet& attest_params,
+                                        AttestationBatch* batch) {
+    if (!keymaster || !batch)
+        return KM_ERROR_OUTPUT_PARAMETER_NULL;
+    if (!pool_)
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+
+    batch->Clear();
+    batch->items_.resize(key_blobs.size());
+    const KeymasterContext& context = keymaster->context();
+
+    // Everything that touches the keymaster or its context happens here, on the calling thread.
+    SigningState rsa_signing;
+    SigningState ec_signing;
+    std::vector<PendingKey> pending(key_blobs.size());
+    for (size_t i = 0; i < key_blobs.size(); ++i) {
+        AttestationBatch::Item& item = batch->items_[i];
+        PendingKey& key = pending[i];
+        item.error = keymaster->PrepareAttestation(key_blobs[i], attest_params, &key.key,
+                                                   &key.tee_enforced, &key.sw_enforced);
+        if (item.error != KM_ERROR_OK)
+            continue;
+
+        keymaster_algorithm_t algorithm;
+        if (!key.sw_enforced.GetTagValue(TAG_ALGORITHM, &algorithm) &&
+            !key.tee_enforced.GetTagValue(TAG_ALGORITHM, &algorithm)) {
+            item.error = KM_ERROR_UNKNOWN_ERROR;
+            continue;
+        }
+        if (algorithm != KM_ALGORITHM_RSA && algorithm != KM_ALGORITHM_EC) {
+            item.error = KM_ERROR_INCOMPATIBLE_ALGORITHM;
+            continue;
+        }
+
+        SigningState* signing = (algorithm == KM_ALGORITHM_RSA) ? &rsa_signing : &ec_signing;
+        if (!signing->loaded) {
+            signing->loaded = true;
+            signing->error = LoadSigningState(context, algorithm, &batch->tails_, signing);
+        }
+        item.error = signing->error;
+        if (item.error != KM_ERROR_OK)
+            continue;
+        key.signing = signing;
+
+        item.error = build_attestation_record(attest_params, key.sw_enforced, key.tee_enforced,
+                                              context, &key.record, &key.record_length);
+    }
+
+    pool_->ParallelFor(key_blobs.size(), [&](size_t i) {
+        AttestationBatch::Item& item = batch->items_[i];
+        if (item.error != KM_ERROR_OK)
+            return;
+
+        const PendingKey& key = pending[i];
+        keymaster_blob_t leaf = {nullptr, 0};
+        item.error = key.key->SignAttestation(key.signing->signer, key.record.get(),
+                                              key.record_length, key.tee_enforced,
+                                              key.sw_enforced, &leaf);
+        item.leaf.reset(leaf.data);
+        if (item.error != KM_ERROR_OK)
+            return;
+
+        const keymaster_cert_chain_t& tail = *key.signing->tail;
+        item.entries.reserve(tail.entry_count + 1);
+        item.entries.push_back(leaf);
+        item.entries.insert(item.entries.end(), tail.entries, tail.entries + tail.entry_count);
+        item.chain.entries = item.entries.data();
+        item.chain.entry_count = item.entries.size();
+    });
+    return KM_ERROR_OK;
+}
+
+}  // namespace keymaster
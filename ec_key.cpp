@@ -25,8 +25,14 @@ typedef int openssl_size_t;
 namespace keymaster {
 
 bool EcKey::EvpToInternal(const EVP_PKEY* pkey) {
-    ec_key_.reset(EVP_PKEY_get1_EC_KEY(const_cast<EVP_PKEY*>(pkey)));
-    return ec_key_.get() != NULL;
+    EVP_PKEY* shared_pkey = const_cast<EVP_PKEY*>(pkey);
+    ec_key_.reset(EVP_PKEY_get1_EC_KEY(shared_pkey));
+    if (!ec_key_.get())
+        return false;
+
+    EVP_PKEY_up_ref(shared_pkey);
+    evp_key_.reset(shared_pkey);
+    return true;
 }
 
 bool EcKey::InternalToEvp(EVP_PKEY* pkey) const {
@@ -37,6 +37,13 @@ class EcKey : public AsymmetricKey {
 
     EC_KEY* key() const { return ec_key_.get(); }
 
+    /**
+     * Returns the EVP_PKEY the key was loaded from, if any.  Operations take references to it
+     * rather than wrapping the EC_KEY in a new EVP_PKEY, so a key kept warm by the factory's cache
+     * is not re-validated on every Begin.
+     */
+    EVP_PKEY* evp_key() const { return evp_key_.get(); }
+
   protected:
     EcKey(EC_KEY* ec_key, const AuthorizationSet& hw_enforced, const AuthorizationSet& sw_enforced,
           keymaster_error_t* error)
@@ -44,6 +51,7 @@ class EcKey : public AsymmetricKey {
 
   private:
     UniquePtr<EC_KEY, EC_KEY_Delete> ec_key_;
+    UniquePtr<EVP_PKEY, EVP_PKEY_Delete> evp_key_;
 };
 
 }  // namespace keymaster
@@ -26,9 +26,16 @@
 
 namespace keymaster {
 
+// Number of parsed EC keys kept warm between operations.
+const size_t kEcKeyCacheSize = 8;
+
 static EcdsaSignOperationFactory sign_factory;
 static EcdsaVerifyOperationFactory verify_factory;
 
+EcKeyFactory::EcKeyFactory(const KeymasterContext* context) : AsymmetricKeyFactory(context) {
+    set_key_cache_size(kEcKeyCacheSize);
+}
+
 OperationFactory* EcKeyFactory::GetOperationFactory(keymaster_purpose_t purpose) const {
     switch (purpose) {
     case KM_PURPOSE_SIGN:
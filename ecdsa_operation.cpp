@@ -37,10 +37,17 @@ Operation* EcdsaOperationFactory::CreateOperation(const Key& key,
         return nullptr;
     }
 
-    UniquePtr<EVP_PKEY, EVP_PKEY_Delete> pkey(EVP_PKEY_new());
-    if (!ecdsa_key->InternalToEvp(pkey.get())) {
-        *error = KM_ERROR_UNKNOWN_ERROR;
-        return nullptr;
+    UniquePtr<EVP_PKEY, EVP_PKEY_Delete> pkey;
+    if (ecdsa_key->evp_key()) {
+        // Share the key's EVP_PKEY, which may be kept warm by the key factory's cache.
+        EVP_PKEY_up_ref(ecdsa_key->evp_key());
+        pkey.reset(ecdsa_key->evp_key());
+    } else {
+        pkey.reset(EVP_PKEY_new());
+        if (!pkey.get() || !ecdsa_key->InternalToEvp(pkey.get())) {
+            *error = KM_ERROR_UNKNOWN_ERROR;
+            return nullptr;
+        }
     }
 
     keymaster_digest_t digest;
@@ -95,8 +102,16 @@ inline size_t min(size_t a, size_t b) {
     return (a < b) ? a : b;
 }
 
+keymaster_error_t EcdsaOperation::InitUndigested() {
+    // Take the EC key once here, rather than on every Finish.
+    ec_key_.reset(EVP_PKEY_get1_EC_KEY(ecdsa_key_));
+    if (!ec_key_.get())
+        return TranslateLastOpenSslError();
+    return KM_ERROR_OK;
+}
+
 keymaster_error_t EcdsaOperation::StoreData(const Buffer& input, size_t* input_consumed) {
-    if (!data_.reserve((EVP_PKEY_bits(ecdsa_key_) + 7) / 8))
+    if (!data_.reserve(max_undigested_length()))
         return KM_ERROR_MEMORY_ALLOCATION_FAILED;
 
     if (!data_.write(input.peek_read(), min(data_.available_write(), input.available_read())))
@@ -113,7 +128,7 @@ keymaster_error_t EcdsaSignOperation::Begin(const AuthorizationSet& /* input_par
         return error;
 
     if (digest_ == KM_DIGEST_NONE)
-        return KM_ERROR_OK;
+        return InitUndigested();
 
     EVP_PKEY_CTX* pkey_ctx;
     if (EVP_DigestSignInit(&digest_ctx_, &pkey_ctx, digest_algorithm_, nullptr /* engine */,
@@ -142,30 +157,39 @@ keymaster_error_t EcdsaSignOperation::Finish(const AuthorizationSet& additional_
     if (!output)
         return KM_ERROR_OUTPUT_PARAMETER_NULL;
 
+    // A pre-hashed message that arrives whole in Finish is signed from the caller's buffer.  Like
+    // StoreData, this uses no more of it than the key is long.
+    if (digest_ == KM_DIGEST_NONE && data_.available_read() == 0)
+        return SignUndigested(input.peek_read(),
+                              min(input.available_read(), max_undigested_length()), output);
+
     keymaster_error_t error = UpdateForFinish(additional_params, input);
     if (error != KM_ERROR_OK)
         return error;
 
+    if (digest_ == KM_DIGEST_NONE)
+        return SignUndigested(data_.peek_read(), data_.available_read(), output);
+
     size_t siglen;
-    if (digest_ == KM_DIGEST_NONE) {
-        UniquePtr<EC_KEY, EC_KEY_Delete> ecdsa(EVP_PKEY_get1_EC_KEY(ecdsa_key_));
-        if (!ecdsa.get())
-            return TranslateLastOpenSslError();
-
-        output->Reinitialize(ECDSA_size(ecdsa.get()));
-        unsigned int siglen_tmp;
-        if (!ECDSA_sign(0 /* type -- ignored */, data_.peek_read(), data_.available_read(),
-                        output->peek_write(), &siglen_tmp, ecdsa.get()))
-            return TranslateLastOpenSslError();
-        siglen = siglen_tmp;
-    } else {
-        if (EVP_DigestSignFinal(&digest_ctx_, nullptr /* signature */, &siglen) != 1)
-            return TranslateLastOpenSslError();
-        if (!output->Reinitialize(siglen))
-            return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-        if (EVP_DigestSignFinal(&digest_ctx_, output->peek_write(), &siglen) <= 0)
-            return TranslateLastOpenSslError();
-    }
+    if (EVP_DigestSignFinal(&digest_ctx_, nullptr /* signature */, &siglen) != 1)
+        return TranslateLastOpenSslError();
+    if (!output->Reinitialize(siglen))
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    if (EVP_DigestSignFinal(&digest_ctx_, output->peek_write(), &siglen) <= 0)
+        return TranslateLastOpenSslError();
+    if (!output->advance_write(siglen))
+        return KM_ERROR_UNKNOWN_ERROR;
+    return KM_ERROR_OK;
+}
+
+keymaster_error_t EcdsaSignOperation::SignUndigested(const uint8_t* data, size_t data_length,
+                                                     Buffer* output) {
+    if (!output->Reinitialize(ECDSA_size(ec_key_.get())))
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+    unsigned int siglen;
+    if (!ECDSA_sign(0 /* type -- ignored */, data, data_length, output->peek_write(), &siglen,
+                    ec_key_.get()))
+        return TranslateLastOpenSslError();
     if (!output->advance_write(siglen))
         return KM_ERROR_UNKNOWN_ERROR;
     return KM_ERROR_OK;
@@ -178,7 +202,7 @@ keymaster_error_t EcdsaVerifyOperation::Begin(const AuthorizationSet& /* input_p
         return error;
 
     if (digest_ == KM_DIGEST_NONE)
-        return KM_ERROR_OK;
+        return InitUndigested();
 
     EVP_PKEY_CTX* pkey_ctx;
     if (EVP_DigestVerifyInit(&digest_ctx_, &pkey_ctx, digest_algorithm_, nullptr /* engine */,
@@ -204,26 +228,31 @@ keymaster_error_t EcdsaVerifyOperation::Finish(const AuthorizationSet& additiona
                                                const Buffer& input, const Buffer& signature,
                                                AuthorizationSet* /* output_params */,
                                                Buffer* /* output */) {
+    // A pre-hashed message that arrives whole in Finish is checked against the caller's buffer.
+    if (digest_ == KM_DIGEST_NONE && data_.available_read() == 0)
+        return VerifyUndigested(input.peek_read(),
+                                min(input.available_read(), max_undigested_length()), signature);
+
     keymaster_error_t error = UpdateForFinish(additional_params, input);
     if (error != KM_ERROR_OK)
         return error;
 
-    if (digest_ == KM_DIGEST_NONE) {
-        UniquePtr<EC_KEY, EC_KEY_Delete> ecdsa(EVP_PKEY_get1_EC_KEY(ecdsa_key_));
-        if (!ecdsa.get())
-            return TranslateLastOpenSslError();
-
-        int result =
-            ECDSA_verify(0 /* type -- ignored */, data_.peek_read(), data_.available_read(),
-                         signature.peek_read(), signature.available_read(), ecdsa.get());
-        if (result < 0)
-            return TranslateLastOpenSslError();
-        else if (result == 0)
-            return KM_ERROR_VERIFICATION_FAILED;
-    } else if (!EVP_DigestVerifyFinal(&digest_ctx_, signature.peek_read(),
-                                      signature.available_read()))
+    if (digest_ == KM_DIGEST_NONE)
+        return VerifyUndigested(data_.peek_read(), data_.available_read(), signature);
+
+    if (!EVP_DigestVerifyFinal(&digest_ctx_, signature.peek_read(), signature.available_read()))
         return KM_ERROR_VERIFICATION_FAILED;
+    return KM_ERROR_OK;
+}
 
+keymaster_error_t EcdsaVerifyOperation::VerifyUndigested(const uint8_t* data, size_t data_length,
+                                                         const Buffer& signature) {
+    int result = ECDSA_verify(0 /* type -- ignored */, data, data_length, signature.peek_read(),
+                              signature.available_read(), ec_key_.get());
+    if (result < 0)
+        return TranslateLastOpenSslError();
+    else if (result == 0)
+        return KM_ERROR_VERIFICATION_FAILED;
     return KM_ERROR_OK;
 }
 
@@ -22,6 +22,7 @@
 
 #include <keymaster/UniquePtr.h>
 
+#include "openssl_utils.h"
 #include "operation.h"
 
 namespace keymaster {
@@ -39,10 +40,13 @@ class EcdsaOperation : public Operation {
   protected:
     keymaster_error_t StoreData(const Buffer& input, size_t* input_consumed);
     keymaster_error_t InitDigest();
+    keymaster_error_t InitUndigested();
+    size_t max_undigested_length() const { return (EVP_PKEY_bits(ecdsa_key_) + 7) / 8; }
 
     keymaster_digest_t digest_;
     const EVP_MD* digest_algorithm_;
     EVP_PKEY* ecdsa_key_;
+    EC_KEY_Ptr ec_key_;  // Set by Begin for undigested operations.
     EVP_MD_CTX digest_ctx_;
     Buffer data_;
 };
@@ -59,6 +63,9 @@ class EcdsaSignOperation : public EcdsaOperation {
     keymaster_error_t Finish(const AuthorizationSet& additional_params, const Buffer& input,
                              const Buffer& signature, AuthorizationSet* output_params,
                              Buffer* output) override;
+
+  private:
+    keymaster_error_t SignUndigested(const uint8_t* data, size_t data_length, Buffer* output);
 };
 
 class EcdsaVerifyOperation : public EcdsaOperation {
@@ -73,6 +80,10 @@ class EcdsaVerifyOperation : public EcdsaOperation {
     keymaster_error_t Finish(const AuthorizationSet& additional_params, const Buffer& input,
                              const Buffer& signature, AuthorizationSet* output_params,
                              Buffer* output) override;
+
+  private:
+    keymaster_error_t VerifyUndigested(const uint8_t* data, size_t data_length,
+                                       const Buffer& signature);
 };
 
 class EcdsaOperationFactory : public OperationFactory {
@@ -16,12 +16,51 @@
 
 #include "ecies_kem.h"
 
+#include <algorithm>
+#include <atomic>
+
 #include "nist_curve_key_exchange.h"
 #include "openssl_err.h"
+#include "worker_pool.h"
 
 namespace keymaster {
 
-EciesKem::EciesKem(const AuthorizationSet& kem_description, keymaster_error_t* error) {
+namespace {
+
+/**
+ * Call \p process for each index in [0, \p count), spread across \p worker_pool if it is non-null.
+ * The batch is cut into one contiguous slice per thread and each slice gets its own KDF, which is
+ * not thread-safe.  Returns false if any call did; the remaining calls of that slice are skipped.
+ */
+template <typename Process>
+bool ForEachInBatch(size_t count, WorkerPool* worker_pool, Process process) {
+    if (count == 0)
+        return true;
+
+    size_t slices = worker_pool ? std::min(count, worker_pool->thread_count()) : 1;
+    std::atomic<bool> ok(true);
+    auto process_slice = [&](size_t slice) {
+        Rfc5869Sha256Kdf kdf;
+        size_t end = count * (slice + 1) / slices;
+        for (size_t i = count * slice / slices; i < end; ++i) {
+            if (!process(&kdf, i)) {
+                ok = false;
+                return;
+            }
+        }
+    };
+
+    if (slices == 1)
+        process_slice(0);
+    else
+        worker_pool->ParallelFor(slices, process_slice);
+    return ok;
+}
+
+}  // anonymous namespace
+
+EciesKem::EciesKem(const AuthorizationSet& kem_description, keymaster_error_t* error)
+    : ephemeral_key_pool_(nullptr) {
     const AuthorizationSet& authorizations(kem_description);
 
     if (!authorizations.GetTagValue(TAG_EC_CURVE, &curve_)) {
@@ -81,49 +120,18 @@ bool EciesKem::Encrypt(const Buffer& peer_public_value, Buffer* output_clear_key
 // http://www.shoup.net/iso/std6.pdf, section 10.2.3.
 bool EciesKem::Encrypt(const uint8_t* peer_public_value, size_t peer_public_value_len,
                        Buffer* output_clear_key, Buffer* output_encrypted_key) {
+    return Encapsulate(kdf_.get(), peer_public_value, peer_public_value_len, output_clear_key,
+                       output_encrypted_key);
+}
 
-    key_exchange_.reset(NistCurveKeyExchange::GenerateKeyExchange(curve_));
-    if (!key_exchange_.get()) {
-        return false;
-    }
-
-    Buffer shared_secret;
-    if (!key_exchange_->CalculateSharedKey(peer_public_value, peer_public_value_len,
-                                           &shared_secret)) {
-        LOG_E("EciesKem: ECDH failed, can't obtain shared secret", 0);
-        return false;
-    }
-    if (!key_exchange_->public_value(output_encrypted_key)) {
-        LOG_E("EciesKem: Can't obtain public value", 0);
-        return false;
-    }
-
-    Buffer z;
-    if (single_hash_mode_) {
-        // z is empty.
-    } else {
-        // z = C0
-        z.Reinitialize(output_encrypted_key->peek_read(), output_encrypted_key->available_read());
-    }
-
-    Buffer actual_secret(z.available_read() + shared_secret.available_read());
-    actual_secret.write(z.peek_read(), z.available_read());
-    actual_secret.write(shared_secret.peek_read(), shared_secret.available_read());
-
-    if (!kdf_->Init(actual_secret.peek_read(), actual_secret.available_read(), nullptr /* salt */,
-                    0 /* salt_len */)) {
-        LOG_E("EciesKem: KDF failed, can't derived keys", 0);
-        return false;
-    }
-    output_clear_key->Reinitialize(key_bytes_to_generate_);
-    if (!kdf_->GenerateKey(nullptr /* info */, 0 /* info length */, output_clear_key->peek_write(),
-                           key_bytes_to_generate_)) {
-        LOG_E("EciesKem: KDF failed, can't derived keys", 0);
-        return false;
-    }
-    output_clear_key->advance_write(key_bytes_to_generate_);
-
-    return true;
+bool EciesKem::EncryptBatch(const Buffer* peer_public_values, size_t count,
+                            Buffer* output_clear_keys, Buffer* output_encrypted_keys,
+                            WorkerPool* worker_pool) {
+    return ForEachInBatch(count, worker_pool, [&](Rfc5869Sha256Kdf* kdf, size_t i) {
+        return Encapsulate(kdf, peer_public_values[i].peek_read(),
+                           peer_public_values[i].available_read(), &output_clear_keys[i],
+                           &output_encrypted_keys[i]);
+    });
 }
 
 bool EciesKem::Decrypt(EC_KEY* private_key, const Buffer& encrypted_key, Buffer* output_key) {
@@ -141,39 +149,94 @@ bool EciesKem::Decrypt(EC_KEY* private_key, const uint8_t* encrypted_key, size_t
         return false;
     }
 
-    Buffer shared_secret;
-    if (!key_exchange_->CalculateSharedKey(encrypted_key, encrypted_key_len, &shared_secret)) {
-        LOG_E("EciesKem: ECDH failed, can't obtain shared secret", 0);
+    Buffer public_value;
+    if (!key_exchange_->public_value(&public_value)) {
+        LOG_E("%s", "EciesKem: Can't obtain public value");
+        return false;
+    }
+
+    return Decapsulate(kdf_.get(), *key_exchange_, public_value, encrypted_key, encrypted_key_len,
+                       output_key);
+}
+
+bool EciesKem::DecryptBatch(EC_KEY* private_key, const Buffer* encrypted_keys, size_t count,
+                            Buffer* output_keys, WorkerPool* worker_pool) {
+    // The private key is checked and its public value encoded once for the whole batch.
+    keymaster_error_t error;
+    NistCurveKeyExchange key_exchange(private_key, &error);
+    if (error != KM_ERROR_OK) {
         return false;
     }
 
     Buffer public_value;
-    if (!key_exchange_->public_value(&public_value)) {
+    if (!key_exchange.public_value(&public_value)) {
         LOG_E("%s", "EciesKem: Can't obtain public value");
         return false;
     }
 
-    Buffer z;
-    if (single_hash_mode_) {
-        // z is empty.
-    } else {
-        // z = C0
-        z.Reinitialize(public_value.peek_read(), public_value.available_read());
+    return ForEachInBatch(count, worker_pool, [&](Rfc5869Sha256Kdf* kdf, size_t i) {
+        return Decapsulate(kdf, key_exchange, public_value, encrypted_keys[i].peek_read(),
+                           encrypted_keys[i].available_read(), &output_keys[i]);
+    });
+}
+
+bool EciesKem::Encapsulate(Rfc5869Sha256Kdf* kdf, const uint8_t* peer_public_value,
+                           size_t peer_public_value_len, Buffer* output_clear_key,
+                           Buffer* output_encrypted_key) const {
+    // The ephemeral key pair is used for this encapsulation only, and freed when it returns.
+    UniquePtr<KeyExchange> key_exchange;
+    if (ephemeral_key_pool_)
+        key_exchange.reset(ephemeral_key_pool_->TakeKeyExchange(curve_));
+    if (!key_exchange.get())
+        key_exchange.reset(NistCurveKeyExchange::GenerateKeyExchange(curve_));
+    if (!key_exchange.get()) {
+        return false;
+    }
+
+    Buffer shared_secret;
+    if (!key_exchange->CalculateSharedKey(peer_public_value, peer_public_value_len,
+                                          &shared_secret)) {
+        LOG_E("EciesKem: ECDH failed, can't obtain shared secret", 0);
+        return false;
+    }
+    if (!key_exchange->public_value(output_encrypted_key)) {
+        LOG_E("EciesKem: Can't obtain public value", 0);
+        return false;
     }
 
-    Buffer actual_secret(z.available_read() + shared_secret.available_read());
-    actual_secret.write(z.peek_read(), z.available_read());
+    // z = C0
+    return DeriveKey(kdf, *output_encrypted_key, shared_secret, output_clear_key);
+}
+
+bool EciesKem::Decapsulate(Rfc5869Sha256Kdf* kdf, const KeyExchange& key_exchange,
+                           const Buffer& public_value, const uint8_t* encrypted_key,
+                           size_t encrypted_key_len, Buffer* output_key) const {
+    Buffer shared_secret;
+    if (!key_exchange.CalculateSharedKey(encrypted_key, encrypted_key_len, &shared_secret)) {
+        LOG_E("EciesKem: ECDH failed, can't obtain shared secret", 0);
+        return false;
+    }
+
+    return DeriveKey(kdf, public_value, shared_secret, output_key);
+}
+
+bool EciesKem::DeriveKey(Rfc5869Sha256Kdf* kdf, const Buffer& z, const Buffer& shared_secret,
+                         Buffer* output_key) const {
+    // In single hash mode z is not part of the KDF input.
+    size_t z_len = single_hash_mode_ ? 0 : z.available_read();
+    Buffer actual_secret(z_len + shared_secret.available_read());
+    actual_secret.write(z.peek_read(), z_len);
     actual_secret.write(shared_secret.peek_read(), shared_secret.available_read());
 
-    if (!kdf_->Init(actual_secret.peek_read(), actual_secret.available_read(), nullptr /* salt */,
-                    0 /* salt_len */)) {
+    if (!kdf->Init(actual_secret.peek_read(), actual_secret.available_read(), nullptr /* salt */,
+                   0 /* salt_len */)) {
         LOG_E("%s", "EciesKem: KDF failed, can't derived keys");
         return false;
     }
 
     output_key->Reinitialize(key_bytes_to_generate_);
-    if (!kdf_->GenerateKey(nullptr /* info */, 0 /* info_len */, output_key->peek_write(),
-                           key_bytes_to_generate_)) {
+    if (!kdf->GenerateKey(nullptr /* info */, 0 /* info_len */, output_key->peek_write(),
+                          key_bytes_to_generate_)) {
         LOG_E("%s", "EciesKem: KDF failed, can't derived keys");
         return false;
     }
@@ -29,6 +29,9 @@
 
 namespace keymaster {
 
+class EphemeralKeyPool;
+class WorkerPool;
+
 /**
  * EciesKem is an implementation of the key encapsulation mechanism ECIES-KEM described in
  * ISO 18033-2 (http://www.shoup.net/iso/std6.pdf, http://www.shoup.net/papers/iso-2_1.pdf).
@@ -48,12 +51,48 @@ class EciesKem : public Kem {
     bool Decrypt(EC_KEY* private_key, const uint8_t* encrypted_key, size_t encrypted_key_len,
                  Buffer* output_key) override;
 
+    /**
+     * Encapsulate a key to each of the \p count values in \p peer_public_values, exactly as
+     * \p count calls to Encrypt would, storing the results in the corresponding elements of
+     * \p output_clear_keys and \p output_encrypted_keys.  If \p worker_pool is non-null the
+     * encapsulations are spread across it, and any ephemeral key pool must be thread-safe.
+     * Returns false if any encapsulation failed, in which case the outputs are unspecified.
+     */
+    bool EncryptBatch(const Buffer* peer_public_values, size_t count, Buffer* output_clear_keys,
+                      Buffer* output_encrypted_keys, WorkerPool* worker_pool = nullptr);
+
+    /**
+     * Decrypt each of the \p count values in \p encrypted_keys with \p private_key, exactly as
+     * \p count calls to Decrypt would, storing the results in the corresponding elements of
+     * \p output_keys.  The private key is checked once for the whole batch.  If \p worker_pool is
+     * non-null the decryptions are spread across it.  Takes ownership of \p private_key.  Returns
+     * false if any decryption failed, in which case the outputs are unspecified.
+     */
+    bool DecryptBatch(EC_KEY* private_key, const Buffer* encrypted_keys, size_t count,
+                      Buffer* output_keys, WorkerPool* worker_pool = nullptr);
+
+    /**
+     * Draw the ephemeral key pairs for Encrypt from \p key_pool, which must outlive this object,
+     * instead of generating them inline.  Pass null to stop using a pool.
+     */
+    void set_ephemeral_key_pool(EphemeralKeyPool* key_pool) { ephemeral_key_pool_ = key_pool; }
+
   private:
+    bool Encapsulate(Rfc5869Sha256Kdf* kdf, const uint8_t* peer_public_value,
+                     size_t peer_public_value_len, Buffer* output_clear_key,
+                     Buffer* output_encrypted_key) const;
+    bool Decapsulate(Rfc5869Sha256Kdf* kdf, const KeyExchange& key_exchange,
+                     const Buffer& public_value, const uint8_t* encrypted_key,
+                     size_t encrypted_key_len, Buffer* output_key) const;
+    bool DeriveKey(Rfc5869Sha256Kdf* kdf, const Buffer& z, const Buffer& shared_secret,
+                   Buffer* output_key) const;
+
     UniquePtr<KeyExchange> key_exchange_;
     UniquePtr<Rfc5869Sha256Kdf> kdf_;
     bool single_hash_mode_;
     uint32_t key_bytes_to_generate_;
     keymaster_ec_curve_t curve_;
+    EphemeralKeyPool* ephemeral_key_pool_;
 };
 
 }  // namespace keymaster
@@ -19,10 +19,16 @@
 #include <gtest/gtest.h>
 #include <openssl/evp.h>
 
+#include <chrono>
+#include <set>
+#include <thread>
+
 #include <hardware/keymaster_defs.h>
 #include <keymaster/android_keymaster_utils.h>
 
 #include "android_keymaster_test_utils.h"
+#include "ephemeral_key_pool.h"
+#include "worker_pool.h"
 #include "nist_curve_key_exchange.h"
 
 using std::string;
@@ -69,5 +75,144 @@ TEST(EciesKem, TestConsistency) {
     }
 }
 
+static bool WaitForStock(const EphemeralKeyPregenerationPool& pool, size_t available) {
+    for (int i = 0; i < 2000; ++i) {
+        bool full = true;
+        for (auto& stats : pool.GetStats())
+            full &= stats.available >= available;
+        if (full)
+            return true;
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    return false;
+}
+
+TEST(EciesKem, EphemeralKeyPool) {
+    static const uint32_t kKeyLen = 32;
+    static const size_t kStock = 4;
+    EphemeralKeyPregenerationPool pool;
+    for (auto& curve : kEcCurves)
+        ASSERT_TRUE(pool.AddStock(curve, kStock));
+    EXPECT_FALSE(pool.AddStock(KM_EC_CURVE_P_256, kStock));
+    ASSERT_TRUE(pool.Start(2 /* thread_count */));
+    EXPECT_FALSE(pool.AddStock(static_cast<keymaster_ec_curve_t>(-1), kStock));
+    ASSERT_TRUE(WaitForStock(pool, kStock));
+
+    for (auto& curve : kEcCurves) {
+        AuthorizationSet kem_description(AuthorizationSetBuilder()
+                                             .Authorization(TAG_EC_CURVE, curve)
+                                             .Authorization(TAG_KDF, KM_KDF_RFC5869_SHA256)
+                                             .Authorization(TAG_KEY_SIZE, kKeyLen));
+        keymaster_error_t error;
+        EciesKem kem(kem_description, &error);
+        ASSERT_EQ(KM_ERROR_OK, error);
+        kem.set_ephemeral_key_pool(&pool);
+
+        UniquePtr<NistCurveKeyExchange> key_exchange(
+            NistCurveKeyExchange::GenerateKeyExchange(curve));
+        Buffer peer_public_value;
+        ASSERT_TRUE(key_exchange->public_value(&peer_public_value));
+        EC_KEY* private_key = key_exchange->private_key();
+
+        // Every encapsulation, from stock or generated inline once the stock runs out, must use
+        // a different ephemeral key.
+        std::set<string> encrypted_keys;
+        for (size_t i = 0; i < 2 * kStock; ++i) {
+            Buffer clear_key;
+            Buffer encrypted_key;
+            ASSERT_TRUE(kem.Encrypt(peer_public_value, &clear_key, &encrypted_key));
+            EXPECT_TRUE(encrypted_keys
+                            .insert(string(reinterpret_cast<const char*>(encrypted_key.peek_read()),
+                                           encrypted_key.available_read()))
+                            .second);
+
+            Buffer decrypted_key;
+            ASSERT_TRUE(kem.Decrypt(EC_KEY_dup(private_key), encrypted_key, &decrypted_key));
+            ASSERT_EQ(kKeyLen, decrypted_key.available_read());
+            EXPECT_EQ(0, memcmp(clear_key.peek_read(), decrypted_key.peek_read(), kKeyLen));
+        }
+        EC_KEY_free(private_key);
+    }
+
+    for (auto& stats : pool.GetStats()) {
+        EXPECT_GE(stats.hits, kStock);
+        EXPECT_EQ(2 * kStock, stats.hits + stats.misses);
+        EXPECT_EQ(0U, stats.failures);
+    }
+
+    // Once stopped, every take misses and leaves generation to the caller.
+    pool.Stop();
+    for (auto& stats : pool.GetStats())
+        EXPECT_EQ(0U, stats.available);
+    EXPECT_EQ(nullptr, pool.TakeKeyExchange(KM_EC_CURVE_P_256));
+}
+
+TEST(EciesKem, BatchMatchesSingle) {
+    static const uint32_t kKeyLen = 16;
+    static const size_t kRecipients = 3;
+    static const size_t kBatchSize = 7;
+    WorkerPool worker_pool(3 /* thread_count */);
+    for (auto& curve : kEcCurves) {
+        AuthorizationSet kem_description(AuthorizationSetBuilder()
+                                             .Authorization(TAG_EC_CURVE, curve)
+                                             .Authorization(TAG_KDF, KM_KDF_RFC5869_SHA256)
+                                             .Authorization(TAG_ECIES_SINGLE_HASH_MODE)
+                                             .Authorization(TAG_KEY_SIZE, kKeyLen));
+        keymaster_error_t error;
+        EciesKem kem(kem_description, &error);
+        ASSERT_EQ(KM_ERROR_OK, error);
+
+        EC_KEY_Ptr private_keys[kRecipients];
+        Buffer recipient_public_values[kRecipients];
+        for (size_t i = 0; i < kRecipients; ++i) {
+            UniquePtr<NistCurveKeyExchange> recipient(
+                NistCurveKeyExchange::GenerateKeyExchange(curve));
+            ASSERT_TRUE(recipient->public_value(&recipient_public_values[i]));
+            private_keys[i].reset(recipient->private_key());
+        }
+        Buffer peer_public_values[kBatchSize];
+        for (size_t i = 0; i < kBatchSize; ++i)
+            peer_public_values[i].Reinitialize(recipient_public_values[i % kRecipients]);
+
+        for (WorkerPool* pool : {static_cast<WorkerPool*>(nullptr), &worker_pool}) {
+            // Each batch encapsulation must decrypt, one at a time, with its recipient's key.
+            Buffer clear_keys[kBatchSize];
+            Buffer encrypted_keys[kBatchSize];
+            ASSERT_TRUE(kem.EncryptBatch(peer_public_values, kBatchSize, clear_keys,
+                                         encrypted_keys, pool));
+            for (size_t i = 0; i < kBatchSize; ++i) {
+                Buffer decrypted_key;
+                ASSERT_TRUE(kem.Decrypt(EC_KEY_dup(private_keys[i % kRecipients].get()),
+                                        encrypted_keys[i], &decrypted_key));
+                ASSERT_EQ(kKeyLen, clear_keys[i].available_read());
+                EXPECT_EQ(0, memcmp(clear_keys[i].peek_read(), decrypted_key.peek_read(), kKeyLen));
+            }
+
+            // Single encapsulations to one recipient must decrypt as a batch.
+            for (size_t i = 0; i < kBatchSize; ++i)
+                ASSERT_TRUE(
+                    kem.Encrypt(recipient_public_values[0], &clear_keys[i], &encrypted_keys[i]));
+            Buffer decrypted_keys[kBatchSize];
+            ASSERT_TRUE(kem.DecryptBatch(EC_KEY_dup(private_keys[0].get()), encrypted_keys,
+                                         kBatchSize, decrypted_keys, pool));
+            for (size_t i = 0; i < kBatchSize; ++i) {
+                ASSERT_EQ(kKeyLen, decrypted_keys[i].available_read());
+                EXPECT_EQ(0, memcmp(clear_keys[i].peek_read(), decrypted_keys[i].peek_read(),
+                                    kKeyLen));
+            }
+
+            // A bad peer public value fails the batch.
+            Buffer bad_public_values[kBatchSize];
+            for (size_t i = 0; i < kBatchSize; ++i)
+                bad_public_values[i].Reinitialize(peer_public_values[i]);
+            bad_public_values[kBatchSize - 1].Reinitialize("bad", 3);
+            EXPECT_FALSE(kem.EncryptBatch(bad_public_values, kBatchSize, clear_keys,
+                                          encrypted_keys, pool));
+            EXPECT_FALSE(kem.DecryptBatch(EC_KEY_dup(private_keys[0].get()), bad_public_values,
+                                          kBatchSize, decrypted_keys, pool));
+        }
+    }
+}
+
 }  // namespace test
 }  // namespace keymaster
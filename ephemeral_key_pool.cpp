@@ -0,0 +1,46 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "ephemeral_key_pool.h"
+
+#include <openssl/err.h>
+
+#include <keymaster/logger.h>
+
+namespace keymaster {
+
+NistCurveKeyExchange* EphemeralKeyGenerator::Generate(const Params& params) {
+    NistCurveKeyExchange* key_exchange = NistCurveKeyExchange::GenerateKeyExchange(params.curve);
+    if (!key_exchange) {
+        LOG_E("Failed to pre-generate ephemeral key on curve %d", params.curve);
+        ERR_clear_error();
+    }
+    return key_exchange;
+}
+
+bool EphemeralKeyPregenerationPool::AddStock(keymaster_ec_curve_t curve, size_t target) {
+    switch (curve) {
+    case KM_EC_CURVE_P_224:
+    case KM_EC_CURVE_P_256:
+    case KM_EC_CURVE_P_384:
+    case KM_EC_CURVE_P_521:
+        return KeyPregenerationPool::AddStock({curve}, target);
+    default:
+        return false;
+    }
+}
+
+}  // namespace keymaster
@@ -0,0 +1,64 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_EPHEMERAL_KEY_POOL_H_
+#define SYSTEM_KEYMASTER_EPHEMERAL_KEY_POOL_H_
+
+#include <hardware/keymaster_defs.h>
+
+#include <keymaster/key_pregeneration_pool.h>
+
+#include "nist_curve_key_exchange.h"
+
+namespace keymaster {
+
+/**
+ * Generator for KeyPregenerationPool producing ephemeral ECDH key pairs, generated and checked by
+ * NistCurveKeyExchange.  Deleting a key exchange clears its private scalar.
+ */
+struct EphemeralKeyGenerator {
+    typedef NistCurveKeyExchange Key;
+    struct Params {
+        keymaster_ec_curve_t curve;
+    };
+
+    static bool Matches(const Params& a, const Params& b) { return a.curve == b.curve; }
+    static NistCurveKeyExchange* Generate(const Params& params);
+    static void Free(NistCurveKeyExchange* key) { delete key; }
+};
+
+/**
+ * EphemeralKeyPregenerationPool keeps a small stock of single-use ECDH key pairs for each
+ * configured NIST curve, so that EciesKem::Encrypt usually only has to perform the ECDH itself.
+ * On a miss, EciesKem generates the key pair itself.
+ */
+class EphemeralKeyPregenerationPool : public EphemeralKeyPool,
+                                      public KeyPregenerationPool<EphemeralKeyGenerator> {
+  public:
+    /**
+     * Keep up to \p target key pairs on \p curve in stock.  Must be called before Start.  Returns
+     * false if the curve is not supported, \p target is zero or the pool is running.
+     */
+    bool AddStock(keymaster_ec_curve_t curve, size_t target);
+
+    NistCurveKeyExchange* TakeKeyExchange(keymaster_ec_curve_t curve) override {
+        return Take({curve});
+    }
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_EPHEMERAL_KEY_POOL_H_
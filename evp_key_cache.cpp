@@ -0,0 +1,72 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "evp_key_cache.h"
+
+#include <openssl/x509.h>
+
+#include <keymaster/android_keymaster_utils.h>
+
+#include "openssl_err.h"
+
+namespace keymaster {
+
+void EvpKeyCache::Entry::Release() {
+    if (listener)
+        listener->OnKeyEvicted(pkey);
+    EVP_PKEY_free(pkey);
+    pkey = nullptr;
+    memset_s(digest, 0, sizeof(digest));
+}
+
+EVP_PKEY* EvpKeyCache::Get(int evp_key_type, const KeymasterKeyBlob& key_material,
+                           keymaster_error_t* error) {
+    *error = KM_ERROR_OK;
+
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    SHA256(key_material.key_material, key_material.key_material_size, digest);
+
+    Entry* entry = entries_.Find([&](const Entry& candidate) {
+        return candidate.evp_key_type == evp_key_type &&
+               memcmp_s(candidate.digest, digest, sizeof(digest)) == 0;
+    });
+    if (entry) {
+        entries_.RecordHit();
+        EVP_PKEY_up_ref(entry->pkey);
+        return entry->pkey;
+    }
+
+    entries_.RecordMiss();
+    const uint8_t* tmp = key_material.key_material;
+    EVP_PKEY* pkey =
+        d2i_PrivateKey(evp_key_type, NULL /* pkey */, &tmp, key_material.key_material_size);
+    if (!pkey) {
+        *error = TranslateLastOpenSslError();
+        return nullptr;
+    }
+
+    entry = entries_.Evict();
+    if (entry) {
+        EVP_PKEY_up_ref(pkey);
+        entry->pkey = pkey;
+        entry->listener = listener_;
+        entry->evp_key_type = evp_key_type;
+        memcpy(entry->digest, digest, sizeof(digest));
+    }
+    return pkey;
+}
+
+}  // namespace keymaster
@@ -0,0 +1,104 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_EVP_KEY_CACHE_H_
+#define SYSTEM_KEYMASTER_EVP_KEY_CACHE_H_
+
+#include <openssl/evp.h>
+#include <openssl/sha.h>
+
+#include <keymaster/UniquePtr.h>
+
+#include <hardware/keymaster_defs.h>
+
+#include "lru_cache.h"
+
+namespace keymaster {
+
+struct KeymasterKeyBlob;
+
+/**
+ * Interface for caches of state derived from EvpKeyCache's keys, which must not keep a key alive
+ * once the key cache has let it go.
+ */
+class EvpKeyCacheListener {
+  public:
+    virtual ~EvpKeyCacheListener() {}
+
+    /**
+     * Called when \p pkey is evicted or cleared from the key cache.  Implementations must release
+     * any references they hold to it.
+     */
+    virtual void OnKeyEvicted(EVP_PKEY* pkey) = 0;
+};
+
+/**
+ * EvpKeyCache keeps recently-loaded private keys parsed, so that repeated operations on one key
+ * share a single EVP_PKEY rather than re-parsing the key material on every Begin.  Beyond saving
+ * the parse, this keeps alive the state the crypto library attaches lazily to the key, such as the
+ * RSA Montgomery contexts and blinding parameters.
+ *
+ * Entries are indexed by the SHA-256 digest of the key material, so the cache holds no second
+ * copy of it.  Freeing an evicted EVP_PKEY clears the private key components.  The returned
+ * EVP_PKEYs are reference-counted and may be used from any thread.
+ *
+ * If a listener is given, it is told of each key the cache drops, so that caches layered on top
+ * can drop their references too and the number of private keys held stays bounded by capacity.
+ * The listener is not owned and must outlive the cache.
+ */
+class EvpKeyCache {
+  public:
+    explicit EvpKeyCache(size_t capacity, EvpKeyCacheListener* listener = nullptr)
+        : entries_(capacity), listener_(listener) {}
+
+    /**
+     * Return a new reference to the EVP_PKEY of type \p evp_key_type parsed from the DER-encoded
+     * private key in \p key_material, parsing and caching it if necessary.  The caller must free
+     * the result with EVP_PKEY_free.  Returns null and sets \p error on failure.
+     */
+    EVP_PKEY* Get(int evp_key_type, const KeymasterKeyBlob& key_material,
+                  keymaster_error_t* error);
+
+    /**
+     * Drop all cached keys.  Outstanding references remain valid.
+     */
+    void Clear() { entries_.Clear(); }
+
+    size_t capacity() const { return entries_.capacity(); }
+    size_t size() const { return entries_.size(); }
+    size_t hits() const { return entries_.hits(); }
+    size_t misses() const { return entries_.misses(); }
+
+  private:
+    struct Entry {
+        Entry() : pkey(nullptr), listener(nullptr) {}
+        bool in_use() const { return pkey != nullptr; }
+        void Release();
+
+        EVP_PKEY* pkey;
+        EvpKeyCacheListener* listener;
+        int evp_key_type;
+        uint8_t digest[SHA256_DIGEST_LENGTH];
+        uint64_t last_used;
+    };
+
+    LruCache<Entry> entries_;
+    EvpKeyCacheListener* listener_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_EVP_KEY_CACHE_H_
@@ -16,43 +16,50 @@
 
 #include "hkdf.h"
 
-#include <keymaster/new>
+#include <openssl/sha.h>
 
 #include <keymaster/android_keymaster_utils.h>
 
-#include "hmac.h"
-
 namespace keymaster {
 
-bool Rfc5869Sha256Kdf::GenerateKey(const uint8_t* info, size_t info_len, uint8_t* output,
-                                   size_t output_len) {
-    if (!is_initialized_ || output == nullptr)
-        return false;
+Rfc5869Sha256Kdf::Rfc5869Sha256Kdf() {
+    HMAC_CTX_init(&prk_ctx_);
+}
+
+Rfc5869Sha256Kdf::~Rfc5869Sha256Kdf() {
+    HMAC_CTX_cleanup(&prk_ctx_);
+}
+
+bool Rfc5869Sha256Kdf::PrecomputeSecretState() {
     /**
      * Step 1. Extract: PRK = HMAC-SHA256(actual_salt, secret)
      * https://tools.ietf.org/html/rfc5869#section-2.2
      */
-    HmacSha256 prk_hmac;
-    bool result;
-    if (salt_.get() != nullptr && salt_len_ > 0) {
-        result = prk_hmac.Init(salt_.get(), salt_len_);
-    } else {
-        UniquePtr<uint8_t[]> zeros(new(std::nothrow) uint8_t[digest_size_]);
-        if (zeros.get() == nullptr)
-            return false;
+    uint8_t zeros[SHA256_DIGEST_LENGTH] = {};
+    const uint8_t* salt = salt_.get();
+    size_t salt_len = salt_len_;
+    if (salt == nullptr || salt_len == 0) {
         /* If salt is not given, digest size of zeros are used. */
-        memset(zeros.get(), 0, digest_size_);
-        result = prk_hmac.Init(zeros.get(), digest_size_);
+        salt = zeros;
+        salt_len = sizeof(zeros);
     }
-    if (!result)
-        return false;
 
-    UniquePtr<uint8_t[]> pseudo_random_key(new(std::nothrow) uint8_t[digest_size_]);
-    if (pseudo_random_key.get() == nullptr || digest_size_ != prk_hmac.DigestLength())
+    uint8_t pseudo_random_key[SHA256_DIGEST_LENGTH];
+    Eraser prk_eraser(pseudo_random_key, sizeof(pseudo_random_key));
+    unsigned int prk_len;
+    if (digest_size_ != sizeof(pseudo_random_key) ||
+        !HMAC(EVP_sha256(), salt, salt_len, secret_key_.get(), secret_key_len_, pseudo_random_key,
+              &prk_len) ||
+        prk_len != sizeof(pseudo_random_key))
         return false;
-    result =
-        prk_hmac.Sign(secret_key_.get(), secret_key_len_, pseudo_random_key.get(), digest_size_);
-    if (!result)
+
+    return HMAC_Init_ex(&prk_ctx_, pseudo_random_key, sizeof(pseudo_random_key), EVP_sha256(),
+                        nullptr /* engine */);
+}
+
+bool Rfc5869Sha256Kdf::GenerateKey(const uint8_t* info, size_t info_len, uint8_t* output,
+                                   size_t output_len) {
+    if (!is_initialized_ || output == nullptr)
         return false;
 
     /**
@@ -63,32 +70,23 @@ bool Rfc5869Sha256Kdf::GenerateKey(const uint8_t* info, size_t info_len, uint8_t
     if (num_blocks >= 256u)
         return false;
 
-    UniquePtr<uint8_t[]> buf(new(std::nothrow) uint8_t[digest_size_ + info_len + 1]);
-    UniquePtr<uint8_t[]> digest(new(std::nothrow) uint8_t[digest_size_]);
-    if (buf.get() == nullptr || digest.get() == nullptr)
-        return false;
-    HmacSha256 hmac;
-    result = hmac.Init(pseudo_random_key.get(), digest_size_);
-    if (!result)
-        return false;
-
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    Eraser digest_eraser(digest, sizeof(digest));
     for (size_t i = 0; i < num_blocks; i++) {
-        size_t block_input_len = 0;
-        if (i != 0) {
-            memcpy(buf.get(), digest.get(), digest_size_);
-            block_input_len = digest_size_;
-        }
-        if (info != nullptr && info_len > 0)
-            memcpy(buf.get() + block_input_len, info, info_len);
-        block_input_len += info_len;
-        *(buf.get() + block_input_len++) = static_cast<uint8_t>(i + 1);
-        result = hmac.Sign(buf.get(), block_input_len, digest.get(), digest_size_);
-        if (!result)
+        // Re-initializing without a key restores the keyed state, without hashing the PRK again.
+        uint8_t counter = static_cast<uint8_t>(i + 1);
+        unsigned int digest_len;
+        if (!HMAC_Init_ex(&prk_ctx_, nullptr /* key */, 0, nullptr /* md */, nullptr) ||
+            (i != 0 && !HMAC_Update(&prk_ctx_, digest, sizeof(digest))) ||
+            (info != nullptr && info_len > 0 && !HMAC_Update(&prk_ctx_, info, info_len)) ||
+            !HMAC_Update(&prk_ctx_, &counter, sizeof(counter)) ||
+            !HMAC_Final(&prk_ctx_, digest, &digest_len) || digest_len != sizeof(digest))
             return false;
+
         size_t block_output_len = digest_size_ < output_len - i * digest_size_
                                       ? digest_size_
                                       : output_len - i * digest_size_;
-        memcpy(output + i * digest_size_, digest.get(), block_output_len);
+        memcpy(output + i * digest_size_, digest, block_output_len);
     }
     return true;
 }
@@ -19,6 +19,8 @@
 
 #include "kdf.h"
 
+#include <openssl/hmac.h>
+
 #include <keymaster/serializable.h>
 
 #include <keymaster/UniquePtr.h>
@@ -31,7 +33,9 @@ namespace keymaster {
  */
 class Rfc5869Sha256Kdf : public Kdf {
   public:
-    ~Rfc5869Sha256Kdf() {}
+    Rfc5869Sha256Kdf();
+    ~Rfc5869Sha256Kdf();
+
     bool Init(Buffer& secret, Buffer& salt) {
         return Init(secret.peek_read(), secret.available_read(), salt.peek_read(),
                     salt.available_read());
@@ -43,6 +47,14 @@ class Rfc5869Sha256Kdf : public Kdf {
 
     bool GenerateKey(const uint8_t* info, size_t info_len, uint8_t* output,
                      size_t output_len) override;
+
+  protected:
+    // Runs the extract step, which depends only on the secret and salt, and keys prk_ctx_ with its
+    // result for the expand steps of every GenerateKey.
+    bool PrecomputeSecretState() override;
+
+  private:
+    HMAC_CTX prk_ctx_;
 };
 
 }  // namespace keymaster
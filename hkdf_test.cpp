@@ -74,5 +74,33 @@ TEST(HkdfTest, Hkdf) {
     }
 }
 
+TEST(HkdfTest, GenerateKeysMatchesGenerateKey) {
+    const string key = hex2str(kHkdfTests[0].key_hex);
+    const string salt = hex2str(kHkdfTests[0].salt_hex);
+    Rfc5869Sha256Kdf hkdf;
+    ASSERT_TRUE(hkdf.Init(reinterpret_cast<const uint8_t*>(key.data()), key.size(),
+                          reinterpret_cast<const uint8_t*>(salt.data()), salt.size()));
+
+    const char* infos[] = {"", "first", "second, rather longer than a digest block"};
+    const size_t count = sizeof(infos) / sizeof(infos[0]);
+    const size_t output_len = 42;
+    keymaster_blob_t info_blobs[count];
+    for (size_t i = 0; i < count; ++i)
+        info_blobs[i] = {reinterpret_cast<const uint8_t*>(infos[i]), strlen(infos[i])};
+
+    uint8_t outputs[count * output_len];
+    ASSERT_TRUE(hkdf.GenerateKeys(info_blobs, count, outputs, output_len));
+
+    // Each derivation restarts from the state Init computed, so repeating them one at a time
+    // gives the same keys.
+    for (size_t i = 0; i < count; ++i) {
+        uint8_t output[output_len];
+        ASSERT_TRUE(hkdf.GenerateKey(info_blobs[i].data, info_blobs[i].data_length, output,
+                                     output_len));
+        EXPECT_EQ(0, memcmp(output, outputs + i * output_len, output_len));
+    }
+    EXPECT_NE(0, memcmp(outputs, outputs + output_len, output_len));
+}
+
 }  // namespace test
 }  // namespace keymaster
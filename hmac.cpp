@@ -27,6 +27,16 @@
 
 namespace keymaster {
 
+HmacSha256::HmacSha256() : initialized_(false) {
+    HMAC_CTX_init(&key_ctx_);
+    HMAC_CTX_init(&ctx_);
+}
+
+HmacSha256::~HmacSha256() {
+    HMAC_CTX_cleanup(&ctx_);
+    HMAC_CTX_cleanup(&key_ctx_);
+}
+
 size_t HmacSha256::DigestLength() const {
     return SHA256_DIGEST_LENGTH;
 }
@@ -36,14 +46,13 @@ bool HmacSha256::Init(const Buffer& key) {
 }
 
 bool HmacSha256::Init(const uint8_t* key, size_t key_len) {
-    if (!key)
+    if (!key || initialized_)
         return false;
 
-    key_len_ = key_len;
-    key_.reset(dup_buffer(key, key_len));
-    if (!key_.get()) {
+    if (!HMAC_Init_ex(&key_ctx_, key, key_len, EVP_sha256(), nullptr /* engine */) ||
+        !HMAC_Init_ex(&ctx_, key, key_len, EVP_sha256(), nullptr /* engine */))
         return false;
-    }
+    initialized_ = true;
     return true;
 }
 
@@ -54,19 +63,20 @@ bool HmacSha256::Sign(const Buffer& data, uint8_t* out_digest, size_t digest_len
 bool HmacSha256::Sign(const uint8_t* data, size_t data_len, uint8_t* out_digest,
                       size_t digest_len) const {
     assert(digest_len);
-
-    uint8_t tmp[SHA256_DIGEST_LENGTH];
-    uint8_t* digest = tmp;
-    if (digest_len >= SHA256_DIGEST_LENGTH)
-        digest = out_digest;
-
-    if (nullptr == ::HMAC(EVP_sha256(), key_.get(), key_len_, data, data_len, digest, nullptr)) {
+    if (!initialized_)
         return false;
-    }
-    if (digest_len < SHA256_DIGEST_LENGTH)
-        memcpy(out_digest, tmp, digest_len);
 
-    return true;
+    HMAC_CTX ctx;
+    HMAC_CTX_init(&ctx);
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    unsigned int computed_len;
+    bool result = HMAC_CTX_copy_ex(&ctx, &key_ctx_) && HMAC_Update(&ctx, data, data_len) &&
+                  HMAC_Final(&ctx, digest, &computed_len);
+    HMAC_CTX_cleanup(&ctx);
+    if (result)
+        memcpy(out_digest, digest, digest_len < sizeof(digest) ? digest_len : sizeof(digest));
+    memset_s(digest, 0, sizeof(digest));
+    return result;
 }
 
 bool HmacSha256::Verify(const Buffer& data, const Buffer& digest) const {
@@ -86,4 +96,36 @@ bool HmacSha256::Verify(const uint8_t* data, size_t data_len, const uint8_t* dig
     return 0 == CRYPTO_memcmp(digest, computed_digest, SHA256_DIGEST_LENGTH);
 }
 
+bool HmacSha256::Update(const Buffer& data) {
+    return Update(data.peek_read(), data.available_read());
+}
+
+bool HmacSha256::Update(const uint8_t* data, size_t data_len) {
+    return initialized_ && HMAC_Update(&ctx_, data, data_len);
+}
+
+bool HmacSha256::Final(uint8_t* out_digest, size_t digest_len) {
+    assert(digest_len);
+    if (!initialized_)
+        return false;
+
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    unsigned int computed_len;
+    bool result = HMAC_Final(&ctx_, digest, &computed_len);
+    if (result)
+        memcpy(out_digest, digest, digest_len < sizeof(digest) ? digest_len : sizeof(digest));
+    memset_s(digest, 0, sizeof(digest));
+
+    // Re-initializing without a key restores the keyed state for the next computation.
+    return HMAC_Init_ex(&ctx_, nullptr /* key */, 0, nullptr /* md */, nullptr) && result;
+}
+
+bool HmacSha256::FinalVerify(const uint8_t* digest, size_t digest_len) {
+    uint8_t computed_digest[SHA256_DIGEST_LENGTH];
+    if (!Final(computed_digest, sizeof(computed_digest)) || digest_len != SHA256_DIGEST_LENGTH)
+        return false;
+
+    return 0 == CRYPTO_memcmp(digest, computed_digest, SHA256_DIGEST_LENGTH);
+}
+
 }  // namespace keymaster
@@ -17,6 +17,8 @@
 #ifndef SYSTEM_KEYMASTER_HMAC_H_
 #define SYSTEM_KEYMASTER_HMAC_H_
 
+#include <openssl/hmac.h>
+
 #include <keymaster/serializable.h>
 
 namespace keymaster {
@@ -24,13 +26,15 @@ namespace keymaster {
 // Only HMAC-SHA256 is supported.
 class HmacSha256 {
   public:
-    HmacSha256(){};
+    HmacSha256();
+    ~HmacSha256();
 
     // DigestLength returns the length, in bytes, of the resulting digest.
     size_t DigestLength() const;
 
     // Initializes this instance using |key|. Call Init only once. It returns
-    // false on the second of later calls.
+    // false on the second of later calls. The key is processed once here, so
+    // later MACs start from the keyed hash state rather than from the key.
     bool Init(const uint8_t* key, size_t key_length);
     bool Init(const Buffer& key);
 
@@ -50,9 +54,30 @@ class HmacSha256 {
     bool Verify(const uint8_t* data, size_t data_len, const uint8_t* digest,
                 size_t digest_len) const;
 
+    // Update adds |data| to an incremental MAC computation, so that input held
+    // in several pieces can be MACed without first being copied together. A
+    // computation starts with the first Update after Init or after the
+    // previous Final.
+    bool Update(const Buffer& data);
+    bool Update(const uint8_t* data, size_t data_len);
+
+    // Final completes the incremental computation, writing at most
+    // |digest_len| bytes of the digest to |digest|, and readies the instance
+    // for the next one.
+    bool Final(uint8_t* digest, size_t digest_len);
+
+    // FinalVerify completes the incremental computation like Final, and
+    // returns true if |digest| is the resulting MAC. As with Verify, |digest|
+    // must be exactly |DigestLength()| bytes long.
+    bool FinalVerify(const uint8_t* digest, size_t digest_len);
+
   private:
-    UniquePtr<uint8_t[]> key_;
-    size_t key_len_;
+    HmacSha256(const HmacSha256&);
+    void operator=(const HmacSha256&);
+
+    bool initialized_;
+    HMAC_CTX key_ctx_;  // Keyed, with no data; copied by Sign.
+    HMAC_CTX ctx_;      // The incremental computation.
 };
 
 }  // namespace keymaster
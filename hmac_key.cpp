@@ -28,6 +28,12 @@ namespace keymaster {
 static HmacSignOperationFactory sign_factory;
 static HmacVerifyOperationFactory verify_factory;
 
+HmacKeyFactory::HmacKeyFactory(const KeymasterContext* context)
+    : SymmetricKeyFactory(context),
+      context_cache_(new (std::nothrow) HmacContextCache(kHmacContextCacheSize)) {}
+
+HmacKeyFactory::~HmacKeyFactory() {}
+
 OperationFactory* HmacKeyFactory::GetOperationFactory(keymaster_purpose_t purpose) const {
     switch (purpose) {
     case KM_PURPOSE_SIGN:
@@ -55,7 +61,8 @@ keymaster_error_t HmacKeyFactory::LoadKey(const KeymasterKeyBlob& key_material,
     }
 
     keymaster_error_t error;
-    key->reset(new (std::nothrow) HmacKey(key_material, hw_enforced, sw_enforced, &error));
+    key->reset(new (std::nothrow)
+                   HmacKey(key_material, hw_enforced, sw_enforced, &error, context_cache_.get()));
     if (!key->get())
         error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
     return error;
@@ -25,9 +25,15 @@ const size_t kMinHmacLengthBits = 64;
 const size_t kMinHmacKeyLengthBits = 64;
 const size_t kMaxHmacKeyLengthBits = 2048;  // Some RFC test cases require >1024-bit keys
 
+// Number of keyed HMAC contexts retained by each HmacKeyFactory.
+const size_t kHmacContextCacheSize = 16;
+
+class HmacContextCache;
+
 class HmacKeyFactory : public SymmetricKeyFactory {
   public:
-    explicit HmacKeyFactory(const KeymasterContext* context) : SymmetricKeyFactory(context) {}
+    explicit HmacKeyFactory(const KeymasterContext* context);
+    ~HmacKeyFactory();
 
     keymaster_error_t LoadKey(const KeymasterKeyBlob& key_material,
                               const AuthorizationSet& additional_params,
@@ -44,13 +50,26 @@ class HmacKeyFactory : public SymmetricKeyFactory {
     }
     keymaster_error_t validate_algorithm_specific_new_key_params(
         const AuthorizationSet& key_description) const override;
+
+    UniquePtr<HmacContextCache> context_cache_;
 };
 
 class HmacKey : public SymmetricKey {
   public:
     HmacKey(const KeymasterKeyBlob& key_material, const AuthorizationSet& hw_enforced,
-            const AuthorizationSet& sw_enforced, keymaster_error_t* error)
-        : SymmetricKey(key_material, hw_enforced, sw_enforced, error) {}
+            const AuthorizationSet& sw_enforced, keymaster_error_t* error,
+            HmacContextCache* context_cache = nullptr)
+        : SymmetricKey(key_material, hw_enforced, sw_enforced, error),
+          context_cache_(context_cache) {}
+
+    /**
+     * Returns the cache of keyed HMAC contexts shared by keys from the same factory, or null if
+     * operations must key their contexts from scratch.  The cache outlives the key.
+     */
+    HmacContextCache* context_cache() const { return context_cache_; }
+
+  private:
+    HmacContextCache* context_cache_;
 };
 
 }  // namespace keymaster
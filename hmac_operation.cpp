@@ -16,6 +16,7 @@
 
 #include "hmac_operation.h"
 
+#include <keymaster/android_keymaster_utils.h>
 #include <keymaster/new>
 
 #include <openssl/evp.h>
@@ -65,10 +66,10 @@ Operation* HmacOperationFactory::CreateOperation(const Key& key,
         return nullptr;
     }
 
-    const SymmetricKey* symmetric_key = static_cast<const SymmetricKey*>(&key);
+    const HmacKey* hmac_key = static_cast<const HmacKey*>(&key);
     UniquePtr<HmacOperation> op(new (std::nothrow) HmacOperation(
-        purpose(), symmetric_key->key_data(), symmetric_key->key_data_size(), digest,
-        mac_length_bits / 8, min_mac_length_bits / 8));
+        purpose(), hmac_key->key_data(), hmac_key->key_data_size(), digest, mac_length_bits / 8,
+        min_mac_length_bits / 8, hmac_key->context_cache()));
     if (!op.get())
         *error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
     else
@@ -88,9 +89,58 @@ const keymaster_digest_t* HmacOperationFactory::SupportedDigests(size_t* digest_
     return supported_digests;
 }
 
+void HmacContextCache::Entry::Release() {
+    // HMAC_CTX_cleanup cleanses the pad midstates before freeing them.
+    HMAC_CTX_cleanup(&ctx);
+    HMAC_CTX_init(&ctx);
+    memset_s(key, 0, sizeof(key));
+    key_size = 0;
+    md = nullptr;
+}
+
+keymaster_error_t HmacContextCache::InitializeContext(const uint8_t* key, size_t key_size,
+                                                      const EVP_MD* md, HMAC_CTX* ctx) {
+    if (key_size > sizeof(Entry::key)) {
+        // Too long to cache; key the context directly.
+        if (!HMAC_Init_ex(ctx, key, key_size, md, NULL /* engine */))
+            return TranslateLastOpenSslError();
+        return KM_ERROR_OK;
+    }
+
+    Entry* entry = entries_.Find([&](const Entry& candidate) {
+        return candidate.md == md && candidate.key_size == key_size &&
+               memcmp_s(candidate.key, key, key_size) == 0;
+    });
+    if (entry) {
+        entries_.RecordHit();
+    } else {
+        entries_.RecordMiss();
+        entry = entries_.Evict();
+        if (!entry) {
+            // No room to cache anything; key the context directly.
+            if (!HMAC_Init_ex(ctx, key, key_size, md, NULL /* engine */))
+                return TranslateLastOpenSslError();
+            return KM_ERROR_OK;
+        }
+
+        if (!HMAC_Init_ex(&entry->ctx, key, key_size, md, NULL /* engine */)) {
+            entry->Release();
+            return TranslateLastOpenSslError();
+        }
+        memcpy(entry->key, key, key_size);
+        entry->key_size = key_size;
+        entry->md = md;
+    }
+
+    // HMAC_CTX_copy initializes its destination, so ctx must not hold any state yet.
+    if (!HMAC_CTX_copy(ctx, &entry->ctx))
+        return TranslateLastOpenSslError();
+    return KM_ERROR_OK;
+}
+
 HmacOperation::HmacOperation(keymaster_purpose_t purpose, const uint8_t* key_data,
                              size_t key_data_size, keymaster_digest_t digest, size_t mac_length,
-                             size_t min_mac_length)
+                             size_t min_mac_length, HmacContextCache* context_cache)
     : Operation(purpose), error_(KM_ERROR_OK), mac_length_(mac_length),
       min_mac_length_(min_mac_length) {
     // Initialize CTX first, so dtor won't crash even if we error out later.
@@ -135,7 +185,10 @@ HmacOperation::HmacOperation(keymaster_purpose_t purpose, const uint8_t* key_dat
         }
     }
 
-    HMAC_Init_ex(&ctx_, key_data, key_data_size, md, NULL /* engine */);
+    if (context_cache)
+        error_ = context_cache->InitializeContext(key_data, key_data_size, md, &ctx_);
+    else
+        HMAC_Init_ex(&ctx_, key_data, key_data_size, md, NULL /* engine */);
 }
 
 HmacOperation::~HmacOperation() {
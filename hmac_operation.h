@@ -21,12 +21,60 @@
 
 #include <openssl/hmac.h>
 
+#include "hmac_key.h"
+#include "lru_cache.h"
+
 namespace keymaster {
 
+/**
+ * HmacContextCache holds keyed HMAC_CTX templates for recently-used HMAC keys, indexed by (key,
+ * digest).  Copying a template into a new operation's context avoids hashing long keys and
+ * recomputing the inner and outer pad midstates on every Begin, which dominates the cost of MACing
+ * short messages.  Entries are wiped on eviction and when the cache is destroyed.
+ */
+class HmacContextCache {
+  public:
+    explicit HmacContextCache(size_t capacity) : entries_(capacity) {}
+
+    /**
+     * Initialize \p ctx for computing HMACs with \p md and the specified key, building and caching
+     * a template if none exists.  \p ctx must have been initialized with HMAC_CTX_init and not
+     * otherwise used.
+     */
+    keymaster_error_t InitializeContext(const uint8_t* key, size_t key_size, const EVP_MD* md,
+                                        HMAC_CTX* ctx);
+
+    /**
+     * Wipe and discard all cached templates.
+     */
+    void Clear() { entries_.Clear(); }
+
+    size_t capacity() const { return entries_.capacity(); }
+    size_t size() const { return entries_.size(); }
+    size_t hits() const { return entries_.hits(); }
+    size_t misses() const { return entries_.misses(); }
+
+  private:
+    struct Entry {
+        Entry() : md(nullptr), key_size(0) { HMAC_CTX_init(&ctx); }
+        bool in_use() const { return md != nullptr; }
+        void Release();
+
+        const EVP_MD* md;
+        size_t key_size;
+        uint8_t key[kMaxHmacKeyLengthBits / 8];
+        uint64_t last_used;
+        HMAC_CTX ctx;
+    };
+
+    LruCache<Entry> entries_;
+};
+
 class HmacOperation : public Operation {
   public:
     HmacOperation(keymaster_purpose_t purpose, const uint8_t* key_data, size_t key_data_size,
-                  keymaster_digest_t digest, size_t mac_length, size_t min_mac_length);
+                  keymaster_digest_t digest, size_t mac_length, size_t min_mac_length,
+                  HmacContextCache* context_cache = nullptr);
     ~HmacOperation();
 
     virtual keymaster_error_t Begin(const AuthorizationSet& input_params,
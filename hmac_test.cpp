@@ -19,6 +19,8 @@
 #include <gtest/gtest.h>
 #include <string.h>
 
+#include <openssl/sha.h>
+
 #include "android_keymaster_test_utils.h"
 
 using std::string;
@@ -80,5 +82,58 @@ TEST(HmacTest, SHA256) {
     }
 }
 
+TEST(HmacTest, IncrementalMatchesOneShot) {
+    for (const HmacTest& test : kHmacTests) {
+        HmacSha256 hmac;
+        const string key = hex2str(test.key);
+        ASSERT_TRUE(hmac.Init(reinterpret_cast<const uint8_t*>(key.data()), key.size()));
+
+        const uint8_t* data = reinterpret_cast<const uint8_t*>(test.data);
+        size_t data_len = strlen(test.data);
+        uint8_t one_shot[SHA256_DIGEST_LENGTH];
+        ASSERT_TRUE(hmac.Sign(data, data_len, one_shot, sizeof(one_shot)));
+        EXPECT_EQ(0, memcmp(test.digest, one_shot, sizeof(one_shot)));
+
+        // Every two-piece split of the data, one computation after another on the same instance.
+        for (size_t split = 0; split <= data_len; ++split) {
+            uint8_t digest[SHA256_DIGEST_LENGTH];
+            ASSERT_TRUE(hmac.Update(data, split));
+            ASSERT_TRUE(hmac.Update(data + split, data_len - split));
+            ASSERT_TRUE(hmac.Final(digest, sizeof(digest)));
+            EXPECT_EQ(0, memcmp(one_shot, digest, sizeof(digest))) << "split at " << split;
+        }
+
+        // Byte at a time, with a truncated output.
+        for (size_t i = 0; i < data_len; ++i)
+            ASSERT_TRUE(hmac.Update(data + i, 1));
+        uint8_t truncated[16];
+        ASSERT_TRUE(hmac.Final(truncated, sizeof(truncated)));
+        EXPECT_EQ(0, memcmp(one_shot, truncated, sizeof(truncated)));
+
+        ASSERT_TRUE(hmac.Update(data, data_len));
+        EXPECT_TRUE(hmac.FinalVerify(test.digest, sizeof(test.digest)));
+
+        uint8_t bad_digest[SHA256_DIGEST_LENGTH];
+        memcpy(bad_digest, test.digest, sizeof(bad_digest));
+        bad_digest[16] ^= 0x80;
+        ASSERT_TRUE(hmac.Update(data, data_len));
+        EXPECT_FALSE(hmac.FinalVerify(bad_digest, sizeof(bad_digest)));
+
+        // The failed verification left the instance ready for the next computation.
+        ASSERT_TRUE(hmac.Update(data, data_len));
+        EXPECT_TRUE(hmac.FinalVerify(test.digest, sizeof(test.digest)));
+    }
+}
+
+TEST(HmacTest, InitOnlyOnce) {
+    HmacSha256 hmac;
+    uint8_t digest[SHA256_DIGEST_LENGTH];
+    EXPECT_FALSE(hmac.Update(reinterpret_cast<const uint8_t*>("a"), 1));
+    EXPECT_FALSE(hmac.Sign(reinterpret_cast<const uint8_t*>("a"), 1, digest, sizeof(digest)));
+
+    ASSERT_TRUE(hmac.Init(reinterpret_cast<const uint8_t*>("key"), 3));
+    EXPECT_FALSE(hmac.Init(reinterpret_cast<const uint8_t*>("key"), 3));
+}
+
 }  // namespace test
 }  // namespace keymaster
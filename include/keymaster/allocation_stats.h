@@ -0,0 +1,97 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_ALLOCATION_STATS_H_
+#define SYSTEM_KEYMASTER_ALLOCATION_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace keymaster {
+
+/*
+ * Heap allocation accounting, kept by the operator new and delete overrides in keymaster_stl.cpp.
+ * Counting is compiled in only when KEYMASTER_ALLOCATION_STATS is defined; otherwise every count
+ * stays zero and AllocationScope compiles away.  Counts are kept per thread, so they cover only the
+ * allocations made by the calling thread.  Allocations BoringSSL makes with malloc directly are
+ * not counted.
+ */
+
+const size_t kAllocationSizeBuckets = 16;
+
+struct AllocationStats {
+    uint64_t allocations;
+    uint64_t frees;
+    uint64_t bytes_allocated;
+    /**
+     * size_histogram[i] counts allocations of 2^i to 2^(i+1) - 1 bytes.  Bucket 0 also counts
+     * zero-byte allocations and the last bucket counts everything larger.
+     */
+    uint64_t size_histogram[kAllocationSizeBuckets];
+};
+
+inline bool allocation_stats_enabled() {
+#ifdef KEYMASTER_ALLOCATION_STATS
+    return true;
+#else
+    return false;
+#endif
+}
+
+/**
+ * Copy the counts of the calling thread into \p stats.
+ */
+void GetThreadAllocationStats(AllocationStats* stats);
+void ResetThreadAllocationStats();
+
+/**
+ * A reporter is called as each AllocationScope ends, with the scope's name and the allocations made
+ * within it.  Install it before any scope is entered; it may be called from any thread.
+ */
+typedef void (*AllocationReporter)(const char* scope_name, const AllocationStats& stats);
+void SetAllocationReporter(AllocationReporter reporter);
+
+/**
+ * AllocationScope measures the allocations the current thread makes during its lifetime, such as
+ * those made while handling one request.  Scopes may be nested.
+ */
+#ifdef KEYMASTER_ALLOCATION_STATS
+class AllocationScope {
+  public:
+    explicit AllocationScope(const char* name);
+    ~AllocationScope();
+
+    /**
+     * Store in \p stats the allocations made on this thread since the scope was entered.
+     */
+    void GetStats(AllocationStats* stats) const;
+
+  private:
+    const char* name_;
+    AllocationStats start_;
+};
+#else   // KEYMASTER_ALLOCATION_STATS
+class AllocationScope {
+  public:
+    explicit AllocationScope(const char* /* name */) {}
+
+    void GetStats(AllocationStats* stats) const { *stats = AllocationStats(); }
+};
+#endif  // KEYMASTER_ALLOCATION_STATS
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_ALLOCATION_STATS_H_
@@ -25,7 +25,10 @@ namespace keymaster {
 class Key;
 class KeyFactory;
 class KeymasterContext;
+class LatencyStats;
+class Operation;
 class OperationTable;
+class RequestTimer;
 
 /**
  * This is the reference implementation of Keymaster.  In addition to acting as a reference for
@@ -80,16 +83,59 @@ class AndroidKeymaster {
     void FinishOperation(const FinishOperationRequest& request, FinishOperationResponse* response);
     void AbortOperation(const AbortOperationRequest& request, AbortOperationResponse* response);
 
+    /**
+     * Report the latency of the requests handled so far, per entry point and per phase, labeled by
+     * algorithm, purpose and block mode where those apply.  Measurement needs a context with a
+     * monotonic clock; see KeymasterContext::GetMonotonicTimeNs.  FormatLatencyStats renders the
+     * response as text.
+     */
+    void GetLatencyStats(const GetLatencyStatsRequest& request, GetLatencyStatsResponse* response);
+
     bool has_operation(keymaster_operation_handle_t op_handle) const;
 
+    /**
+     * Load the key in \p key_blob and create an operation for \p purpose with \p begin_params,
+     * applying every check BeginOperation applies, but neither begin the operation nor add it to the
+     * operation table.  This lets batch front-ends validate a request once and then run many
+     * operations on the key themselves.
+     */
+    keymaster_error_t PrepareOperation(const keymaster_key_blob_t& key_blob,
+                                       keymaster_purpose_t purpose,
+                                       const AuthorizationSet& begin_params, UniquePtr<Key>* key,
+                                       UniquePtr<Operation>* operation);
+
+    /**
+     * Load the key in \p key_blob and its authorizations for attestation with \p attest_params,
+     * exactly as AttestKey loads them, but generate no certificates.  This lets batch front-ends
+     * attest many keys while loading the attestation signing key and chain only once.
+     */
+    keymaster_error_t PrepareAttestation(const keymaster_key_blob_t& key_blob,
+                                         const AuthorizationSet& attest_params,
+                                         UniquePtr<Key>* key, AuthorizationSet* tee_enforced,
+                                         AuthorizationSet* sw_enforced);
+
+    const KeymasterContext& context() const { return *context_.get(); }
+
   private:
+    // As the public versions, timing the phases of the request in \p timer, which may be null.
+    keymaster_error_t PrepareOperation(const keymaster_key_blob_t& key_blob,
+                                       keymaster_purpose_t purpose,
+                                       const AuthorizationSet& begin_params, UniquePtr<Key>* key,
+                                       UniquePtr<Operation>* operation, RequestTimer* timer);
+    keymaster_error_t PrepareAttestation(const keymaster_key_blob_t& key_blob,
+                                         const AuthorizationSet& attest_params,
+                                         UniquePtr<Key>* key, AuthorizationSet* tee_enforced,
+                                         AuthorizationSet* sw_enforced, RequestTimer* timer);
+
     keymaster_error_t LoadKey(const keymaster_key_blob_t& key_blob,
                               const AuthorizationSet& additional_params,
                               AuthorizationSet* hw_enforced, AuthorizationSet* sw_enforced,
-                              const KeyFactory** factory, UniquePtr<Key>* key);
+                              const KeyFactory** factory, UniquePtr<Key>* key,
+                              RequestTimer* timer);
 
     UniquePtr<KeymasterContext> context_;
     UniquePtr<OperationTable> operation_table_;
+    UniquePtr<LatencyStats> latency_stats_;
 };
 
 }  // namespace keymaster
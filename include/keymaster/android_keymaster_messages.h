@@ -47,6 +47,7 @@ enum AndroidKeymasterCommand {
     ATTEST_KEY = 16,
     UPGRADE_KEY = 17,
     CONFIGURE = 18,
+    GET_LATENCY_STATS = 19,
 };
 
 /**
@@ -680,6 +681,65 @@ struct ConfigureResponse : public KeymasterResponse {
     bool NonErrorDeserialize(const uint8_t**, const uint8_t*) override { return true; }
 };
 
+struct GetLatencyStatsRequest : public KeymasterMessage {
+    explicit GetLatencyStatsRequest(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterMessage(ver), reset(false) {}
+
+    size_t SerializedSize() const override { return sizeof(uint32_t); }
+    uint8_t* Serialize(uint8_t* buf, const uint8_t* end) const override {
+        return append_uint32_to_buf(buf, end, reset ? 1 : 0);
+    }
+    bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) override {
+        uint32_t value;
+        if (!copy_uint32_from_buf(buf_ptr, end, &value))
+            return false;
+        reset = value != 0;
+        return true;
+    }
+
+    // If true, the statistics are cleared once they have been copied into the response.
+    bool reset;
+};
+
+// Stands in for a label that doesn't apply to a latency measurement, or wasn't known.
+const uint32_t kNoLatencyLabel = 0xFFFFFFFF;
+
+/**
+ * The latency of one entry point, or of one phase within it, for one combination of labels.  See
+ * LatencyStats.  Percentiles are accurate to the histogram's bucket width, about 6%.
+ */
+struct LatencySummary {
+    uint32_t entry_point;  // LatencyStats::EntryPoint
+    uint32_t phase;        // LatencyStats::Phase
+    uint32_t algorithm;    // keymaster_algorithm_t, or kNoLatencyLabel
+    uint32_t purpose;      // keymaster_purpose_t, or kNoLatencyLabel
+    uint32_t block_mode;   // keymaster_block_mode_t, or kNoLatencyLabel
+    uint64_t count;
+    uint64_t total_ns;
+    uint64_t max_ns;
+    uint64_t p50_ns;
+    uint64_t p90_ns;
+    uint64_t p99_ns;
+    uint64_t p999_ns;
+};
+
+struct GetLatencyStatsResponse : public KeymasterResponse {
+    explicit GetLatencyStatsResponse(int32_t ver = MAX_MESSAGE_VERSION)
+        : KeymasterResponse(ver), summaries(nullptr), summary_count(0), dropped(0) {}
+    ~GetLatencyStatsResponse() { delete[] summaries; }
+
+    bool AllocateSummaries(size_t count);
+
+    size_t NonErrorSerializedSize() const override;
+    uint8_t* NonErrorSerialize(uint8_t* buf, const uint8_t* end) const override;
+    bool NonErrorDeserialize(const uint8_t** buf_ptr, const uint8_t* end) override;
+
+    LatencySummary* summaries;
+    size_t summary_count;
+    // Measurements not recorded because the statistics had no room for another series.
+    uint64_t dropped;
+};
+
 }  // namespace keymaster
 
 #endif  // SYSTEM_KEYMASTER_ANDROID_KEYMASTER_MESSAGES_H_
@@ -214,48 +214,108 @@ template <typename T> T hton(T t) {
     return retval;
 }
 
+/**
+ * A source of storage for key material, in place of the heap.  See SetKeyMaterialAllocator.
+ */
+class KeyMaterialAllocator {
+  public:
+    virtual ~KeyMaterialAllocator() {}
+
+    /**
+     * Return \p size bytes, or null to have the caller fall back to the heap.
+     */
+    virtual uint8_t* Allocate(size_t size) = 0;
+
+    /**
+     * If \p material was returned by Allocate, wipe and release it and return true.  Otherwise
+     * return false.
+     */
+    virtual bool Free(uint8_t* material) = 0;
+};
+
+/**
+ * Draw key material allocated from now on from \p allocator, which must outlive everything it
+ * allocates, and return the allocator it replaces.  Storage allocated before the call is still
+ * released correctly.  Install the allocator before any requests are handled; it is read without
+ * locking.
+ */
+KeyMaterialAllocator* SetKeyMaterialAllocator(KeyMaterialAllocator* allocator);
+
+/**
+ * Allocate \p size bytes for key material, from the installed KeyMaterialAllocator if there is
+ * one and it has room, otherwise from the heap.  Returns null if allocation fails.  \p allocator
+ * is set to the allocator the storage came from, or null for the heap, and must be passed back
+ * when the storage is freed or released.
+ */
+uint8_t* AllocateKeyMaterial(size_t size, KeyMaterialAllocator** allocator);
+
+/**
+ * Copy \p size bytes at \p data into storage from AllocateKeyMaterial.
+ */
+uint8_t* DuplicateKeyMaterial(const void* data, size_t size, KeyMaterialAllocator** allocator);
+
+/**
+ * Wipe the \p size bytes at \p material and release them.  \p material may be null, storage
+ * from AllocateKeyMaterial with the \p allocator it returned, or storage from new[] with a null
+ * \p allocator.
+ */
+void FreeKeyMaterial(const uint8_t* material, size_t size, KeyMaterialAllocator* allocator);
+
+/**
+ * Give up the \p size bytes of key material at \p material, returning them in storage which the
+ * caller must release with delete[].  Key material from \p allocator is moved to the heap, and if
+ * that fails it is freed and null is returned.
+ */
+uint8_t* ReleaseKeyMaterial(const uint8_t* material, size_t size,
+                            KeyMaterialAllocator* allocator);
+
 /**
  * KeymasterKeyBlob is a very simple extension of the C struct keymaster_key_blob_t.  It manages its
- * own memory, which makes avoiding memory leaks much easier.
+ * own memory, which makes avoiding memory leaks much easier.  The memory comes from
+ * AllocateKeyMaterial and is wiped when it is released.
  */
 struct KeymasterKeyBlob : public keymaster_key_blob_t {
-    KeymasterKeyBlob() {
+    KeymasterKeyBlob() : allocator_(nullptr) {
         key_material = nullptr;
         key_material_size = 0;
     }
 
     KeymasterKeyBlob(const uint8_t* data, size_t size) {
         key_material_size = 0;
-        key_material = dup_buffer(data, size);
+        key_material = DuplicateKeyMaterial(data, size, &allocator_);
         if (key_material)
             key_material_size = size;
     }
 
     explicit KeymasterKeyBlob(size_t size) {
         key_material_size = 0;
-        key_material = new (std::nothrow) uint8_t[size];
+        key_material = AllocateKeyMaterial(size, &allocator_);
         if (key_material)
             key_material_size = size;
     }
 
     explicit KeymasterKeyBlob(const keymaster_key_blob_t& blob) {
         key_material_size = 0;
-        key_material = dup_buffer(blob.key_material, blob.key_material_size);
+        key_material =
+            DuplicateKeyMaterial(blob.key_material, blob.key_material_size, &allocator_);
         if (key_material)
             key_material_size = blob.key_material_size;
     }
 
     KeymasterKeyBlob(const KeymasterKeyBlob& blob) {
         key_material_size = 0;
-        key_material = dup_buffer(blob.key_material, blob.key_material_size);
+        key_material =
+            DuplicateKeyMaterial(blob.key_material, blob.key_material_size, &allocator_);
         if (key_material)
             key_material_size = blob.key_material_size;
     }
 
     void operator=(const KeymasterKeyBlob& blob) {
         Clear();
-        key_material = dup_buffer(blob.key_material, blob.key_material_size);
-        key_material_size = blob.key_material_size;
+        key_material =
+            DuplicateKeyMaterial(blob.key_material, blob.key_material_size, &allocator_);
+        if (key_material)
+            key_material_size = blob.key_material_size;
     }
 
     ~KeymasterKeyBlob() { Clear(); }
@@ -264,15 +324,15 @@ struct KeymasterKeyBlob : public keymaster_key_blob_t {
     const uint8_t* end() const { return key_material + key_material_size; }
 
     void Clear() {
-        memset_s(const_cast<uint8_t*>(key_material), 0, key_material_size);
-        delete[] key_material;
+        FreeKeyMaterial(key_material, key_material_size, allocator_);
         key_material = nullptr;
         key_material_size = 0;
+        allocator_ = nullptr;
     }
 
     const uint8_t* Reset(size_t new_size) {
         Clear();
-        key_material = new (std::nothrow) uint8_t[new_size];
+        key_material = AllocateKeyMaterial(new_size, &allocator_);
         if (key_material)
             key_material_size = new_size;
         return key_material;
@@ -283,10 +343,16 @@ struct KeymasterKeyBlob : public keymaster_key_blob_t {
     // version of the pointer.  Use sparingly.
     uint8_t* writable_data() { return const_cast<uint8_t*>(key_material); }
 
+    // Returns the key material in storage the caller must delete[], or null with size zero if
+    // moving it there fails.
     keymaster_key_blob_t release() {
-        keymaster_key_blob_t tmp = {key_material, key_material_size};
+        keymaster_key_blob_t tmp = {
+            ReleaseKeyMaterial(key_material, key_material_size, allocator_), key_material_size};
+        if (!tmp.key_material)
+            tmp.key_material_size = 0;
         key_material = nullptr;
         key_material_size = 0;
+        allocator_ = nullptr;
         return tmp;
     }
 
@@ -297,15 +363,33 @@ struct KeymasterKeyBlob : public keymaster_key_blob_t {
 
     bool Deserialize(const uint8_t** buf_ptr, const uint8_t* end) {
         Clear();
-        UniquePtr<uint8_t[]> tmp;
-        if (!copy_size_and_data_from_buf(buf_ptr, end, &key_material_size, &tmp)) {
-            key_material = nullptr;
-            key_material_size = 0;
+        uint32_t size;
+        if (!copy_uint32_from_buf(buf_ptr, end, &size) ||
+            static_cast<size_t>(end - *buf_ptr) < size)
             return false;
-        }
-        key_material = tmp.release();
+        if (size == 0)
+            return true;
+        if (!Reset(size))
+            return false;
+        memcpy(writable_data(), *buf_ptr, size);
+        *buf_ptr += size;
         return true;
     }
+
+  protected:
+    // Where key_material came from; null for the heap, including storage assigned directly to
+    // key_material.
+    KeyMaterialAllocator* allocator_;
+};
+
+/**
+ * A KeymasterKeyBlob over key material that belongs to someone else, for handing a caller's
+ * keymaster_key_blob_t to code that takes a KeymasterKeyBlob, without copying it.  The blob never
+ * wipes or frees the material, and release() returns a copy.  The material must outlive the blob
+ * and must not be written through writable_data().
+ */
+struct BorrowedKeymasterKeyBlob : public KeymasterKeyBlob {
+    explicit BorrowedKeymasterKeyBlob(const keymaster_key_blob_t& blob);
 };
 
 struct Characteristics_Delete {
@@ -25,9 +25,12 @@ namespace keymaster {
  * Abstract base for KeyFactories that handle asymmetric keys.
  */
 class AsymmetricKey;
+class EvpKeyCache;
+class EvpKeyCacheListener;
 class AsymmetricKeyFactory : public KeyFactory {
   public:
-    explicit AsymmetricKeyFactory(const KeymasterContext* context) : KeyFactory(context) {}
+    explicit AsymmetricKeyFactory(const KeymasterContext* context);
+    ~AsymmetricKeyFactory();
 
     keymaster_error_t LoadKey(const KeymasterKeyBlob& key_material,
                               const AuthorizationSet& additional_params,
@@ -44,6 +47,18 @@ class AsymmetricKeyFactory : public KeyFactory {
 
     virtual const keymaster_key_format_t* SupportedImportFormats(size_t* format_count) const override;
     virtual const keymaster_key_format_t* SupportedExportFormats(size_t* format_count) const override;
+
+  protected:
+    /**
+     * Keep up to \p capacity parsed keys warm across LoadKey calls, so that repeated operations on
+     * one key share an EVP_PKEY and the precomputed state attached to it.  Zero, the default,
+     * disables caching.  \p listener, if given, is told of each key the cache drops; it is not
+     * owned and must outlive the cache.
+     */
+    void set_key_cache_size(size_t capacity, EvpKeyCacheListener* listener = nullptr);
+
+  private:
+    UniquePtr<EvpKeyCache> key_cache_;
 };
 
 }  // namespace keymaster
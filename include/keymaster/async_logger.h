@@ -0,0 +1,108 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_ASYNC_LOGGER_H_
+#define SYSTEM_KEYMASTER_ASYNC_LOGGER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <keymaster/logger.h>
+
+namespace keymaster {
+
+/**
+ * AsyncLogger takes logging off the calling thread.  Each logging thread records messages in a
+ * ring buffer of its own, without locks: the level, the format pointer (formats are string
+ * literals, so they outlive the record), the raw argument values and copies of any string
+ * arguments.  A background thread formats the records and passes them to the sink logger.
+ *
+ * Memory is bounded by \p records_per_thread fixed-size records per logging thread.  When a
+ * thread's ring is full its messages are dropped and counted, and the count is reported through
+ * the sink.  Messages from one thread reach the sink in order; messages from different threads
+ * may be interleaved differently than they were logged.
+ *
+ * Formats with '*' widths or precisions, or more arguments than a record holds, are formatted on
+ * the calling thread instead, and only the writing is deferred.
+ *
+ * \p sink must outlive the AsyncLogger, and need not be installed as the logger itself.
+ *
+ * Logger's instance pointer is a plain variable, so construct and destroy an AsyncLogger only while
+ * no other thread is logging.  Logging through an AsyncLogger that has been removed asserts.  The
+ * destructor also waits for calls already inside log_msg to finish before the final write.
+ */
+class AsyncLogger : public Logger {
+  public:
+    /**
+     * Create a logger which writes through \p sink, and make it the logger.  The writer thread
+     * drains the rings every few milliseconds, or sooner when one is half full.
+     */
+    explicit AsyncLogger(Logger* sink, size_t records_per_thread = 256);
+
+    /**
+     * Write all records, then stop the writer thread and reinstate the logger that was installed
+     * when this one was constructed.
+     */
+    ~AsyncLogger() override;
+
+    int log_msg(LogLevel level, const char* fmt, va_list args) const override;
+
+    /**
+     * Write every message recorded before the call, and return once they have been written.
+     */
+    void Flush();
+
+    /**
+     * Returns the number of messages dropped because their thread's ring was full.
+     */
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  private:
+    class Ring;
+
+    Ring* ThreadRing() const;
+    void RunWriter();
+    void Drain();
+
+    Logger* const sink_;
+    Logger* const previous_;
+    const size_t records_per_thread_;
+    const uint64_t id_;
+
+    mutable std::mutex rings_mutex_;  // Guards rings_.
+    mutable std::vector<std::shared_ptr<Ring>> rings_;
+    mutable std::atomic<uint64_t> dropped_;
+    std::atomic<bool> installed_;
+    mutable std::atomic<uint32_t> callers_;  // Calls currently inside log_msg.
+
+    std::mutex drain_mutex_;  // Serializes Drain, which formats and writes.
+    uint64_t dropped_reported_;  // Guarded by drain_mutex_.
+
+    std::mutex writer_mutex_;
+    mutable std::condition_variable work_available_;
+    bool stopping_;  // Guarded by writer_mutex_.
+    std::thread writer_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_ASYNC_LOGGER_H_
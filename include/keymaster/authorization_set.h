@@ -26,6 +26,7 @@
 namespace keymaster {
 
 class AuthorizationSetBuilder;
+class RequestArena;
 
 /**
  * An extension of the keymaster_key_param_set_t struct, which provides serialization memory
@@ -41,7 +42,19 @@ class AuthorizationSet : public Serializable, public keymaster_key_param_set_t {
      */
     AuthorizationSet()
         : elems_capacity_(0), indirect_data_(NULL), indirect_data_size_(0),
-          indirect_data_capacity_(0), error_(OK) {
+          indirect_data_capacity_(0), error_(OK), arena_(nullptr) {
+        elems_ = nullptr;
+        elems_size_ = 0;
+    }
+
+    /**
+     * Construct an empty AuthorizationSet which draws its storage from \p arena rather than the
+     * heap, for temporaries that die with a request.  The set must not outlive \p arena.  A set
+     * copy-constructed from this one, or moved from it, gets ordinary heap storage of its own.
+     */
+    explicit AuthorizationSet(RequestArena* arena)
+        : elems_capacity_(0), indirect_data_(nullptr), indirect_data_size_(0),
+          indirect_data_capacity_(0), error_(OK), arena_(arena) {
         elems_ = nullptr;
         elems_size_ = 0;
     }
@@ -53,18 +66,20 @@ class AuthorizationSet : public Serializable, public keymaster_key_param_set_t {
      * return ALLOCATION_FAILURE. It is the responsibility of the caller to check before using the
      * set, if allocations might fail.
      */
-    AuthorizationSet(const keymaster_key_param_t* elems, size_t count) : indirect_data_(nullptr) {
+    AuthorizationSet(const keymaster_key_param_t* elems, size_t count)
+        : indirect_data_(nullptr), arena_(nullptr) {
         elems_ = nullptr;
         Reinitialize(elems, count);
     }
 
-    explicit AuthorizationSet(const keymaster_key_param_set_t& set) : indirect_data_(nullptr) {
+    explicit AuthorizationSet(const keymaster_key_param_set_t& set)
+        : indirect_data_(nullptr), arena_(nullptr) {
         elems_ = nullptr;
         Reinitialize(set.params, set.length);
     }
 
     explicit AuthorizationSet(const uint8_t* serialized_set, size_t serialized_size)
-        : indirect_data_(nullptr) {
+        : indirect_data_(nullptr), arena_(nullptr) {
         elems_ = nullptr;
         Deserialize(&serialized_set, serialized_set + serialized_size);
     }
@@ -76,7 +91,8 @@ class AuthorizationSet : public Serializable, public keymaster_key_param_set_t {
     explicit AuthorizationSet(/* NOT const */ AuthorizationSetBuilder& builder);
 
     // Copy constructor.
-    AuthorizationSet(const AuthorizationSet& set) : Serializable(), indirect_data_(nullptr) {
+    AuthorizationSet(const AuthorizationSet& set)
+        : Serializable(), indirect_data_(nullptr), arena_(nullptr) {
         elems_ = nullptr;
         error_ = set.error_;
         if (error_ != OK) return;
@@ -84,7 +100,11 @@ class AuthorizationSet : public Serializable, public keymaster_key_param_set_t {
     }
 
     // Move constructor.
-    AuthorizationSet(AuthorizationSet&& set) : Serializable() {
+    AuthorizationSet(AuthorizationSet&& set)
+        : Serializable(), elems_capacity_(0), indirect_data_(nullptr), indirect_data_size_(0),
+          indirect_data_capacity_(0), error_(OK), arena_(nullptr) {
+        elems_ = nullptr;
+        elems_size_ = 0;
         MoveFrom(set);
     }
 
@@ -474,6 +494,7 @@ class AuthorizationSet : public Serializable, public keymaster_key_param_set_t {
     size_t indirect_data_size_;
     size_t indirect_data_capacity_;
     Error error_;
+    RequestArena* arena_;  // Null for heap storage.
 };
 
 class AuthorizationSetBuilder {
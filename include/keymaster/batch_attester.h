@@ -0,0 +1,110 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_BATCH_ATTESTER_H_
+#define SYSTEM_KEYMASTER_BATCH_ATTESTER_H_
+
+#include <memory>
+#include <vector>
+
+#include <hardware/keymaster_defs.h>
+
+#include <keymaster/android_keymaster_utils.h>
+#include <keymaster/authorization_set.h>
+
+namespace keymaster {
+
+class AndroidKeymaster;
+class WorkerPool;
+
+/**
+ * The certificate chains produced by BatchAttester::Attest.  Each chain holds its own leaf
+ * certificate followed by the certificates of the attestation signing key, which the batch stores
+ * once per signing algorithm and shares between all of its chains.  The chains belong to the batch:
+ * they remain valid until it is cleared or destroyed and must not be freed by the caller.
+ */
+class AttestationBatch {
+  public:
+    AttestationBatch();
+    ~AttestationBatch();
+
+    size_t size() const { return items_.size(); }
+
+    /**
+     * Return KM_ERROR_OK if the chain for key \p i was produced, or the reason it was not.
+     */
+    keymaster_error_t error(size_t i) const { return items_[i].error; }
+
+    /**
+     * Return the chain for key \p i.  The chain is empty unless error(i) is KM_ERROR_OK.
+     */
+    const keymaster_cert_chain_t& chain(size_t i) const { return items_[i].chain; }
+
+    void Clear();
+
+  private:
+    friend class BatchAttester;
+
+    struct Item {
+        Item();
+
+        keymaster_error_t error;
+        keymaster_cert_chain_t chain;
+        std::vector<keymaster_blob_t> entries;
+        std::unique_ptr<const uint8_t[]> leaf;
+    };
+
+    std::vector<Item> items_;
+    std::vector<std::unique_ptr<keymaster_cert_chain_t, CertificateChainDelete>> tails_;
+};
+
+/**
+ * BatchAttester generates attestation certificate chains for many keys with one set of attestation
+ * parameters, spreading the signing across a pool of threads.  The attestation signing key, the
+ * certificate template and the signing key's chain are loaded once per signing algorithm for the
+ * whole batch rather than once per key.
+ */
+class BatchAttester {
+  public:
+    /**
+     * Create an attester using \p thread_count threads, including the calling thread.  Zero means
+     * one per hardware thread.  If the pool can't be allocated, Attest returns
+     * KM_ERROR_MEMORY_ALLOCATION_FAILED.
+     */
+    explicit BatchAttester(size_t thread_count);
+    ~BatchAttester();
+
+    /**
+     * Attest each of the keys in \p key_blobs with \p attest_params, replacing the contents of
+     * \p batch with one chain per key.  Each key is loaded and checked as AttestKey would, and a
+     * key that fails leaves an error in its own slot without affecting the others.
+     *
+     * \p keymaster and its context are used only on the calling thread; the worker threads only
+     * build and sign the leaf certificates.
+     */
+    keymaster_error_t Attest(AndroidKeymaster* keymaster,
+                             const std::vector<keymaster_key_blob_t>& key_blobs,
+                             const AuthorizationSet& attest_params, AttestationBatch* batch);
+
+    size_t thread_count() const;
+
+  private:
+    std::unique_ptr<WorkerPool> pool_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_BATCH_ATTESTER_H_
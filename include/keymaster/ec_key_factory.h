@@ -26,7 +26,7 @@ namespace keymaster {
 
 class EcKeyFactory : public AsymmetricKeyFactory {
   public:
-    explicit EcKeyFactory(const KeymasterContext* context) : AsymmetricKeyFactory(context) {}
+    explicit EcKeyFactory(const KeymasterContext* context);
 
     keymaster_algorithm_t keymaster_key_type() const override { return KM_ALGORITHM_EC; }
     int evp_key_type() const override { return EVP_PKEY_EC; }
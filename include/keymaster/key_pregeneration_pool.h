@@ -0,0 +1,313 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_KEY_PREGENERATION_POOL_H_
+#define SYSTEM_KEYMASTER_KEY_PREGENERATION_POOL_H_
+
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <vector>
+
+namespace keymaster {
+
+/**
+ * KeyPregenerationPool keeps a small stock of keys for each configured set of generation
+ * parameters, generated by background threads, so that callers usually find a key ready instead
+ * of generating one inline.  Generator describes the keys:
+ *
+ *     struct Generator {
+ *         typedef ... Key;
+ *         struct Params { ... };  // Identifies a stock.
+ *         static bool Matches(const Params& a, const Params& b);
+ *         // Returns null on failure, after logging it and clearing the OpenSSL error queue.
+ *         static Key* Generate(const Params& params);
+ *         // Frees a key that was never handed out, wiping its private part.
+ *         static void Free(Key* key);
+ *     };
+ *
+ * Derived classes expose AddStock and Take with their own parameter types.  Configure the stocks
+ * with AddStock, then call Start.  Each key is handed out by exactly one Take call.  When a stock
+ * is empty, Take returns null and the caller generates the key inline, exactly as it would without
+ * a pool.  Take never waits for a key to be generated.  Stop, which the destructor calls, joins
+ * the threads and frees all pooled keys.
+ *
+ * A stock whose generation fails is retried after a delay, doubling from kMinRetryDelay up to
+ * kMaxRetryDelay while it keeps failing, and the other stocks are filled meanwhile.
+ *
+ * All methods are thread-safe.
+ */
+template <typename Generator>
+class KeyPregenerationPool {
+  public:
+    typedef typename Generator::Key Key;
+    typedef typename Generator::Params Params;
+    typedef std::chrono::steady_clock Clock;
+
+    static constexpr std::chrono::milliseconds kMinRetryDelay{50};
+    static constexpr std::chrono::milliseconds kMaxRetryDelay{5000};
+
+    struct Stats : public Params {
+        size_t target;           // Configured stock level.
+        size_t available;        // Keys currently in stock.
+        uint64_t hits;           // Take calls served from stock.
+        uint64_t misses;         // Take calls that found the stock empty.
+        uint64_t failures;       // Background generation attempts that failed.
+        uint64_t total_take_us;  // Total time spent in Take, almost all of it taking the lock.
+        uint64_t max_take_us;    // Longest single Take call.
+    };
+
+    KeyPregenerationPool() : stopping_(false) {}
+    ~KeyPregenerationPool() { Stop(); }
+
+    KeyPregenerationPool(const KeyPregenerationPool&) = delete;
+    KeyPregenerationPool& operator=(const KeyPregenerationPool&) = delete;
+
+    /**
+     * Start \p thread_count background threads filling the stocks.  Returns false if the pool is
+     * already running or \p thread_count is zero.
+     */
+    bool Start(size_t thread_count);
+
+    /**
+     * Stop the background threads and free all pooled keys.  Take still works afterwards, but
+     * every call is a miss.
+     */
+    void Stop();
+
+    /**
+     * Return the current statistics for each configured stock, in the order they were added.
+     */
+    std::vector<Stats> GetStats() const;
+
+  protected:
+    /**
+     * Keep up to \p target keys generated with \p params in stock.  Must be called before Start.
+     * Returns false if \p target is zero, the stock already exists, the pool is running or memory
+     * can't be allocated.
+     */
+    bool AddStock(const Params& params, size_t target);
+
+    /**
+     * Return a key from the stock for \p params, which the caller takes ownership of, or null if
+     * that stock is empty or was never added.
+     */
+    Key* Take(const Params& params);
+
+  private:
+    struct Stock {
+        Stats stats;
+        std::deque<Key*> keys;
+        size_t in_flight;
+        std::chrono::milliseconds retry_delay;  // Zero unless the last generation failed.
+        Clock::time_point retry_at;              // Don't generate for this stock before then.
+    };
+
+    void FillStocks();
+    Stock* FindStock(const Params& params);
+    Stock* NextStockToFill(Clock::time_point now, Clock::time_point* next_retry);
+    void FreeKeys();
+
+    mutable std::mutex mutex_;
+    std::condition_variable refill_;
+    std::vector<std::unique_ptr<Stock>> stocks_;
+    std::vector<std::thread> threads_;
+    bool stopping_;
+};
+
+template <typename Generator>
+constexpr std::chrono::milliseconds KeyPregenerationPool<Generator>::kMinRetryDelay;
+template <typename Generator>
+constexpr std::chrono::milliseconds KeyPregenerationPool<Generator>::kMaxRetryDelay;
+
+template <typename Generator>
+bool KeyPregenerationPool<Generator>::Start(size_t thread_count) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!threads_.empty() || thread_count == 0)
+        return false;
+
+    stopping_ = false;
+    for (size_t i = 0; i < thread_count; ++i)
+        threads_.emplace_back(&KeyPregenerationPool::FillStocks, this);
+    return true;
+}
+
+template <typename Generator>
+void KeyPregenerationPool<Generator>::Stop() {
+    std::vector<std::thread> threads;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        threads.swap(threads_);
+    }
+    refill_.notify_all();
+    for (auto& thread : threads)
+        thread.join();
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    FreeKeys();
+}
+
+template <typename Generator>
+std::vector<typename KeyPregenerationPool<Generator>::Stats>
+KeyPregenerationPool<Generator>::GetStats() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    std::vector<Stats> stats;
+    for (auto& stock : stocks_)
+        stats.push_back(stock->stats);
+    return stats;
+}
+
+template <typename Generator>
+bool KeyPregenerationPool<Generator>::AddStock(const Params& params, size_t target) {
+    if (target == 0)
+        return false;
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!threads_.empty() || FindStock(params))
+        return false;
+
+    std::unique_ptr<Stock> stock(new (std::nothrow) Stock);
+    if (!stock)
+        return false;
+    stock->stats = Stats();
+    static_cast<Params&>(stock->stats) = params;
+    stock->stats.target = target;
+    stock->in_flight = 0;
+    stock->retry_delay = std::chrono::milliseconds(0);
+    stocks_.push_back(std::move(stock));
+    return true;
+}
+
+template <typename Generator>
+typename KeyPregenerationPool<Generator>::Key*
+KeyPregenerationPool<Generator>::Take(const Params& params) {
+    auto start = Clock::now();
+    std::unique_lock<std::mutex> lock(mutex_);
+    Stock* stock = FindStock(params);
+    if (!stock)
+        return nullptr;
+
+    // On a miss the caller generates the key itself, reporting any error, so don't do it here.
+    Key* key = nullptr;
+    if (!stock->keys.empty()) {
+        key = stock->keys.front();
+        stock->keys.pop_front();
+        stock->stats.available = stock->keys.size();
+        ++stock->stats.hits;
+    } else {
+        ++stock->stats.misses;
+    }
+
+    uint64_t take_us =
+        std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - start).count();
+    stock->stats.total_take_us += take_us;
+    if (take_us > stock->stats.max_take_us)
+        stock->stats.max_take_us = take_us;
+    lock.unlock();
+
+    refill_.notify_one();
+    return key;
+}
+
+template <typename Generator>
+void KeyPregenerationPool<Generator>::FillStocks() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        Clock::time_point next_retry = Clock::time_point::max();
+        Stock* stock = NextStockToFill(Clock::now(), &next_retry);
+        if (!stock) {
+            if (next_retry == Clock::time_point::max())
+                refill_.wait(lock);
+            else
+                refill_.wait_until(lock, next_retry);
+            continue;
+        }
+
+        ++stock->in_flight;
+        lock.unlock();
+        Key* key = Generator::Generate(stock->stats);
+        lock.lock();
+        --stock->in_flight;
+
+        if (!key) {
+            // Back off this stock only, so that one failing configuration doesn't keep the
+            // threads from filling the others.
+            ++stock->stats.failures;
+            stock->retry_delay = std::min(std::max(stock->retry_delay * 2, kMinRetryDelay),
+                                          kMaxRetryDelay);
+            stock->retry_at = Clock::now() + stock->retry_delay;
+        } else if (stopping_) {
+            Generator::Free(key);
+        } else {
+            stock->retry_delay = std::chrono::milliseconds(0);
+            stock->keys.push_back(key);
+            stock->stats.available = stock->keys.size();
+        }
+    }
+}
+
+template <typename Generator>
+typename KeyPregenerationPool<Generator>::Stock*
+KeyPregenerationPool<Generator>::FindStock(const Params& params) {
+    for (auto& stock : stocks_)
+        if (Generator::Matches(stock->stats, params))
+            return stock.get();
+    return nullptr;
+}
+
+template <typename Generator>
+typename KeyPregenerationPool<Generator>::Stock*
+KeyPregenerationPool<Generator>::NextStockToFill(Clock::time_point now,
+                                                 Clock::time_point* next_retry) {
+    // Fill the emptiest stock first, relative to its target, counting keys being generated.
+    // Stocks backing off after a failure are skipped, and the earliest retry time is reported.
+    Stock* neediest = nullptr;
+    for (auto& stock : stocks_) {
+        size_t level = stock->keys.size() + stock->in_flight;
+        if (level >= stock->stats.target)
+            continue;
+        if (stock->retry_delay.count() != 0 && stock->retry_at > now) {
+            *next_retry = std::min(*next_retry, stock->retry_at);
+            continue;
+        }
+        if (!neediest || level * neediest->stats.target <
+                             (neediest->keys.size() + neediest->in_flight) * stock->stats.target)
+            neediest = stock.get();
+    }
+    return neediest;
+}
+
+template <typename Generator>
+void KeyPregenerationPool<Generator>::FreeKeys() {
+    for (auto& stock : stocks_) {
+        for (Key* key : stock->keys)
+            Generator::Free(key);
+        stock->keys.clear();
+        stock->stats.available = 0;
+    }
+}
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_KEY_PREGENERATION_POOL_H_
@@ -26,6 +26,7 @@
 
 namespace keymaster {
 
+class AttestationCertTemplate;
 class AuthorizationSet;
 class KeyFactory;
 class OperationFactory;
@@ -173,6 +174,28 @@ class KeymasterContext {
     virtual keymaster_cert_chain_t* AttestationChain(keymaster_algorithm_t algorithm,
                                                      keymaster_error_t* error) const = 0;
 
+    /**
+     * Return the certificate chain of the attestation signing key of the specified algorithm
+     * without copying it, or null if the context does not keep the chain in memory, in which case
+     * callers use AttestationChain.  The chain is owned by the context, must not be modified and
+     * remains valid for the lifetime of the context.
+     */
+    virtual const keymaster_cert_chain_t*
+    SharedAttestationChain(keymaster_algorithm_t /* algorithm */) const {
+        return nullptr;
+    }
+
+    /**
+     * Return the attestation certificate template for the attestation signing key of the specified
+     * algorithm, or null if the context does not keep one, in which case a template is built from
+     * the attestation chain for each attestation.  The template is owned by the context and remains
+     * valid for the lifetime of the context.
+     */
+    virtual const AttestationCertTemplate*
+    AttestationCertificateTemplate(keymaster_algorithm_t /* algorithm */) const {
+        return nullptr;
+    }
+
     /**
      * Generate the current unique ID.
      */
@@ -196,6 +219,13 @@ class KeymasterContext {
         return KM_ERROR_UNIMPLEMENTED;
     }
 
+    /**
+     * Return the time in nanoseconds on a monotonic clock, which AndroidKeymaster uses to measure
+     * the latency of requests (see LatencyStats).  Contexts without such a clock return 0, which
+     * turns the measurements off.
+     */
+    virtual uint64_t GetMonotonicTimeNs() const { return 0; }
+
   private:
     // Uncopyable.
     KeymasterContext(const KeymasterContext&);
@@ -0,0 +1,165 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_LATENCY_STATS_H_
+#define SYSTEM_KEYMASTER_LATENCY_STATS_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <keymaster/android_keymaster_messages.h>
+
+namespace keymaster {
+
+/**
+ * LatencyHistogram counts durations in log-linear buckets, in the manner of HdrHistogram: each
+ * power of two is split into kSubBuckets equal buckets, so a duration is known to within about
+ * 6% of its value.  Recording is a few shifts and an increment.  Durations longer than about 68
+ * seconds are counted in the last bucket, though max_ns() is exact.
+ */
+class LatencyHistogram {
+  public:
+    static const size_t kSubBucketBits = 4;
+    static const size_t kSubBuckets = 1 << kSubBucketBits;
+    static const size_t kMaxValueBits = 36;
+    static const size_t kBucketCount = (kMaxValueBits - kSubBucketBits + 1) * kSubBuckets;
+
+    LatencyHistogram() { Reset(); }
+
+    void Record(uint64_t duration_ns);
+    void Reset();
+
+    uint64_t count() const { return count_; }
+    uint64_t total_ns() const { return total_ns_; }
+    uint64_t max_ns() const { return max_ns_; }
+
+    /**
+     * Returns the duration that \p per_mille thousandths of the recorded durations don't exceed,
+     * rounded up to the end of its bucket.
+     */
+    uint64_t Percentile(uint32_t per_mille) const;
+
+  private:
+    uint64_t count_;
+    uint64_t total_ns_;
+    uint64_t max_ns_;
+    uint32_t buckets_[kBucketCount];
+};
+
+/**
+ * LatencyLabels identify the kind of request a duration belongs to.  Labels that don't apply,
+ * or aren't known, are kNoLatencyLabel.
+ */
+struct LatencyLabels {
+    LatencyLabels()
+        : algorithm(kNoLatencyLabel), purpose(kNoLatencyLabel), block_mode(kNoLatencyLabel) {}
+
+    uint32_t algorithm;
+    uint32_t purpose;
+    uint32_t block_mode;
+};
+
+/**
+ * LatencyStats keeps a LatencyHistogram for each combination of AndroidKeymaster entry point,
+ * phase and labels that has been seen.  TOTAL_PHASE covers the whole request; the other phases
+ * cover the parts of it spent in that kind of work, so they needn't add up to the total.
+ *
+ * Histograms are allocated when their combination is first recorded, up to kMaxSeries of them;
+ * measurements that would need more are counted as dropped.  Like AndroidKeymaster, LatencyStats
+ * is not thread-safe.
+ */
+class LatencyStats {
+  public:
+    enum EntryPoint {
+        ADD_RNG_ENTROPY,
+        GENERATE_KEY,
+        GET_KEY_CHARACTERISTICS,
+        IMPORT_KEY,
+        EXPORT_KEY,
+        ATTEST_KEY,
+        UPGRADE_KEY,
+        DELETE_KEY,
+        DELETE_ALL_KEYS,
+        BEGIN_OPERATION,
+        UPDATE_OPERATION,
+        FINISH_OPERATION,
+        ABORT_OPERATION,
+        CONFIGURE,
+        kEntryPointCount,
+    };
+
+    enum Phase {
+        TOTAL_PHASE,
+        KEY_BLOB_PHASE,     // Parsing key blobs and loading keys.
+        ENFORCEMENT_PHASE,  // Authorization checks.
+        CRYPTO_PHASE,       // Key generation and operation setup, data processing and teardown.
+        TABLE_PHASE,        // Operation table management.
+        kPhaseCount,
+    };
+
+    static const size_t kMaxSeries = 128;
+
+    LatencyStats();
+    ~LatencyStats();
+
+    void Record(EntryPoint entry_point, Phase phase, const LatencyLabels& labels,
+                uint64_t duration_ns);
+
+    /**
+     * Summarize every series with at least one measurement into \p response, ordered by entry
+     * point, phase and labels.
+     */
+    keymaster_error_t Summarize(GetLatencyStatsResponse* response) const;
+
+    /**
+     * Clear all measurements.  Histograms stay allocated for reuse.
+     */
+    void Reset();
+
+    static const char* entry_point_name(uint32_t entry_point);
+    static const char* phase_name(uint32_t phase);
+
+  private:
+    // Disallow copying.
+    LatencyStats(const LatencyStats&);
+    void operator=(const LatencyStats&);
+
+    struct Series {
+        uint32_t entry_point;
+        uint32_t phase;
+        LatencyLabels labels;
+        LatencyHistogram* histogram;
+    };
+
+    // index_ is an open-addressed hash table of series_ indices plus one; zero marks a free slot.
+    static const size_t kIndexSize = 2 * kMaxSeries;
+
+    Series series_[kMaxSeries];
+    size_t series_count_;
+    uint8_t index_[kIndexSize];
+    uint64_t dropped_;
+};
+
+/**
+ * Format the summaries in \p stats as a text table, one row per summary, into \p buffer of \p size
+ * bytes.  Returns the length of the complete table, as snprintf does; if that isn't less than \p
+ * size the table was truncated.
+ */
+size_t FormatLatencyStats(const GetLatencyStatsResponse& stats, char* buffer, size_t size);
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_LATENCY_STATS_H_
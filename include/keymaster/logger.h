@@ -19,6 +19,15 @@
 
 #include <stdarg.h>
 
+/**
+ * The least severe level the LOG_* macros log at, as a Logger::LogLevel value: 0 for debug up to
+ * 4 for severe, or 5 to log nothing.  Calls below it compile to nothing, though their arguments
+ * are still type-checked.  Defaults to logging everything.
+ */
+#ifndef KEYMASTER_MIN_LOG_LEVEL
+#define KEYMASTER_MIN_LOG_LEVEL 0
+#endif
+
 namespace keymaster {
 
 class Logger {
@@ -36,6 +45,17 @@ class Logger {
 
     virtual int log_msg(LogLevel level, const char* fmt, va_list args) const = 0;
 
+    /**
+     * Returns true if a message at \p level would be logged: a logger is installed and \p level is
+     * at least the runtime minimum.  The LOG_* macros check this before evaluating arguments.
+     */
+    static bool enabled(LogLevel level) { return instance_ && level >= min_level_; }
+
+    /**
+     * Set the runtime minimum level.  Messages below it are discarded.  Defaults to DEBUG_LVL.
+     */
+    static void set_min_level(LogLevel level) { min_level_ = level; }
+
     static int Log(LogLevel level, const char* fmt, va_list args);
     static int Log(LogLevel level, const char* fmt, ...);
     static int Debug(const char* fmt, ...);
@@ -46,6 +66,7 @@ class Logger {
 
   protected:
     static void set_instance(Logger* logger) { instance_ = logger; }
+    static Logger* instance() { return instance_; }
 
   private:
     // Disallow copying.
@@ -53,17 +74,23 @@ class Logger {
     void operator=(const Logger&);
 
     static Logger* instance_;
+    static LogLevel min_level_;
 };
 
 #define STR(x) #x
 #define STRINGIFY(x) STR(x)
 #define FILE_LINE __FILE__ ", Line " STRINGIFY(__LINE__) ": "
 
-#define LOG_D(fmt, ...) Logger::Debug(FILE_LINE fmt, __VA_ARGS__)
-#define LOG_I(fmt, ...) Logger::Info(FILE_LINE fmt, __VA_ARGS__)
-#define LOG_W(fmt, ...) Logger::Warning(FILE_LINE fmt, __VA_ARGS__)
-#define LOG_E(fmt, ...) Logger::Error(FILE_LINE fmt, __VA_ARGS__)
-#define LOG_S(fmt, ...) Logger::Severe(FILE_LINE fmt, __VA_ARGS__)
+#define KEYMASTER_LOG(level, method, fmt, ...)                                                    \
+    ((Logger::level >= KEYMASTER_MIN_LOG_LEVEL && Logger::enabled(Logger::level))                  \
+         ? static_cast<void>(Logger::method(FILE_LINE fmt, __VA_ARGS__))                           \
+         : static_cast<void>(0))
+
+#define LOG_D(fmt, ...) KEYMASTER_LOG(DEBUG_LVL, Debug, fmt, __VA_ARGS__)
+#define LOG_I(fmt, ...) KEYMASTER_LOG(INFO_LVL, Info, fmt, __VA_ARGS__)
+#define LOG_W(fmt, ...) KEYMASTER_LOG(WARNING_LVL, Warning, fmt, __VA_ARGS__)
+#define LOG_E(fmt, ...) KEYMASTER_LOG(ERROR_LVL, Error, fmt, __VA_ARGS__)
+#define LOG_S(fmt, ...) KEYMASTER_LOG(SEVERE_LVL, Severe, fmt, __VA_ARGS__)
 
 }  // namespace keymaster
 
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_REQUEST_ARENA_H_
+#define SYSTEM_KEYMASTER_REQUEST_ARENA_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+namespace keymaster {
+
+/**
+ * A bump allocator for the temporaries of a single request.  Allocations are carved from an
+ * optional caller-supplied buffer (typically on the stack) and then from heap blocks, and are
+ * never freed individually.  Everything is released at once when the arena is destroyed, and all
+ * memory it handed out is wiped first, so it may hold key material and authorizations.
+ *
+ * Nothing allocated from an arena may outlive it.  RequestArena is not thread-safe.
+ */
+class RequestArena {
+  public:
+    /**
+     * Heap blocks are at least this large.  Larger allocations get a block of their own.
+     */
+    static const size_t kBlockSize = 1024;
+
+    RequestArena() : RequestArena(nullptr, 0) {}
+
+    /**
+     * Construct an arena which allocates from \p initial_buffer, of \p initial_size bytes, before
+     * it turns to the heap.  The buffer must outlive the arena.
+     */
+    RequestArena(uint8_t* initial_buffer, size_t initial_size);
+    ~RequestArena();
+
+    RequestArena(const RequestArena&) = delete;
+    RequestArena& operator=(const RequestArena&) = delete;
+
+    /**
+     * Return \p size bytes aligned for any of the keymaster data types, or null if the allocation
+     * fails.  The memory is not initialized.
+     */
+    void* Allocate(size_t size);
+
+    /**
+     * Returns the total number of bytes handed out by Allocate.
+     */
+    size_t bytes_allocated() const { return bytes_allocated_; }
+
+    /**
+     * Returns the number of heap blocks the arena has needed.
+     */
+    size_t heap_blocks() const { return heap_blocks_; }
+
+  private:
+    // Every heap block starts with this header, which links it to the previously allocated one.
+    struct Block {
+        Block* previous;
+        size_t size;
+    };
+
+    void* AllocateFromBlock(size_t size);
+
+    uint8_t* initial_buffer_;
+    size_t initial_size_;
+    size_t initial_used_;  // How much of the initial buffer was used, once heap blocks are in use.
+    Block* blocks_;
+    uint8_t* position_;
+    uint8_t* end_;
+    size_t bytes_allocated_;
+    size_t heap_blocks_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_REQUEST_ARENA_H_
@@ -0,0 +1,74 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_RSA_BATCH_VERIFIER_H_
+#define SYSTEM_KEYMASTER_RSA_BATCH_VERIFIER_H_
+
+#include <memory>
+#include <vector>
+
+#include <hardware/keymaster_defs.h>
+
+#include <keymaster/authorization_set.h>
+
+namespace keymaster {
+
+class AndroidKeymaster;
+class WorkerPool;
+
+/**
+ * RsaBatchVerifier checks many RSA signatures made with one key, spreading them across a pool of
+ * threads.  The key blob and parameters are validated once, exactly as BeginOperation would
+ * validate them, and every item then shares a single parsed public key.
+ */
+class RsaBatchVerifier {
+  public:
+    struct Item {
+        keymaster_blob_t message;
+        keymaster_blob_t signature;
+    };
+
+    /**
+     * Create a verifier using \p thread_count threads, including the calling thread.  Zero means
+     * one per hardware thread.  If the pool can't be allocated, Verify returns
+     * KM_ERROR_MEMORY_ALLOCATION_FAILED.
+     */
+    explicit RsaBatchVerifier(size_t thread_count);
+    ~RsaBatchVerifier();
+
+    /**
+     * Verify each of \p items with the RSA key in \p key_blob, using the digest and padding in
+     * \p begin_params.  On success, (*results)[i] is KM_ERROR_OK if item i verified, or
+     * KM_ERROR_VERIFICATION_FAILED or another error if it did not.  Returns an error, and fills in
+     * no results, if the key or parameters cannot be used for verification.  Keys limited by
+     * TAG_MAX_USES_PER_BOOT or TAG_MIN_SECONDS_BETWEEN_OPS are refused with
+     * KM_ERROR_INVALID_ARGUMENT, because the whole batch is authorized as one use.
+     *
+     * \p keymaster is used only for loading and checking the key, on the calling thread.
+     */
+    keymaster_error_t Verify(AndroidKeymaster* keymaster, const keymaster_key_blob_t& key_blob,
+                             const AuthorizationSet& begin_params, const std::vector<Item>& items,
+                             std::vector<keymaster_error_t>* results);
+
+    size_t thread_count() const;
+
+  private:
+    std::unique_ptr<WorkerPool> pool_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_RSA_BATCH_VERIFIER_H_
@@ -24,9 +24,28 @@
 
 namespace keymaster {
 
+class RsaContextCache;
+
+/**
+ * Source of ready-made RSA keys for RsaKeyFactory::GenerateKey, so that key generation, which is
+ * slow and highly variable, can be moved off the request path.
+ */
+class RsaKeyPool {
+  public:
+    virtual ~RsaKeyPool() {}
+
+    /**
+     * Return a freshly generated RSA key with the specified size and public exponent, which the
+     * caller takes ownership of, or null if the pool does not provide such keys.  A key must never
+     * be returned twice.
+     */
+    virtual RSA* TakeKey(uint32_t key_size, uint64_t public_exponent) = 0;
+};
+
 class RsaKeyFactory : public AsymmetricKeyFactory {
   public:
-    explicit RsaKeyFactory(const KeymasterContext* context) : AsymmetricKeyFactory(context) {}
+    explicit RsaKeyFactory(const KeymasterContext* context);
+    ~RsaKeyFactory();
 
     keymaster_error_t GenerateKey(const AuthorizationSet& key_description,
                                   KeymasterKeyBlob* key_blob, AuthorizationSet* hw_enforced,
@@ -46,6 +65,12 @@ class RsaKeyFactory : public AsymmetricKeyFactory {
     keymaster_algorithm_t keymaster_key_type() const override { return KM_ALGORITHM_RSA; }
     int evp_key_type() const override { return EVP_PKEY_RSA; }
 
+    /**
+     * Take generated keys from \p key_pool when it has them.  The pool is not owned and must
+     * outlive the factory, or be unset first.  Null, the default, generates every key inline.
+     */
+    void set_key_pool(RsaKeyPool* key_pool) { key_pool_ = key_pool; }
+
   protected:
     keymaster_error_t UpdateImportKeyDescription(const AuthorizationSet& key_description,
                                                  keymaster_key_format_t import_key_format,
@@ -53,6 +78,10 @@ class RsaKeyFactory : public AsymmetricKeyFactory {
                                                  AuthorizationSet* updated_description,
                                                  uint64_t* public_exponent,
                                                  uint32_t* key_size) const;
+
+  private:
+    UniquePtr<RsaContextCache> context_cache_;
+    RsaKeyPool* key_pool_;
 };
 
 }  // namespace keymaster
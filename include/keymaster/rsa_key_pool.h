@@ -0,0 +1,65 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_RSA_KEY_POOL_H_
+#define SYSTEM_KEYMASTER_RSA_KEY_POOL_H_
+
+#include <openssl/rsa.h>
+
+#include <keymaster/key_pregeneration_pool.h>
+#include <keymaster/rsa_key_factory.h>
+
+namespace keymaster {
+
+/**
+ * Generator for KeyPregenerationPool producing RSA keys.  RSA_free clears the private key
+ * components.
+ */
+struct RsaKeyGenerator {
+    typedef RSA Key;
+    struct Params {
+        uint32_t key_size;
+        uint64_t public_exponent;
+    };
+
+    static bool Matches(const Params& a, const Params& b) {
+        return a.key_size == b.key_size && a.public_exponent == b.public_exponent;
+    }
+    static RSA* Generate(const Params& params);
+    static void Free(RSA* key) { RSA_free(key); }
+};
+
+/**
+ * RsaKeyPregenerationPool keeps a small stock of RSA keys for each configured (key size, public
+ * exponent), so that RsaKeyFactory::GenerateKey usually finds a key ready instead of generating
+ * one inline.  On a miss, RsaKeyFactory generates the key itself.
+ */
+class RsaKeyPregenerationPool : public RsaKeyPool, public KeyPregenerationPool<RsaKeyGenerator> {
+  public:
+    /**
+     * Keep up to \p target keys of the specified size and public exponent in stock.  Must be
+     * called before Start.  Returns false if the parameters are invalid or the pool is running.
+     */
+    bool AddStock(uint32_t key_size, uint64_t public_exponent, size_t target);
+
+    RSA* TakeKey(uint32_t key_size, uint64_t public_exponent) override {
+        return Take({key_size, public_exponent});
+    }
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_RSA_KEY_POOL_H_
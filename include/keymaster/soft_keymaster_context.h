@@ -31,6 +31,7 @@ namespace keymaster {
 class SoftKeymasterKeyRegistrations;
 class Keymaster0Engine;
 class Keymaster1Engine;
+class RsaKeyPool;
 
 /**
  * SoftKeymasterContext provides the context for a non-secure implementation of AndroidKeymaster.
@@ -53,6 +54,14 @@ class SoftKeymasterContext : public KeymasterContext {
      */
     keymaster_error_t SetHardwareDevice(keymaster1_device_t* keymaster1_device);
 
+    /**
+     * Take generated software RSA keys from the specified pool, e.g. a started
+     * RsaKeyPregenerationPool, rather than generating them inline.  Takes ownership of the pool.
+     * Pass null to go back to inline generation.  Keys generated by a wrapped hardware device
+     * don't come from the pool.
+     */
+    void SetRsaKeyPool(RsaKeyPool* rsa_key_pool);
+
     keymaster_security_level_t GetSecurityLevel() const override {
         return KM_SECURITY_LEVEL_SOFTWARE;
     }
@@ -84,9 +93,14 @@ class SoftKeymasterContext : public KeymasterContext {
                              keymaster_error_t* error) const override;
     keymaster_cert_chain_t* AttestationChain(keymaster_algorithm_t algorithm,
                                              keymaster_error_t* error) const override;
+    const keymaster_cert_chain_t*
+    SharedAttestationChain(keymaster_algorithm_t algorithm) const override;
+    const AttestationCertTemplate*
+    AttestationCertificateTemplate(keymaster_algorithm_t algorithm) const override;
     keymaster_error_t GenerateUniqueId(uint64_t creation_date_time,
                                        const keymaster_blob_t& application_id,
                                        bool reset_since_rotation, Buffer* unique_id) const override;
+    uint64_t GetMonotonicTimeNs() const override;
 
     KeymasterEnforcement* enforcement_policy() override {
         // SoftKeymaster does no enforcement; it's all done by Keystore.
@@ -116,6 +130,7 @@ class SoftKeymasterContext : public KeymasterContext {
 
     std::unique_ptr<Keymaster0Engine> km0_engine_;
     std::unique_ptr<Keymaster1Engine> km1_engine_;
+    std::unique_ptr<RsaKeyPool> rsa_key_pool_;  // Must outlive rsa_factory_.
     std::unique_ptr<KeyFactory> rsa_factory_;
     std::unique_ptr<KeyFactory> ec_factory_;
     std::unique_ptr<KeyFactory> aes_factory_;
@@ -124,6 +139,13 @@ class SoftKeymasterContext : public KeymasterContext {
     const std::string root_of_trust_;
     uint32_t os_version_;
     uint32_t os_patchlevel_;
+
+    // Attestation keys, parsed once and shared with every caller of AttestationKey.
+    EVP_PKEY* rsa_attestation_key_;
+    EVP_PKEY* ec_attestation_key_;
+    // Certificate templates for the attestation keys, built once from the attestation chains.
+    std::unique_ptr<AttestationCertTemplate> rsa_cert_template_;
+    std::unique_ptr<AttestationCertTemplate> ec_cert_template_;
 };
 
 }  // namespace keymaster
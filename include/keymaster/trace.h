@@ -0,0 +1,85 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_TRACE_H_
+#define SYSTEM_KEYMASTER_TRACE_H_
+
+#include <stdint.h>
+
+namespace keymaster {
+
+/**
+ * Tracer receives the spans marked by TraceSpan, to build per-request timelines.  Tracing is off
+ * unless a Tracer is installed; with none, a TraceSpan costs a load and a branch.
+ *
+ * Like the Logger, the tracer is a global which must be installed or removed only while no
+ * requests are being processed.
+ */
+class Tracer {
+  public:
+    Tracer() {}
+    virtual ~Tracer() {}
+
+    /**
+     * Returns the time in nanoseconds on the clock spans are measured with.
+     */
+    virtual uint64_t NowNs() const = 0;
+
+    /**
+     * Record that the calling thread spent \p start_ns to \p end_ns in \p name, which must be a
+     * string literal, or otherwise outlive the tracer.  Called from any thread.
+     */
+    virtual void RecordSpan(const char* name, uint64_t start_ns, uint64_t end_ns) = 0;
+
+    static Tracer* instance() { return instance_; }
+
+  protected:
+    static void set_instance(Tracer* tracer) { instance_ = tracer; }
+
+  private:
+    // Disallow copying.
+    Tracer(const Tracer&);
+    void operator=(const Tracer&);
+
+    static Tracer* instance_;
+};
+
+/**
+ * TraceSpan records the time from its construction until it goes out of scope as a span named \p
+ * name, if a Tracer is installed.  Spans on one thread nest as their scopes do.
+ */
+class TraceSpan {
+  public:
+    explicit TraceSpan(const char* name)
+        : tracer_(Tracer::instance()), name_(name), start_ns_(tracer_ ? tracer_->NowNs() : 0) {}
+    ~TraceSpan() {
+        if (tracer_)
+            tracer_->RecordSpan(name_, start_ns_, tracer_->NowNs());
+    }
+
+  private:
+    // Disallow copying.
+    TraceSpan(const TraceSpan&);
+    void operator=(const TraceSpan&);
+
+    Tracer* const tracer_;
+    const char* const name_;
+    const uint64_t start_ns_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_TRACE_H_
@@ -0,0 +1,85 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_TRACE_EVENT_RECORDER_H_
+#define SYSTEM_KEYMASTER_TRACE_EVENT_RECORDER_H_
+
+#include <stdint.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+#include <keymaster/trace.h>
+
+namespace keymaster {
+
+/**
+ * TraceEventRecorder is a Tracer which keeps spans in memory and exports them as Chrome trace-event
+ * JSON, which chrome://tracing and the Perfetto UI load.  Each thread records into a buffer of its
+ * own without locks, so a span costs two clock reads and a few stores.
+ *
+ * Each thread's buffer holds \p spans_per_thread spans, allocated when the thread records its first
+ * span.  Spans recorded after a buffer fills are dropped and counted.  Buffers outlive their
+ * threads, so spans of threads that have exited are still exported.
+ */
+class TraceEventRecorder : public Tracer {
+  public:
+    /**
+     * Create a recorder and make it the tracer.
+     */
+    explicit TraceEventRecorder(size_t spans_per_thread = 16384);
+
+    /**
+     * Reinstate the tracer that was installed when this one was constructed.
+     */
+    ~TraceEventRecorder() override;
+
+    uint64_t NowNs() const override;
+    void RecordSpan(const char* name, uint64_t start_ns, uint64_t end_ns) override;
+
+    /**
+     * Returns the spans recorded so far as a trace-event JSON document, with one track per
+     * recording thread.  May be called while other threads record; spans they complete during
+     * the call may or may not be included.
+     */
+    std::string ExportJson() const;
+
+    /**
+     * Returns the number of spans dropped because their thread's buffer was full.
+     */
+    uint64_t dropped() const { return dropped_.load(std::memory_order_relaxed); }
+
+  private:
+    class ThreadBuffer;
+
+    ThreadBuffer* ThisThreadBuffer();
+
+    Tracer* const previous_;
+    const size_t spans_per_thread_;
+    const uint64_t id_;
+    const uint64_t origin_ns_;  // Timestamps are exported relative to this.
+
+    mutable std::mutex buffers_mutex_;  // Guards buffers_.
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers_;
+    std::atomic<uint64_t> dropped_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_TRACE_EVENT_RECORDER_H_
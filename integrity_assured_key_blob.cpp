@@ -16,16 +16,14 @@
 
 #include "integrity_assured_key_blob.h"
 
-#include <assert.h>
-
 #include <keymaster/new>
 
-#include <openssl/hmac.h>
 #include <openssl/mem.h>
 
 #include <keymaster/android_keymaster_utils.h>
 #include <keymaster/authorization_set.h>
 
+#include "hmac.h"
 #include "openssl_err.h"
 
 namespace keymaster {
@@ -34,21 +32,6 @@ static const uint8_t BLOB_VERSION = 0;
 static const size_t HMAC_SIZE = 8;
 static const char HMAC_KEY[] = "IntegrityAssuredBlob0";
 
-inline size_t min(size_t a, size_t b) {
-    if (a < b)
-        return a;
-    return b;
-}
-
-class HmacCleanup {
-  public:
-    explicit HmacCleanup(HMAC_CTX* ctx) : ctx_(ctx) {}
-    ~HmacCleanup() { HMAC_CTX_cleanup(ctx_); }
-
-  private:
-    HMAC_CTX* ctx_;
-};
-
 static keymaster_error_t ComputeHmac(const uint8_t* serialized_data, size_t serialized_data_size,
                                      const AuthorizationSet& hidden, uint8_t hmac[HMAC_SIZE]) {
     size_t hidden_bytes_size = hidden.SerializedSize();
@@ -57,23 +40,14 @@ static keymaster_error_t ComputeHmac(const uint8_t* serialized_data, size_t seri
         return KM_ERROR_MEMORY_ALLOCATION_FAILED;
     hidden.Serialize(hidden_bytes.get(), hidden_bytes.get() + hidden_bytes_size);
 
-    HMAC_CTX ctx;
-    HMAC_CTX_init(&ctx);
-    const EVP_MD* md = EVP_sha256();
-    if (!HMAC_Init_ex(&ctx, HMAC_KEY, sizeof(HMAC_KEY), md, NULL /* engine */))
-        return TranslateLastOpenSslError();
-    HmacCleanup cleanup(&ctx);
-
-    uint8_t tmp[EVP_MAX_MD_SIZE];
-    unsigned tmp_len;
-    if (!HMAC_Update(&ctx, serialized_data, serialized_data_size) ||
-        !HMAC_Update(&ctx, hidden_bytes.get(), hidden_bytes_size) ||  //
-        !HMAC_Final(&ctx, tmp, &tmp_len))
+    // The blob is MACed in place, followed by the hidden set, without joining the two.
+    HmacSha256 hmac_sha256;
+    if (!hmac_sha256.Init(reinterpret_cast<const uint8_t*>(HMAC_KEY), sizeof(HMAC_KEY)) ||
+        !hmac_sha256.Update(serialized_data, serialized_data_size) ||
+        !hmac_sha256.Update(hidden_bytes.get(), hidden_bytes_size) ||
+        !hmac_sha256.Final(hmac, HMAC_SIZE))
         return TranslateLastOpenSslError();
 
-    assert(tmp_len >= HMAC_SIZE);
-    memcpy(hmac, tmp, min(HMAC_SIZE, tmp_len));
-
     return KM_ERROR_OK;
 }
 
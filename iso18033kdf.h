@@ -19,6 +19,8 @@
 
 #include "kdf.h"
 
+#include <openssl/evp.h>
+
 #include <hardware/keymaster_defs.h>
 
 #include <keymaster/serializable.h>
@@ -33,7 +35,7 @@ namespace keymaster {
  */
 class Iso18033Kdf : public Kdf {
   public:
-    ~Iso18033Kdf() {}
+    ~Iso18033Kdf();
 
     bool Init(keymaster_digest_t digest_type, const uint8_t* secret, size_t secret_len) {
         return Kdf::Init(digest_type, secret, secret_len, nullptr /* salt */, 0 /* salt_len */);
@@ -57,10 +59,14 @@ class Iso18033Kdf : public Kdf {
                      size_t output_len) override;
 
   protected:
-    explicit Iso18033Kdf(uint32_t start_counter) : start_counter_(start_counter) {}
+    explicit Iso18033Kdf(uint32_t start_counter);
+
+    // Hashes the secret once into secret_ctx_, which each output block then copies.
+    bool PrecomputeSecretState() override;
 
   private:
     uint32_t start_counter_;
+    EVP_MD_CTX secret_ctx_;
 };
 
 }  // namespace keymaster
@@ -54,7 +54,20 @@ bool Kdf::Init(keymaster_digest_t digest_type, const uint8_t* secret, size_t sec
         salt_.reset();
     }
 
-    is_initialized_ = true;
+    is_initialized_ = PrecomputeSecretState();
+    return is_initialized_;
+}
+
+bool Kdf::GenerateKeys(const keymaster_blob_t* infos, size_t count, uint8_t* outputs,
+                       size_t output_len) {
+    if (!infos || !outputs)
+        return false;
+
+    for (size_t i = 0; i < count; ++i) {
+        if (!GenerateKey(infos[i].data, infos[i].data_length, outputs + i * output_len,
+                         output_len))
+            return false;
+    }
     return true;
 }
 
@@ -37,7 +37,21 @@ class Kdf {
     virtual bool GenerateKey(const uint8_t* info, size_t info_len, uint8_t* output,
                              size_t output_len) = 0;
 
+    /**
+     * Derives |count| keys of |output_len| bytes each from the secret, one for each entry of
+     * |infos|, writing key i to outputs + i * output_len.  The secret-dependent state computed by
+     * Init is shared by all of them.  Returns false if any derivation fails.
+     */
+    bool GenerateKeys(const keymaster_blob_t* infos, size_t count, uint8_t* outputs,
+                      size_t output_len);
+
   protected:
+    /**
+     * Called by Init once the secret and salt are stored, so that subclasses can compute the state
+     * that depends only on them once, rather than on every GenerateKey.
+     */
+    virtual bool PrecomputeSecretState() { return true; }
+
     bool Uint32ToBigEndianByteArray(uint32_t number, uint8_t* output);
     UniquePtr<uint8_t[]> secret_key_;
     size_t secret_key_len_;
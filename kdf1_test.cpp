@@ -55,6 +55,23 @@ TEST(Kdf1Test, Kdf1) {
     }
 }
 
+TEST(Kdf1Test, RepeatedAndBatchedDerivations) {
+    const string key = hex2str(kKdf1Tests[0].key_hex);
+    const string expected_output = hex2str(kKdf1Tests[0].expected_output_hex);
+    const size_t output_len = expected_output.size();
+
+    Kdf1 kdf1;
+    ASSERT_TRUE(kdf1.Init(kKdf1Tests[0].digest_type, reinterpret_cast<const uint8_t*>(key.data()),
+                          key.size()));
+
+    // Each derivation starts over from the hashed secret, so every one matches the known answer.
+    keymaster_blob_t no_infos[3] = {};
+    UniquePtr<uint8_t[]> outputs(new uint8_t[3 * output_len]);
+    ASSERT_TRUE(kdf1.GenerateKeys(no_infos, 3, outputs.get(), output_len));
+    for (size_t i = 0; i < 3; ++i)
+        EXPECT_EQ(0, memcmp(outputs.get() + i * output_len, expected_output.data(), output_len));
+}
+
 }  // namespace test
 
 }  // namespace keymaster
@@ -27,6 +27,8 @@
 
 namespace keymaster {
 
+class AttestationSigner;
+
 class Key {
   public:
     virtual ~Key() {}
@@ -48,6 +50,20 @@ class Key {
         return KM_ERROR_INCOMPATIBLE_ALGORITHM;
     }
 
+    /**
+     * Build and sign the leaf certificate of an attestation chain, embedding the DER-encoded
+     * attestation record in \p attestation_record.  Does not call into the context, so it may be
+     * called from any thread.
+     */
+    virtual keymaster_error_t SignAttestation(const AttestationSigner& /* signer */,
+                                              const uint8_t* /* attestation_record */,
+                                              size_t /* record_length */,
+                                              const AuthorizationSet& /* tee_enforced */,
+                                              const AuthorizationSet& /* sw_enforced */,
+                                              keymaster_blob_t* /* certificate */) const {
+        return KM_ERROR_INCOMPATIBLE_ALGORITHM;
+    }
+
     const AuthorizationSet& authorizations() const { return authorizations_; }
 
   protected:
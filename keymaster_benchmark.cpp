@@ -0,0 +1,974 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+/*
+ * Host micro-benchmarks for keymaster hot paths.  Built by the local Makefile with "make
+ * keymaster_benchmark"; not part of the unit tests.  Each benchmark runs its body repeatedly for a
+ * fixed wall-clock interval and reports throughput and mean latency.
+ */
+
+#include <fcntl.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <keymaster/allocation_stats.h>
+#include <keymaster/android_keymaster.h>
+#include <keymaster/android_keymaster_messages.h>
+#include <keymaster/async_logger.h>
+#include <keymaster/authorization_set.h>
+#include <keymaster/batch_attester.h>
+#include <keymaster/rsa_batch_verifier.h>
+#include <keymaster/latency_stats.h>
+#include <keymaster/soft_keymaster_context.h>
+#include <keymaster/trace_event_recorder.h>
+
+#include "attestation_record.h"
+#include "ecies_kem.h"
+#include "ephemeral_key_pool.h"
+#include "hkdf.h"
+#include "kdf1.h"
+#include "kdf2.h"
+#include "nist_curve_key_exchange.h"
+#include "secure_memory_pool.h"
+#include "sha256_multibuffer.h"
+#include "worker_pool.h"
+
+namespace keymaster {
+namespace benchmark {
+
+const double kRunSeconds = 2.0;
+
+static double now_seconds() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/**
+ * Run \p body until kRunSeconds have elapsed and print the achieved rate.  \p body returns false to
+ * report a failure, which aborts the benchmark.  If each call of \p body processes several items,
+ * pass their number as \p items_per_call to report per-item figures.
+ */
+template <typename Body> bool Run(const char* name, Body body, size_t items_per_call = 1) {
+    size_t iterations = 0;
+    double start = now_seconds();
+    double elapsed = 0;
+    do {
+        if (!body()) {
+            printf("%-48s FAILED\n", name);
+            return false;
+        }
+        ++iterations;
+        elapsed = now_seconds() - start;
+    } while (elapsed < kRunSeconds);
+
+    double items = static_cast<double>(iterations) * items_per_call;
+    printf("%-48s %10.1f ops/s %10.2f us/op\n", name, items / elapsed, elapsed * 1e6 / items);
+    return true;
+}
+
+/**
+ * Run for a body declared not to allocate.  In builds with KEYMASTER_ALLOCATION_STATS the benchmark
+ * fails if any call of \p body allocates from the heap.
+ */
+template <typename Body>
+bool RunAllocationFree(const char* name, Body body, size_t items_per_call = 1) {
+    return Run(name,
+               [&] {
+                   AllocationScope scope(name);
+                   if (!body())
+                       return false;
+                   AllocationStats stats;
+                   scope.GetStats(&stats);
+                   if (stats.allocations != 0) {
+                       printf("%-48s made %llu allocations\n", name,
+                              static_cast<unsigned long long>(stats.allocations));
+                       return false;
+                   }
+                   return true;
+               },
+               items_per_call);
+}
+
+/**
+ * Thin wrapper around an AndroidKeymaster backed by a SoftKeymasterContext, with key blobs held as
+ * strings.
+ */
+class BenchmarkKeymaster {
+  public:
+    BenchmarkKeymaster() : BenchmarkKeymaster(new SoftKeymasterContext) {}
+    explicit BenchmarkKeymaster(KeymasterContext* context)
+        : keymaster_(context, 64 /* operation_table_size */) {}
+
+    bool GenerateKey(const AuthorizationSetBuilder& builder, std::string* key_blob) {
+        GenerateKeyRequest request;
+        request.key_description.Reinitialize(builder.build());
+        request.key_description.push_back(TAG_NO_AUTH_REQUIRED);
+        GenerateKeyResponse response;
+        keymaster_.GenerateKey(request, &response);
+        if (response.error != KM_ERROR_OK)
+            return false;
+        key_blob->assign(reinterpret_cast<const char*>(response.key_blob.key_material),
+                         response.key_blob.key_material_size);
+        return true;
+    }
+
+    bool Process(keymaster_purpose_t purpose, const std::string& key_blob,
+                 const AuthorizationSet& begin_params, const std::string& input,
+                 const std::string& signature, std::string* output) {
+        BeginOperationRequest begin_request;
+        begin_request.purpose = purpose;
+        begin_request.SetKeyMaterial(key_blob.data(), key_blob.size());
+        begin_request.additional_params.Reinitialize(begin_params);
+        BeginOperationResponse begin_response;
+        keymaster_.BeginOperation(begin_request, &begin_response);
+        if (begin_response.error != KM_ERROR_OK)
+            return false;
+
+        FinishOperationRequest finish_request;
+        finish_request.op_handle = begin_response.op_handle;
+        finish_request.input.Reinitialize(input.data(), input.size());
+        finish_request.signature.Reinitialize(signature.data(), signature.size());
+        FinishOperationResponse finish_response;
+        keymaster_.FinishOperation(finish_request, &finish_response);
+        if (finish_response.error != KM_ERROR_OK)
+            return false;
+        if (output)
+            output->assign(reinterpret_cast<const char*>(finish_response.output.peek_read()),
+                           finish_response.output.available_read());
+        return true;
+    }
+
+    bool AttestKey(const std::string& key_blob, const AuthorizationSet& attest_params) {
+        AttestKeyRequest request;
+        request.SetKeyMaterial(key_blob.data(), key_blob.size());
+        request.attest_params.Reinitialize(attest_params);
+        AttestKeyResponse response;
+        keymaster_.AttestKey(request, &response);
+        return response.error == KM_ERROR_OK;
+    }
+
+    AndroidKeymaster* keymaster() { return &keymaster_; }
+
+  private:
+    AndroidKeymaster keymaster_;
+};
+
+/**
+ * SoftKeymasterContext without shared attestation certificate templates, so that every attestation
+ * parses the signing certificate and derives the authority key identifier again.
+ */
+class UntemplatedSoftKeymasterContext : public SoftKeymasterContext {
+  public:
+    const AttestationCertTemplate*
+    AttestationCertificateTemplate(keymaster_algorithm_t /* algorithm */) const override {
+        return nullptr;
+    }
+};
+
+/**
+ * SoftKeymasterContext without a monotonic clock, so that AndroidKeymaster records no latency
+ * statistics.  Comparing runs against it with runs against SoftKeymasterContext gives the cost of
+ * the measurement.
+ */
+class UntimedSoftKeymasterContext : public SoftKeymasterContext {
+  public:
+    uint64_t GetMonotonicTimeNs() const override { return 0; }
+};
+
+static AuthorizationSet RsaSignParams() {
+    return AuthorizationSetBuilder()
+        .Digest(KM_DIGEST_SHA_2_256)
+        .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN)
+        .build();
+}
+
+/**
+ * Repeated RSA signing.  "warm" signs with one key throughout, so the parsed key and its
+ * Montgomery/blinding state stay cached; "cold" rotates through more keys than the cache holds, so
+ * every Begin re-parses and re-derives that state.
+ */
+static bool BenchmarkRsaSign(BenchmarkKeymaster* km, uint32_t key_size) {
+    const size_t kColdKeyCount = 9;  // One more than the RSA key cache size.
+    std::vector<std::string> blobs(kColdKeyCount);
+    for (auto& blob : blobs)
+        if (!km->GenerateKey(AuthorizationSetBuilder()
+                                 .RsaSigningKey(key_size, 65537)
+                                 .Digest(KM_DIGEST_SHA_2_256)
+                                 .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN),
+                             &blob))
+            return false;
+
+    AuthorizationSet params = RsaSignParams();
+    std::string message(32, 'a');
+    char name[64];
+
+    snprintf(name, sizeof(name), "rsa%u_sign_sha256_warm", key_size);
+    if (!Run(name, [&] {
+            return km->Process(KM_PURPOSE_SIGN, blobs[0], params, message, "", nullptr);
+        }))
+        return false;
+
+    size_t next = 0;
+    snprintf(name, sizeof(name), "rsa%u_sign_sha256_cold", key_size);
+    return Run(name, [&] {
+        next = (next + 1) % blobs.size();
+        return km->Process(KM_PURPOSE_SIGN, blobs[next], params, message, "", nullptr);
+    });
+}
+
+/**
+ * Public-key RSA operations on small messages, where setting up the padding context is a large
+ * share of the cost: PSS verification and OAEP encryption.
+ */
+static bool BenchmarkRsaPublic(BenchmarkKeymaster* km, uint32_t key_size) {
+    std::string sign_blob, crypt_blob;
+    if (!km->GenerateKey(AuthorizationSetBuilder()
+                             .RsaSigningKey(key_size, 65537)
+                             .Digest(KM_DIGEST_SHA_2_256)
+                             .Padding(KM_PAD_RSA_PSS),
+                         &sign_blob) ||
+        !km->GenerateKey(AuthorizationSetBuilder()
+                             .RsaEncryptionKey(key_size, 65537)
+                             .Digest(KM_DIGEST_SHA_2_256)
+                             .Padding(KM_PAD_RSA_OAEP),
+                         &crypt_blob))
+        return false;
+
+    AuthorizationSet pss_params =
+        AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256).Padding(KM_PAD_RSA_PSS).build();
+    AuthorizationSet oaep_params =
+        AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256).Padding(KM_PAD_RSA_OAEP).build();
+    std::string message(32, 'a');
+    std::string signature;
+    if (!km->Process(KM_PURPOSE_SIGN, sign_blob, pss_params, message, "", &signature))
+        return false;
+    char name[64];
+
+    snprintf(name, sizeof(name), "rsa%u_verify_pss_sha256", key_size);
+    if (!Run(name, [&] {
+            return km->Process(KM_PURPOSE_VERIFY, sign_blob, pss_params, message, signature,
+                               nullptr);
+        }))
+        return false;
+
+    snprintf(name, sizeof(name), "rsa%u_encrypt_oaep_sha256", key_size);
+    return Run(name, [&] {
+        return km->Process(KM_PURPOSE_ENCRYPT, crypt_blob, oaep_params, message, "", nullptr);
+    });
+}
+
+/**
+ * HMAC-SHA256 signing of 32-byte messages.  "warm" uses one key, so its keyed context template
+ * stays cached; "cold" rotates through more keys than the cache holds, so every Begin keys a new
+ * context, as all operations did before the cache.
+ */
+static bool BenchmarkHmacSign(BenchmarkKeymaster* km) {
+    const size_t kColdKeyCount = 17;  // One more than the HMAC context cache size.
+    std::vector<std::string> blobs(kColdKeyCount);
+    for (auto& blob : blobs)
+        if (!km->GenerateKey(AuthorizationSetBuilder()
+                                 .HmacKey(256)
+                                 .Digest(KM_DIGEST_SHA_2_256)
+                                 .Authorization(TAG_MIN_MAC_LENGTH, 256),
+                             &blob))
+            return false;
+
+    AuthorizationSet params = AuthorizationSetBuilder()
+                                  .Digest(KM_DIGEST_SHA_2_256)
+                                  .Authorization(TAG_MAC_LENGTH, 256)
+                                  .build();
+    std::string message(32, 'a');
+
+    if (!Run("hmac_sha256_sign_32b_warm", [&] {
+            return km->Process(KM_PURPOSE_SIGN, blobs[0], params, message, "", nullptr);
+        }))
+        return false;
+
+    size_t next = 0;
+    return Run("hmac_sha256_sign_32b_cold", [&] {
+        next = (next + 1) % blobs.size();
+        return km->Process(KM_PURPOSE_SIGN, blobs[next], params, message, "", nullptr);
+    });
+}
+
+/**
+ * BeginOperation alone, each operation aborted straight away, on an HMAC key so that the request
+ * handling rather than the crypto dominates.  Besides the mean, reports the 99th percentile latency
+ * and, in builds with KEYMASTER_ALLOCATION_STATS, the heap allocations per request.  \p variant is
+ * appended to the benchmark name.
+ */
+static bool BenchmarkBeginOperation(BenchmarkKeymaster* km, const char* variant) {
+    std::string blob;
+    if (!km->GenerateKey(AuthorizationSetBuilder()
+                             .HmacKey(256)
+                             .Digest(KM_DIGEST_SHA_2_256)
+                             .Authorization(TAG_MIN_MAC_LENGTH, 256),
+                         &blob))
+        return false;
+
+    std::string name_string = std::string("begin_operation_hmac_sha256") + variant;
+    const char* name = name_string.c_str();
+    BeginOperationRequest request;
+    request.purpose = KM_PURPOSE_SIGN;
+    request.SetKeyMaterial(blob.data(), blob.size());
+    request.additional_params.Reinitialize(AuthorizationSetBuilder()
+                                               .Digest(KM_DIGEST_SHA_2_256)
+                                               .Authorization(TAG_MAC_LENGTH, 256)
+                                               .build());
+
+    std::vector<double> latencies;
+    uint64_t allocations = 0;
+    if (!Run(name, [&] {
+            BeginOperationResponse response;
+            AllocationStats stats;
+            double start = now_seconds();
+            {
+                AllocationScope scope(name);
+                km->keymaster()->BeginOperation(request, &response);
+                scope.GetStats(&stats);
+            }
+            latencies.push_back(now_seconds() - start);
+            allocations += stats.allocations;
+            if (response.error != KM_ERROR_OK)
+                return false;
+
+            AbortOperationRequest abort_request;
+            abort_request.op_handle = response.op_handle;
+            AbortOperationResponse abort_response;
+            km->keymaster()->AbortOperation(abort_request, &abort_response);
+            return abort_response.error == KM_ERROR_OK;
+        }))
+        return false;
+
+    std::sort(latencies.begin(), latencies.end());
+    printf("%-48s %10.2f us p99\n", name, latencies[latencies.size() * 99 / 100] * 1e6);
+    if (allocation_stats_enabled())
+        printf("%-48s %10.1f allocations/op\n", name,
+               static_cast<double>(allocations) / latencies.size());
+    return true;
+}
+
+/**
+ * ECDSA-SHA256 verification of 32-byte messages.  "warm" verifies against one key, which stays
+ * parsed in the key cache; "cold" rotates through more keys than the cache holds, so every Begin
+ * parses and validates the key, as all operations did before the cache.
+ */
+static bool BenchmarkEcdsaVerify(BenchmarkKeymaster* km, uint32_t key_size) {
+    const size_t kColdKeyCount = 9;  // One more than the EC key cache size.
+    AuthorizationSet params = AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256).build();
+    std::string message(32, 'a');
+    std::vector<std::string> blobs(kColdKeyCount), signatures(kColdKeyCount);
+    for (size_t i = 0; i < kColdKeyCount; ++i) {
+        if (!km->GenerateKey(
+                AuthorizationSetBuilder().EcdsaSigningKey(key_size).Digest(KM_DIGEST_SHA_2_256),
+                &blobs[i]) ||
+            !km->Process(KM_PURPOSE_SIGN, blobs[i], params, message, "", &signatures[i]))
+            return false;
+    }
+
+    char name[64];
+    snprintf(name, sizeof(name), "ec%u_verify_sha256_warm", key_size);
+    if (!Run(name, [&] {
+            return km->Process(KM_PURPOSE_VERIFY, blobs[0], params, message, signatures[0],
+                               nullptr);
+        }))
+        return false;
+
+    size_t next = 0;
+    snprintf(name, sizeof(name), "ec%u_verify_sha256_cold", key_size);
+    return Run(name, [&] {
+        next = (next + 1) % blobs.size();
+        return km->Process(KM_PURPOSE_VERIFY, blobs[next], params, message, signatures[next],
+                           nullptr);
+    });
+}
+
+/**
+ * Batch RSA-2048 PSS verification of 32-byte messages with one key, at increasing thread counts.
+ * Per-item throughput should scale with the number of threads up to the number of cores.
+ */
+static bool BenchmarkRsaBatchVerify(BenchmarkKeymaster* km) {
+    const size_t kBatchSize = 256;
+    std::string key_blob;
+    if (!km->GenerateKey(AuthorizationSetBuilder()
+                             .RsaSigningKey(2048, 65537)
+                             .Digest(KM_DIGEST_SHA_2_256)
+                             .Padding(KM_PAD_RSA_PSS),
+                         &key_blob))
+        return false;
+
+    AuthorizationSet params =
+        AuthorizationSetBuilder().Digest(KM_DIGEST_SHA_2_256).Padding(KM_PAD_RSA_PSS).build();
+    std::vector<std::string> messages(kBatchSize), signatures(kBatchSize);
+    std::vector<RsaBatchVerifier::Item> items(kBatchSize);
+    for (size_t i = 0; i < kBatchSize; ++i) {
+        messages[i].assign(32, 'a' + i % 26);
+        if (!km->Process(KM_PURPOSE_SIGN, key_blob, params, messages[i], "", &signatures[i]))
+            return false;
+        items[i].message = {reinterpret_cast<const uint8_t*>(messages[i].data()),
+                            messages[i].size()};
+        items[i].signature = {reinterpret_cast<const uint8_t*>(signatures[i].data()),
+                              signatures[i].size()};
+    }
+
+    keymaster_key_blob_t blob = {reinterpret_cast<const uint8_t*>(key_blob.data()),
+                                 key_blob.size()};
+    for (size_t threads : {1, 2, 4, 8}) {
+        RsaBatchVerifier verifier(threads);
+        std::vector<keymaster_error_t> results;
+        char name[64];
+        snprintf(name, sizeof(name), "rsa2048_batch_verify_pss_sha256_t%zu", threads);
+        if (!Run(name,
+                 [&] {
+                     return verifier.Verify(km->keymaster(), blob, params, items, &results) ==
+                                KM_ERROR_OK &&
+                            results[0] == KM_ERROR_OK;
+                 },
+                 kBatchSize))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Allocating and freeing key-sized key material, from the heap (with the wipe KeymasterKeyBlob
+ * always did) and from a SecureMemoryPool, whose chunks are already mapped and locked.
+ */
+static bool BenchmarkKeyMaterialAllocation() {
+    SecureMemoryPool pool;
+    for (size_t size : {32, 1200}) {
+        std::string heap_name = "key_material_" + std::to_string(size) + "b_heap";
+        std::string pool_name = "key_material_" + std::to_string(size) + "b_secure_pool";
+        if (!Run(heap_name.c_str(),
+                 [&] {
+                     KeyMaterialAllocator* allocator;
+                     uint8_t* material = AllocateKeyMaterial(size, &allocator);
+                     FreeKeyMaterial(material, size, allocator);
+                     return material != nullptr;
+                 }) ||
+            !Run(pool_name.c_str(), [&] {
+                uint8_t* material = pool.Allocate(size);
+                return material != nullptr && pool.Free(material);
+            }))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Writes each message to /dev/null with one write(2), standing in for the log daemon socket.
+ */
+class DevNullLogger : public Logger {
+  public:
+    DevNullLogger() : fd_(open("/dev/null", O_WRONLY | O_CLOEXEC)) {}
+    ~DevNullLogger() { close(fd_); }
+
+    int log_msg(LogLevel /* level */, const char* fmt, va_list args) const override {
+        char message[1024];
+        int length = vsnprintf(message, sizeof(message), fmt, args);
+        if (length > 0 && write(fd_, message, std::min<size_t>(length, sizeof(message) - 1)) < 0)
+            return -1;
+        return length;
+    }
+
+  private:
+    const int fd_;
+};
+
+static int LogTo(const Logger& logger, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int result = logger.log_msg(Logger::DEBUG_LVL, fmt, args);
+    va_end(args);
+    return result;
+}
+
+/**
+ * Latency of a LOG_D-style call of the kind SoftKeymasterDevice::begin makes, written
+ * synchronously and through an AsyncLogger, while three other threads log every few microseconds,
+ * and the cost of a LOG_D that the runtime level suppresses.
+ */
+static bool BenchmarkLogging() {
+    DevNullLogger sink;
+    AsyncLogger async_logger(&sink);
+    const char* fmt =
+        "soft_keymaster_device.cpp, Line 1234: Operation %llu on %s key with digest %d";
+    for (const Logger* logger : {static_cast<const Logger*>(&sink),
+                                 static_cast<const Logger*>(&async_logger)}) {
+        std::string name = logger == &sink ? "log_message_sync" : "log_message_async";
+        std::atomic<bool> done(false);
+        std::vector<std::thread> background;
+        for (int i = 0; i < 3; ++i)
+            background.emplace_back([&] {
+                for (unsigned long long n = 0; !done; ++n) {
+                    LogTo(*logger, fmt, n, "HMAC", 4);
+                    std::this_thread::sleep_for(std::chrono::microseconds(2));
+                }
+            });
+
+        std::vector<double> latencies;
+        unsigned long long n = 0;
+        bool result = Run(name.c_str(), [&] {
+            double start = now_seconds();
+            LogTo(*logger, fmt, ++n, "AES", 0);
+            latencies.push_back(now_seconds() - start);
+            std::this_thread::sleep_for(std::chrono::microseconds(10));
+            return true;
+        });
+        done = true;
+        for (auto& thread : background)
+            thread.join();
+        if (!result)
+            return false;
+
+        std::sort(latencies.begin(), latencies.end());
+        printf("%-48s %10.2f us p99\n", name.c_str(), latencies[latencies.size() * 99 / 100] * 1e6);
+    }
+    printf("%-48s %10llu dropped\n", "log_message_async",
+           static_cast<unsigned long long>(async_logger.dropped()));
+
+    // A LOG_D below the runtime minimum level costs only the level check.
+    Logger::set_min_level(Logger::INFO_LVL);
+    unsigned long long n = 0;
+    bool result = RunAllocationFree("log_debug_suppressed", [&] {
+        LOG_D("Operation %llu on %s key with digest %d", ++n, "AES", 0);
+        return true;
+    });
+    Logger::set_min_level(Logger::DEBUG_LVL);
+    return result;
+}
+
+/**
+ * The cost of a TraceSpan with no tracer installed, which is what every traced scope in
+ * AndroidKeymaster and SoftKeymasterDevice pays normally, and BeginOperation traced into a
+ * TraceEventRecorder, for comparison with begin_operation_hmac_sha256.
+ */
+static bool BenchmarkTracing(BenchmarkKeymaster* km) {
+    if (!RunAllocationFree("trace_span_disabled", [] {
+            TraceSpan span("disabled");
+            return true;
+        }))
+        return false;
+
+    TraceEventRecorder recorder;
+    if (!BenchmarkBeginOperation(km, "_traced"))
+        return false;
+    printf("%-48s %10llu dropped\n", "begin_operation_hmac_sha256_traced",
+           static_cast<unsigned long long>(recorder.dropped()));
+    return true;
+}
+
+/**
+ * Multi-buffer SHA-256 throughput per message at each lane count the build supports, for token-
+ * and key-blob-sized messages.
+ */
+static bool BenchmarkSha256MultiBuffer() {
+    const size_t kBatchSize = 64;
+    for (size_t message_size : {32, 256}) {
+        std::string message(message_size, 'k');
+        std::vector<Sha256Input> inputs(
+            kBatchSize, {reinterpret_cast<const uint8_t*>(message.data()), message.size()});
+        std::vector<uint8_t> digests(kBatchSize * SHA256_DIGEST_LENGTH);
+        auto digests_out = reinterpret_cast<uint8_t(*)[SHA256_DIGEST_LENGTH]>(digests.data());
+
+        for (size_t lanes : {1, 4, 8}) {
+            if (lanes > Sha256MultiBufferMaxLanes())
+                break;
+            char name[64];
+            snprintf(name, sizeof(name), "sha256_%zub_lanes%zu", message_size, lanes);
+            if (!RunAllocationFree(name,
+                                   [&] {
+                                       Sha256MultiBuffer(inputs.data(), inputs.size(),
+                                                         digests_out, lanes);
+                                       return true;
+                                   },
+                                   kBatchSize))
+                return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Derivation of a 32-byte key from a 32-byte secret.  "init_and_derive" runs \p init before every
+ * derivation, as ECIES does, so the secret is processed each time; "derive" reuses the state
+ * computed by one Init.
+ */
+template <typename Init> static bool BenchmarkKdf(const char* name, Kdf* kdf, Init init) {
+    const uint8_t info[16] = {2};
+    uint8_t output[32];
+    char run_name[64];
+
+    snprintf(run_name, sizeof(run_name), "%s_init_and_derive_32b", name);
+    if (!Run(run_name, [&] {
+            return init() && kdf->GenerateKey(info, sizeof(info), output, sizeof(output));
+        }))
+        return false;
+
+    snprintf(run_name, sizeof(run_name), "%s_derive_32b", name);
+    return init() && Run(run_name, [&] {
+               return kdf->GenerateKey(info, sizeof(info), output, sizeof(output));
+           });
+}
+
+static bool BenchmarkKdfs() {
+    const uint8_t secret[32] = {1};
+    Kdf1 kdf1;
+    Kdf2 kdf2;
+    Rfc5869Sha256Kdf hkdf;
+    return BenchmarkKdf("kdf1_sha256", &kdf1,
+                        [&] { return kdf1.Init(KM_DIGEST_SHA_2_256, secret, sizeof(secret)); }) &&
+           BenchmarkKdf("kdf2_sha256", &kdf2,
+                        [&] { return kdf2.Init(KM_DIGEST_SHA_2_256, secret, sizeof(secret)); }) &&
+           BenchmarkKdf("hkdf_sha256", &hkdf, [&] {
+               return hkdf.Init(secret, sizeof(secret), nullptr /* salt */, 0 /* salt_len */);
+           });
+}
+
+/**
+ * ECIES-KEM encapsulation to a fixed recipient with the ephemeral key pair generated inline, then
+ * drawn from a pre-generation pool with two refill threads.  "pooled_burst" times as many
+ * encapsulations as the full stock holds, so every key pair is a hit; "pooled_sustained" keeps
+ * encapsulating for the whole run, and the pool statistics printed afterwards show how many
+ * requests the refill threads kept up with.
+ */
+static bool BenchmarkEciesEncrypt(keymaster_ec_curve_t curve, const char* curve_name) {
+    const size_t kStock = 64;
+    AuthorizationSet kem_description(AuthorizationSetBuilder()
+                                         .Authorization(TAG_EC_CURVE, curve)
+                                         .Authorization(TAG_KDF, KM_KDF_RFC5869_SHA256)
+                                         .Authorization(TAG_KEY_SIZE, 32));
+    keymaster_error_t error;
+    EciesKem kem(kem_description, &error);
+    UniquePtr<NistCurveKeyExchange> recipient(NistCurveKeyExchange::GenerateKeyExchange(curve));
+    Buffer peer_public_value;
+    if (error != KM_ERROR_OK || !recipient.get() || !recipient->public_value(&peer_public_value))
+        return false;
+
+    Buffer clear_key;
+    Buffer encrypted_key;
+    auto encrypt = [&] { return kem.Encrypt(peer_public_value, &clear_key, &encrypted_key); };
+    char name[64];
+    snprintf(name, sizeof(name), "ecies_%s_encrypt_inline", curve_name);
+    if (!Run(name, encrypt))
+        return false;
+
+    EphemeralKeyPregenerationPool pool;
+    if (!pool.AddStock(curve, kStock) || !pool.Start(2 /* thread_count */))
+        return false;
+    for (int i = 0; pool.GetStats()[0].available < kStock; ++i) {
+        if (i == 10000)
+            return false;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    kem.set_ephemeral_key_pool(&pool);
+
+    snprintf(name, sizeof(name), "ecies_%s_encrypt_pooled_burst", curve_name);
+    double start = now_seconds();
+    for (size_t i = 0; i < kStock; ++i) {
+        if (!encrypt()) {
+            printf("%-48s FAILED\n", name);
+            return false;
+        }
+    }
+    double elapsed = now_seconds() - start;
+    printf("%-48s %10.1f ops/s %10.2f us/op\n", name, kStock / elapsed, elapsed * 1e6 / kStock);
+
+    snprintf(name, sizeof(name), "ecies_%s_encrypt_pooled_sustained", curve_name);
+    bool ok = Run(name, encrypt);
+    kem.set_ephemeral_key_pool(nullptr);
+
+    EphemeralKeyPregenerationPool::Stats stats = pool.GetStats()[0];
+    uint64_t takes = stats.hits + stats.misses;
+    printf("%-48s %9.1f%% hits %10.2f us/take\n", "  ephemeral key pool",
+           100.0 * stats.hits / takes, static_cast<double>(stats.total_take_us) / takes);
+    return ok;
+}
+
+/**
+ * Decapsulation of a batch of ECIES-KEM encapsulated keys sent to one recipient, as one Decrypt
+ * call per key, as a serial DecryptBatch and as a DecryptBatch spread over a worker pool.
+ */
+static bool BenchmarkEciesDecryptBatch(keymaster_ec_curve_t curve, const char* curve_name) {
+    const size_t kBatchSize = 64;
+    AuthorizationSet kem_description(AuthorizationSetBuilder()
+                                         .Authorization(TAG_EC_CURVE, curve)
+                                         .Authorization(TAG_KDF, KM_KDF_RFC5869_SHA256)
+                                         .Authorization(TAG_KEY_SIZE, 32));
+    keymaster_error_t error;
+    EciesKem kem(kem_description, &error);
+    UniquePtr<NistCurveKeyExchange> recipient(NistCurveKeyExchange::GenerateKeyExchange(curve));
+    Buffer peer_public_value;
+    if (error != KM_ERROR_OK || !recipient.get() || !recipient->public_value(&peer_public_value))
+        return false;
+    EC_KEY_Ptr private_key(recipient->private_key());
+
+    std::vector<Buffer> clear_keys(kBatchSize);
+    std::vector<Buffer> encrypted_keys(kBatchSize);
+    for (size_t i = 0; i < kBatchSize; ++i)
+        if (!kem.Encrypt(peer_public_value, &clear_keys[i], &encrypted_keys[i]))
+            return false;
+
+    char name[64];
+    snprintf(name, sizeof(name), "ecies_%s_decrypt_x%zu_single", curve_name, kBatchSize);
+    if (!Run(name,
+             [&] {
+                 for (size_t i = 0; i < kBatchSize; ++i)
+                     if (!kem.Decrypt(EC_KEY_dup(private_key.get()), encrypted_keys[i],
+                                      &clear_keys[i]))
+                         return false;
+                 return true;
+             },
+             kBatchSize))
+        return false;
+
+    WorkerPool worker_pool(0 /* one thread per core */);
+    for (WorkerPool* pool : {static_cast<WorkerPool*>(nullptr), &worker_pool}) {
+        snprintf(name, sizeof(name), "ecies_%s_decrypt_x%zu_batch_threads%zu", curve_name,
+                 kBatchSize, pool ? pool->thread_count() : 1);
+        if (!Run(name,
+                 [&] {
+                     return kem.DecryptBatch(EC_KEY_dup(private_key.get()), encrypted_keys.data(),
+                                             kBatchSize, clear_keys.data(), pool);
+                 },
+                 kBatchSize))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Attestation of an RSA and an EC key, each signed by the attestation key of the same algorithm
+ * and returned with the attestation certificate chain.  \p variant is appended to the benchmark
+ * names, to tell apart runs against differently configured contexts.
+ */
+static bool BenchmarkAttestKey(BenchmarkKeymaster* km, const char* variant) {
+    std::string rsa_blob;
+    std::string ec_blob;
+    if (!km->GenerateKey(AuthorizationSetBuilder().RsaSigningKey(2048, 65537).Digest(
+                             KM_DIGEST_SHA_2_256),
+                         &rsa_blob) ||
+        !km->GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(
+                             KM_DIGEST_SHA_2_256),
+                         &ec_blob))
+        return false;
+
+    AuthorizationSet attest_params(
+        AuthorizationSetBuilder()
+            .Authorization(TAG_ATTESTATION_CHALLENGE, "challenge", 9)
+            .Authorization(TAG_ATTESTATION_APPLICATION_ID, "attest_app_id", 13));
+    std::string rsa_name = std::string("attest_key_rsa2048") + variant;
+    std::string ec_name = std::string("attest_key_ec256") + variant;
+    return Run(rsa_name.c_str(), [&] { return km->AttestKey(rsa_blob, attest_params); }) &&
+           Run(ec_name.c_str(), [&] { return km->AttestKey(ec_blob, attest_params); });
+}
+
+/**
+ * Batch attestation of 64 EC-256 keys at increasing thread counts, reported per key for comparison
+ * with attest_key_ec256.
+ */
+static bool BenchmarkBatchAttest(BenchmarkKeymaster* km) {
+    const size_t kBatchSize = 64;
+    std::vector<std::string> key_blobs(kBatchSize);
+    std::vector<keymaster_key_blob_t> blobs(kBatchSize);
+    for (size_t i = 0; i < kBatchSize; ++i) {
+        if (!km->GenerateKey(AuthorizationSetBuilder().EcdsaSigningKey(256).Digest(
+                                 KM_DIGEST_SHA_2_256),
+                             &key_blobs[i]))
+            return false;
+        blobs[i] = {reinterpret_cast<const uint8_t*>(key_blobs[i].data()), key_blobs[i].size()};
+    }
+
+    AuthorizationSet attest_params(
+        AuthorizationSetBuilder()
+            .Authorization(TAG_ATTESTATION_CHALLENGE, "challenge", 9)
+            .Authorization(TAG_ATTESTATION_APPLICATION_ID, "attest_app_id", 13));
+    for (size_t threads : {1, 2, 4, 8}) {
+        BatchAttester attester(threads);
+        AttestationBatch batch;
+        char name[64];
+        snprintf(name, sizeof(name), "batch_attest_ec256_t%zu", threads);
+        if (!Run(name,
+                 [&] {
+                     return attester.Attest(km->keymaster(), blobs, attest_params, &batch) ==
+                                KM_ERROR_OK &&
+                            batch.error(kBatchSize - 1) == KM_ERROR_OK;
+                 },
+                 kBatchSize))
+            return false;
+    }
+    return true;
+}
+
+/**
+ * Encoding of the attestation record for a typical software-generated RSA key, by the direct DER
+ * writer and by the reference ASN.1 template encoder.  No signing is involved.
+ */
+static bool BenchmarkAttestationRecord() {
+    SoftKeymasterContext context;
+    AuthorizationSet sw_enforced(AuthorizationSetBuilder()
+                                     .RsaSigningKey(2048, 65537)
+                                     .Digest(KM_DIGEST_NONE)
+                                     .Digest(KM_DIGEST_SHA_2_256)
+                                     .Digest(KM_DIGEST_SHA_2_512)
+                                     .Padding(KM_PAD_RSA_PSS)
+                                     .Padding(KM_PAD_RSA_PKCS1_1_5_SIGN)
+                                     .Authorization(TAG_NO_AUTH_REQUIRED)
+                                     .Authorization(TAG_ORIGIN, KM_ORIGIN_GENERATED)
+                                     .Authorization(TAG_CREATION_DATETIME, 1500000000000ULL)
+                                     .Authorization(TAG_OS_VERSION, 80000)
+                                     .Authorization(TAG_OS_PATCHLEVEL, 201710));
+    AuthorizationSet tee_enforced;
+    AuthorizationSet attest_params(
+        AuthorizationSetBuilder()
+            .Authorization(TAG_ATTESTATION_CHALLENGE, "challenge", 9)
+            .Authorization(TAG_ATTESTATION_APPLICATION_ID, "attest_app_id", 13));
+
+    UniquePtr<uint8_t[]> record;
+    size_t record_len;
+    return Run("attestation_record_der_writer",
+               [&] {
+                   return build_attestation_record(attest_params, sw_enforced, tee_enforced,
+                                                   context, &record,
+                                                   &record_len) == KM_ERROR_OK;
+               }) &&
+           Run("attestation_record_asn1_templates", [&] {
+               return build_attestation_record_asn1(attest_params, sw_enforced, tee_enforced,
+                                                    context, &record, &record_len) == KM_ERROR_OK;
+           });
+}
+
+static bool BenchmarkAttestationRecordParse() {
+    SoftKeymasterContext context;
+    AuthorizationSet sw_enforced(AuthorizationSetBuilder()
+                                     .RsaSigningKey(2048, 65537)
+                                     .Digest(KM_DIGEST_NONE)
+                                     .Digest(KM_DIGEST_SHA_2_256)
+                                     .Padding(KM_PAD_RSA_PSS)
+                                     .Authorization(TAG_NO_AUTH_REQUIRED)
+                                     .Authorization(TAG_ORIGIN, KM_ORIGIN_GENERATED)
+                                     .Authorization(TAG_CREATION_DATETIME, 1500000000000ULL)
+                                     .Authorization(TAG_OS_VERSION, 80000)
+                                     .Authorization(TAG_OS_PATCHLEVEL, 201710));
+    AuthorizationSet attest_params(
+        AuthorizationSetBuilder()
+            .Authorization(TAG_ATTESTATION_CHALLENGE, "challenge", 9)
+            .Authorization(TAG_ATTESTATION_APPLICATION_ID, "attest_app_id", 13));
+    UniquePtr<uint8_t[]> record;
+    size_t record_len;
+    if (build_attestation_record(attest_params, sw_enforced, AuthorizationSet(), context, &record,
+                                 &record_len) != KM_ERROR_OK) {
+        printf("%-48s FAILED\n", "attestation_record_parse");
+        return false;
+    }
+
+    return Run("attestation_record_parse_copying",
+               [&] {
+                   uint32_t attestation_version;
+                   uint32_t keymaster_version;
+                   keymaster_security_level_t attestation_security_level;
+                   keymaster_security_level_t keymaster_security_level;
+                   keymaster_blob_t attestation_challenge = {};
+                   keymaster_blob_t unique_id = {};
+                   AuthorizationSet software_enforced;
+                   AuthorizationSet tee_enforced;
+                   keymaster_error_t error = parse_attestation_record(
+                       record.get(), record_len, &attestation_version,
+                       &attestation_security_level, &keymaster_version,
+                       &keymaster_security_level, &attestation_challenge, &software_enforced,
+                       &tee_enforced, &unique_id);
+                   delete[] attestation_challenge.data;
+                   delete[] unique_id.data;
+                   return error == KM_ERROR_OK;
+               }) &&
+           RunAllocationFree("attestation_record_parse_in_place", [&] {
+               AttestationRecordView view;
+               if (parse_attestation_record(record.get(), record_len, &view) != KM_ERROR_OK)
+                   return false;
+               keymaster_key_param_t param;
+               AuthListReader software_enforced(view.software_enforced);
+               while (software_enforced.Next(&param))
+                   continue;
+               AuthListReader tee_enforced(view.tee_enforced);
+               while (tee_enforced.Next(&param))
+                   continue;
+               return true;
+           });
+}
+
+/**
+ * Print the latency statistics \p km has gathered over the benchmarks run against it.
+ */
+static bool PrintLatencyStats(BenchmarkKeymaster* km) {
+    GetLatencyStatsResponse response;
+    km->keymaster()->GetLatencyStats(GetLatencyStatsRequest(), &response);
+    if (response.error != KM_ERROR_OK)
+        return false;
+
+    size_t length = FormatLatencyStats(response, nullptr, 0);
+    std::vector<char> table(length + 1);
+    FormatLatencyStats(response, table.data(), table.size());
+    printf("\n%s", table.data());
+    return true;
+}
+
+}  // namespace benchmark
+}  // namespace keymaster
+
+int main(int /* argc */, char** /* argv */) {
+    using namespace keymaster::benchmark;
+
+    BenchmarkKeymaster km;
+    bool ok = true;
+    ok &= BenchmarkRsaSign(&km, 2048);
+    ok &= BenchmarkRsaSign(&km, 4096);
+    ok &= BenchmarkRsaPublic(&km, 2048);
+    ok &= BenchmarkRsaBatchVerify(&km);
+    ok &= BenchmarkEcdsaVerify(&km, 256);
+    ok &= BenchmarkEcdsaVerify(&km, 384);
+    ok &= BenchmarkEcdsaVerify(&km, 521);
+    ok &= BenchmarkHmacSign(&km);
+    ok &= BenchmarkBeginOperation(&km, "");
+    BenchmarkKeymaster untimed_km(new UntimedSoftKeymasterContext);
+    ok &= BenchmarkBeginOperation(&untimed_km, "_untimed");
+    ok &= BenchmarkAttestKey(&km, "");
+    BenchmarkKeymaster untemplated_km(new UntemplatedSoftKeymasterContext);
+    ok &= BenchmarkAttestKey(&untemplated_km, "_untemplated");
+    ok &= BenchmarkBatchAttest(&km);
+    ok &= BenchmarkAttestationRecord();
+    ok &= BenchmarkAttestationRecordParse();
+    ok &= BenchmarkKeyMaterialAllocation();
+    ok &= BenchmarkLogging();
+    ok &= BenchmarkTracing(&km);
+    ok &= BenchmarkSha256MultiBuffer();
+    ok &= BenchmarkKdfs();
+    ok &= BenchmarkEciesEncrypt(KM_EC_CURVE_P_256, "p256");
+    ok &= BenchmarkEciesEncrypt(KM_EC_CURVE_P_521, "p521");
+    ok &= BenchmarkEciesDecryptBatch(KM_EC_CURVE_P_256, "p256");
+    ok &= PrintLatencyStats(&km);
+    return ok ? 0 : 1;
+}
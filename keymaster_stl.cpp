@@ -16,29 +16,139 @@
 */
 
 #include <keymaster/new>
+#include <keymaster/allocation_stats.h>
 #include <stdlib.h>
 
 namespace std {
 struct nothrow_t {};
 }
 
+// Host builds link the system C++ library, which defines std::nothrow itself.
+#ifndef HOST_BUILD
 const std::nothrow_t __attribute__((weak)) std::nothrow = {};
+#endif
+
+namespace keymaster {
+
+#ifdef KEYMASTER_ALLOCATION_STATS
+
+static __thread AllocationStats thread_allocation_stats;
+static AllocationReporter allocation_reporter = nullptr;
+
+static size_t allocation_size_bucket(size_t size) {
+    size_t bucket = 0;
+    while (size > 1 && bucket < kAllocationSizeBuckets - 1) {
+        size >>= 1;
+        ++bucket;
+    }
+    return bucket;
+}
+
+static void* counted_malloc(size_t size) {
+    void* ptr = malloc(size);
+    if (ptr) {
+        AllocationStats& stats = thread_allocation_stats;
+        ++stats.allocations;
+        stats.bytes_allocated += size;
+        ++stats.size_histogram[allocation_size_bucket(size)];
+    }
+    return ptr;
+}
+
+static void counted_free(void* ptr) {
+    if (ptr) {
+        ++thread_allocation_stats.frees;
+        free(ptr);
+    }
+}
+
+void GetThreadAllocationStats(AllocationStats* stats) {
+    *stats = thread_allocation_stats;
+}
+
+void ResetThreadAllocationStats() {
+    thread_allocation_stats = AllocationStats();
+}
+
+void SetAllocationReporter(AllocationReporter reporter) {
+    allocation_reporter = reporter;
+}
+
+AllocationScope::AllocationScope(const char* name) : name_(name) {
+    start_ = thread_allocation_stats;
+}
+
+AllocationScope::~AllocationScope() {
+    AllocationReporter reporter = allocation_reporter;
+    if (reporter) {
+        AllocationStats stats;
+        GetStats(&stats);
+        reporter(name_, stats);
+    }
+}
+
+void AllocationScope::GetStats(AllocationStats* stats) const {
+    const AllocationStats& now = thread_allocation_stats;
+    stats->allocations = now.allocations - start_.allocations;
+    stats->frees = now.frees - start_.frees;
+    stats->bytes_allocated = now.bytes_allocated - start_.bytes_allocated;
+    for (size_t i = 0; i < kAllocationSizeBuckets; ++i)
+        stats->size_histogram[i] = now.size_histogram[i] - start_.size_histogram[i];
+}
+
+#else  // KEYMASTER_ALLOCATION_STATS
+
+static void* counted_malloc(size_t size) {
+    return malloc(size);
+}
+
+static void counted_free(void* ptr) {
+    if (ptr)
+        free(ptr);
+}
+
+void GetThreadAllocationStats(AllocationStats* stats) {
+    *stats = AllocationStats();
+}
+
+void ResetThreadAllocationStats() {}
+
+void SetAllocationReporter(AllocationReporter /* reporter */) {}
+
+#endif  // KEYMASTER_ALLOCATION_STATS
+
+}  // namespace keymaster
 
 void* __attribute__((weak)) operator new(size_t __sz, const std::nothrow_t&) {
-    return malloc(__sz);
+    return keymaster::counted_malloc(__sz);
 }
 void* __attribute__((weak)) operator new[](size_t __sz, const std::nothrow_t&) {
-    return malloc(__sz);
+    return keymaster::counted_malloc(__sz);
+}
+
+#ifdef KEYMASTER_ALLOCATION_STATS
+// Count the allocations of STL containers and plain new as well, in the builds that have them.
+// Keymaster is built without exceptions, so running out of memory here is fatal.
+void* __attribute__((weak)) operator new(size_t __sz) {
+    void* ptr = keymaster::counted_malloc(__sz);
+    if (!ptr)
+        abort();
+    return ptr;
 }
+void* __attribute__((weak)) operator new[](size_t __sz) {
+    void* ptr = keymaster::counted_malloc(__sz);
+    if (!ptr)
+        abort();
+    return ptr;
+}
+#endif  // KEYMASTER_ALLOCATION_STATS
 
 void __attribute__((weak)) operator delete(void* ptr) {
-    if (ptr)
-        free(ptr);
+    keymaster::counted_free(ptr);
 }
 
 void __attribute__((weak)) operator delete[](void* ptr) {
-    if (ptr)
-        free(ptr);
+    keymaster::counted_free(ptr);
 }
 
 extern "C" {
@@ -0,0 +1,334 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/latency_stats.h>
+
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <keymaster/new>
+
+namespace keymaster {
+
+const size_t LatencyHistogram::kSubBucketBits;
+const size_t LatencyHistogram::kSubBuckets;
+const size_t LatencyHistogram::kMaxValueBits;
+const size_t LatencyHistogram::kBucketCount;
+const size_t LatencyStats::kMaxSeries;
+const size_t LatencyStats::kIndexSize;
+
+// Durations below kSubBuckets have a bucket each.  Above that, the bucket of a duration is given by
+// the position of its highest set bit and the kSubBucketBits bits below it.
+static size_t bucket_index(uint64_t duration_ns) {
+    const uint64_t kMaxValue = (uint64_t(1) << LatencyHistogram::kMaxValueBits) - 1;
+    if (duration_ns > kMaxValue)
+        duration_ns = kMaxValue;
+    if (duration_ns < LatencyHistogram::kSubBuckets)
+        return duration_ns;
+    size_t shift = 63 - __builtin_clzll(duration_ns) - LatencyHistogram::kSubBucketBits;
+    return shift * LatencyHistogram::kSubBuckets + (duration_ns >> shift);
+}
+
+// Returns the largest duration counted in bucket \p index.
+static uint64_t bucket_max(size_t index) {
+    if (index < 2 * LatencyHistogram::kSubBuckets)
+        return index;
+    size_t shift = index / LatencyHistogram::kSubBuckets - 1;
+    uint64_t sub_bucket = index % LatencyHistogram::kSubBuckets + LatencyHistogram::kSubBuckets;
+    return ((sub_bucket + 1) << shift) - 1;
+}
+
+void LatencyHistogram::Record(uint64_t duration_ns) {
+    ++buckets_[bucket_index(duration_ns)];
+    ++count_;
+    total_ns_ += duration_ns;
+    if (duration_ns > max_ns_)
+        max_ns_ = duration_ns;
+}
+
+void LatencyHistogram::Reset() {
+    count_ = 0;
+    total_ns_ = 0;
+    max_ns_ = 0;
+    memset(buckets_, 0, sizeof(buckets_));
+}
+
+uint64_t LatencyHistogram::Percentile(uint32_t per_mille) const {
+    if (count_ == 0)
+        return 0;
+    // The rank of the duration wanted, rounded up, counting from one.
+    uint64_t rank = (count_ * per_mille + 999) / 1000;
+    if (rank == 0)
+        rank = 1;
+    uint64_t seen = 0;
+    for (size_t i = 0; i < kBucketCount; ++i) {
+        seen += buckets_[i];
+        if (seen >= rank)
+            return bucket_max(i) < max_ns_ ? bucket_max(i) : max_ns_;
+    }
+    return max_ns_;
+}
+
+LatencyStats::LatencyStats() : series_count_(0), dropped_(0) {
+    memset(index_, 0, sizeof(index_));
+}
+
+LatencyStats::~LatencyStats() {
+    for (size_t i = 0; i < series_count_; ++i)
+        delete series_[i].histogram;
+}
+
+static bool same_series(uint32_t entry_point, uint32_t phase, const LatencyLabels& labels,
+                        uint32_t other_entry_point, uint32_t other_phase,
+                        const LatencyLabels& other_labels) {
+    return entry_point == other_entry_point && phase == other_phase &&
+           labels.algorithm == other_labels.algorithm && labels.purpose == other_labels.purpose &&
+           labels.block_mode == other_labels.block_mode;
+}
+
+void LatencyStats::Record(EntryPoint entry_point, Phase phase, const LatencyLabels& labels,
+                          uint64_t duration_ns) {
+    uint32_t hash = entry_point * 0x9E3779B1 ^ phase * 0x85EBCA77 ^ labels.algorithm * 0xC2B2AE3D ^
+                    labels.purpose * 0x27D4EB2F ^ labels.block_mode * 0x165667B1;
+    hash ^= hash >> 15;
+
+    for (size_t probe = 0; probe < kIndexSize; ++probe) {
+        uint8_t* slot = &index_[(hash + probe) % kIndexSize];
+        if (*slot == 0) {
+            if (series_count_ == kMaxSeries) {
+                ++dropped_;
+                return;
+            }
+            Series* series = &series_[series_count_];
+            series->histogram = new (std::nothrow) LatencyHistogram;
+            if (!series->histogram) {
+                ++dropped_;
+                return;
+            }
+            series->entry_point = entry_point;
+            series->phase = phase;
+            series->labels = labels;
+            *slot = static_cast<uint8_t>(++series_count_);
+            series->histogram->Record(duration_ns);
+            return;
+        }
+
+        Series* series = &series_[*slot - 1];
+        if (same_series(entry_point, phase, labels, series->entry_point, series->phase,
+                        series->labels)) {
+            series->histogram->Record(duration_ns);
+            return;
+        }
+    }
+    ++dropped_;
+}
+
+static bool summary_less(const LatencySummary& a, const LatencySummary& b) {
+    if (a.entry_point != b.entry_point)
+        return a.entry_point < b.entry_point;
+    if (a.phase != b.phase)
+        return a.phase < b.phase;
+    if (a.algorithm != b.algorithm)
+        return a.algorithm < b.algorithm;
+    if (a.purpose != b.purpose)
+        return a.purpose < b.purpose;
+    return a.block_mode < b.block_mode;
+}
+
+keymaster_error_t LatencyStats::Summarize(GetLatencyStatsResponse* response) const {
+    size_t count = 0;
+    for (size_t i = 0; i < series_count_; ++i)
+        if (series_[i].histogram->count() > 0)
+            ++count;
+    if (!response->AllocateSummaries(count))
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+
+    size_t filled = 0;
+    for (size_t i = 0; i < series_count_; ++i) {
+        const Series& series = series_[i];
+        const LatencyHistogram& histogram = *series.histogram;
+        if (histogram.count() == 0)
+            continue;
+
+        LatencySummary summary;
+        summary.entry_point = series.entry_point;
+        summary.phase = series.phase;
+        summary.algorithm = series.labels.algorithm;
+        summary.purpose = series.labels.purpose;
+        summary.block_mode = series.labels.block_mode;
+        summary.count = histogram.count();
+        summary.total_ns = histogram.total_ns();
+        summary.max_ns = histogram.max_ns();
+        summary.p50_ns = histogram.Percentile(500);
+        summary.p90_ns = histogram.Percentile(900);
+        summary.p99_ns = histogram.Percentile(990);
+        summary.p999_ns = histogram.Percentile(999);
+
+        // Insertion sort; there are at most kMaxSeries summaries.
+        size_t j = filled++;
+        for (; j > 0 && summary_less(summary, response->summaries[j - 1]); --j)
+            response->summaries[j] = response->summaries[j - 1];
+        response->summaries[j] = summary;
+    }
+    response->dropped = dropped_;
+    return KM_ERROR_OK;
+}
+
+void LatencyStats::Reset() {
+    for (size_t i = 0; i < series_count_; ++i)
+        series_[i].histogram->Reset();
+    dropped_ = 0;
+}
+
+/* static */
+const char* LatencyStats::entry_point_name(uint32_t entry_point) {
+    switch (entry_point) {
+    case ADD_RNG_ENTROPY:
+        return "AddRngEntropy";
+    case GENERATE_KEY:
+        return "GenerateKey";
+    case GET_KEY_CHARACTERISTICS:
+        return "GetKeyCharacteristics";
+    case IMPORT_KEY:
+        return "ImportKey";
+    case EXPORT_KEY:
+        return "ExportKey";
+    case ATTEST_KEY:
+        return "AttestKey";
+    case UPGRADE_KEY:
+        return "UpgradeKey";
+    case DELETE_KEY:
+        return "DeleteKey";
+    case DELETE_ALL_KEYS:
+        return "DeleteAllKeys";
+    case BEGIN_OPERATION:
+        return "BeginOperation";
+    case UPDATE_OPERATION:
+        return "UpdateOperation";
+    case FINISH_OPERATION:
+        return "FinishOperation";
+    case ABORT_OPERATION:
+        return "AbortOperation";
+    case CONFIGURE:
+        return "Configure";
+    }
+    return "Unknown";
+}
+
+/* static */
+const char* LatencyStats::phase_name(uint32_t phase) {
+    switch (phase) {
+    case TOTAL_PHASE:
+        return "total";
+    case KEY_BLOB_PHASE:
+        return "key_blob";
+    case ENFORCEMENT_PHASE:
+        return "enforcement";
+    case CRYPTO_PHASE:
+        return "crypto";
+    case TABLE_PHASE:
+        return "table";
+    }
+    return "unknown";
+}
+
+static const char* algorithm_name(uint32_t algorithm) {
+    switch (algorithm) {
+    case KM_ALGORITHM_RSA:
+        return "RSA";
+    case KM_ALGORITHM_EC:
+        return "EC";
+    case KM_ALGORITHM_AES:
+        return "AES";
+    case KM_ALGORITHM_HMAC:
+        return "HMAC";
+    case kNoLatencyLabel:
+        return "-";
+    }
+    return "?";
+}
+
+static const char* purpose_name(uint32_t purpose) {
+    switch (purpose) {
+    case KM_PURPOSE_ENCRYPT:
+        return "ENCRYPT";
+    case KM_PURPOSE_DECRYPT:
+        return "DECRYPT";
+    case KM_PURPOSE_SIGN:
+        return "SIGN";
+    case KM_PURPOSE_VERIFY:
+        return "VERIFY";
+    case KM_PURPOSE_DERIVE_KEY:
+        return "DERIVE_KEY";
+    case kNoLatencyLabel:
+        return "-";
+    }
+    return "?";
+}
+
+static const char* block_mode_name(uint32_t block_mode) {
+    switch (block_mode) {
+    case KM_MODE_ECB:
+        return "ECB";
+    case KM_MODE_CBC:
+        return "CBC";
+    case KM_MODE_CTR:
+        return "CTR";
+    case KM_MODE_GCM:
+        return "GCM";
+    case kNoLatencyLabel:
+        return "-";
+    }
+    return "?";
+}
+
+// Appends to the table as snprintf would, keeping count of the length of the complete table.
+static void append_row(char* buffer, size_t size, size_t* length, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    char* out = *length < size ? buffer + *length : nullptr;
+    int written = vsnprintf(out, out ? size - *length : 0, fmt, args);
+    va_end(args);
+    if (written > 0)
+        *length += written;
+}
+
+size_t FormatLatencyStats(const GetLatencyStatsResponse& stats, char* buffer, size_t size) {
+    if (size > 0)
+        buffer[0] = '\0';
+    size_t length = 0;
+    append_row(buffer, size, &length,
+               "%-21s %-11s %-4s %-10s %-4s %9s %9s %9s %9s %9s %9s %9s\n", "entry_point", "phase",
+               "alg", "purpose", "mode", "count", "mean_us", "p50_us", "p90_us", "p99_us",
+               "p99.9_us", "max_us");
+    for (size_t i = 0; i < stats.summary_count; ++i) {
+        const LatencySummary& s = stats.summaries[i];
+        append_row(buffer, size, &length,
+                   "%-21s %-11s %-4s %-10s %-4s %9llu %9.1f %9.1f %9.1f %9.1f %9.1f %9.1f\n",
+                   LatencyStats::entry_point_name(s.entry_point), LatencyStats::phase_name(s.phase),
+                   algorithm_name(s.algorithm), purpose_name(s.purpose),
+                   block_mode_name(s.block_mode), static_cast<unsigned long long>(s.count),
+                   s.count ? s.total_ns / 1e3 / s.count : 0.0, s.p50_ns / 1e3, s.p90_ns / 1e3,
+                   s.p99_ns / 1e3, s.p999_ns / 1e3, s.max_ns / 1e3);
+    }
+    if (stats.dropped)
+        append_row(buffer, size, &length, "%llu measurements dropped\n",
+                   static_cast<unsigned long long>(stats.dropped));
+    return length;
+}
+
+}  // namespace keymaster
@@ -19,10 +19,11 @@
 namespace keymaster {
 
 Logger* Logger::instance_ = 0;
+Logger::LogLevel Logger::min_level_ = DEBUG_LVL;
 
 /* static */
 int Logger::Log(LogLevel level, const char* fmt, va_list args) {
-    if (!instance_)
+    if (!enabled(level))
         return 0;
     return instance_->log_msg(level, fmt, args);
 }
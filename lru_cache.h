@@ -0,0 +1,133 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_LRU_CACHE_H_
+#define SYSTEM_KEYMASTER_LRU_CACHE_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <keymaster/new>
+
+#include <keymaster/UniquePtr.h>
+
+namespace keymaster {
+
+/**
+ * LruCache is the fixed-size table behind the key and context caches.  It holds up to capacity
+ * entries of type Entry, which must provide:
+ *
+ *     Entry();               // Constructs an unused entry.
+ *     bool in_use() const;
+ *     void Release();        // Wipes and frees whatever the entry holds, leaving it unused.
+ *     uint64_t last_used;    // Maintained by the cache.
+ *
+ * The caches are small, so entries are found by linear search.  They are evicted in
+ * least-recently-used order, and all are released when the cache is cleared or destroyed.
+ *
+ * The cache is not internally synchronized; like the OperationTable, callers must serialize access.
+ */
+template <typename Entry> class LruCache {
+  public:
+    explicit LruCache(size_t capacity)
+        : entries_(new (std::nothrow) Entry[capacity]), capacity_(entries_.get() ? capacity : 0),
+          use_counter_(0), hits_(0), misses_(0) {}
+    ~LruCache() { Clear(); }
+
+    LruCache(const LruCache&) = delete;
+    LruCache& operator=(const LruCache&) = delete;
+
+    /**
+     * Return the entry in use for which \p matches returns true, marking it most recently used, or
+     * null if there is none.
+     */
+    template <typename Predicate> Entry* Find(const Predicate& matches) {
+        for (size_t i = 0; i < capacity_; ++i) {
+            Entry* entry = &entries_[i];
+            if (entry->in_use() && matches(*entry)) {
+                entry->last_used = ++use_counter_;
+                return entry;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Return an unused entry, marked most recently used, releasing the least recently used entry
+     * if all are in use.  Returns null only if the cache has no capacity.
+     */
+    Entry* Evict() {
+        Entry* victim = nullptr;
+        for (size_t i = 0; i < capacity_; ++i) {
+            Entry* entry = &entries_[i];
+            if (!entry->in_use()) {
+                victim = entry;
+                break;
+            }
+            if (!victim || entry->last_used < victim->last_used)
+                victim = entry;
+        }
+        if (victim) {
+            if (victim->in_use())
+                victim->Release();
+            victim->last_used = ++use_counter_;
+        }
+        return victim;
+    }
+
+    /**
+     * Release every entry in use for which \p matches returns true.
+     */
+    template <typename Predicate> void Release(const Predicate& matches) {
+        for (size_t i = 0; i < capacity_; ++i)
+            if (entries_[i].in_use() && matches(entries_[i]))
+                entries_[i].Release();
+    }
+
+    /**
+     * Release all entries.
+     */
+    void Clear() {
+        for (size_t i = 0; i < capacity_; ++i)
+            if (entries_[i].in_use())
+                entries_[i].Release();
+    }
+
+    void RecordHit() { ++hits_; }
+    void RecordMiss() { ++misses_; }
+
+    size_t capacity() const { return capacity_; }
+    size_t size() const {
+        size_t count = 0;
+        for (size_t i = 0; i < capacity_; ++i)
+            if (entries_[i].in_use())
+                ++count;
+        return count;
+    }
+    size_t hits() const { return hits_; }
+    size_t misses() const { return misses_; }
+
+  private:
+    UniquePtr<Entry[]> entries_;
+    size_t capacity_;
+    uint64_t use_counter_;
+    size_t hits_;
+    size_t misses_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_LRU_CACHE_H_
@@ -60,11 +60,12 @@ NistCurveKeyExchange* NistCurveKeyExchange::GenerateKeyExchange(keymaster_ec_cur
         return nullptr;
     }
     keymaster_error_t error;
-    NistCurveKeyExchange* key_exchange = new NistCurveKeyExchange(key.release(), &error);
-    if (error != KM_ERROR_OK) {
+    UniquePtr<NistCurveKeyExchange> key_exchange(
+        new (std::nothrow) NistCurveKeyExchange(key.release(), &error));
+    if (!key_exchange.get() || error != KM_ERROR_OK) {
         return nullptr;
     }
-    return key_exchange;
+    return key_exchange.release();
 }
 
 keymaster_error_t NistCurveKeyExchange::ExtractPublicKey() {
@@ -28,6 +28,24 @@
 
 namespace keymaster {
 
+class NistCurveKeyExchange;
+
+/**
+ * Source of ready-made ephemeral key exchanges for EciesKem::Encrypt, so that generating and
+ * checking the ephemeral key pair can be moved off the encapsulation path.
+ */
+class EphemeralKeyPool {
+  public:
+    virtual ~EphemeralKeyPool() {}
+
+    /**
+     * Return a key exchange holding a freshly generated key pair on \p curve, which the caller
+     * takes ownership of, or null if the pool does not provide keys for \p curve.  A key pair must
+     * never be returned twice.
+     */
+    virtual NistCurveKeyExchange* TakeKeyExchange(keymaster_ec_curve_t curve) = 0;
+};
+
 /**
  * NistCurveKeyExchange implements a KeyExchange using elliptic-curve
  * Diffie-Hellman on NIST curves: P-224, P-256, P-384 and P-521.
@@ -24,6 +24,7 @@
 #include <hardware/keymaster_defs.h>
 #include <keymaster/android_keymaster_utils.h>
 #include <keymaster/authorization_set.h>
+#include <keymaster/latency_stats.h>
 #include <keymaster/logger.h>
 
 namespace keymaster {
@@ -95,6 +96,10 @@ class Operation {
     void set_key_id(uint64_t key_id) { key_id_ = key_id; }
     uint64_t key_id() const { return key_id_; }
 
+    // The labels AndroidKeymaster records the operation's latencies under.
+    void set_latency_labels(const LatencyLabels& labels) { latency_labels_ = labels; }
+    const LatencyLabels& latency_labels() const { return latency_labels_; }
+
     void SetAuthorizations(const AuthorizationSet& auths) {
         key_auths_.Reinitialize(auths.data(), auths.size());
     }
@@ -119,6 +124,7 @@ protected:
     const keymaster_purpose_t purpose_;
     AuthorizationSet key_auths_;
     uint64_t key_id_;
+    LatencyLabels latency_labels_;
 };
 
 }  // namespace keymaster
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/request_arena.h>
+
+#include <keymaster/new>
+
+#include <keymaster/android_keymaster_utils.h>
+
+namespace keymaster {
+
+// Enough for the 64-bit integers and the pointers in keymaster parameters.
+static const size_t kAlignment = 8;
+
+static uint8_t* align_up(uint8_t* p) {
+    return reinterpret_cast<uint8_t*>((reinterpret_cast<uintptr_t>(p) + kAlignment - 1) &
+                                      ~(kAlignment - 1));
+}
+
+RequestArena::RequestArena(uint8_t* initial_buffer, size_t initial_size)
+    : initial_buffer_(initial_buffer), initial_size_(initial_buffer ? initial_size : 0),
+      initial_used_(0), blocks_(nullptr), position_(initial_buffer),
+      end_(initial_buffer + initial_size_), bytes_allocated_(0), heap_blocks_(0) {}
+
+RequestArena::~RequestArena() {
+    // Most requests use a small part of the initial buffer, and only that part needs wiping.
+    if (initial_buffer_)
+        memset_s(initial_buffer_, 0, blocks_ ? initial_used_ : position_ - initial_buffer_);
+    while (blocks_) {
+        Block* previous = blocks_->previous;
+        memset_s(blocks_, 0, blocks_->size);
+        delete[] reinterpret_cast<uint8_t*>(blocks_);
+        blocks_ = previous;
+    }
+}
+
+void* RequestArena::Allocate(size_t size) {
+    void* result = AllocateFromBlock(size);
+    if (result)
+        return result;
+
+    if (size > SIZE_MAX - sizeof(Block) - kAlignment)
+        return nullptr;
+    size_t block_size = sizeof(Block) + size + kAlignment;
+    if (block_size < kBlockSize)
+        block_size = kBlockSize;
+
+    uint8_t* memory = new (std::nothrow) uint8_t[block_size];
+    if (!memory)
+        return nullptr;
+    if (!blocks_ && initial_buffer_)
+        initial_used_ = position_ - initial_buffer_;
+    Block* block = reinterpret_cast<Block*>(memory);
+    block->previous = blocks_;
+    block->size = block_size;
+    blocks_ = block;
+    ++heap_blocks_;
+
+    // Whatever was left of the previous block is abandoned.
+    position_ = memory + sizeof(Block);
+    end_ = memory + block_size;
+    return AllocateFromBlock(size);
+}
+
+void* RequestArena::AllocateFromBlock(size_t size) {
+    if (!position_)
+        return nullptr;
+    uint8_t* start = align_up(position_);
+    if (start > end_ || static_cast<size_t>(end_ - start) < size)
+        return nullptr;
+    position_ = start + size;
+    bytes_allocated_ += size;
+    return start;
+}
+
+}  // namespace keymaster
@@ -0,0 +1,113 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/rsa_batch_verifier.h>
+
+#include <keymaster/android_keymaster.h>
+
+#include "openssl_utils.h"
+#include "rsa_key.h"
+#include "rsa_operation.h"
+#include "worker_pool.h"
+
+namespace keymaster {
+
+namespace {
+
+keymaster_error_t VerifyItem(keymaster_digest_t digest, keymaster_padding_t padding, EVP_PKEY* pkey,
+                             const RsaBatchVerifier::Item& item) {
+    // The operation takes ownership of a reference to the shared key.  It has no context cache,
+    // because the cache isn't safe to use from several threads.
+    EVP_PKEY_up_ref(pkey);
+    RsaVerifyOperation operation(digest, padding, pkey);
+
+    AuthorizationSet no_params;
+    AuthorizationSet output_params;
+    keymaster_error_t error = operation.Begin(no_params, &output_params);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    Buffer message(item.message.data, item.message.data_length);
+    Buffer signature(item.signature.data, item.signature.data_length);
+    Buffer output;
+    return operation.Finish(no_params, message, signature, &output_params, &output);
+}
+
+}  // anonymous namespace
+
+RsaBatchVerifier::RsaBatchVerifier(size_t thread_count)
+    : pool_(new (std::nothrow) WorkerPool(thread_count)) {}
+
+RsaBatchVerifier::~RsaBatchVerifier() {}
+
+size_t RsaBatchVerifier::thread_count() const {
+    return pool_ ? pool_->thread_count() : 0;
+}
+
+keymaster_error_t RsaBatchVerifier::Verify(AndroidKeymaster* keymaster,
+                                           const keymaster_key_blob_t& key_blob,
+                                           const AuthorizationSet& begin_params,
+                                           const std::vector<Item>& items,
+                                           std::vector<keymaster_error_t>* results) {
+    if (!keymaster || !results)
+        return KM_ERROR_OUTPUT_PARAMETER_NULL;
+    if (!pool_)
+        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+
+    UniquePtr<Key> key;
+    UniquePtr<Operation> prototype;
+    keymaster_error_t error =
+        keymaster->PrepareOperation(key_blob, KM_PURPOSE_VERIFY, begin_params, &key, &prototype);
+    if (error != KM_ERROR_OK)
+        return error;
+
+    keymaster_algorithm_t algorithm;
+    if (!key->authorizations().GetTagValue(TAG_ALGORITHM, &algorithm) ||
+        algorithm != KM_ALGORITHM_RSA)
+        return KM_ERROR_INCOMPATIBLE_ALGORITHM;
+
+    // The batch is authorized by a single Begin, which enforcement counts as one use of the key, so
+    // keys whose uses are limited or rate-limited are refused rather than used N times.
+    if (key->authorizations().Contains(TAG_MAX_USES_PER_BOOT) ||
+        key->authorizations().Contains(TAG_MIN_SECONDS_BETWEEN_OPS))
+        return KM_ERROR_INVALID_ARGUMENT;
+
+    // The prototype carries the validated digest and padding.
+    const RsaOperation* rsa_prototype = static_cast<const RsaOperation*>(prototype.get());
+    keymaster_digest_t digest = rsa_prototype->digest();
+    keymaster_padding_t padding = rsa_prototype->padding();
+
+    EVP_PKEY_Ptr pkey(RsaOperationFactory::GetRsaKey(*key, &error));
+    if (!pkey.get())
+        return error;
+
+    results->assign(items.size(), KM_ERROR_UNKNOWN_ERROR);
+    auto verify = [&](size_t i) {
+        (*results)[i] = VerifyItem(digest, padding, pkey.get(), items[i]);
+    };
+
+    // Keys backed by a keymaster0/1 device have no EVP_PKEY of their own and may carry an engine
+    // that isn't safe to use concurrently, so only plain software keys are verified in parallel.
+    if (static_cast<const RsaKey*>(key.get())->evp_key()) {
+        pool_->ParallelFor(items.size(), verify);
+    } else {
+        for (size_t i = 0; i < items.size(); ++i)
+            verify(i);
+    }
+    return KM_ERROR_OK;
+}
+
+}  // namespace keymaster
@@ -25,8 +25,14 @@
 namespace keymaster {
 
 bool RsaKey::EvpToInternal(const EVP_PKEY* pkey) {
-    rsa_key_.reset(EVP_PKEY_get1_RSA(const_cast<EVP_PKEY*>(pkey)));
-    return rsa_key_.get() != NULL;
+    EVP_PKEY* shared_pkey = const_cast<EVP_PKEY*>(pkey);
+    rsa_key_.reset(EVP_PKEY_get1_RSA(shared_pkey));
+    if (!rsa_key_.get())
+        return false;
+
+    EVP_PKEY_up_ref(shared_pkey);
+    evp_key_.reset(shared_pkey);
+    return true;
 }
 
 bool RsaKey::InternalToEvp(EVP_PKEY* pkey) const {
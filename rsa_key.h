@@ -20,14 +20,17 @@
 #include <openssl/rsa.h>
 
 #include "asymmetric_key.h"
+#include "openssl_utils.h"
 
 namespace keymaster {
 
+class RsaContextCache;
+
 class RsaKey : public AsymmetricKey {
   public:
     RsaKey(const AuthorizationSet& hw_enforced, const AuthorizationSet& sw_enforced,
-           keymaster_error_t* error)
-        : AsymmetricKey(hw_enforced, sw_enforced, error) {}
+           keymaster_error_t* error, RsaContextCache* context_cache = nullptr)
+        : AsymmetricKey(hw_enforced, sw_enforced, error), context_cache_(context_cache) {}
 
     bool InternalToEvp(EVP_PKEY* pkey) const override;
     bool EvpToInternal(const EVP_PKEY* pkey) override;
@@ -41,13 +44,23 @@ class RsaKey : public AsymmetricKey {
 
     RSA* key() const { return rsa_key_.get(); }
 
+    /**
+     * Returns the EVP_PKEY the key was loaded from, if any.  Operations take references to it
+     * rather than wrapping the RSA in a new EVP_PKEY, so state attached to it stays warm.
+     */
+    EVP_PKEY* evp_key() const { return evp_key_.get(); }
+
+    RsaContextCache* context_cache() const { return context_cache_; }
+
   protected:
     RsaKey(RSA* rsa, const AuthorizationSet& hw_enforced, const AuthorizationSet& sw_enforced,
            keymaster_error_t* error)
-        : AsymmetricKey(hw_enforced, sw_enforced, error), rsa_key_(rsa) {}
+        : AsymmetricKey(hw_enforced, sw_enforced, error), rsa_key_(rsa), context_cache_(nullptr) {}
 
   private:
     UniquePtr<RSA, RSA_Delete> rsa_key_;
+    UniquePtr<EVP_PKEY, EVP_PKEY_Delete> evp_key_;
+    RsaContextCache* context_cache_;
 };
 
 }  // namespace keymaster
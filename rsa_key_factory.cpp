@@ -31,11 +31,29 @@ const int kMaximumRsaKeySize = 4096;  // OpenSSL fails above 4096.
 const int kMinimumRsaKeySize = 16;    // OpenSSL goes into an infinite loop if key size < 10
 const int kMinimumRsaExponent = 3;
 
+// Number of parsed RSA keys kept warm between operations.
+const size_t kRsaKeyCacheSize = 8;
+
+// Number of configured EVP context templates kept for those keys.
+const size_t kRsaContextCacheSize = 16;
+
 static RsaSigningOperationFactory sign_factory;
 static RsaVerificationOperationFactory verify_factory;
 static RsaEncryptionOperationFactory encrypt_factory;
 static RsaDecryptionOperationFactory decrypt_factory;
 
+RsaKeyFactory::RsaKeyFactory(const KeymasterContext* context)
+    : AsymmetricKeyFactory(context),
+      context_cache_(new (std::nothrow) RsaContextCache(kRsaContextCacheSize)),
+      key_pool_(nullptr) {
+    set_key_cache_size(kRsaKeyCacheSize, context_cache_.get());
+}
+
+RsaKeyFactory::~RsaKeyFactory() {
+    // The key cache reports evictions to the context cache, so it must go first.
+    set_key_cache_size(0);
+}
+
 OperationFactory* RsaKeyFactory::GetOperationFactory(keymaster_purpose_t purpose) const {
     switch (purpose) {
     case KM_PURPOSE_SIGN:
@@ -80,15 +98,24 @@ keymaster_error_t RsaKeyFactory::GenerateKey(const AuthorizationSet& key_descrip
         return KM_ERROR_UNSUPPORTED_KEY_SIZE;
     }
 
-    UniquePtr<BIGNUM, BIGNUM_Delete> exponent(BN_new());
-    UniquePtr<RSA, RsaKey::RSA_Delete> rsa_key(RSA_new());
+    UniquePtr<RSA, RsaKey::RSA_Delete> rsa_key;
+    if (key_pool_)
+        rsa_key.reset(key_pool_->TakeKey(key_size, public_exponent));
+
     UniquePtr<EVP_PKEY, EVP_PKEY_Delete> pkey(EVP_PKEY_new());
-    if (exponent.get() == NULL || rsa_key.get() == NULL || pkey.get() == NULL)
+    if (pkey.get() == NULL)
         return KM_ERROR_MEMORY_ALLOCATION_FAILED;
 
-    if (!BN_set_word(exponent.get(), public_exponent) ||
-        !RSA_generate_key_ex(rsa_key.get(), key_size, exponent.get(), NULL /* callback */))
-        return TranslateLastOpenSslError();
+    if (!rsa_key.get()) {
+        UniquePtr<BIGNUM, BIGNUM_Delete> exponent(BN_new());
+        rsa_key.reset(RSA_new());
+        if (exponent.get() == NULL || rsa_key.get() == NULL)
+            return KM_ERROR_MEMORY_ALLOCATION_FAILED;
+
+        if (!BN_set_word(exponent.get(), public_exponent) ||
+            !RSA_generate_key_ex(rsa_key.get(), key_size, exponent.get(), NULL /* callback */))
+            return TranslateLastOpenSslError();
+    }
 
     if (EVP_PKEY_set1_RSA(pkey.get(), rsa_key.get()) != 1)
         return TranslateLastOpenSslError();
@@ -177,7 +204,7 @@ keymaster_error_t RsaKeyFactory::CreateEmptyKey(const AuthorizationSet& hw_enfor
                                                 const AuthorizationSet& sw_enforced,
                                                 UniquePtr<AsymmetricKey>* key) const {
     keymaster_error_t error;
-    key->reset(new (std::nothrow) RsaKey(hw_enforced, sw_enforced, &error));
+    key->reset(new (std::nothrow) RsaKey(hw_enforced, sw_enforced, &error, context_cache_.get()));
     if (!key->get())
         error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
     return error;
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/rsa_key_pool.h>
+
+#include <openssl/bn.h>
+#include <openssl/err.h>
+
+#include <keymaster/logger.h>
+
+#include "openssl_utils.h"
+
+namespace keymaster {
+
+RSA* RsaKeyGenerator::Generate(const Params& params) {
+    BIGNUM_Ptr exponent(BN_new());
+    RSA_Ptr rsa(RSA_new());
+    if (!exponent.get() || !rsa.get() || !BN_set_word(exponent.get(), params.public_exponent) ||
+        !RSA_generate_key_ex(rsa.get(), params.key_size, exponent.get(), nullptr /* callback */)) {
+        LOG_E("Failed to pre-generate %u-bit RSA key", params.key_size);
+        ERR_clear_error();
+        return nullptr;
+    }
+    return rsa.release();
+}
+
+bool RsaKeyPregenerationPool::AddStock(uint32_t key_size, uint64_t public_exponent,
+                                       size_t target) {
+    if (key_size % 8 != 0 || key_size < 512 || key_size > 4096 || public_exponent < 3 ||
+        public_exponent % 2 != 1)
+        return false;
+    return KeyPregenerationPool::AddStock({key_size, public_exponent}, target);
+}
+
+}  // namespace keymaster
@@ -36,6 +36,114 @@ const size_t kPssOverhead = 2;
 // additional overhead, for the digest algorithmIdentifier required by PKCS#1.
 const size_t kPkcs1UndigestedSignaturePaddingOverhead = 11;
 
+struct EVP_PKEY_CTX_Delete {
+    void operator()(EVP_PKEY_CTX* p) { EVP_PKEY_CTX_free(p); }
+};
+
+void RsaContextCache::Entry::Release() {
+    EVP_MD_CTX_cleanup(&md_ctx);
+    EVP_MD_CTX_init(&md_ctx);
+    if (pkey_ctx)
+        EVP_PKEY_CTX_free(pkey_ctx);
+    pkey_ctx = nullptr;
+    EVP_PKEY_free(key);
+    key = nullptr;
+}
+
+RsaContextCache::Entry* RsaContextCache::Find(EVP_PKEY* key, keymaster_purpose_t purpose,
+                                              keymaster_padding_t padding,
+                                              keymaster_digest_t digest) {
+    return entries_.Find([&](const Entry& candidate) {
+        return candidate.key == key && candidate.purpose == purpose &&
+               candidate.padding == padding && candidate.digest == digest;
+    });
+}
+
+void RsaContextCache::OnKeyEvicted(EVP_PKEY* key) {
+    entries_.Release([&](const Entry& candidate) { return candidate.key == key; });
+}
+
+RsaContextCache::Entry* RsaContextCache::Insert(EVP_PKEY* key, keymaster_purpose_t purpose,
+                                                keymaster_padding_t padding,
+                                                keymaster_digest_t digest) {
+    Entry* entry = Find(key, purpose, padding, digest);
+    if (entry)
+        entry->Release();
+    else
+        entry = entries_.Evict();
+    if (!entry)
+        return nullptr;
+
+    EVP_PKEY_up_ref(key);
+    entry->key = key;
+    entry->purpose = purpose;
+    entry->padding = padding;
+    entry->digest = digest;
+    return entry;
+}
+
+bool RsaContextCache::CopyDigestContext(EVP_PKEY* key, keymaster_purpose_t purpose,
+                                        keymaster_padding_t padding, keymaster_digest_t digest,
+                                        EVP_MD_CTX* ctx) {
+    Entry* entry = Find(key, purpose, padding, digest);
+    if (!entry) {
+        entries_.RecordMiss();
+        return false;
+    }
+    if (!EVP_MD_CTX_copy_ex(ctx, &entry->md_ctx)) {
+        // Fall back to building the context from scratch.
+        ERR_clear_error();
+        entry->Release();
+        entries_.RecordMiss();
+        return false;
+    }
+    entries_.RecordHit();
+    return true;
+}
+
+void RsaContextCache::StoreDigestContext(EVP_PKEY* key, keymaster_purpose_t purpose,
+                                         keymaster_padding_t padding, keymaster_digest_t digest,
+                                         const EVP_MD_CTX* ctx) {
+    Entry* entry = Insert(key, purpose, padding, digest);
+    if (entry && !EVP_MD_CTX_copy_ex(&entry->md_ctx, ctx)) {
+        ERR_clear_error();
+        entry->Release();
+    }
+}
+
+EVP_PKEY_CTX* RsaContextCache::DupPkeyContext(EVP_PKEY* key, keymaster_purpose_t purpose,
+                                              keymaster_padding_t padding,
+                                              keymaster_digest_t digest) {
+    Entry* entry = Find(key, purpose, padding, digest);
+    if (!entry) {
+        entries_.RecordMiss();
+        return nullptr;
+    }
+    EVP_PKEY_CTX* ctx = EVP_PKEY_CTX_dup(entry->pkey_ctx);
+    if (!ctx) {
+        // Fall back to building the context from scratch.
+        ERR_clear_error();
+        entry->Release();
+        entries_.RecordMiss();
+        return nullptr;
+    }
+    entries_.RecordHit();
+    return ctx;
+}
+
+void RsaContextCache::StorePkeyContext(EVP_PKEY* key, keymaster_purpose_t purpose,
+                                       keymaster_padding_t padding, keymaster_digest_t digest,
+                                       EVP_PKEY_CTX* ctx) {
+    Entry* entry = Insert(key, purpose, padding, digest);
+    if (!entry)
+        return;
+    entry->pkey_ctx = EVP_PKEY_CTX_dup(ctx);
+    if (!entry->pkey_ctx) {
+        ERR_clear_error();
+        entry->Release();
+    }
+}
+
 /* static */
 EVP_PKEY* RsaOperationFactory::GetRsaKey(const Key& key, keymaster_error_t* error) {
     const RsaKey* rsa_key = static_cast<const RsaKey*>(&key);
@@ -45,6 +153,12 @@ EVP_PKEY* RsaOperationFactory::GetRsaKey(const Key& key, keymaster_error_t* erro
         return nullptr;
     }
 
+    if (rsa_key->evp_key()) {
+        // Share the key's EVP_PKEY, which may be kept warm by the key factory's cache.
+        EVP_PKEY_up_ref(rsa_key->evp_key());
+        return rsa_key->evp_key();
+    }
+
     UniquePtr<EVP_PKEY, EVP_PKEY_Delete> pkey(EVP_PKEY_new());
     if (!rsa_key->InternalToEvp(pkey.get())) {
         *error = KM_ERROR_UNKNOWN_ERROR;
@@ -80,7 +194,12 @@ RsaOperation* RsaOperationFactory::CreateRsaOperation(const Key& key,
     if (!rsa.get())
         return nullptr;
 
-    RsaOperation* op = InstantiateOperation(digest, padding, rsa.release());
+    // Context templates are matched by EVP_PKEY identity, so they're only worth keeping for keys
+    // whose EVP_PKEY outlives the operation.
+    const RsaKey& rsa_key = static_cast<const RsaKey&>(key);
+    RsaContextCache* context_cache = rsa_key.evp_key() ? rsa_key.context_cache() : nullptr;
+
+    RsaOperation* op = InstantiateOperation(digest, padding, rsa.release(), context_cache);
     if (!op)
         *error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
     return op;
@@ -226,8 +345,9 @@ keymaster_error_t RsaOperation::InitDigest() {
 }
 
 RsaDigestingOperation::RsaDigestingOperation(keymaster_purpose_t purpose, keymaster_digest_t digest,
-                                             keymaster_padding_t padding, EVP_PKEY* key)
-    : RsaOperation(purpose, digest, padding, key) {
+                                             keymaster_padding_t padding, EVP_PKEY* key,
+                                             RsaContextCache* context_cache)
+    : RsaOperation(purpose, digest, padding, key, context_cache) {
     EVP_MD_CTX_init(&digest_ctx_);
 }
 RsaDigestingOperation::~RsaDigestingOperation() {
@@ -259,6 +379,36 @@ int RsaDigestingOperation::GetOpensslPadding(keymaster_error_t* error) {
     }
 }
 
+keymaster_error_t RsaDigestingOperation::InitDigestContext(bool signing) {
+    if (context_cache_ &&
+        context_cache_->CopyDigestContext(rsa_key_, purpose(), padding_, digest_, &digest_ctx_))
+        return KM_ERROR_OK;
+
+    EVP_PKEY_CTX* pkey_ctx;
+    int result;
+    if (signing)
+        result = EVP_DigestSignInit(&digest_ctx_, &pkey_ctx, digest_algorithm_,
+                                    nullptr /* engine */, rsa_key_);
+    else
+        result = EVP_DigestVerifyInit(&digest_ctx_, &pkey_ctx, digest_algorithm_,
+                                      nullptr /* engine */, rsa_key_);
+    if (result != 1)
+        return TranslateLastOpenSslError();
+
+    keymaster_error_t error = SetRsaPaddingInEvpContext(pkey_ctx, signing);
+    if (error == KM_ERROR_OK && context_cache_)
+        context_cache_->StoreDigestContext(rsa_key_, purpose(), padding_, digest_, &digest_ctx_);
+    return error;
+}
+
+keymaster_error_t RsaDigestingOperation::InitUndigested() {
+    // Take the RSA key once here, rather than on every Finish.
+    rsa_.reset(EVP_PKEY_get1_RSA(rsa_key_));
+    if (!rsa_.get())
+        return TranslateLastOpenSslError();
+    return KM_ERROR_OK;
+}
+
 keymaster_error_t RsaSignOperation::Begin(const AuthorizationSet& input_params,
                                           AuthorizationSet* output_params) {
     keymaster_error_t error = RsaDigestingOperation::Begin(input_params, output_params);
@@ -266,13 +416,9 @@ keymaster_error_t RsaSignOperation::Begin(const AuthorizationSet& input_params,
         return error;
 
     if (digest_ == KM_DIGEST_NONE)
-        return KM_ERROR_OK;
+        return InitUndigested();
 
-    EVP_PKEY_CTX* pkey_ctx;
-    if (EVP_DigestSignInit(&digest_ctx_, &pkey_ctx, digest_algorithm_, nullptr /* engine */,
-                           rsa_key_) != 1)
-        return TranslateLastOpenSslError();
-    return SetRsaPaddingInEvpContext(pkey_ctx, true /* signing */);
+    return InitDigestContext(true /* signing */);
 }
 
 keymaster_error_t RsaSignOperation::Update(const AuthorizationSet& additional_params,
@@ -294,66 +440,66 @@ keymaster_error_t RsaSignOperation::Finish(const AuthorizationSet& additional_pa
                                            AuthorizationSet* /* output_params */, Buffer* output) {
     assert(output);
 
+    // A pre-hashed message that arrives whole in Finish is signed from the caller's buffer.
+    if (digest_ == KM_DIGEST_NONE && data_.available_read() == 0)
+        return SignUndigested(input.peek_read(), input.available_read(), output);
+
     keymaster_error_t error = UpdateForFinish(additional_params, input);
     if (error != KM_ERROR_OK)
         return error;
 
     if (digest_ == KM_DIGEST_NONE)
-        return SignUndigested(output);
+        return SignUndigested(data_.peek_read(), data_.available_read(), output);
     else
         return SignDigested(output);
 }
 
-static keymaster_error_t zero_pad_left(UniquePtr<uint8_t[]>* dest, size_t padded_len, Buffer& src) {
-    assert(padded_len > src.available_read());
+static keymaster_error_t zero_pad_left(UniquePtr<uint8_t[]>* dest, size_t padded_len,
+                                       const uint8_t* src, size_t src_len) {
+    assert(padded_len > src_len);
 
     dest->reset(new(std::nothrow) uint8_t[padded_len]);
     if (!dest->get())
         return KM_ERROR_MEMORY_ALLOCATION_FAILED;
 
-    size_t padding_len = padded_len - src.available_read();
+    size_t padding_len = padded_len - src_len;
     memset(dest->get(), 0, padding_len);
-    if (!src.read(dest->get() + padding_len, src.available_read()))
-        return KM_ERROR_UNKNOWN_ERROR;
-
+    memcpy(dest->get() + padding_len, src, src_len);
     return KM_ERROR_OK;
 }
 
-keymaster_error_t RsaSignOperation::SignUndigested(Buffer* output) {
-    UniquePtr<RSA, RSA_Delete> rsa(EVP_PKEY_get1_RSA(const_cast<EVP_PKEY*>(rsa_key_)));
-    if (!rsa.get())
-        return TranslateLastOpenSslError();
-
-    if (!output->Reinitialize(RSA_size(rsa.get())))
+keymaster_error_t RsaSignOperation::SignUndigested(const uint8_t* data, size_t data_length,
+                                                   Buffer* output) {
+    if (!output->Reinitialize(RSA_size(rsa_.get())))
         return KM_ERROR_MEMORY_ALLOCATION_FAILED;
 
     size_t key_len = EVP_PKEY_size(rsa_key_);
     int bytes_encrypted;
     switch (padding_) {
     case KM_PAD_NONE: {
-        const uint8_t* to_encrypt = data_.peek_read();
+        const uint8_t* to_encrypt = data;
         UniquePtr<uint8_t[]> zero_padded;
-        if (data_.available_read() > key_len) {
+        if (data_length > key_len) {
             return KM_ERROR_INVALID_INPUT_LENGTH;
-        } else if (data_.available_read() < key_len) {
-            keymaster_error_t error = zero_pad_left(&zero_padded, key_len, data_);
+        } else if (data_length < key_len) {
+            keymaster_error_t error = zero_pad_left(&zero_padded, key_len, data, data_length);
             if (error != KM_ERROR_OK)
                 return error;
             to_encrypt = zero_padded.get();
         }
-        bytes_encrypted = RSA_private_encrypt(key_len, to_encrypt, output->peek_write(), rsa.get(),
+        bytes_encrypted = RSA_private_encrypt(key_len, to_encrypt, output->peek_write(), rsa_.get(),
                                               RSA_NO_PADDING);
         break;
     }
     case KM_PAD_RSA_PKCS1_1_5_SIGN:
         // Does PKCS1 padding without digesting even make sense?  Dunno.  We'll support it.
-        if (data_.available_read() + kPkcs1UndigestedSignaturePaddingOverhead > key_len) {
+        if (data_length + kPkcs1UndigestedSignaturePaddingOverhead > key_len) {
             LOG_E("Input too long: cannot sign %u-byte message with PKCS1 padding with %u-bit key",
-                  data_.available_read(), EVP_PKEY_size(rsa_key_) * 8);
+                  data_length, EVP_PKEY_size(rsa_key_) * 8);
             return KM_ERROR_INVALID_INPUT_LENGTH;
         }
-        bytes_encrypted = RSA_private_encrypt(data_.available_read(), data_.peek_read(),
-                                              output->peek_write(), rsa.get(), RSA_PKCS1_PADDING);
+        bytes_encrypted = RSA_private_encrypt(data_length, data, output->peek_write(), rsa_.get(),
+                                              RSA_PKCS1_PADDING);
         break;
 
     default:
@@ -390,12 +536,9 @@ keymaster_error_t RsaVerifyOperation::Begin(const AuthorizationSet& input_params
         return error;
 
     if (digest_ == KM_DIGEST_NONE)
-        return KM_ERROR_OK;
+        return InitUndigested();
 
-    EVP_PKEY_CTX* pkey_ctx;
-    if (EVP_DigestVerifyInit(&digest_ctx_, &pkey_ctx, digest_algorithm_, NULL, rsa_key_) != 1)
-        return TranslateLastOpenSslError();
-    return SetRsaPaddingInEvpContext(pkey_ctx, false /* signing */);
+    return InitDigestContext(false /* signing */);
 }
 
 keymaster_error_t RsaVerifyOperation::Update(const AuthorizationSet& additional_params,
@@ -416,35 +559,36 @@ keymaster_error_t RsaVerifyOperation::Finish(const AuthorizationSet& additional_
                                              const Buffer& input, const Buffer& signature,
                                              AuthorizationSet* /* output_params */,
                                              Buffer* /* output */) {
+    // A pre-hashed message that arrives whole in Finish is checked against the caller's buffer.
+    if (digest_ == KM_DIGEST_NONE && data_.available_read() == 0)
+        return VerifyUndigested(input.peek_read(), input.available_read(), signature);
+
     keymaster_error_t error = UpdateForFinish(additional_params, input);
     if (error != KM_ERROR_OK)
         return error;
 
     if (digest_ == KM_DIGEST_NONE)
-        return VerifyUndigested(signature);
+        return VerifyUndigested(data_.peek_read(), data_.available_read(), signature);
     else
         return VerifyDigested(signature);
 }
 
-keymaster_error_t RsaVerifyOperation::VerifyUndigested(const Buffer& signature) {
-    UniquePtr<RSA, RSA_Delete> rsa(EVP_PKEY_get1_RSA(const_cast<EVP_PKEY*>(rsa_key_)));
-    if (!rsa.get())
-        return KM_ERROR_UNKNOWN_ERROR;
-
-    size_t key_len = RSA_size(rsa.get());
+keymaster_error_t RsaVerifyOperation::VerifyUndigested(const uint8_t* data, size_t data_length,
+                                                       const Buffer& signature) {
+    size_t key_len = RSA_size(rsa_.get());
     int openssl_padding;
     switch (padding_) {
     case KM_PAD_NONE:
-        if (data_.available_read() > key_len)
+        if (data_length > key_len)
             return KM_ERROR_INVALID_INPUT_LENGTH;
         if (key_len != signature.available_read())
             return KM_ERROR_VERIFICATION_FAILED;
         openssl_padding = RSA_NO_PADDING;
         break;
     case KM_PAD_RSA_PKCS1_1_5_SIGN:
-        if (data_.available_read() + kPkcs1UndigestedSignaturePaddingOverhead > key_len) {
+        if (data_length + kPkcs1UndigestedSignaturePaddingOverhead > key_len) {
             LOG_E("Input too long: cannot verify %u-byte message with PKCS1 padding && %u-bit key",
-                  data_.available_read(), key_len * 8);
+                  data_length, key_len * 8);
             return KM_ERROR_INVALID_INPUT_LENGTH;
         }
         openssl_padding = RSA_PKCS1_PADDING;
@@ -457,23 +601,23 @@ keymaster_error_t RsaVerifyOperation::VerifyUndigested(const Buffer& signature)
     if (!decrypted_data.get())
         return KM_ERROR_MEMORY_ALLOCATION_FAILED;
     int bytes_decrypted = RSA_public_decrypt(signature.available_read(), signature.peek_read(),
-                                             decrypted_data.get(), rsa.get(), openssl_padding);
+                                             decrypted_data.get(), rsa_.get(), openssl_padding);
     if (bytes_decrypted < 0)
         return KM_ERROR_VERIFICATION_FAILED;
 
     const uint8_t* compare_pos = decrypted_data.get();
     size_t bytes_to_compare = bytes_decrypted;
     uint8_t zero_check_result = 0;
-    if (padding_ == KM_PAD_NONE && data_.available_read() < bytes_to_compare) {
+    if (padding_ == KM_PAD_NONE && data_length < bytes_to_compare) {
         // If the data is short, for "unpadded" signing we zero-pad to the left.  So during
         // verification we should have zeros on the left of the decrypted data.  Do a constant-time
         // check.
-        const uint8_t* zero_end = compare_pos + bytes_to_compare - data_.available_read();
+        const uint8_t* zero_end = compare_pos + bytes_to_compare - data_length;
         while (compare_pos < zero_end)
             zero_check_result |= *compare_pos++;
-        bytes_to_compare = data_.available_read();
+        bytes_to_compare = data_length;
     }
-    if (memcmp_s(compare_pos, data_.peek_read(), bytes_to_compare) != 0 || zero_check_result != 0)
+    if (memcmp_s(compare_pos, data, bytes_to_compare) != 0 || zero_check_result != 0)
         return KM_ERROR_VERIFICATION_FAILED;
     return KM_ERROR_OK;
 }
@@ -513,9 +657,42 @@ int RsaCryptOperation::GetOpensslPadding(keymaster_error_t* error) {
     }
 }
 
-struct EVP_PKEY_CTX_Delete {
-    void operator()(EVP_PKEY_CTX* p) { EVP_PKEY_CTX_free(p); }
-};
+EVP_PKEY_CTX* RsaCryptOperation::CreatePkeyContext(keymaster_error_t* error) {
+    *error = KM_ERROR_OK;
+    if (context_cache_) {
+        EVP_PKEY_CTX* ctx = context_cache_->DupPkeyContext(rsa_key_, purpose(), padding_, digest_);
+        if (ctx)
+            return ctx;
+    }
+
+    UniquePtr<EVP_PKEY_CTX, EVP_PKEY_CTX_Delete> ctx(
+        EVP_PKEY_CTX_new(rsa_key_, nullptr /* engine */));
+    if (!ctx.get()) {
+        *error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
+        return nullptr;
+    }
+
+    int result;
+    if (purpose() == KM_PURPOSE_ENCRYPT)
+        result = EVP_PKEY_encrypt_init(ctx.get());
+    else
+        result = EVP_PKEY_decrypt_init(ctx.get());
+    if (result <= 0) {
+        *error = TranslateLastOpenSslError();
+        return nullptr;
+    }
+
+    *error = SetRsaPaddingInEvpContext(ctx.get(), false /* signing */);
+    if (*error != KM_ERROR_OK)
+        return nullptr;
+    *error = SetOaepDigestIfRequired(ctx.get());
+    if (*error != KM_ERROR_OK)
+        return nullptr;
+
+    if (context_cache_)
+        context_cache_->StorePkeyContext(rsa_key_, purpose(), padding_, digest_, ctx.get());
+    return ctx.release();
+}
 
 keymaster_error_t RsaEncryptOperation::Finish(const AuthorizationSet& additional_params,
                                               const Buffer& input, const Buffer& /* signature */,
@@ -528,19 +705,8 @@ keymaster_error_t RsaEncryptOperation::Finish(const AuthorizationSet& additional
     if (error != KM_ERROR_OK)
         return error;
 
-    UniquePtr<EVP_PKEY_CTX, EVP_PKEY_CTX_Delete> ctx(
-        EVP_PKEY_CTX_new(rsa_key_, nullptr /* engine */));
+    UniquePtr<EVP_PKEY_CTX, EVP_PKEY_CTX_Delete> ctx(CreatePkeyContext(&error));
     if (!ctx.get())
-        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-
-    if (EVP_PKEY_encrypt_init(ctx.get()) <= 0)
-        return TranslateLastOpenSslError();
-
-    error = SetRsaPaddingInEvpContext(ctx.get(), false /* signing */);
-    if (error != KM_ERROR_OK)
-        return error;
-    error = SetOaepDigestIfRequired(ctx.get());
-    if (error != KM_ERROR_OK)
         return error;
 
     size_t outlen;
@@ -555,7 +721,8 @@ keymaster_error_t RsaEncryptOperation::Finish(const AuthorizationSet& additional
     size_t to_encrypt_len = data_.available_read();
     UniquePtr<uint8_t[]> zero_padded;
     if (padding_ == KM_PAD_NONE && to_encrypt_len < outlen) {
-        keymaster_error_t error = zero_pad_left(&zero_padded, outlen, data_);
+        keymaster_error_t error =
+            zero_pad_left(&zero_padded, outlen, data_.peek_read(), data_.available_read());
         if (error != KM_ERROR_OK)
             return error;
         to_encrypt = zero_padded.get();
@@ -581,19 +748,8 @@ keymaster_error_t RsaDecryptOperation::Finish(const AuthorizationSet& additional
     if (error != KM_ERROR_OK)
         return error;
 
-    UniquePtr<EVP_PKEY_CTX, EVP_PKEY_CTX_Delete> ctx(
-        EVP_PKEY_CTX_new(rsa_key_, nullptr /* engine */));
+    UniquePtr<EVP_PKEY_CTX, EVP_PKEY_CTX_Delete> ctx(CreatePkeyContext(&error));
     if (!ctx.get())
-        return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-
-    if (EVP_PKEY_decrypt_init(ctx.get()) <= 0)
-        return TranslateLastOpenSslError();
-
-    error = SetRsaPaddingInEvpContext(ctx.get(), false /* signing */);
-    if (error != KM_ERROR_OK)
-        return error;
-    error = SetOaepDigestIfRequired(ctx.get());
-    if (error != KM_ERROR_OK)
         return error;
 
     size_t outlen;
@@ -608,7 +764,8 @@ keymaster_error_t RsaDecryptOperation::Finish(const AuthorizationSet& additional
     size_t to_decrypt_len = data_.available_read();
     UniquePtr<uint8_t[]> zero_padded;
     if (padding_ == KM_PAD_NONE && to_decrypt_len < outlen) {
-        keymaster_error_t error = zero_pad_left(&zero_padded, outlen, data_);
+        keymaster_error_t error =
+            zero_pad_left(&zero_padded, outlen, data_.peek_read(), data_.available_read());
         if (error != KM_ERROR_OK)
             return error;
         to_decrypt = zero_padded.get();
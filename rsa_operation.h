@@ -22,10 +22,98 @@
 #include <openssl/evp.h>
 #include <openssl/rsa.h>
 
+#include "evp_key_cache.h"
+#include "lru_cache.h"
+#include "openssl_utils.h"
 #include "operation.h"
 
 namespace keymaster {
 
+/**
+ * RsaContextCache holds configured EVP contexts for recently-used RSA keys, indexed by (key,
+ * purpose, padding, digest).  Digesting sign and verify operations use EVP_MD_CTX templates that
+ * have been through EVP_DigestSignInit/EVP_DigestVerifyInit, and encrypt and decrypt operations use
+ * EVP_PKEY_CTX templates with padding, OAEP digest and MGF1 digest already set.  Duplicating a
+ * template is much cheaper than building and configuring a new context, which otherwise dominates
+ * public-key operations on small messages.
+ *
+ * Keys are matched by EVP_PKEY identity, so the cache is only useful with keys that are shared
+ * across operations, as the RSA key factory's key cache arranges.  Each entry holds a reference to
+ * its key, so an EVP_PKEY cannot be freed and its address reused while an entry for it exists.
+ * The cache listens to the key cache and drops a key's entries when the key is evicted there, so
+ * it never keeps alive a private key the key cache has let go.
+ */
+class RsaContextCache : public EvpKeyCacheListener {
+  public:
+    explicit RsaContextCache(size_t capacity) : entries_(capacity) {}
+
+    /**
+     * If a digest context template exists for the specified key and mode, copy it into \p ctx and
+     * return true.  \p ctx must have been initialized with EVP_MD_CTX_init.
+     */
+    bool CopyDigestContext(EVP_PKEY* key, keymaster_purpose_t purpose, keymaster_padding_t padding,
+                           keymaster_digest_t digest, EVP_MD_CTX* ctx);
+
+    /**
+     * Cache a copy of \p ctx, which must have been initialized for signing or verification with
+     * \p key but not yet updated.  Failure to cache is not an error.
+     */
+    void StoreDigestContext(EVP_PKEY* key, keymaster_purpose_t purpose,
+                            keymaster_padding_t padding, keymaster_digest_t digest,
+                            const EVP_MD_CTX* ctx);
+
+    /**
+     * If a key context template exists for the specified key and mode, return a duplicate of it,
+     * which the caller must free with EVP_PKEY_CTX_free.  Otherwise return null.
+     */
+    EVP_PKEY_CTX* DupPkeyContext(EVP_PKEY* key, keymaster_purpose_t purpose,
+                                 keymaster_padding_t padding, keymaster_digest_t digest);
+
+    /**
+     * Cache a duplicate of \p ctx, which must have been fully configured for \p key but not yet
+     * used.  Failure to cache is not an error.
+     */
+    void StorePkeyContext(EVP_PKEY* key, keymaster_purpose_t purpose, keymaster_padding_t padding,
+                          keymaster_digest_t digest, EVP_PKEY_CTX* ctx);
+
+    /**
+     * Discard all cached templates and release the keys they reference.
+     */
+    void Clear() { entries_.Clear(); }
+
+    /**
+     * Discard all cached templates for \p key.
+     */
+    void OnKeyEvicted(EVP_PKEY* key) override;
+
+    size_t capacity() const { return entries_.capacity(); }
+    size_t size() const { return entries_.size(); }
+    size_t hits() const { return entries_.hits(); }
+    size_t misses() const { return entries_.misses(); }
+
+  private:
+    struct Entry {
+        Entry() : key(nullptr), pkey_ctx(nullptr) { EVP_MD_CTX_init(&md_ctx); }
+        bool in_use() const { return key != nullptr; }
+        void Release();
+
+        EVP_PKEY* key;
+        keymaster_purpose_t purpose;
+        keymaster_padding_t padding;
+        keymaster_digest_t digest;
+        uint64_t last_used;
+        EVP_MD_CTX md_ctx;
+        EVP_PKEY_CTX* pkey_ctx;
+    };
+
+    Entry* Find(EVP_PKEY* key, keymaster_purpose_t purpose, keymaster_padding_t padding,
+                keymaster_digest_t digest);
+    Entry* Insert(EVP_PKEY* key, keymaster_purpose_t purpose, keymaster_padding_t padding,
+                  keymaster_digest_t digest);
+
+    LruCache<Entry> entries_;
+};
+
 /**
  * Base class for all RSA operations.
  *
@@ -34,9 +122,9 @@ namespace keymaster {
 class RsaOperation : public Operation {
   public:
     RsaOperation(keymaster_purpose_t purpose, keymaster_digest_t digest,
-                 keymaster_padding_t padding, EVP_PKEY* key)
+                 keymaster_padding_t padding, EVP_PKEY* key, RsaContextCache* context_cache)
         : Operation(purpose), rsa_key_(key), padding_(padding), digest_(digest),
-          digest_algorithm_(nullptr) {}
+          digest_algorithm_(nullptr), context_cache_(context_cache) {}
     ~RsaOperation();
 
     keymaster_error_t Begin(const AuthorizationSet& input_params,
@@ -62,6 +150,7 @@ class RsaOperation : public Operation {
     Buffer data_;
     const keymaster_digest_t digest_;
     const EVP_MD* digest_algorithm_;
+    RsaContextCache* context_cache_;
 };
 
 /**
@@ -73,13 +162,17 @@ class RsaOperation : public Operation {
 class RsaDigestingOperation : public RsaOperation {
   public:
     RsaDigestingOperation(keymaster_purpose_t purpose, keymaster_digest_t digest,
-                          keymaster_padding_t padding, EVP_PKEY* key);
+                          keymaster_padding_t padding, EVP_PKEY* key,
+                          RsaContextCache* context_cache);
     ~RsaDigestingOperation();
 
   protected:
     int GetOpensslPadding(keymaster_error_t* error) override;
+    keymaster_error_t InitDigestContext(bool signing);
+    keymaster_error_t InitUndigested();
     bool require_digest() const override { return padding_ == KM_PAD_RSA_PSS; }
     EVP_MD_CTX digest_ctx_;
+    RSA_Ptr rsa_;  // Set by Begin for undigested operations.
 };
 
 /**
@@ -87,8 +180,9 @@ class RsaDigestingOperation : public RsaOperation {
  */
 class RsaSignOperation : public RsaDigestingOperation {
   public:
-    RsaSignOperation(keymaster_digest_t digest, keymaster_padding_t padding, EVP_PKEY* key)
-        : RsaDigestingOperation(KM_PURPOSE_SIGN, digest, padding, key) {}
+    RsaSignOperation(keymaster_digest_t digest, keymaster_padding_t padding, EVP_PKEY* key,
+                     RsaContextCache* context_cache = nullptr)
+        : RsaDigestingOperation(KM_PURPOSE_SIGN, digest, padding, key, context_cache) {}
 
     keymaster_error_t Begin(const AuthorizationSet& input_params,
                             AuthorizationSet* output_params) override;
@@ -100,7 +194,7 @@ class RsaSignOperation : public RsaDigestingOperation {
                              Buffer* output) override;
 
   private:
-    keymaster_error_t SignUndigested(Buffer* output);
+    keymaster_error_t SignUndigested(const uint8_t* data, size_t data_length, Buffer* output);
     keymaster_error_t SignDigested(Buffer* output);
 };
 
@@ -109,8 +203,9 @@ class RsaSignOperation : public RsaDigestingOperation {
  */
 class RsaVerifyOperation : public RsaDigestingOperation {
   public:
-    RsaVerifyOperation(keymaster_digest_t digest, keymaster_padding_t padding, EVP_PKEY* key)
-        : RsaDigestingOperation(KM_PURPOSE_VERIFY, digest, padding, key) {}
+    RsaVerifyOperation(keymaster_digest_t digest, keymaster_padding_t padding, EVP_PKEY* key,
+                       RsaContextCache* context_cache = nullptr)
+        : RsaDigestingOperation(KM_PURPOSE_VERIFY, digest, padding, key, context_cache) {}
 
     keymaster_error_t Begin(const AuthorizationSet& input_params,
                             AuthorizationSet* output_params) override;
@@ -122,7 +217,8 @@ class RsaVerifyOperation : public RsaDigestingOperation {
                              Buffer* output) override;
 
   private:
-    keymaster_error_t VerifyUndigested(const Buffer& signature);
+    keymaster_error_t VerifyUndigested(const uint8_t* data, size_t data_length,
+                                       const Buffer& signature);
     keymaster_error_t VerifyDigested(const Buffer& signature);
 };
 
@@ -132,11 +228,12 @@ class RsaVerifyOperation : public RsaDigestingOperation {
 class RsaCryptOperation : public RsaOperation {
   public:
     RsaCryptOperation(keymaster_purpose_t purpose, keymaster_digest_t digest,
-                      keymaster_padding_t padding, EVP_PKEY* key)
-        : RsaOperation(purpose, digest, padding, key) {}
+                      keymaster_padding_t padding, EVP_PKEY* key, RsaContextCache* context_cache)
+        : RsaOperation(purpose, digest, padding, key, context_cache) {}
 
   protected:
     keymaster_error_t SetOaepDigestIfRequired(EVP_PKEY_CTX* pkey_ctx);
+    EVP_PKEY_CTX* CreatePkeyContext(keymaster_error_t* error);
 
   private:
     int GetOpensslPadding(keymaster_error_t* error) override;
@@ -148,8 +245,9 @@ class RsaCryptOperation : public RsaOperation {
  */
 class RsaEncryptOperation : public RsaCryptOperation {
   public:
-    RsaEncryptOperation(keymaster_digest_t digest, keymaster_padding_t padding, EVP_PKEY* key)
-        : RsaCryptOperation(KM_PURPOSE_ENCRYPT, digest, padding, key) {}
+    RsaEncryptOperation(keymaster_digest_t digest, keymaster_padding_t padding, EVP_PKEY* key,
+                        RsaContextCache* context_cache = nullptr)
+        : RsaCryptOperation(KM_PURPOSE_ENCRYPT, digest, padding, key, context_cache) {}
     keymaster_error_t Finish(const AuthorizationSet& additional_params, const Buffer& input,
                              const Buffer& signature, AuthorizationSet* output_params,
                              Buffer* output) override;
@@ -160,8 +258,9 @@ class RsaEncryptOperation : public RsaCryptOperation {
  */
 class RsaDecryptOperation : public RsaCryptOperation {
   public:
-    RsaDecryptOperation(keymaster_digest_t digest, keymaster_padding_t padding, EVP_PKEY* key)
-        : RsaCryptOperation(KM_PURPOSE_DECRYPT, digest, padding, key) {}
+    RsaDecryptOperation(keymaster_digest_t digest, keymaster_padding_t padding, EVP_PKEY* key,
+                        RsaContextCache* context_cache = nullptr)
+        : RsaCryptOperation(KM_PURPOSE_DECRYPT, digest, padding, key, context_cache) {}
     keymaster_error_t Finish(const AuthorizationSet& additional_params, const Buffer& input,
                              const Buffer& signature, AuthorizationSet* output_params,
                              Buffer* output) override;
@@ -182,14 +281,19 @@ class RsaOperationFactory : public OperationFactory {
     }
     const keymaster_digest_t* SupportedDigests(size_t* digest_count) const override;
 
-  protected:
+    /**
+     * Return a new reference to an EVP_PKEY for the specified RsaKey, which the caller must free.
+     */
     static EVP_PKEY* GetRsaKey(const Key& key, keymaster_error_t* error);
+
+  protected:
     virtual RsaOperation* CreateRsaOperation(const Key& key, const AuthorizationSet& begin_params,
                                              keymaster_error_t* error);
 
   private:
     virtual RsaOperation* InstantiateOperation(keymaster_digest_t digest,
-                                               keymaster_padding_t padding, EVP_PKEY* key) = 0;
+                                               keymaster_padding_t padding, EVP_PKEY* key,
+                                               RsaContextCache* context_cache) = 0;
 };
 
 /**
@@ -218,8 +322,8 @@ class RsaSigningOperationFactory : public RsaDigestingOperationFactory {
   public:
     keymaster_purpose_t purpose() const override { return KM_PURPOSE_SIGN; }
     RsaOperation* InstantiateOperation(keymaster_digest_t digest, keymaster_padding_t padding,
-                                       EVP_PKEY* key) override {
-        return new (std::nothrow) RsaSignOperation(digest, padding, key);
+                                       EVP_PKEY* key, RsaContextCache* context_cache) override {
+        return new (std::nothrow) RsaSignOperation(digest, padding, key, context_cache);
     }
 };
 
@@ -229,8 +333,8 @@ class RsaSigningOperationFactory : public RsaDigestingOperationFactory {
 class RsaVerificationOperationFactory : public RsaDigestingOperationFactory {
     keymaster_purpose_t purpose() const override { return KM_PURPOSE_VERIFY; }
     RsaOperation* InstantiateOperation(keymaster_digest_t digest, keymaster_padding_t padding,
-                                       EVP_PKEY* key) override {
-        return new (std::nothrow) RsaVerifyOperation(digest, padding, key);
+                                       EVP_PKEY* key, RsaContextCache* context_cache) override {
+        return new (std::nothrow) RsaVerifyOperation(digest, padding, key, context_cache);
     }
 };
 
@@ -240,8 +344,8 @@ class RsaVerificationOperationFactory : public RsaDigestingOperationFactory {
 class RsaEncryptionOperationFactory : public RsaCryptingOperationFactory {
     keymaster_purpose_t purpose() const override { return KM_PURPOSE_ENCRYPT; }
     RsaOperation* InstantiateOperation(keymaster_digest_t digest, keymaster_padding_t padding,
-                                       EVP_PKEY* key) override {
-        return new (std::nothrow) RsaEncryptOperation(digest, padding, key);
+                                       EVP_PKEY* key, RsaContextCache* context_cache) override {
+        return new (std::nothrow) RsaEncryptOperation(digest, padding, key, context_cache);
     }
 };
 
@@ -251,8 +355,8 @@ class RsaEncryptionOperationFactory : public RsaCryptingOperationFactory {
 class RsaDecryptionOperationFactory : public RsaCryptingOperationFactory {
     keymaster_purpose_t purpose() const override { return KM_PURPOSE_DECRYPT; }
     RsaOperation* InstantiateOperation(keymaster_digest_t digest, keymaster_padding_t padding,
-                                       EVP_PKEY* key) override {
-        return new (std::nothrow) RsaDecryptOperation(digest, padding, key);
+                                       EVP_PKEY* key, RsaContextCache* context_cache) override {
+        return new (std::nothrow) RsaDecryptOperation(digest, padding, key, context_cache);
     }
 };
 
@@ -0,0 +1,159 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "secure_memory_pool.h"
+
+#include <assert.h>
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#include <algorithm>
+
+#include <keymaster/logger.h>
+
+namespace keymaster {
+
+const size_t SecureMemoryPool::kMinSlotSize;
+const size_t SecureMemoryPool::kMaxSlotSize;
+const size_t SecureMemoryPool::kChunkSize;
+const size_t SecureMemoryPool::kSizeClasses;
+
+// Returns the index of the smallest slot size that holds \p size bytes.
+static size_t size_class(size_t size) {
+    size_t index = 0;
+    for (size_t slot_size = SecureMemoryPool::kMinSlotSize; slot_size < size; slot_size *= 2)
+        ++index;
+    return index;
+}
+
+SecureMemoryPool::SecureMemoryPool() : locked_chunks_(0), slots_in_use_(0) {
+    for (auto& slot : free_slots_)
+        slot = nullptr;
+}
+
+SecureMemoryPool::~SecureMemoryPool() {
+    for (const Chunk& chunk : chunks_) {
+        memset_s(chunk.base, 0, kChunkSize);
+        munlock(chunk.base, kChunkSize);
+        munmap(chunk.base, kChunkSize);
+    }
+}
+
+/* static */
+SecureMemoryPool* SecureMemoryPool::Get() {
+    // Key material may still be freed during static destruction, so the pool is never destroyed.
+    static SecureMemoryPool* pool = new SecureMemoryPool;
+    return pool;
+}
+
+/* static */
+void SecureMemoryPool::InstallForKeyMaterial() {
+    static std::once_flag installed;
+    std::call_once(installed, [] { SetKeyMaterialAllocator(Get()); });
+}
+
+uint8_t* SecureMemoryPool::Allocate(size_t size) {
+    if (size > kMaxSlotSize)
+        return nullptr;
+
+    size_t index = size_class(size);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (!free_slots_[index] && !AddChunk(index))
+        return nullptr;
+
+    // Free slots hold the address of the next free slot.
+    uint8_t* slot = free_slots_[index];
+    memcpy(&free_slots_[index], slot, sizeof(slot));
+    ++slots_in_use_;
+    return slot;
+}
+
+bool SecureMemoryPool::Owns(const uint8_t* material) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return FindChunk(material) != nullptr;
+}
+
+bool SecureMemoryPool::Free(uint8_t* material) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    const Chunk* chunk = FindChunk(material);
+    if (!chunk)
+        return false;
+    assert((material - chunk->base) % chunk->slot_size == 0);
+
+    memset_s(material, 0, chunk->slot_size);
+    size_t index = size_class(chunk->slot_size);
+    memcpy(material, &free_slots_[index], sizeof(material));
+    free_slots_[index] = material;
+    --slots_in_use_;
+    return true;
+}
+
+void SecureMemoryPool::GetStats(Stats* stats) const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stats->chunks = chunks_.size();
+    stats->locked_chunks = locked_chunks_;
+    stats->slots_in_use = slots_in_use_;
+}
+
+bool SecureMemoryPool::AddChunk(size_t index) {
+    void* mapping = mmap(nullptr /* addr */, kChunkSize, PROT_READ | PROT_WRITE,
+                         MAP_PRIVATE | MAP_ANONYMOUS, -1 /* fd */, 0 /* offset */);
+    if (mapping == MAP_FAILED) {
+        LOG_E("Failed to map secure memory: %s", strerror(errno));
+        return false;
+    }
+    uint8_t* base = static_cast<uint8_t*>(mapping);
+
+    // One mlock per chunk, rather than per allocation.
+    if (mlock(base, kChunkSize) == 0)
+        ++locked_chunks_;
+    else
+        LOG_W("Failed to lock secure memory, key material may be swapped: %s", strerror(errno));
+#ifdef MADV_DONTDUMP
+    madvise(base, kChunkSize, MADV_DONTDUMP);
+#endif
+
+    Chunk chunk = {base, kMinSlotSize << index};
+    auto position = std::upper_bound(
+        chunks_.begin(), chunks_.end(), base,
+        [](const uint8_t* address, const Chunk& other) { return address < other.base; });
+    chunks_.insert(position, chunk);
+
+    // Thread the new slots onto the (empty) free list, lowest address first.
+    uint8_t* next = nullptr;
+    for (size_t offset = kChunkSize; offset >= chunk.slot_size; offset -= chunk.slot_size) {
+        uint8_t* slot = base + offset - chunk.slot_size;
+        memcpy(slot, &next, sizeof(next));
+        next = slot;
+    }
+    free_slots_[index] = next;
+    return true;
+}
+
+const SecureMemoryPool::Chunk* SecureMemoryPool::FindChunk(const uint8_t* material) const {
+    auto next = std::upper_bound(
+        chunks_.begin(), chunks_.end(), material,
+        [](const uint8_t* address, const Chunk& chunk) { return address < chunk.base; });
+    if (next == chunks_.begin())
+        return nullptr;
+    const Chunk& chunk = *(next - 1);
+    if (material >= chunk.base + kChunkSize)
+        return nullptr;
+    return &chunk;
+}
+
+}  // namespace keymaster
@@ -0,0 +1,98 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_SECURE_MEMORY_POOL_H_
+#define SYSTEM_KEYMASTER_SECURE_MEMORY_POOL_H_
+
+#include <stdint.h>
+
+#include <mutex>
+#include <vector>
+
+#include <keymaster/android_keymaster_utils.h>
+
+namespace keymaster {
+
+/**
+ * A KeyMaterialAllocator which serves key material from locked memory.  The pool maps chunks of
+ * kChunkSize bytes, locks them so they are never swapped out, excludes them from core dumps, and
+ * carves each into slots of one power-of-two size, kept on a free list per size.  Slots are wiped
+ * when freed.  Requests larger than kMaxSlotSize are left to the heap.
+ *
+ * Locking a chunk can fail, for example when RLIMIT_MEMLOCK is exhausted.  The chunk is used anyway
+ * and still wiped on free, and a warning is logged.
+ *
+ * SecureMemoryPool is thread-safe.
+ */
+class SecureMemoryPool : public KeyMaterialAllocator {
+  public:
+    static const size_t kMinSlotSize = 16;
+    static const size_t kMaxSlotSize = 4096;
+    static const size_t kChunkSize = 64 * 1024;
+
+    SecureMemoryPool();
+
+    /**
+     * Wipe, unlock and unmap every chunk.  Nothing allocated from the pool may still be in use.
+     */
+    ~SecureMemoryPool();
+
+    /**
+     * Returns the process-wide pool, which is never destroyed.
+     */
+    static SecureMemoryPool* Get();
+
+    /**
+     * Make the process-wide pool the key material allocator.  Only the first call has any effect.
+     */
+    static void InstallForKeyMaterial();
+
+    uint8_t* Allocate(size_t size) override;
+    bool Free(uint8_t* material) override;
+
+    /**
+     * Returns true if \p material is in one of the pool's chunks.
+     */
+    bool Owns(const uint8_t* material) const;
+
+    struct Stats {
+        size_t chunks;
+        size_t locked_chunks;
+        size_t slots_in_use;
+    };
+    void GetStats(Stats* stats) const;
+
+  private:
+    struct Chunk {
+        uint8_t* base;
+        size_t slot_size;
+    };
+
+    static const size_t kSizeClasses = 9;  // kMinSlotSize through kMaxSlotSize.
+
+    bool AddChunk(size_t size_class);
+    const Chunk* FindChunk(const uint8_t* material) const;
+
+    mutable std::mutex mutex_;
+    std::vector<Chunk> chunks_;  // Sorted by base.
+    uint8_t* free_slots_[kSizeClasses];
+    size_t locked_chunks_;
+    size_t slots_in_use_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_SECURE_MEMORY_POOL_H_
@@ -0,0 +1,376 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sha256_multibuffer.h"
+
+#include <string.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+#if defined(__AVX2__)
+#include <immintrin.h>
+#endif
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
+#include <keymaster/android_keymaster_utils.h>
+
+namespace keymaster {
+
+namespace {
+
+const size_t kSha256BlockSize = 64;
+
+const uint32_t kSha256InitialState[8] = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a, 0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+};
+
+const uint32_t kSha256RoundConstants[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+inline uint32_t LoadBigEndian32(const uint8_t* p) {
+    return (static_cast<uint32_t>(p[0]) << 24) | (static_cast<uint32_t>(p[1]) << 16) |
+           (static_cast<uint32_t>(p[2]) << 8) | static_cast<uint32_t>(p[3]);
+}
+
+inline void StoreBigEndian32(uint32_t value, uint8_t* p) {
+    p[0] = static_cast<uint8_t>(value >> 24);
+    p[1] = static_cast<uint8_t>(value >> 16);
+    p[2] = static_cast<uint8_t>(value >> 8);
+    p[3] = static_cast<uint8_t>(value);
+}
+
+/*
+ * Each lane set below wraps one vector instruction set as a set of 32-bit-per-lane operations, so
+ * that the compression function is written once.  Shift counts are template parameters because
+ * the NEON and SSE shift intrinsics want immediates.
+ */
+
+#if defined(__AVX2__)
+struct Avx2Lanes {
+    typedef __m256i Vector;
+    static const size_t kLanes = 8;
+
+    static Vector Load(const uint32_t* p) {
+        return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p));
+    }
+    static void Store(uint32_t* p, Vector v) {
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), v);
+    }
+    static Vector Splat(uint32_t x) { return _mm256_set1_epi32(static_cast<int>(x)); }
+    static Vector Add(Vector a, Vector b) { return _mm256_add_epi32(a, b); }
+    static Vector Xor(Vector a, Vector b) { return _mm256_xor_si256(a, b); }
+    static Vector Or(Vector a, Vector b) { return _mm256_or_si256(a, b); }
+    static Vector And(Vector a, Vector b) { return _mm256_and_si256(a, b); }
+    // Returns ~a & b.
+    static Vector AndNot(Vector a, Vector b) { return _mm256_andnot_si256(a, b); }
+    template <int n> static Vector ShiftRight(Vector a) { return _mm256_srli_epi32(a, n); }
+    template <int n> static Vector ShiftLeft(Vector a) { return _mm256_slli_epi32(a, n); }
+};
+#endif  // __AVX2__
+
+#if defined(__SSE2__)
+struct Sse2Lanes {
+    typedef __m128i Vector;
+    static const size_t kLanes = 4;
+
+    static Vector Load(const uint32_t* p) {
+        return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    }
+    static void Store(uint32_t* p, Vector v) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), v); }
+    static Vector Splat(uint32_t x) { return _mm_set1_epi32(static_cast<int>(x)); }
+    static Vector Add(Vector a, Vector b) { return _mm_add_epi32(a, b); }
+    static Vector Xor(Vector a, Vector b) { return _mm_xor_si128(a, b); }
+    static Vector Or(Vector a, Vector b) { return _mm_or_si128(a, b); }
+    static Vector And(Vector a, Vector b) { return _mm_and_si128(a, b); }
+    // Returns ~a & b.
+    static Vector AndNot(Vector a, Vector b) { return _mm_andnot_si128(a, b); }
+    template <int n> static Vector ShiftRight(Vector a) { return _mm_srli_epi32(a, n); }
+    template <int n> static Vector ShiftLeft(Vector a) { return _mm_slli_epi32(a, n); }
+};
+#endif  // __SSE2__
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+struct NeonLanes {
+    typedef uint32x4_t Vector;
+    static const size_t kLanes = 4;
+
+    static Vector Load(const uint32_t* p) { return vld1q_u32(p); }
+    static void Store(uint32_t* p, Vector v) { vst1q_u32(p, v); }
+    static Vector Splat(uint32_t x) { return vdupq_n_u32(x); }
+    static Vector Add(Vector a, Vector b) { return vaddq_u32(a, b); }
+    static Vector Xor(Vector a, Vector b) { return veorq_u32(a, b); }
+    static Vector Or(Vector a, Vector b) { return vorrq_u32(a, b); }
+    static Vector And(Vector a, Vector b) { return vandq_u32(a, b); }
+    // Returns ~a & b.
+    static Vector AndNot(Vector a, Vector b) { return vbicq_u32(b, a); }
+    template <int n> static Vector ShiftRight(Vector a) { return vshrq_n_u32(a, n); }
+    template <int n> static Vector ShiftLeft(Vector a) { return vshlq_n_u32(a, n); }
+};
+#endif  // __ARM_NEON
+
+/**
+ * MultiBufferSha256 runs one SHA-256 computation per lane of the vector type described by |Lanes|.
+ * The message schedule and working variables of lane i live in element i of each vector.  When a
+ * lane's message is finished its digest is written out and the lane takes the next input.
+ */
+template <typename Lanes> class MultiBufferSha256 {
+    typedef typename Lanes::Vector Vector;
+    static const size_t kLanes = Lanes::kLanes;
+
+  public:
+    MultiBufferSha256(const Sha256Input* inputs, size_t count,
+                      uint8_t (*digests)[SHA256_DIGEST_LENGTH])
+        : inputs_(inputs), count_(count), digests_(digests), next_input_(0) {
+        memset(lanes_, 0, sizeof(lanes_));
+        memset(state_, 0, sizeof(state_));
+    }
+
+    ~MultiBufferSha256() {
+        // The tails and schedule hold copies of message bytes.
+        memset_s(lanes_, 0, sizeof(lanes_));
+        memset_s(schedule_, 0, sizeof(schedule_));
+    }
+
+    void Run() {
+        for (size_t i = 0; i < kLanes; ++i)
+            StartNextInput(i);
+
+        static const uint8_t kIdleBlock[kSha256BlockSize] = {};
+        bool any_active = true;
+        while (any_active) {
+            for (size_t i = 0; i < kLanes; ++i) {
+                const uint8_t* block = lanes_[i].active ? CurrentBlock(lanes_[i]) : kIdleBlock;
+                for (size_t t = 0; t < 16; ++t)
+                    schedule_[t][i] = LoadBigEndian32(block + 4 * t);
+            }
+
+            Compress();
+
+            any_active = false;
+            for (size_t i = 0; i < kLanes; ++i) {
+                if (lanes_[i].active && Advance(&lanes_[i])) {
+                    FinishLane(i);
+                    StartNextInput(i);
+                }
+                any_active |= lanes_[i].active;
+            }
+        }
+    }
+
+  private:
+    struct Lane {
+        bool active;
+        size_t input;
+        const uint8_t* data;  // Next unprocessed full block of the message.
+        size_t full_blocks;   // Full message blocks not yet processed.
+        size_t tail_blocks;   // 1 or 2: the last partial block plus padding and length.
+        size_t tail_index;    // Tail blocks already processed.
+        uint8_t tail[2 * kSha256BlockSize];
+    };
+
+    void StartNextInput(size_t i) {
+        Lane* lane = &lanes_[i];
+        if (next_input_ >= count_) {
+            lane->active = false;
+            return;
+        }
+
+        const Sha256Input& input = inputs_[next_input_];
+        lane->active = true;
+        lane->input = next_input_++;
+        lane->data = input.data;
+        lane->full_blocks = input.data_length / kSha256BlockSize;
+        lane->tail_index = 0;
+
+        size_t remainder = input.data_length % kSha256BlockSize;
+        memset(lane->tail, 0, sizeof(lane->tail));
+        if (remainder)
+            memcpy(lane->tail, input.data + lane->full_blocks * kSha256BlockSize, remainder);
+        lane->tail[remainder] = 0x80;
+        lane->tail_blocks = (remainder + 1 + 8 <= kSha256BlockSize) ? 1 : 2;
+
+        uint64_t bit_length = static_cast<uint64_t>(input.data_length) * 8;
+        uint8_t* length_field = lane->tail + lane->tail_blocks * kSha256BlockSize - 8;
+        StoreBigEndian32(static_cast<uint32_t>(bit_length >> 32), length_field);
+        StoreBigEndian32(static_cast<uint32_t>(bit_length), length_field + 4);
+
+        for (size_t j = 0; j < 8; ++j)
+            state_[j][i] = kSha256InitialState[j];
+    }
+
+    static const uint8_t* CurrentBlock(const Lane& lane) {
+        if (lane.full_blocks)
+            return lane.data;
+        return lane.tail + lane.tail_index * kSha256BlockSize;
+    }
+
+    // Moves |lane| past the block just compressed.  Returns true if its message is finished.
+    static bool Advance(Lane* lane) {
+        if (lane->full_blocks) {
+            lane->data += kSha256BlockSize;
+            --lane->full_blocks;
+            return false;
+        }
+        return ++lane->tail_index == lane->tail_blocks;
+    }
+
+    void FinishLane(size_t i) {
+        uint8_t* digest = digests_[lanes_[i].input];
+        for (size_t j = 0; j < 8; ++j)
+            StoreBigEndian32(state_[j][i], digest + 4 * j);
+    }
+
+    template <int n> static Vector RotateRight(Vector x) {
+        return Lanes::Or(Lanes::template ShiftRight<n>(x), Lanes::template ShiftLeft<32 - n>(x));
+    }
+
+    static Vector Add(Vector a, Vector b) { return Lanes::Add(a, b); }
+    static Vector Xor3(Vector a, Vector b, Vector c) { return Lanes::Xor(Lanes::Xor(a, b), c); }
+
+    static Vector BigSigma0(Vector x) {
+        return Xor3(RotateRight<2>(x), RotateRight<13>(x), RotateRight<22>(x));
+    }
+    static Vector BigSigma1(Vector x) {
+        return Xor3(RotateRight<6>(x), RotateRight<11>(x), RotateRight<25>(x));
+    }
+    static Vector SmallSigma0(Vector x) {
+        return Xor3(RotateRight<7>(x), RotateRight<18>(x), Lanes::template ShiftRight<3>(x));
+    }
+    static Vector SmallSigma1(Vector x) {
+        return Xor3(RotateRight<17>(x), RotateRight<19>(x), Lanes::template ShiftRight<10>(x));
+    }
+    static Vector Choose(Vector e, Vector f, Vector g) {
+        return Lanes::Xor(Lanes::And(e, f), Lanes::AndNot(e, g));
+    }
+    static Vector Majority(Vector a, Vector b, Vector c) {
+        return Lanes::Xor(Lanes::And(a, b), Lanes::And(c, Lanes::Xor(a, b)));
+    }
+
+    void Compress() {
+        Vector w[16];
+        for (size_t t = 0; t < 16; ++t)
+            w[t] = Lanes::Load(schedule_[t]);
+
+        Vector a = Lanes::Load(state_[0]);
+        Vector b = Lanes::Load(state_[1]);
+        Vector c = Lanes::Load(state_[2]);
+        Vector d = Lanes::Load(state_[3]);
+        Vector e = Lanes::Load(state_[4]);
+        Vector f = Lanes::Load(state_[5]);
+        Vector g = Lanes::Load(state_[6]);
+        Vector h = Lanes::Load(state_[7]);
+
+        for (size_t t = 0; t < 64; ++t) {
+            if (t >= 16) {
+                // w[t & 15] still holds W[t - 16]; the others are W[t - 15], W[t - 7], W[t - 2].
+                w[t & 15] = Add(Add(w[t & 15], SmallSigma0(w[(t + 1) & 15])),
+                                Add(w[(t + 9) & 15], SmallSigma1(w[(t + 14) & 15])));
+            }
+            Vector t1 = Add(Add(h, BigSigma1(e)),
+                            Add(Choose(e, f, g),
+                                Add(Lanes::Splat(kSha256RoundConstants[t]), w[t & 15])));
+            Vector t2 = Add(BigSigma0(a), Majority(a, b, c));
+            h = g;
+            g = f;
+            f = e;
+            e = Add(d, t1);
+            d = c;
+            c = b;
+            b = a;
+            a = Add(t1, t2);
+        }
+
+        Lanes::Store(state_[0], Add(Lanes::Load(state_[0]), a));
+        Lanes::Store(state_[1], Add(Lanes::Load(state_[1]), b));
+        Lanes::Store(state_[2], Add(Lanes::Load(state_[2]), c));
+        Lanes::Store(state_[3], Add(Lanes::Load(state_[3]), d));
+        Lanes::Store(state_[4], Add(Lanes::Load(state_[4]), e));
+        Lanes::Store(state_[5], Add(Lanes::Load(state_[5]), f));
+        Lanes::Store(state_[6], Add(Lanes::Load(state_[6]), g));
+        Lanes::Store(state_[7], Add(Lanes::Load(state_[7]), h));
+    }
+
+    const Sha256Input* inputs_;
+    size_t count_;
+    uint8_t (*digests_)[SHA256_DIGEST_LENGTH];
+    size_t next_input_;
+    Lane lanes_[kLanes];
+    uint32_t state_[8][kLanes];
+    uint32_t schedule_[16][kLanes];
+};
+
+template <typename Lanes>
+void HashInLanes(const Sha256Input* inputs, size_t count,
+                 uint8_t (*digests)[SHA256_DIGEST_LENGTH]) {
+    MultiBufferSha256<Lanes> hasher(inputs, count, digests);
+    hasher.Run();
+}
+
+}  // anonymous namespace
+
+size_t Sha256MultiBufferMaxLanes() {
+#if defined(__AVX2__)
+    return 8;
+#elif defined(__SSE2__) || defined(__ARM_NEON) || defined(__ARM_NEON__)
+    return 4;
+#else
+    return 1;
+#endif
+}
+
+void Sha256MultiBuffer(const Sha256Input* inputs, size_t count,
+                       uint8_t (*digests)[SHA256_DIGEST_LENGTH], size_t lanes) {
+    if (lanes == 0 || lanes > Sha256MultiBufferMaxLanes())
+        lanes = Sha256MultiBufferMaxLanes();
+
+    // A single input gains nothing from lanes, and the crypto library's SHA256 is faster per lane.
+    if (count < 2)
+        lanes = 1;
+
+#if defined(__AVX2__)
+    if (lanes >= 8) {
+        HashInLanes<Avx2Lanes>(inputs, count, digests);
+        return;
+    }
+#endif
+#if defined(__SSE2__)
+    if (lanes >= 4) {
+        HashInLanes<Sse2Lanes>(inputs, count, digests);
+        return;
+    }
+#elif defined(__ARM_NEON) || defined(__ARM_NEON__)
+    if (lanes >= 4) {
+        HashInLanes<NeonLanes>(inputs, count, digests);
+        return;
+    }
+#endif
+
+    for (size_t i = 0; i < count; ++i)
+        SHA256(inputs[i].data, inputs[i].data_length, digests[i]);
+}
+
+}  // namespace keymaster
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_SHA256_MULTIBUFFER_H_
+#define SYSTEM_KEYMASTER_SHA256_MULTIBUFFER_H_
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <openssl/sha.h>
+
+namespace keymaster {
+
+struct Sha256Input {
+    const uint8_t* data;
+    size_t data_length;
+};
+
+/**
+ * Returns the widest lane count Sha256MultiBuffer supports in this build: 8 with AVX2, 4 with SSE2
+ * or NEON, and 1 where only the scalar fallback is available.
+ */
+size_t Sha256MultiBufferMaxLanes();
+
+/**
+ * Computes the SHA-256 digests of |count| independent inputs, writing the digest of inputs[i] to
+ * digests[i].  Inputs are hashed in SIMD lanes, one message per lane, so that hashing many small
+ * messages costs about as much per block as one long message.  Lanes are refilled as soon as
+ * their message is done, so inputs of mixed lengths don't leave lanes idle for long.
+ *
+ * |lanes| limits the lane count used; zero selects Sha256MultiBufferMaxLanes().  Counts the build
+ * doesn't support are rounded down to one that it does, and one lane hashes each input with the
+ * crypto library's SHA256.  This is mostly useful for benchmarking; callers normally pass zero.
+ */
+void Sha256MultiBuffer(const Sha256Input* inputs, size_t count,
+                       uint8_t (*digests)[SHA256_DIGEST_LENGTH], size_t lanes = 0);
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_SHA256_MULTIBUFFER_H_
@@ -0,0 +1,88 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "sha256_multibuffer.h"
+
+#include <gtest/gtest.h>
+#include <string.h>
+
+#include <vector>
+
+#include "android_keymaster_test_utils.h"
+
+namespace keymaster {
+
+namespace test {
+
+TEST(Sha256MultiBufferTest, KnownAnswers) {
+    const char* messages[] = {
+        "", "abc", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq",
+    };
+    const char* expected[] = {
+        "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855",
+        "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad",
+        "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1",
+    };
+    const size_t count = sizeof(messages) / sizeof(messages[0]);
+
+    Sha256Input inputs[count];
+    for (size_t i = 0; i < count; ++i) {
+        inputs[i].data = reinterpret_cast<const uint8_t*>(messages[i]);
+        inputs[i].data_length = strlen(messages[i]);
+    }
+
+    uint8_t digests[count][SHA256_DIGEST_LENGTH];
+    Sha256MultiBuffer(inputs, count, digests);
+    for (size_t i = 0; i < count; ++i)
+        EXPECT_EQ(hex2str(expected[i]),
+                  std::string(reinterpret_cast<char*>(digests[i]), SHA256_DIGEST_LENGTH));
+}
+
+TEST(Sha256MultiBufferTest, MatchesSha256AtEveryLaneCount) {
+    // Lengths around the block boundaries exercise one- and two-block padding, and the mix of
+    // lengths makes lanes finish and refill at different times.
+    std::vector<std::string> messages;
+    for (size_t length = 0; length < 3 * 64 + 2; ++length) {
+        std::string message(length, '\0');
+        for (size_t i = 0; i < length; ++i)
+            message[i] = static_cast<char>(length * 31 + i);
+        messages.push_back(message);
+    }
+
+    std::vector<Sha256Input> inputs(messages.size());
+    for (size_t i = 0; i < messages.size(); ++i) {
+        inputs[i].data = reinterpret_cast<const uint8_t*>(messages[i].data());
+        inputs[i].data_length = messages[i].size();
+    }
+
+    for (size_t lanes = 0; lanes <= 8; ++lanes) {
+        std::vector<uint8_t> digests(inputs.size() * SHA256_DIGEST_LENGTH);
+        Sha256MultiBuffer(inputs.data(), inputs.size(),
+                          reinterpret_cast<uint8_t(*)[SHA256_DIGEST_LENGTH]>(digests.data()),
+                          lanes);
+        for (size_t i = 0; i < inputs.size(); ++i) {
+            uint8_t expected[SHA256_DIGEST_LENGTH];
+            SHA256(inputs[i].data, inputs[i].data_length, expected);
+            EXPECT_EQ(0, memcmp(expected, &digests[i * SHA256_DIGEST_LENGTH],
+                                SHA256_DIGEST_LENGTH))
+                << "lanes " << lanes << ", length " << inputs[i].data_length;
+        }
+    }
+}
+
+}  // namespace test
+
+}  // namespace keymaster
@@ -27,8 +27,10 @@
 
 #include <keymaster/android_keymaster_utils.h>
 #include <keymaster/logger.h>
+#include <keymaster/rsa_key_factory.h>
 
 #include "aes_key.h"
+#include "attestation_cert_template.h"
 #include "auth_encrypted_key_blob.h"
 #include "ec_keymaster0_key.h"
 #include "ec_keymaster1_key.h"
@@ -281,7 +283,51 @@ static uint8_t kEcAttestRootCert[] = {
     0xa5, 0x85, 0x65, 0x3c, 0xad, 0x4f, 0x24, 0xa7, 0xe7, 0x4d, 0xaf, 0x41, 0x7d, 0xf1, 0xbf,
 };
 
-size_t kCertificateChainLength = 2;
+const keymaster_blob_t kRsaAttestChainEntries[] = {
+    {kRsaAttestCert, array_length(kRsaAttestCert)},
+    {kRsaAttestRootCert, array_length(kRsaAttestRootCert)},
+};
+
+const keymaster_blob_t kEcAttestChainEntries[] = {
+    {kEcAttestCert, array_length(kEcAttestCert)},
+    {kEcAttestRootCert, array_length(kEcAttestRootCert)},
+};
+
+// The chain entries are never modified; keymaster_cert_chain_t just has no const variant.
+const keymaster_cert_chain_t kRsaAttestChain = {
+    const_cast<keymaster_blob_t*>(kRsaAttestChainEntries), array_length(kRsaAttestChainEntries)};
+const keymaster_cert_chain_t kEcAttestChain = {
+    const_cast<keymaster_blob_t*>(kEcAttestChainEntries), array_length(kEcAttestChainEntries)};
+
+EVP_PKEY* ParseAttestationKey(keymaster_algorithm_t algorithm, keymaster_error_t* error) {
+    const uint8_t* key;
+    size_t key_length;
+    int evp_key_type;
+
+    switch (algorithm) {
+    case KM_ALGORITHM_RSA:
+        key = kRsaAttestKey;
+        key_length = array_length(kRsaAttestKey);
+        evp_key_type = EVP_PKEY_RSA;
+        break;
+
+    case KM_ALGORITHM_EC:
+        key = kEcAttestKey;
+        key_length = array_length(kEcAttestKey);
+        evp_key_type = EVP_PKEY_EC;
+        break;
+
+    default:
+        *error = KM_ERROR_UNSUPPORTED_ALGORITHM;
+        return nullptr;
+    }
+
+    EVP_PKEY* pkey = d2i_PrivateKey(evp_key_type, nullptr /* pkey */, &key, key_length);
+    if (!pkey)
+        *error = TranslateLastOpenSslError();
+
+    return pkey;
+}
 
 bool UpgradeIntegerTag(keymaster_tag_t tag, uint32_t value, AuthorizationSet* set,
                        bool* set_changed) {
@@ -310,9 +356,20 @@ bool UpgradeIntegerTag(keymaster_tag_t tag, uint32_t value, AuthorizationSet* se
 SoftKeymasterContext::SoftKeymasterContext(const std::string& root_of_trust)
     : rsa_factory_(new RsaKeyFactory(this)), ec_factory_(new EcKeyFactory(this)),
       aes_factory_(new AesKeyFactory(this)), hmac_factory_(new HmacKeyFactory(this)),
-      km1_dev_(nullptr), root_of_trust_(root_of_trust), os_version_(0), os_patchlevel_(0) {}
+      km1_dev_(nullptr), root_of_trust_(root_of_trust), os_version_(0), os_patchlevel_(0) {
+    // If parsing fails here, AttestationKey parses on each call and reports the error.
+    keymaster_error_t error;
+    rsa_attestation_key_ = ParseAttestationKey(KM_ALGORITHM_RSA, &error);
+    ec_attestation_key_ = ParseAttestationKey(KM_ALGORITHM_EC, &error);
+    // Likewise, a missing template is built for each attestation instead.
+    rsa_cert_template_.reset(AttestationCertTemplate::Create(kRsaAttestChain.entries[0], &error));
+    ec_cert_template_.reset(AttestationCertTemplate::Create(kEcAttestChain.entries[0], &error));
+}
 
-SoftKeymasterContext::~SoftKeymasterContext() {}
+SoftKeymasterContext::~SoftKeymasterContext() {
+    EVP_PKEY_free(rsa_attestation_key_);
+    EVP_PKEY_free(ec_attestation_key_);
+}
 
 keymaster_error_t SoftKeymasterContext::SetHardwareDevice(keymaster0_device_t* keymaster0_device) {
     if (!keymaster0_device)
@@ -347,6 +404,12 @@ keymaster_error_t SoftKeymasterContext::SetHardwareDevice(keymaster1_device_t* k
     return KM_ERROR_OK;
 }
 
+void SoftKeymasterContext::SetRsaKeyPool(RsaKeyPool* rsa_key_pool) {
+    // Detach the old pool from the factory before destroying it.
+    static_cast<RsaKeyFactory*>(rsa_factory_.get())->set_key_pool(rsa_key_pool);
+    rsa_key_pool_.reset(rsa_key_pool);
+}
+
 keymaster_error_t SoftKeymasterContext::SetSystemVersion(uint32_t os_version,
                                                          uint32_t os_patchlevel) {
     os_version_ = os_version;
@@ -359,6 +422,13 @@ void SoftKeymasterContext::GetSystemVersion(uint32_t* os_version, uint32_t* os_p
     *os_patchlevel = os_patchlevel_;
 }
 
+uint64_t SoftKeymasterContext::GetMonotonicTimeNs() const {
+    timespec now;
+    if (clock_gettime(CLOCK_MONOTONIC, &now) != 0)
+        return 0;
+    return static_cast<uint64_t>(now.tv_sec) * 1000000000 + now.tv_nsec;
+}
+
 KeyFactory* SoftKeymasterContext::GetKeyFactory(keymaster_algorithm_t algorithm) const {
     switch (algorithm) {
     case KM_ALGORITHM_RSA:
@@ -763,38 +833,34 @@ void SoftKeymasterContext::AddSystemVersionToSet(AuthorizationSet* auth_set) con
 
 EVP_PKEY* SoftKeymasterContext::AttestationKey(keymaster_algorithm_t algorithm,
                                                keymaster_error_t* error) const {
-
-    const uint8_t* key;
-    size_t key_length;
-    int evp_key_type;
-
+    EVP_PKEY* pkey = nullptr;
     switch (algorithm) {
     case KM_ALGORITHM_RSA:
-        key = kRsaAttestKey;
-        key_length = array_length(kRsaAttestKey);
-        evp_key_type = EVP_PKEY_RSA;
+        pkey = rsa_attestation_key_;
         break;
-
     case KM_ALGORITHM_EC:
-        key = kEcAttestKey;
-        key_length = array_length(kEcAttestKey);
-        evp_key_type = EVP_PKEY_EC;
+        pkey = ec_attestation_key_;
         break;
-
     default:
-        *error = KM_ERROR_UNSUPPORTED_ALGORITHM;
-        return nullptr;
+        break;
     }
 
-    EVP_PKEY* pkey = d2i_PrivateKey(evp_key_type, nullptr /* pkey */, &key, key_length);
     if (!pkey)
-        *error = TranslateLastOpenSslError();
+        return ParseAttestationKey(algorithm, error);
 
+    // The key is never modified after parsing, so callers can share it.
+    EVP_PKEY_up_ref(pkey);
     return pkey;
 }
 
 keymaster_cert_chain_t* SoftKeymasterContext::AttestationChain(keymaster_algorithm_t algorithm,
                                                                keymaster_error_t* error) const {
+    const keymaster_cert_chain_t* shared_chain = SharedAttestationChain(algorithm);
+    if (!shared_chain) {
+        *error = KM_ERROR_UNSUPPORTED_ALGORITHM;
+        return nullptr;
+    }
+
     // If we have to bail it will be because of an allocation failure.
     *error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
 
@@ -803,51 +869,47 @@ keymaster_cert_chain_t* SoftKeymasterContext::AttestationChain(keymaster_algorit
         return nullptr;
     memset(chain.get(), 0, sizeof(keymaster_cert_chain_t));
 
-    chain->entries = new keymaster_blob_t[kCertificateChainLength];
+    chain->entries = new keymaster_blob_t[shared_chain->entry_count];
     if (!chain->entries)
         return nullptr;
 
-    memset(chain->entries, 0, sizeof(chain->entries[0]) * kCertificateChainLength);
-    chain->entry_count = kCertificateChainLength;
+    memset(chain->entries, 0, sizeof(chain->entries[0]) * shared_chain->entry_count);
+    chain->entry_count = shared_chain->entry_count;
 
-    size_t entry = 0;
+    for (size_t i = 0; i < chain->entry_count; ++i) {
+        const keymaster_blob_t& entry = shared_chain->entries[i];
+        chain->entries[i].data = dup_buffer(entry.data, entry.data_length);
+        if (!chain->entries[i].data)
+            return nullptr;
+        chain->entries[i].data_length = entry.data_length;
+    }
 
+    *error = KM_ERROR_OK;
+    return chain.release();
+}
+
+const keymaster_cert_chain_t*
+SoftKeymasterContext::SharedAttestationChain(keymaster_algorithm_t algorithm) const {
     switch (algorithm) {
     case KM_ALGORITHM_RSA:
-        chain->entries[entry].data = dup_array(kRsaAttestCert);
-        if (!chain->entries[entry].data)
-            return nullptr;
-        chain->entries[entry].data_length = array_length(kRsaAttestCert);
-        entry++;
-        chain->entries[entry].data = dup_array(kRsaAttestRootCert);
-        if (!chain->entries[entry].data)
-            return nullptr;
-        chain->entries[entry].data_length = array_length(kRsaAttestRootCert);
-        entry++;
-        break;
-
+        return &kRsaAttestChain;
     case KM_ALGORITHM_EC:
-        chain->entries[entry].data = dup_array(kEcAttestCert);
-        if (!chain->entries[entry].data)
-            return nullptr;
-        chain->entries[entry].data_length = array_length(kEcAttestCert);
-        entry++;
-        chain->entries[entry].data = dup_array(kEcAttestRootCert);
-        if (!chain->entries[entry].data)
-            return nullptr;
-        chain->entries[entry].data_length = array_length(kEcAttestRootCert);
-        entry++;
-        break;
-
+        return &kEcAttestChain;
     default:
-        *error = KM_ERROR_UNSUPPORTED_ALGORITHM;
         return nullptr;
-    };
-
-    assert(entry == kCertificateChainLength);
+    }
+}
 
-    *error = KM_ERROR_OK;
-    return chain.release();
+const AttestationCertTemplate*
+SoftKeymasterContext::AttestationCertificateTemplate(keymaster_algorithm_t algorithm) const {
+    switch (algorithm) {
+    case KM_ALGORITHM_RSA:
+        return rsa_cert_template_.get();
+    case KM_ALGORITHM_EC:
+        return ec_cert_template_.get();
+    default:
+        return nullptr;
+    }
 }
 
 keymaster_error_t SoftKeymasterContext::GenerateUniqueId(
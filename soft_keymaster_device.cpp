@@ -40,8 +40,10 @@
 #include <keymaster/authorization_set.h>
 #include <keymaster/soft_keymaster_context.h>
 #include <keymaster/soft_keymaster_logger.h>
+#include <keymaster/trace.h>
 
 #include "openssl_utils.h"
+#include "secure_memory_pool.h"
 
 struct keystore_module soft_keymaster1_device_module = {
     .common =
@@ -164,6 +166,7 @@ SoftKeymasterDevice::SoftKeymasterDevice()
       impl_(new AndroidKeymaster(context_, kOperationTableSize)), configured_(false) {
     LOG_I("Creating device", 0);
     LOG_D("Device address: %p", this);
+    SecureMemoryPool::InstallForKeyMaterial();
 
     initialize_device_struct(KEYMASTER_SOFTWARE_ONLY | KEYMASTER_BLOBS_ARE_STANDALONE |
                              KEYMASTER_SUPPORTS_EC);
@@ -174,6 +177,7 @@ SoftKeymasterDevice::SoftKeymasterDevice(SoftKeymasterContext* context)
       impl_(new AndroidKeymaster(context_, kOperationTableSize)), configured_(false) {
     LOG_I("Creating test device", 0);
     LOG_D("Device address: %p", this);
+    SecureMemoryPool::InstallForKeyMaterial();
 
     initialize_device_struct(KEYMASTER_SOFTWARE_ONLY | KEYMASTER_BLOBS_ARE_STANDALONE |
                              KEYMASTER_SUPPORTS_EC);
@@ -1202,6 +1206,7 @@ keymaster_error_t SoftKeymasterDevice::begin(const keymaster1_device_t* dev,
                                              const keymaster_key_param_set_t* in_params,
                                              keymaster_key_param_set_t* out_params,
                                              keymaster_operation_handle_t* operation_handle) {
+    TraceSpan span("SoftKeymasterDevice::begin");
     if (!dev || !key || !key->key_material)
         return KM_ERROR_UNEXPECTED_NULL_POINTER;
 
@@ -1217,8 +1222,11 @@ keymaster_error_t SoftKeymasterDevice::begin(const keymaster1_device_t* dev,
         KeymasterKeyBlob key_material;
         AuthorizationSet hw_enforced;
         AuthorizationSet sw_enforced;
-        skdev->context_->ParseKeyBlob(KeymasterKeyBlob(*key), in_params_set, &key_material,
-                                      &hw_enforced, &sw_enforced);
+        {
+            TraceSpan parse_span("ParseKeyBlob");
+            skdev->context_->ParseKeyBlob(KeymasterKeyBlob(*key), in_params_set, &key_material,
+                                          &hw_enforced, &sw_enforced);
+        }
 
         keymaster_algorithm_t algorithm = KM_ALGORITHM_AES;
         if (!hw_enforced.GetTagValue(TAG_ALGORITHM, &algorithm) &&
@@ -1251,15 +1259,19 @@ keymaster_error_t SoftKeymasterDevice::begin(const keymaster1_device_t* dev,
     }
 
     BeginOperationRequest request;
-    request.purpose = purpose;
-    request.SetKeyMaterial(*key);
-    request.additional_params.Reinitialize(*in_params);
+    {
+        TraceSpan marshal_span("MarshalRequest");
+        request.purpose = purpose;
+        request.SetKeyMaterial(*key);
+        request.additional_params.Reinitialize(*in_params);
+    }
 
     BeginOperationResponse response;
     skdev->impl_->BeginOperation(request, &response);
     if (response.error != KM_ERROR_OK)
         return response.error;
 
+    TraceSpan unmarshal_span("UnmarshalResponse");
     if (response.output_params.size() > 0) {
         if (out_params)
             response.output_params.CopyToParamSet(out_params);
@@ -1295,6 +1307,7 @@ keymaster_error_t SoftKeymasterDevice::update(const keymaster1_device_t* dev,
                                               const keymaster_blob_t* input, size_t* input_consumed,
                                               keymaster_key_param_set_t* out_params,
                                               keymaster_blob_t* output) {
+    TraceSpan span("SoftKeymasterDevice::update");
     if (!input)
         return KM_ERROR_UNEXPECTED_NULL_POINTER;
 
@@ -1320,17 +1333,21 @@ keymaster_error_t SoftKeymasterDevice::update(const keymaster1_device_t* dev,
     }
 
     UpdateOperationRequest request;
-    request.op_handle = operation_handle;
-    if (input)
-        request.input.Reinitialize(input->data, input->data_length);
-    if (in_params)
-        request.additional_params.Reinitialize(*in_params);
+    {
+        TraceSpan marshal_span("MarshalRequest");
+        request.op_handle = operation_handle;
+        if (input)
+            request.input.Reinitialize(input->data, input->data_length);
+        if (in_params)
+            request.additional_params.Reinitialize(*in_params);
+    }
 
     UpdateOperationResponse response;
     convert_device(dev)->impl_->UpdateOperation(request, &response);
     if (response.error != KM_ERROR_OK)
         return response.error;
 
+    TraceSpan unmarshal_span("UnmarshalResponse");
     if (response.output_params.size() > 0) {
         if (out_params)
             response.output_params.CopyToParamSet(out_params);
@@ -1377,6 +1394,7 @@ keymaster_error_t SoftKeymasterDevice::finish(const keymaster1_device_t* dev,
                                               const keymaster_blob_t* signature,
                                               keymaster_key_param_set_t* out_params,
                                               keymaster_blob_t* output) {
+    TraceSpan span("SoftKeymasterDevice::finish");
     if (!dev)
         return KM_ERROR_UNEXPECTED_NULL_POINTER;
 
@@ -1399,16 +1417,20 @@ keymaster_error_t SoftKeymasterDevice::finish(const keymaster1_device_t* dev,
     }
 
     FinishOperationRequest request;
-    request.op_handle = operation_handle;
-    if (signature && signature->data_length > 0)
-        request.signature.Reinitialize(signature->data, signature->data_length);
-    request.additional_params.Reinitialize(*params);
+    {
+        TraceSpan marshal_span("MarshalRequest");
+        request.op_handle = operation_handle;
+        if (signature && signature->data_length > 0)
+            request.signature.Reinitialize(signature->data, signature->data_length);
+        request.additional_params.Reinitialize(*params);
+    }
 
     FinishOperationResponse response;
     convert_device(dev)->impl_->FinishOperation(request, &response);
     if (response.error != KM_ERROR_OK)
         return response.error;
 
+    TraceSpan unmarshal_span("UnmarshalResponse");
     if (response.output_params.size() > 0) {
         if (out_params)
             response.output_params.CopyToParamSet(out_params);
@@ -1441,6 +1463,7 @@ keymaster_error_t SoftKeymasterDevice::finish(const keymaster2_device_t* dev,
                                               const keymaster_blob_t* signature,
                                               keymaster_key_param_set_t* out_params,
                                               keymaster_blob_t* output) {
+    TraceSpan span("SoftKeymasterDevice::finish");
     if (!dev)
         return KM_ERROR_UNEXPECTED_NULL_POINTER;
 
@@ -1555,18 +1578,22 @@ keymaster_error_t SoftKeymasterDevice::finish(const keymaster2_device_t* dev,
     }
 
     FinishOperationRequest request;
-    request.op_handle = operation_handle;
-    if (signature && signature->data_length > 0)
-        request.signature.Reinitialize(signature->data, signature->data_length);
-    if (input && input->data_length > 0)
-        request.input.Reinitialize(input->data, input->data_length);
-    request.additional_params.Reinitialize(*params);
+    {
+        TraceSpan marshal_span("MarshalRequest");
+        request.op_handle = operation_handle;
+        if (signature && signature->data_length > 0)
+            request.signature.Reinitialize(signature->data, signature->data_length);
+        if (input && input->data_length > 0)
+            request.input.Reinitialize(input->data, input->data_length);
+        request.additional_params.Reinitialize(*params);
+    }
 
     FinishOperationResponse response;
     convert_device(dev)->impl_->FinishOperation(request, &response);
     if (response.error != KM_ERROR_OK)
         return response.error;
 
+    TraceSpan unmarshal_span("UnmarshalResponse");
     if (response.output_params.size() > 0) {
         if (out_params)
             response.output_params.CopyToParamSet(out_params);
@@ -1590,6 +1617,7 @@ keymaster_error_t SoftKeymasterDevice::finish(const keymaster2_device_t* dev,
 /* static */
 keymaster_error_t SoftKeymasterDevice::abort(const keymaster1_device_t* dev,
                                              keymaster_operation_handle_t operation_handle) {
+    TraceSpan span("SoftKeymasterDevice::abort");
     const keymaster1_device_t* km1_dev = convert_device(dev)->wrapped_km1_device_;
     if (km1_dev && !convert_device(dev)->impl_->has_operation(operation_handle)) {
         // This operation is being handled by km1_dev (or doesn't exist).  Pass it through to
@@ -114,27 +114,21 @@ SymmetricKey::SymmetricKey(const KeymasterKeyBlob& key_material,
     if (*error != KM_ERROR_OK)
         return;
 
-    uint8_t* tmp = dup_buffer(key_material.key_material, key_material.key_material_size);
-    if (tmp) {
-        key_data_.reset(tmp);
-        key_data_size_ = key_material.key_material_size;
+    key_data_ = key_material;
+    if (key_data_.key_material) {
         *error = KM_ERROR_OK;
     } else {
         *error = KM_ERROR_MEMORY_ALLOCATION_FAILED;
     }
 }
 
-SymmetricKey::~SymmetricKey() {
-    memset_s(key_data_.get(), 0, key_data_size_);
-}
-
 keymaster_error_t SymmetricKey::key_material(UniquePtr<uint8_t[]>* key_material,
                                              size_t* size) const {
-    *size = key_data_size_;
+    *size = key_data_.key_material_size;
     key_material->reset(new (std::nothrow) uint8_t[*size]);
     if (!key_material->get())
         return KM_ERROR_MEMORY_ALLOCATION_FAILED;
-    memcpy(key_material->get(), key_data_.get(), *size);
+    memcpy(key_material->get(), key_data_.key_material, *size);
     return KM_ERROR_OK;
 }
 
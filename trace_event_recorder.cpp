@@ -0,0 +1,164 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include <keymaster/trace_event_recorder.h>
+
+#include <stdio.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <keymaster/new>
+
+namespace keymaster {
+
+namespace {
+
+struct Span {
+    const char* name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+std::atomic<uint64_t> next_recorder_id(1);
+std::atomic<uint32_t> next_thread_id(1);
+
+// Appends \p name to \p json as a JSON string.  Span names are identifiers, so escaping the
+// characters that would end the string is enough.
+void append_json_string(const char* name, std::string* json) {
+    json->push_back('"');
+    for (const char* p = name; *p; ++p) {
+        if (*p == '"' || *p == '\\')
+            json->push_back('\\');
+        json->push_back(*p);
+    }
+    json->push_back('"');
+}
+
+}  // anonymous namespace
+
+/**
+ * The spans of one thread.  Only the owning thread pushes; it publishes each span by advancing
+ * count_, so that ExportJson can read the spans before it without locking.
+ */
+class TraceEventRecorder::ThreadBuffer {
+  public:
+    ThreadBuffer(size_t capacity, uint32_t thread_id)
+        : spans_(new (std::nothrow) Span[capacity]), capacity_(spans_ ? capacity : 0),
+          thread_id_(thread_id), count_(0) {}
+
+    bool Push(const char* name, uint64_t start_ns, uint64_t end_ns) {
+        size_t count = count_.load(std::memory_order_relaxed);
+        if (count == capacity_)
+            return false;
+        spans_[count] = {name, start_ns, end_ns};
+        count_.store(count + 1, std::memory_order_release);
+        return true;
+    }
+
+    size_t count() const { return count_.load(std::memory_order_acquire); }
+    const Span& span(size_t i) const { return spans_[i]; }
+    uint32_t thread_id() const { return thread_id_; }
+
+  private:
+    const std::unique_ptr<Span[]> spans_;
+    const size_t capacity_;
+    const uint32_t thread_id_;
+    std::atomic<size_t> count_;
+};
+
+TraceEventRecorder::TraceEventRecorder(size_t spans_per_thread)
+    : previous_(instance()), spans_per_thread_(spans_per_thread), id_(next_recorder_id++),
+      origin_ns_(NowNs()), dropped_(0) {
+    set_instance(this);
+}
+
+TraceEventRecorder::~TraceEventRecorder() {
+    set_instance(previous_);
+}
+
+uint64_t TraceEventRecorder::NowNs() const {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000 + ts.tv_nsec;
+}
+
+void TraceEventRecorder::RecordSpan(const char* name, uint64_t start_ns, uint64_t end_ns) {
+    ThreadBuffer* buffer = ThisThreadBuffer();
+    if (!buffer || !buffer->Push(name, start_ns, end_ns))
+        dropped_.fetch_add(1, std::memory_order_relaxed);
+}
+
+TraceEventRecorder::ThreadBuffer* TraceEventRecorder::ThisThreadBuffer() {
+    // Threads keep their buffer, and the id of the recorder it belongs to, for as long as they
+    // live.  A thread first recording into a new recorder replaces its buffer.
+    struct ThreadState {
+        uint32_t thread_id = next_thread_id++;
+        uint64_t recorder_id = 0;
+        std::shared_ptr<ThreadBuffer> buffer;
+    };
+    static thread_local ThreadState state;
+
+    if (state.recorder_id != id_) {
+        std::shared_ptr<ThreadBuffer> buffer(new (std::nothrow)
+                                                 ThreadBuffer(spans_per_thread_, state.thread_id));
+        if (!buffer)
+            return nullptr;
+        {
+            std::lock_guard<std::mutex> lock(buffers_mutex_);
+            buffers_.push_back(buffer);
+        }
+        state.recorder_id = id_;
+        state.buffer = std::move(buffer);
+    }
+    return state.buffer.get();
+}
+
+std::string TraceEventRecorder::ExportJson() const {
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    {
+        std::lock_guard<std::mutex> lock(buffers_mutex_);
+        buffers = buffers_;
+    }
+
+    const int pid = getpid();
+    std::string json = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    bool first = true;
+    char fields[128];
+    for (const auto& buffer : buffers) {
+        snprintf(fields, sizeof(fields),
+                 "%s{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%d,\"tid\":%u,"
+                 "\"args\":{\"name\":\"keymaster thread %u\"}}",
+                 first ? "" : ",\n", pid, buffer->thread_id(), buffer->thread_id());
+        json += fields;
+        first = false;
+
+        size_t count = buffer->count();
+        for (size_t i = 0; i < count; ++i) {
+            const Span& span = buffer->span(i);
+            json += ",\n{\"ph\":\"X\",\"cat\":\"keymaster\",\"name\":";
+            append_json_string(span.name, &json);
+            // Timestamps and durations are in microseconds.
+            snprintf(fields, sizeof(fields), ",\"pid\":%d,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f}",
+                     pid, buffer->thread_id(), (span.start_ns - origin_ns_) / 1e3,
+                     (span.end_ns - span.start_ns) / 1e3);
+            json += fields;
+        }
+    }
+    json += "]}\n";
+    return json;
+}
+
+}  // namespace keymaster
@@ -0,0 +1,89 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#include "worker_pool.h"
+
+namespace keymaster {
+
+WorkerPool::WorkerPool(size_t thread_count)
+    : task_(nullptr), count_(0), next_index_(0), completed_(0), generation_(0), stopping_(false) {
+    if (thread_count == 0)
+        thread_count = std::thread::hardware_concurrency();
+    for (size_t i = 1; i < thread_count; ++i)
+        workers_.emplace_back(&WorkerPool::RunWorker, this);
+}
+
+WorkerPool::~WorkerPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+    }
+    work_available_.notify_all();
+    for (auto& worker : workers_)
+        worker.join();
+}
+
+void WorkerPool::ParallelFor(size_t count, const std::function<void(size_t)>& task) {
+    if (count == 0)
+        return;
+
+    std::lock_guard<std::mutex> parallel_for_lock(parallel_for_mutex_);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        task_ = &task;
+        count_ = count;
+        next_index_ = 0;
+        completed_ = 0;
+        ++generation_;
+    }
+    work_available_.notify_all();
+
+    // The calling thread works too, then waits for the stragglers.
+    RunTasks();
+    std::unique_lock<std::mutex> lock(mutex_);
+    work_done_.wait(lock, [this] { return completed_ == count_; });
+    task_ = nullptr;
+}
+
+void WorkerPool::RunWorker() {
+    uint64_t seen_generation = 0;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        work_available_.wait(lock,
+                             [&] { return stopping_ || generation_ != seen_generation; });
+        if (stopping_)
+            return;
+        seen_generation = generation_;
+        lock.unlock();
+        RunTasks();
+        lock.lock();
+    }
+}
+
+void WorkerPool::RunTasks() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (task_ && next_index_ < count_) {
+        size_t index = next_index_++;
+        const std::function<void(size_t)>& task = *task_;
+        lock.unlock();
+        task(index);
+        lock.lock();
+        if (++completed_ == count_)
+            work_done_.notify_one();
+    }
+}
+
+}  // namespace keymaster
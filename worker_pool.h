@@ -0,0 +1,72 @@
+/*
+ * Copyright 2017 The Android Open Source Project
+ *
+ * Licensed under the Apache License, Version 2.0 (the "License");
+ * you may not use this file except in compliance with the License.
+ * You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing, software
+ * distributed under the License is distributed on an "AS IS" BASIS,
+ * WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ * See the License for the specific language governing permissions and
+ * limitations under the License.
+ */
+
+#ifndef SYSTEM_KEYMASTER_WORKER_POOL_H_
+#define SYSTEM_KEYMASTER_WORKER_POOL_H_
+
+#include <stdint.h>
+
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace keymaster {
+
+/**
+ * A fixed set of worker threads for spreading independent work items across cores.  Only one
+ * ParallelFor runs at a time; concurrent callers are serialized.
+ */
+class WorkerPool {
+  public:
+    /**
+     * Create a pool with \p thread_count threads in total, counting the thread that calls
+     * ParallelFor.  Zero means one per hardware thread.
+     */
+    explicit WorkerPool(size_t thread_count);
+    ~WorkerPool();
+
+    size_t thread_count() const { return workers_.size() + 1; }
+
+    /**
+     * Call \p task with each index in [0, \p count), spread across the pool, and return when all
+     * calls have completed.
+     */
+    void ParallelFor(size_t count, const std::function<void(size_t)>& task);
+
+  private:
+    void RunWorker();
+    void RunTasks();
+
+    std::mutex parallel_for_mutex_;  // Serializes ParallelFor calls.
+    std::mutex mutex_;
+    std::condition_variable work_available_;
+    std::condition_variable work_done_;
+    std::vector<std::thread> workers_;
+
+    // State of the current ParallelFor, guarded by mutex_.
+    const std::function<void(size_t)>* task_;
+    size_t count_;
+    size_t next_index_;
+    size_t completed_;
+    uint64_t generation_;
+    bool stopping_;
+};
+
+}  // namespace keymaster
+
+#endif  // SYSTEM_KEYMASTER_WORKER_POOL_H_